@@ -18,10 +18,13 @@ enum pkt_direction {
 
 /* Packet metadata passed from eBPF to userspace */
 struct pkt_meta {
-    __u32 len;           /* Packet length */
+    __u32 len;           /* Packet length on the wire */
+    __u32 caplen;        /* Bytes of data[] captured (< len when truncated in BPF) */
     __u32 ifindex;       /* Interface index */
     __u8  direction;     /* PKT_DIR_INGRESS or PKT_DIR_EGRESS */
-    __u8  pad[3];        /* Padding for alignment */
+    __u8  vlan_present;  /* Outer tag stripped into skb metadata: vlan_tci holds it */
+    __u16 vlan_tci;
+    __u32 hash;          /* skb flow hash (shard selection, tunnel source port) */
     __u64 timestamp;     /* Packet timestamp (ns) */
     __u8  data[];        /* Flexible array for packet data */
 } __attribute__((packed));
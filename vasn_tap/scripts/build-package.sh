@@ -40,6 +40,7 @@ mkdir -p "${STAGE_DIR}"
 required_files=(
   "${REPO_ROOT}/vasn_tap"
   "${REPO_ROOT}/tc_clone.bpf.o"
+  "${REPO_ROOT}/xdp_capture.bpf.o"
   "${REPO_ROOT}/config.example.yaml"
   "${REPO_ROOT}/scripts/install.sh"
   "${REPO_ROOT}/scripts/uninstall.sh"
@@ -58,6 +59,7 @@ done
 
 cp "${REPO_ROOT}/vasn_tap" "${STAGE_DIR}/vasn_tap"
 cp "${REPO_ROOT}/tc_clone.bpf.o" "${STAGE_DIR}/tc_clone.bpf.o"
+cp "${REPO_ROOT}/xdp_capture.bpf.o" "${STAGE_DIR}/xdp_capture.bpf.o"
 cp "${REPO_ROOT}/config.example.yaml" "${STAGE_DIR}/config.example.yaml"
 cp "${REPO_ROOT}/scripts/install.sh" "${STAGE_DIR}/install.sh"
 cp "${REPO_ROOT}/scripts/uninstall.sh" "${STAGE_DIR}/uninstall.sh"
@@ -68,7 +70,7 @@ cp "${REPO_ROOT}/README.md" "${STAGE_DIR}/README.md"
 
 chmod 755 "${STAGE_DIR}/install.sh" "${STAGE_DIR}/uninstall.sh" "${STAGE_DIR}/vasn_tapctl.sh"
 chmod 644 "${STAGE_DIR}/vasn_tap.service" "${STAGE_DIR}/INSTALL.txt" "${STAGE_DIR}/README.md" "${STAGE_DIR}/config.example.yaml"
-chmod 644 "${STAGE_DIR}/tc_clone.bpf.o"
+chmod 644 "${STAGE_DIR}/tc_clone.bpf.o" "${STAGE_DIR}/xdp_capture.bpf.o"
 chmod 755 "${STAGE_DIR}/vasn_tap"
 
 echo "[4/5] Creating tarball: $(basename "${TARBALL}")"
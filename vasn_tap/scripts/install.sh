@@ -44,12 +44,14 @@ SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
 
 BIN_SRC="${SCRIPT_DIR}/vasn_tap"
 BPF_SRC="${SCRIPT_DIR}/tc_clone.bpf.o"
+XDP_BPF_SRC="${SCRIPT_DIR}/xdp_capture.bpf.o"
 CFG_EXAMPLE_SRC="${SCRIPT_DIR}/config.example.yaml"
 CTL_SRC="${SCRIPT_DIR}/vasn_tapctl.sh"
 UNIT_SRC="${SCRIPT_DIR}/vasn_tap.service"
 
 BIN_DST="/usr/local/bin/vasn_tap"
 BPF_DST="/usr/local/share/vasn_tap/tc_clone.bpf.o"
+XDP_BPF_DST="/usr/local/share/vasn_tap/xdp_capture.bpf.o"
 CTL_DST="/usr/local/bin/vasn_tapctl"
 UNIT_DST="/etc/systemd/system/vasn_tap.service"
 CFG_DIR="/etc/vasn_tap"
@@ -167,7 +169,7 @@ prompt_for_runtime_iface() {
   echo "Set runtime.${field_name} to '${iface}' in ${cfg_path}"
 }
 
-for f in "${BIN_SRC}" "${BPF_SRC}" "${CTL_SRC}" "${UNIT_SRC}"; do
+for f in "${BIN_SRC}" "${BPF_SRC}" "${XDP_BPF_SRC}" "${CTL_SRC}" "${UNIT_SRC}"; do
   if [[ ! -f "${f}" ]]; then
     echo "Required file not found: ${f}" >&2
     exit 1
@@ -179,9 +181,10 @@ install -d -m 755 /usr/local/bin
 install -d -m 755 /usr/local/share/vasn_tap
 install -d -m 755 "${CFG_DIR}"
 
-echo "[2/6] Installing binary and BPF object"
+echo "[2/6] Installing binary and BPF objects"
 install -m 755 "${BIN_SRC}" "${BIN_DST}"
 install -m 644 "${BPF_SRC}" "${BPF_DST}"
+install -m 644 "${XDP_BPF_SRC}" "${XDP_BPF_DST}"
 
 echo "[3/6] Installing control script"
 install -m 755 "${CTL_SRC}" "${CTL_DST}"
@@ -40,6 +40,7 @@ UNIT_PATH="/etc/systemd/system/${SERVICE_NAME}.service"
 BIN_PATH="/usr/local/bin/vasn_tap"
 CTL_PATH="/usr/local/bin/vasn_tapctl"
 BPF_PATH="/usr/local/share/vasn_tap/tc_clone.bpf.o"
+XDP_BPF_PATH="/usr/local/share/vasn_tap/xdp_capture.bpf.o"
 SHARE_DIR="/usr/local/share/vasn_tap"
 CFG_DIR="/etc/vasn_tap"
 
@@ -65,6 +66,7 @@ rm -f "${BIN_PATH}" "${CTL_PATH}"
 
 echo "[4/5] Removing BPF artifact"
 rm -f "${BPF_PATH}"
+rm -f "${XDP_BPF_PATH}"
 rmdir "${SHARE_DIR}" 2>/dev/null || true
 
 echo "[5/5] Configuration"
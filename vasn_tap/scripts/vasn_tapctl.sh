@@ -12,6 +12,7 @@ Usage:
   vasn_tapctl start
   vasn_tapctl stop
   vasn_tapctl restart
+  vasn_tapctl reload
   vasn_tapctl status
   vasn_tapctl counters
   vasn_tapctl logs [journalctl_args]
@@ -248,6 +249,12 @@ case "${cmd}" in
     require_systemd
     systemctl restart "${SERVICE_NAME}"
     ;;
+  reload)
+    # Re-reads only the filter section (SIGHUP); other changes need restart.
+    require_systemd
+    validate_config "${CONFIG_PATH_DEFAULT}"
+    systemctl reload "${SERVICE_NAME}"
+    ;;
   status)
     require_systemd
     systemctl status "${SERVICE_NAME}" --no-pager
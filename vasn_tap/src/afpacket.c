@@ -37,6 +37,9 @@
 #include "tx_ring.h"
 #include "filter.h"
 #include "truncate.h"
+#include "parse.h"
+#include "flow.h"
+#include "dedup.h"
 #include "../include/common.h"
 
 /* Poll timeout in milliseconds */
@@ -46,11 +49,13 @@
 /*
  * Setup a single TPACKET_V3 RX socket with mmap ring
  * @param ifindex: Interface index to bind to
+ * @param geom: Ring geometry (runtime.rx_ring)
  * @param worker: Worker struct to populate with fd, ring, etc.
  * @param verbose: Enable verbose logging
  * @return: 0 on success, negative errno on failure
  */
-static int setup_rx_socket(int ifindex, struct afpacket_worker *worker, bool verbose)
+static int setup_rx_socket(int ifindex, const struct ring_config *geom,
+                           struct afpacket_worker *worker, bool verbose)
 {
     int fd;
     int ver = TPACKET_V3;
@@ -75,11 +80,11 @@ static int setup_rx_socket(int ifindex, struct afpacket_worker *worker, bool ver
     }
 
     /* Setup RX ring parameters */
-    req.tp_block_size = AFPACKET_BLOCK_SIZE;
-    req.tp_block_nr   = AFPACKET_BLOCK_NR;
-    req.tp_frame_size = AFPACKET_FRAME_SIZE;
-    req.tp_frame_nr   = (AFPACKET_BLOCK_SIZE / AFPACKET_FRAME_SIZE) * AFPACKET_BLOCK_NR;
-    req.tp_retire_blk_tov = AFPACKET_BLOCK_TIMEOUT;
+    req.tp_block_size = geom->block_size;
+    req.tp_block_nr   = geom->block_nr;
+    req.tp_frame_size = geom->frame_size;
+    req.tp_frame_nr   = (geom->block_size / geom->frame_size) * geom->block_nr;
+    req.tp_retire_blk_tov = geom->retire_timeout_ms;
     req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
 
     if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
@@ -201,11 +206,18 @@ static void process_block(struct afpacket_worker *worker,
                           uint32_t truncate_length)
 {
     uint32_t num_pkts = block->hdr.bh1.num_pkts;
+    /* One filter for the whole block; a reload waits until the block is done */
+    const struct filter_state *fs = filter_enter((unsigned int)worker_id);
+    uint64_t *hits = fs ? filter_hits_row(fs, (unsigned int)worker_id) : NULL;
     struct tpacket3_hdr *pkt;
+    struct pkt_desc pd;
     uint8_t *pkt_data;
     uint32_t pkt_len;
+    uint32_t send_len;
     uint32_t i;
     uint32_t queued = 0;
+    struct worker_stats batch = {0};    /* Published once per block */
+    uint64_t now = worker->flows ? flow_clock_ns() : 0;
 
     pkt = (struct tpacket3_hdr *)((uint8_t *)block + block->hdr.bh1.offset_to_first_pkt);
 
@@ -232,97 +244,98 @@ static void process_block(struct afpacket_worker *worker,
             }
         }
 
-        atomic_fetch_add(&worker->stats.packets_received, 1);
-        atomic_fetch_add(&worker->stats.bytes_received, pkt_len);
+        batch.packets_received++;
+        batch.bytes_received += pkt_len;
+
+        /*
+         * Parse once; filter, truncation and loop detection share the descriptor.
+         * An outer tag stripped by the kernel (or NIC) is only in the header.
+         */
+        if (pkt->tp_status & TP_STATUS_VLAN_VALID)
+            pkt_parse_vlan(pkt_data, pkt_len, (uint16_t)pkt->hv1.tp_vlan_tci, &pd);
+        else
+            pkt_parse(pkt_data, pkt_len, &pd);
 
         /* Skip our own tunnel output when -i and -o are the same (avoid re-encapsulation loop) */
-        if (tunnel_ctx && tunnel_is_own_packet(tunnel_ctx, pkt_data, pkt_len))
+        if (tunnel_ctx && tunnel_is_own_packet(tunnel_ctx, pkt_data, &pd))
+            goto next_pkt;
+
+        /* Drop mode (no tunnel and no TX ring) */
+        if (!tunnel_ctx && worker->tx.fd < 0) {
+            batch.packets_dropped++;
+            goto next_pkt;
+        }
+
+        /* Sampled out before dedup and the filter: only the kept share costs a lookup */
+        if (sampler_skip(&worker->sampler, &pd)) {
+            batch.packets_sampled_out++;
+            batch.bytes_sampled_out += pkt_len;
+            goto next_pkt;
+        }
+
+        /* Second copy of a frame (ingress + egress capture): counted, never filtered or sent */
+        if (worker->dups &&
+            dedup_seen(worker->dups, pkt_data, &pd,
+                       (uint64_t)pkt->tp_sec * 1000000000ull + pkt->tp_nsec)) {
+            batch.packets_dup++;
+            batch.bytes_dup += pkt_len;
+            goto next_pkt;
+        }
+
+        if (fs) {
+            int matched;
+            enum filter_action fa = filter_classify(fs->fc, &pd, &matched);
+            unsigned int slot = (matched >= 0) ? (unsigned int)matched : fs->cfg->num_rules;
+            counter_add(&hits[slot], 1);
+            if (fa == FILTER_ACTION_DROP) {
+                batch.packets_dropped++;
+                goto next_pkt;
+            }
+        }
+
+        /* Elephant flows: only the first bytes / packets of each flow go out */
+        if (worker->flows && flow_cutoff(worker->flows, &pd, pkt_len, now)) {
+            batch.packets_cutoff++;
+            batch.bytes_cutoff += pkt_len;
             goto next_pkt;
+        }
+
+        send_len = truncate_apply(pkt_data, pkt_len, truncate_enabled, truncate_length, &pd);
+        if (send_len < pkt_len) {
+            batch.packets_truncated++;
+            batch.bytes_truncated += (uint64_t)(pkt_len - send_len);
+        }
 
         if (tunnel_ctx) {
-            //tunnel_debug_own_mismatch(tunnel_ctx, pkt_data, pkt_len);
-            if (g_filter_config) {
-                int matched;
-                enum filter_action fa = filter_packet(g_filter_config, pkt_data, pkt_len, &matched);
-                unsigned int slot = (matched >= 0) ? (unsigned int)matched : g_filter_config->num_rules;
-                atomic_fetch_add(&filter_rule_hits[slot], 1);
-                if (fa == FILTER_ACTION_DROP) {
-                    atomic_fetch_add(&worker->stats.packets_dropped, 1);
-                } else {
-                    uint32_t send_len = truncate_apply(pkt_data, pkt_len, truncate_enabled, truncate_length);
-                    if (send_len < pkt_len) {
-                        atomic_fetch_add(&worker->stats.packets_truncated, 1);
-                        atomic_fetch_add(&worker->stats.bytes_truncated, (uint64_t)(pkt_len - send_len));
-                    }
-                    if (tunnel_send(tunnel_ctx, pkt_data, send_len) == 0) {
-                        atomic_fetch_add(&worker->stats.packets_sent, 1);
-                        atomic_fetch_add(&worker->stats.bytes_sent, send_len);
-                        queued++;
-                    } else {
-                        atomic_fetch_add(&worker->stats.packets_dropped, 1);
-                    }
-                }
+            if (tunnel_send(worker->tunnel_tx, pkt_data, send_len, pkt->hv1.tp_rxhash) == 0) {
+                batch.packets_sent++;
+                batch.bytes_sent += send_len;
+                queued++;
             } else {
-                uint32_t send_len = truncate_apply(pkt_data, pkt_len, truncate_enabled, truncate_length);
-                if (send_len < pkt_len) {
-                    atomic_fetch_add(&worker->stats.packets_truncated, 1);
-                    atomic_fetch_add(&worker->stats.bytes_truncated, (uint64_t)(pkt_len - send_len));
-                }
-                if (tunnel_send(tunnel_ctx, pkt_data, send_len) == 0) {
-                    atomic_fetch_add(&worker->stats.packets_sent, 1);
-                    atomic_fetch_add(&worker->stats.bytes_sent, send_len);
-                    queued++;
-                } else {
-                    atomic_fetch_add(&worker->stats.packets_dropped, 1);
-                }
+                batch.packets_dropped++;
             }
-        } else if (worker->tx.fd >= 0) {
-            if (g_filter_config) {
-                int matched;
-                enum filter_action fa = filter_packet(g_filter_config, pkt_data, pkt_len, &matched);
-                unsigned int slot = (matched >= 0) ? (unsigned int)matched : g_filter_config->num_rules;
-                atomic_fetch_add(&filter_rule_hits[slot], 1);
-                if (fa == FILTER_ACTION_DROP) {
-                    atomic_fetch_add(&worker->stats.packets_dropped, 1);
-                } else {
-                    uint32_t send_len = truncate_apply(pkt_data, pkt_len, truncate_enabled, truncate_length);
-                    if (send_len < pkt_len) {
-                        atomic_fetch_add(&worker->stats.packets_truncated, 1);
-                        atomic_fetch_add(&worker->stats.bytes_truncated, (uint64_t)(pkt_len - send_len));
-                    }
-                    if (tx_ring_write(&worker->tx, pkt_data, send_len) == 0) {
-                        atomic_fetch_add(&worker->stats.packets_sent, 1);
-                        atomic_fetch_add(&worker->stats.bytes_sent, send_len);
-                        queued++;
-                    } else {
-                        atomic_fetch_add(&worker->stats.packets_dropped, 1);
-                    }
-                }
+        } else {
+            int sent = tx_ring_write(&worker->tx, pkt_data, send_len, &pd);
+            if (sent >= 0) {
+                batch.packets_sent++;
+                batch.bytes_sent += (uint32_t)sent;
+                if ((uint32_t)sent < send_len)
+                    batch.packets_clamped++;
+                queued++;
             } else {
-                uint32_t send_len = truncate_apply(pkt_data, pkt_len, truncate_enabled, truncate_length);
-                if (send_len < pkt_len) {
-                    atomic_fetch_add(&worker->stats.packets_truncated, 1);
-                    atomic_fetch_add(&worker->stats.bytes_truncated, (uint64_t)(pkt_len - send_len));
-                }
-                if (tx_ring_write(&worker->tx, pkt_data, send_len) == 0) {
-                    atomic_fetch_add(&worker->stats.packets_sent, 1);
-                    atomic_fetch_add(&worker->stats.bytes_sent, send_len);
-                    queued++;
-                } else {
-                    atomic_fetch_add(&worker->stats.packets_dropped, 1);
-                }
+                batch.packets_dropped++;
             }
-        } else {
-            atomic_fetch_add(&worker->stats.packets_dropped, 1);
         }
 
 next_pkt:
         pkt = (struct tpacket3_hdr *)((uint8_t *)pkt + pkt->tp_next_offset);
     }
+    filter_exit((unsigned int)worker_id);
+    worker_stats_publish(&worker->stats, &batch);
 
     if (queued > 0) {
         if (tunnel_ctx)
-            tunnel_flush(tunnel_ctx);
+            tunnel_flush(worker->tunnel_tx);
         else
             tx_ring_flush(&worker->tx);
     }
@@ -403,7 +416,13 @@ static void *afpacket_worker_thread(void *arg)
  */
 static void cleanup_worker(struct afpacket_worker *worker)
 {
+    tunnel_sender_destroy(worker->tunnel_tx);
+    worker->tunnel_tx = NULL;
     tx_ring_teardown(&worker->tx);
+    flow_table_destroy(worker->flows);
+    worker->flows = NULL;
+    dedup_table_destroy(worker->dups);
+    worker->dups = NULL;
 
     /* Tear down RX ring */
     if (worker->rd) {
@@ -437,12 +456,26 @@ int afpacket_init(struct afpacket_ctx *ctx, const struct afpacket_config *config
         num_cpus = get_nprocs();
         ctx->config.num_workers = num_cpus > 0 ? num_cpus : 1;
     }
+    if (ctx->config.num_workers > FILTER_MAX_READERS) {
+        ctx->config.num_workers = FILTER_MAX_READERS;
+    }
+
+    /* One filter hit row per worker */
+    err = filter_set_readers((unsigned int)ctx->config.num_workers);
+    if (err) {
+        return err;
+    }
 
     printf("AF_PACKET: Using %d worker thread(s) with FANOUT_HASH\n",
            ctx->config.num_workers);
 
-    /* Allocate worker array */
-    ctx->workers = calloc(ctx->config.num_workers, sizeof(struct afpacket_worker));
+    /* PACKET_RX_RING memory is allocated by the kernel; the mapping cannot be hugetlb */
+    if (ctx->config.rx_ring.hugepages) {
+        printf("AF_PACKET: rx_ring.hugepages ignored (ring memory is kernel-allocated)\n");
+    }
+
+    /* Allocate worker array (cache-line aligned: stats are per worker) */
+    ctx->workers = counter_calloc(ctx->config.num_workers, sizeof(struct afpacket_worker));
     if (!ctx->workers) {
         return -ENOMEM;
     }
@@ -456,8 +489,8 @@ int afpacket_init(struct afpacket_ctx *ctx, const struct afpacket_config *config
 
     /* Setup RX socket + ring for each worker */
     for (i = 0; i < ctx->config.num_workers; i++) {
-        err = setup_rx_socket(ctx->config.input_ifindex, &ctx->workers[i],
-                              ctx->config.verbose);
+        err = setup_rx_socket(ctx->config.input_ifindex, &ctx->config.rx_ring,
+                              &ctx->workers[i], ctx->config.verbose);
         if (err) {
             fprintf(stderr, "AF_PACKET: Failed to setup RX socket for worker %d\n", i);
             goto err_cleanup;
@@ -473,12 +506,43 @@ int afpacket_init(struct afpacket_ctx *ctx, const struct afpacket_config *config
         /* Setup shared TX ring if output interface configured */
         if (ctx->config.output_ifindex > 0 && ctx->config.output_ifname[0] != '\0') {
             err = tx_ring_setup(&ctx->workers[i].tx, ctx->config.output_ifindex,
+                                &ctx->config.tx_ring,
                                 ctx->config.verbose && i == 0, ctx->config.debug);
             if (err) {
                 fprintf(stderr, "AF_PACKET: Failed to setup TX ring for worker %d\n", i);
                 goto err_cleanup;
             }
         }
+
+        /* Each worker encapsulates into its own buffer and socket */
+        if (ctx->config.tunnel_ctx) {
+            err = tunnel_sender_create(ctx->config.tunnel_ctx, &ctx->config.tx_ring,
+                                       &ctx->workers[i].tunnel_tx);
+            if (err) {
+                fprintf(stderr, "AF_PACKET: Failed to setup tunnel sender for worker %d\n", i);
+                goto err_cleanup;
+            }
+        }
+
+        /* FANOUT_HASH keeps a flow on one worker, so each counts its own flows */
+        if (ctx->config.flow_cutoff.enabled) {
+            ctx->workers[i].flows = flow_table_create(&ctx->config.flow_cutoff);
+            if (!ctx->workers[i].flows) {
+                err = -ENOMEM;
+                goto err_cleanup;
+            }
+        }
+
+        /* Both copies of a frame hash alike, so they reach the same worker */
+        if (ctx->config.dedup.enabled) {
+            ctx->workers[i].dups = dedup_table_create(&ctx->config.dedup);
+            if (!ctx->workers[i].dups) {
+                err = -ENOMEM;
+                goto err_cleanup;
+            }
+        }
+
+        sampler_init(&ctx->workers[i].sampler, &ctx->config.sampling);
     }
 
     /* Allocate thread handles */
@@ -611,13 +675,21 @@ void afpacket_get_stats(struct afpacket_ctx *ctx, struct worker_stats *total)
     }
 
     for (i = 0; i < ctx->config.num_workers; i++) {
-        total->packets_received += atomic_load(&ctx->workers[i].stats.packets_received);
-        total->packets_sent     += atomic_load(&ctx->workers[i].stats.packets_sent);
-        total->packets_dropped  += atomic_load(&ctx->workers[i].stats.packets_dropped);
-        total->bytes_received   += atomic_load(&ctx->workers[i].stats.bytes_received);
-        total->bytes_sent       += atomic_load(&ctx->workers[i].stats.bytes_sent);
-        total->packets_truncated += atomic_load(&ctx->workers[i].stats.packets_truncated);
-        total->bytes_truncated   += atomic_load(&ctx->workers[i].stats.bytes_truncated);
+        total->packets_received += counter_read(&ctx->workers[i].stats.packets_received);
+        total->packets_sent     += counter_read(&ctx->workers[i].stats.packets_sent);
+        total->packets_dropped  += counter_read(&ctx->workers[i].stats.packets_dropped);
+        total->bytes_received   += counter_read(&ctx->workers[i].stats.bytes_received);
+        total->bytes_sent       += counter_read(&ctx->workers[i].stats.bytes_sent);
+        total->packets_truncated += counter_read(&ctx->workers[i].stats.packets_truncated);
+        total->bytes_truncated   += counter_read(&ctx->workers[i].stats.bytes_truncated);
+        total->packets_clamped   += counter_read(&ctx->workers[i].stats.packets_clamped);
+        total->packets_cutoff    += counter_read(&ctx->workers[i].stats.packets_cutoff);
+        total->bytes_cutoff      += counter_read(&ctx->workers[i].stats.bytes_cutoff);
+        total->packets_dup       += counter_read(&ctx->workers[i].stats.packets_dup);
+        total->bytes_dup         += counter_read(&ctx->workers[i].stats.bytes_dup);
+        total->packets_sampled_out += counter_read(&ctx->workers[i].stats.packets_sampled_out);
+        total->bytes_sampled_out   += counter_read(&ctx->workers[i].stats.bytes_sampled_out);
+        total->packets_tx_full   += counter_read(&ctx->workers[i].tx.full_drops);
     }
 }
 
@@ -630,13 +702,21 @@ void afpacket_reset_stats(struct afpacket_ctx *ctx)
     }
 
     for (i = 0; i < ctx->config.num_workers; i++) {
-        atomic_store(&ctx->workers[i].stats.packets_received, 0);
-        atomic_store(&ctx->workers[i].stats.packets_sent, 0);
-        atomic_store(&ctx->workers[i].stats.packets_dropped, 0);
-        atomic_store(&ctx->workers[i].stats.bytes_received, 0);
-        atomic_store(&ctx->workers[i].stats.bytes_sent, 0);
-        atomic_store(&ctx->workers[i].stats.packets_truncated, 0);
-        atomic_store(&ctx->workers[i].stats.bytes_truncated, 0);
+        counter_set(&ctx->workers[i].stats.packets_received, 0);
+        counter_set(&ctx->workers[i].stats.packets_sent, 0);
+        counter_set(&ctx->workers[i].stats.packets_dropped, 0);
+        counter_set(&ctx->workers[i].stats.bytes_received, 0);
+        counter_set(&ctx->workers[i].stats.bytes_sent, 0);
+        counter_set(&ctx->workers[i].stats.packets_truncated, 0);
+        counter_set(&ctx->workers[i].stats.bytes_truncated, 0);
+        counter_set(&ctx->workers[i].stats.packets_clamped, 0);
+        counter_set(&ctx->workers[i].stats.packets_cutoff, 0);
+        counter_set(&ctx->workers[i].stats.bytes_cutoff, 0);
+        counter_set(&ctx->workers[i].stats.packets_dup, 0);
+        counter_set(&ctx->workers[i].stats.bytes_dup, 0);
+        counter_set(&ctx->workers[i].stats.packets_sampled_out, 0);
+        counter_set(&ctx->workers[i].stats.bytes_sampled_out, 0);
+        counter_set(&ctx->workers[i].tx.full_drops, 0);
     }
 }
 
@@ -650,9 +730,9 @@ void afpacket_print_per_worker_stats(struct afpacket_ctx *ctx)
 
     printf("\n--- Per-Worker Statistics ---\n");
     for (i = 0; i < ctx->config.num_workers; i++) {
-        uint64_t rx   = atomic_load(&ctx->workers[i].stats.packets_received);
-        uint64_t tx   = atomic_load(&ctx->workers[i].stats.packets_sent);
-        uint64_t drop = atomic_load(&ctx->workers[i].stats.packets_dropped);
+        uint64_t rx   = counter_read(&ctx->workers[i].stats.packets_received);
+        uint64_t tx   = counter_read(&ctx->workers[i].stats.packets_sent);
+        uint64_t drop = counter_read(&ctx->workers[i].stats.packets_dropped);
         printf("  Worker %d: RX=%lu TX=%lu Dropped=%lu\n",
                i, (unsigned long)rx, (unsigned long)tx, (unsigned long)drop);
     }
@@ -13,16 +13,14 @@
 #include <pthread.h>
 
 struct tunnel_ctx;
+struct tunnel_sender;
+struct flow_table;
+struct dedup_table;
 
 /* Reuse worker_stats from worker.h for consistent stats interface */
 #include "worker.h"
 #include "tx_ring.h"
-
-/* TPACKET_V3 RX ring configuration */
-#define AFPACKET_BLOCK_SIZE     (1 << 18)   /* 256 KB per block */
-#define AFPACKET_BLOCK_NR       64          /* 64 blocks = 16 MB per worker */
-#define AFPACKET_FRAME_SIZE     (1 << 11)   /* 2048 bytes per frame */
-#define AFPACKET_BLOCK_TIMEOUT  100         /* 100ms block retire timeout */
+#include "sample.h"
 
 /* Fanout group ID (arbitrary, must be same for all sockets) */
 #define AFPACKET_FANOUT_GROUP_ID  42
@@ -39,6 +37,11 @@ struct afpacket_config {
     bool debug;                   /* TX debug (hex dumps) */
     bool truncate_enabled;        /* Truncate allowed packets before send */
     uint32_t truncate_length;     /* Truncate length when enabled (64..9000) */
+    struct ring_config rx_ring;   /* TPACKET_V3 RX ring geometry (runtime.rx_ring) */
+    struct ring_config tx_ring;   /* TPACKET_V2 TX ring geometry (runtime.tx_ring) */
+    struct flow_cutoff_config flow_cutoff; /* Per-flow cutoff (runtime.flow_cutoff) */
+    struct dedup_config dedup;    /* Duplicate suppression (runtime.dedup) */
+    struct sampling_config sampling; /* Deterministic sampling (runtime.sampling) */
 };
 
 /* Per-worker state for AF_PACKET mode */
@@ -53,6 +56,10 @@ struct afpacket_worker {
 
     /* TX: shared TPACKET_V2 mmap ring (tx.fd == -1 means drop mode) */
     struct tx_ring_ctx   tx;
+    struct tunnel_sender *tunnel_tx;     /* Own tunnel send state (tunnel mode) */
+    struct flow_table   *flows;          /* Own flow cutoff table (NULL = no cutoff) */
+    struct dedup_table  *dups;           /* Own duplicate table (NULL = no dedup) */
+    struct sampler       sampler;        /* Own sampling state (SAMPLING_NONE = keep all) */
 
     bool                 debug;          /* Enable TX debug prints (from config) */
     struct worker_stats  stats;          /* Per-worker statistics */
@@ -102,7 +109,7 @@ void afpacket_cleanup(struct afpacket_ctx *ctx);
 void afpacket_get_stats(struct afpacket_ctx *ctx, struct worker_stats *total);
 
 /*
- * Reset all AF_PACKET worker statistics
+ * Reset all AF_PACKET worker statistics (workers stopped: counters have one writer)
  * @param ctx: Context
  */
 void afpacket_reset_stats(struct afpacket_ctx *ctx);
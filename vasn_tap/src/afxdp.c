@@ -0,0 +1,1060 @@
+/*
+ * vasn_tap - AF_XDP Capture Backend Implementation
+ * XDP redirect into one AF_XDP socket per RX queue, UMEM-backed RX
+ *
+ * A small XDP program (xdp_capture.bpf.o) redirects every frame received on
+ * the input interface into the XSKMAP slot for its RX queue. Each queue gets
+ * its own worker thread with a private UMEM, fill ring, completion ring and
+ * RX ring, so workers share no state except atomic stats counters (the same
+ * model as the AF_PACKET backend, with RSS doing the fanout).
+ *
+ * Packets are processed in place in the UMEM frame (filter, truncate). When
+ * forwarding to an output interface without a tunnel, each worker also binds
+ * an XSK to its own output queue with XDP_SHARED_UMEM, so an allowed frame is
+ * posted to that socket's TX ring as-is (no payload copy in userspace) and
+ * recycled into the fill ring once the TX completion ring hands it back.
+ * Workers without such a socket (not enough output queues, unsupported
+ * device), full TX rings, and tunnel mode fall back to copying through the
+ * TPACKET_V2 TX ring or the tunnel. Unlike AF_PACKET this consumes the packet: the
+ * input interface's stack never sees it, so this mode is meant for SPAN /
+ * mirror ports. Only ingress traffic is captured.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/sysinfo.h>
+#include <net/if.h>
+#include <linux/ethtool.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/sockios.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "afxdp.h"
+#include "tunnel.h"
+#include "tx_ring.h"
+#include "filter.h"
+#include "truncate.h"
+#include "parse.h"
+#include "flow.h"
+#include "dedup.h"
+#include "ebpf/xdp_capture.h"
+#include "../include/common.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/* Path to the XDP redirect object */
+#define XDP_BPF_OBJ_PATH "xdp_capture.bpf.o"
+
+/* Poll timeout in milliseconds */
+#define AFXDP_POLL_TIMEOUT_MS  100
+
+
+/*
+ * Number of RX queues on an interface (ETHTOOL_GCHANNELS), 1 if unknown
+ */
+static int get_rx_queue_count(int ifindex)
+{
+    struct ethtool_channels ch = { .cmd = ETHTOOL_GCHANNELS };
+    struct ifreq ifr = {0};
+    int fd, n;
+
+    if (!if_indextoname(ifindex, ifr.ifr_name))
+        return 1;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return 1;
+
+    ifr.ifr_data = (void *)&ch;
+    if (ioctl(fd, SIOCETHTOOL, &ifr) < 0) {
+        close(fd);
+        return 1;
+    }
+    close(fd);
+
+    n = (int)(ch.rx_count > ch.combined_count ? ch.rx_count : ch.combined_count);
+    return n > 0 ? n : 1;
+}
+
+/*
+ * mmap one XSK ring and resolve its producer/consumer/flags/desc pointers
+ */
+static int map_ring(int fd, const struct xdp_ring_offset *off, uint32_t size,
+                    size_t desc_size, off_t pgoff, struct afxdp_ring *r)
+{
+    size_t len = off->desc + size * desc_size;
+    void *map;
+
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (map == MAP_FAILED)
+        return -errno;
+
+    r->map      = map;
+    r->map_len  = len;
+    r->producer = (uint32_t *)((uint8_t *)map + off->producer);
+    r->consumer = (uint32_t *)((uint8_t *)map + off->consumer);
+    r->flags    = (uint32_t *)((uint8_t *)map + off->flags);
+    r->ring     = (uint8_t *)map + off->desc;
+    r->size     = size;
+    r->mask     = size - 1;
+    r->cached_prod = *r->producer;
+    r->cached_cons = *r->consumer;
+    return 0;
+}
+
+static void unmap_ring(struct afxdp_ring *r)
+{
+    if (r->map) {
+        munmap(r->map, r->map_len);
+        r->map = NULL;
+    }
+}
+
+/*
+ * Number of descriptors ready to consume on a kernel-produced ring (RX, completion)
+ */
+static inline uint32_t ring_cons_peek(struct afxdp_ring *r, uint32_t max)
+{
+    uint32_t avail = __atomic_load_n(r->producer, __ATOMIC_ACQUIRE) - r->cached_cons;
+    return avail < max ? avail : max;
+}
+
+static inline void ring_cons_release(struct afxdp_ring *r, uint32_t n)
+{
+    r->cached_cons += n;
+    __atomic_store_n(r->consumer, r->cached_cons, __ATOMIC_RELEASE);
+}
+
+/*
+ * Hand frames back to the kernel on a user-produced ring (fill)
+ * The fill ring holds every UMEM frame, so it always has room for the frames
+ * just taken off the RX or TX completion ring.
+ */
+static inline void fill_ring_push(struct afxdp_ring *r, const uint64_t *addrs, uint32_t n)
+{
+    uint64_t *ring = (uint64_t *)r->ring;
+    uint32_t i;
+
+    for (i = 0; i < n; i++)
+        ring[(r->cached_prod + i) & r->mask] = addrs[i];
+    r->cached_prod += n;
+    __atomic_store_n(r->producer, r->cached_prod, __ATOMIC_RELEASE);
+}
+
+/*
+ * Post one frame on the TX ring of the shared-UMEM TX socket
+ * @return: 0 on success, -1 if the TX ring is full
+ */
+static inline int txq_push(struct afxdp_ring *r, uint64_t addr, uint32_t len)
+{
+    struct xdp_desc *d;
+
+    if (r->size - (r->cached_prod - __atomic_load_n(r->consumer, __ATOMIC_ACQUIRE)) == 0)
+        return -1;
+    d = &((struct xdp_desc *)r->ring)[r->cached_prod & r->mask];
+    d->addr = addr;
+    d->len = len;
+    d->options = 0;
+    r->cached_prod++;
+    __atomic_store_n(r->producer, r->cached_prod, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * Return frames the output device has finished sending to the RX fill ring
+ */
+static void reap_tx_completions(struct afxdp_worker *worker)
+{
+    const uint64_t *ring = (const uint64_t *)worker->tx_comp.ring;
+    uint64_t addrs[AFXDP_RX_BATCH];
+    uint32_t n, i;
+
+    while ((n = ring_cons_peek(&worker->tx_comp, AFXDP_RX_BATCH)) > 0) {
+        for (i = 0; i < n; i++)
+            addrs[i] = ring[(worker->tx_comp.cached_cons + i) & worker->tx_comp.mask] &
+                       ~((uint64_t)AFXDP_FRAME_SIZE - 1);
+        ring_cons_release(&worker->tx_comp, n);
+        fill_ring_push(&worker->fill, addrs, n);
+    }
+}
+
+/*
+ * Create one AF_XDP socket with its own UMEM, bound to the given RX queue
+ */
+static int setup_xsk(const struct afxdp_config *config, uint32_t queue_id,
+                     struct afxdp_worker *worker)
+{
+    struct xdp_umem_reg umem = {0};
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp = {0};
+    socklen_t optlen = sizeof(off);
+    uint64_t addrs[AFXDP_NUM_FRAMES];
+    int size, fd, err;
+    uint32_t i;
+
+    fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (fd < 0) {
+        fprintf(stderr, "AF_XDP: Failed to create socket: %s\n", strerror(errno));
+        return -errno;
+    }
+    worker->xsk_fd = fd;
+    worker->queue_id = queue_id;
+
+    /* Packet buffer area, registered with the kernel as UMEM */
+    worker->umem_size = (size_t)AFXDP_NUM_FRAMES * AFXDP_FRAME_SIZE;
+    worker->umem_area = MAP_FAILED;
+    if (config->hugepages) {
+        /* 8 MB = four 2 MB pages: fewer TLB misses on the RX path */
+        worker->umem_area = mmap(NULL, worker->umem_size, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB,
+                                 -1, 0);
+        if (worker->umem_area == MAP_FAILED && config->verbose && queue_id == 0) {
+            printf("AF_XDP: No hugepages for UMEM (%s); using regular pages\n",
+                   strerror(errno));
+        }
+    }
+    if (worker->umem_area == MAP_FAILED) {
+        worker->umem_area = mmap(NULL, worker->umem_size, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    }
+    if (worker->umem_area == MAP_FAILED) {
+        worker->umem_area = NULL;
+        fprintf(stderr, "AF_XDP: Failed to allocate UMEM: %s\n", strerror(errno));
+        return -errno;
+    }
+
+    umem.addr = (uint64_t)(uintptr_t)worker->umem_area;
+    umem.len = worker->umem_size;
+    umem.chunk_size = AFXDP_FRAME_SIZE;
+    umem.headroom = 0;
+    if (setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &umem, sizeof(umem)) < 0) {
+        fprintf(stderr, "AF_XDP: Failed to register UMEM: %s\n", strerror(errno));
+        return -errno;
+    }
+
+    size = AFXDP_FILL_RING_SIZE;
+    if (setsockopt(fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) < 0)
+        goto err_sockopt;
+    size = AFXDP_COMP_RING_SIZE;
+    if (setsockopt(fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) < 0)
+        goto err_sockopt;
+    size = AFXDP_RX_RING_SIZE;
+    if (setsockopt(fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) < 0)
+        goto err_sockopt;
+
+    if (getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0)
+        goto err_sockopt;
+
+    err = map_ring(fd, &off.fr, AFXDP_FILL_RING_SIZE, sizeof(uint64_t),
+                   XDP_UMEM_PGOFF_FILL_RING, &worker->fill);
+    if (!err)
+        err = map_ring(fd, &off.cr, AFXDP_COMP_RING_SIZE, sizeof(uint64_t),
+                       XDP_UMEM_PGOFF_COMPLETION_RING, &worker->comp);
+    if (!err)
+        err = map_ring(fd, &off.rx, AFXDP_RX_RING_SIZE, sizeof(struct xdp_desc),
+                       XDP_PGOFF_RX_RING, &worker->rx);
+    if (err) {
+        fprintf(stderr, "AF_XDP: Failed to mmap rings: %s\n", strerror(-err));
+        return err;
+    }
+
+    /* Give every frame to the kernel up front */
+    for (i = 0; i < AFXDP_NUM_FRAMES; i++)
+        addrs[i] = (uint64_t)i * AFXDP_FRAME_SIZE;
+    fill_ring_push(&worker->fill, addrs, AFXDP_NUM_FRAMES);
+
+    sxdp.sxdp_family   = AF_XDP;
+    sxdp.sxdp_ifindex  = config->input_ifindex;
+    sxdp.sxdp_queue_id = queue_id;
+    sxdp.sxdp_flags    = (config->zero_copy ? XDP_ZEROCOPY : XDP_COPY) | XDP_USE_NEED_WAKEUP;
+    if (bind(fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+        fprintf(stderr, "AF_XDP: Failed to bind to %s queue %u (%s): %s\n",
+                config->input_ifname, queue_id,
+                config->zero_copy ? "zero-copy" : "copy", strerror(errno));
+        return -errno;
+    }
+
+    return 0;
+
+err_sockopt:
+    err = -errno;
+    fprintf(stderr, "AF_XDP: Failed to configure rings: %s\n", strerror(-err));
+    return err;
+}
+
+/*
+ * Bind a TX-only XSK on the output interface that shares the worker's UMEM
+ * A socket on another device/queue needs its own fill and completion rings;
+ * the fill ring stays empty since this socket never receives.
+ * @return: 0 on success, negative errno if copy-free TX is not possible
+ */
+static int setup_tx_xsk(const struct afxdp_config *config, uint32_t queue_id,
+                        struct afxdp_worker *worker)
+{
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp = {0};
+    socklen_t optlen = sizeof(off);
+    int size, fd, err;
+
+    fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (fd < 0)
+        return -errno;
+    worker->txsk_fd = fd;
+
+    size = AFXDP_COMP_RING_SIZE;
+    if (setsockopt(fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) < 0 ||
+        setsockopt(fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) < 0)
+        return -errno;
+    size = AFXDP_TX_RING_SIZE;
+    if (setsockopt(fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) < 0)
+        return -errno;
+    if (getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0)
+        return -errno;
+
+    err = map_ring(fd, &off.cr, AFXDP_COMP_RING_SIZE, sizeof(uint64_t),
+                   XDP_UMEM_PGOFF_COMPLETION_RING, &worker->tx_comp);
+    if (!err)
+        err = map_ring(fd, &off.tx, AFXDP_TX_RING_SIZE, sizeof(struct xdp_desc),
+                       XDP_PGOFF_TX_RING, &worker->txq);
+    if (err)
+        return err;
+
+    /* Copy/zero-copy and need-wakeup are inherited from the RX socket */
+    sxdp.sxdp_family         = AF_XDP;
+    sxdp.sxdp_ifindex        = config->output_ifindex;
+    sxdp.sxdp_queue_id       = queue_id;
+    sxdp.sxdp_flags          = XDP_SHARED_UMEM;
+    sxdp.sxdp_shared_umem_fd = worker->xsk_fd;
+    if (bind(fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0)
+        return -errno;
+
+    return 0;
+}
+
+/*
+ * Drop a partially or fully set up TX XSK
+ */
+static void teardown_tx_xsk(struct afxdp_worker *worker)
+{
+    unmap_ring(&worker->txq);
+    unmap_ring(&worker->tx_comp);
+    if (worker->txsk_fd >= 0) {
+        close(worker->txsk_fd);
+        worker->txsk_fd = -1;
+    }
+}
+
+/*
+ * Load xdp_capture.bpf.o and look up the program and XSKMAP
+ */
+static int load_xdp_prog(struct afxdp_ctx *ctx)
+{
+    struct bpf_program *prog;
+    struct bpf_map *map;
+    int err;
+
+    ctx->bpf_obj = bpf_object__open(XDP_BPF_OBJ_PATH);
+    if (!ctx->bpf_obj) {
+        err = -errno;
+        fprintf(stderr, "AF_XDP: Failed to open %s: %s\n", XDP_BPF_OBJ_PATH, strerror(-err));
+        return err;
+    }
+
+    err = bpf_object__load(ctx->bpf_obj);
+    if (err) {
+        fprintf(stderr, "AF_XDP: Failed to load %s: %s\n", XDP_BPF_OBJ_PATH, strerror(-err));
+        return err;
+    }
+
+    prog = bpf_object__find_program_by_name(ctx->bpf_obj, XDP_CAPTURE_PROG);
+    map = bpf_object__find_map_by_name(ctx->bpf_obj, XSKS_MAP_NAME);
+    if (!prog || !map) {
+        fprintf(stderr, "AF_XDP: %s missing program or map\n", XDP_BPF_OBJ_PATH);
+        return -ENOENT;
+    }
+    ctx->prog_fd = bpf_program__fd(prog);
+    ctx->xsks_map_fd = bpf_map__fd(map);
+    return 0;
+}
+
+/*
+ * Attach the XDP program; auto tries driver mode first, then generic (skb) mode
+ */
+static int attach_xdp_prog(struct afxdp_ctx *ctx)
+{
+    uint32_t base = XDP_FLAGS_UPDATE_IF_NOEXIST;
+    enum afxdp_xdp_mode mode = ctx->config.xdp_mode;
+    int err = -EINVAL;
+
+    if (mode == AFXDP_XDP_MODE_NATIVE || mode == AFXDP_XDP_MODE_AUTO) {
+        err = bpf_xdp_attach(ctx->config.input_ifindex, ctx->prog_fd,
+                             base | XDP_FLAGS_DRV_MODE, NULL);
+        if (!err) {
+            ctx->xdp_flags = base | XDP_FLAGS_DRV_MODE;
+        } else if (mode == AFXDP_XDP_MODE_NATIVE || ctx->config.zero_copy) {
+            fprintf(stderr, "AF_XDP: Failed to attach XDP in native mode: %s\n", strerror(-err));
+            return err;
+        } else if (ctx->config.verbose) {
+            printf("AF_XDP: Native XDP unavailable (%s), using generic mode\n", strerror(-err));
+        }
+    }
+    if (err) {
+        err = bpf_xdp_attach(ctx->config.input_ifindex, ctx->prog_fd,
+                             base | XDP_FLAGS_SKB_MODE, NULL);
+        if (err) {
+            fprintf(stderr, "AF_XDP: Failed to attach XDP in generic mode: %s\n", strerror(-err));
+            return err;
+        }
+        ctx->xdp_flags = base | XDP_FLAGS_SKB_MODE;
+    }
+
+    ctx->attached = true;
+    printf("AF_XDP: XDP program attached to %s (%s mode)\n", ctx->config.input_ifname,
+           (ctx->xdp_flags & XDP_FLAGS_DRV_MODE) ? "native" : "generic");
+    return 0;
+}
+
+/*
+ * Pin current thread to specified CPU
+ */
+static int pin_to_cpu(int cpu_id)
+{
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu_id, &cpuset);
+
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+    if (err) {
+        fprintf(stderr, "AF_XDP: Failed to pin thread to CPU %d: %s\n",
+                cpu_id, strerror(err));
+        return -err;
+    }
+    return 0;
+}
+
+/* Outcome of process_packet() */
+enum afxdp_verdict {
+    AFXDP_PKT_DONE = 0,     /* Dropped or skipped; frame can be recycled */
+    AFXDP_PKT_COPIED,       /* Copied to tx_ring/tunnel; frame can be recycled */
+    AFXDP_PKT_POSTED,       /* Frame posted to the TX XSK; recycled on completion */
+};
+
+/*
+ * Filter, truncate and forward one packet held in a UMEM frame; counts go to
+ * batch, published once per RX batch
+ */
+static enum afxdp_verdict process_packet(struct afxdp_worker *worker,
+                                         const struct afxdp_config *config,
+                                         const struct filter_state *fs,
+                                         uint64_t *hits,
+                                         struct worker_stats *batch,
+                                         const struct xdp_desc *desc,
+                                         uint64_t now)
+{
+    struct tunnel_ctx *tunnel_ctx = config->tunnel_ctx;
+    uint8_t *pkt_data = (uint8_t *)worker->umem_area + desc->addr;
+    uint32_t pkt_len = desc->len;
+    struct pkt_desc pd;
+    uint32_t send_len;
+    int ret;
+
+    batch->packets_received++;
+    batch->bytes_received += pkt_len;
+
+    if (!tunnel_ctx && worker->tx.fd < 0) {
+        batch->packets_dropped++;
+        return AFXDP_PKT_DONE;
+    }
+
+    /* Parse once; filter, truncation, loop detection and the tunnel flow hash share it */
+    pkt_parse(pkt_data, pkt_len, &pd);
+
+    /* Skip our own tunnel output when -i and -o are the same (avoid re-encapsulation loop) */
+    if (tunnel_ctx && tunnel_is_own_packet(tunnel_ctx, pkt_data, &pd))
+        return AFXDP_PKT_DONE;
+
+    /* Sampled out before dedup and the filter: only the kept share costs a lookup */
+    if (sampler_skip(&worker->sampler, &pd)) {
+        batch->packets_sampled_out++;
+        batch->bytes_sampled_out += pkt_len;
+        return AFXDP_PKT_DONE;
+    }
+
+    /* Frame mirrored twice (e.g. a SPAN of both directions): counted, never filtered or sent */
+    if (worker->dups && dedup_seen(worker->dups, pkt_data, &pd, now)) {
+        batch->packets_dup++;
+        batch->bytes_dup += pkt_len;
+        return AFXDP_PKT_DONE;
+    }
+
+    if (fs) {
+        int matched;
+        enum filter_action fa = filter_classify(fs->fc, &pd, &matched);
+        unsigned int slot = (matched >= 0) ? (unsigned int)matched : fs->cfg->num_rules;
+        counter_add(&hits[slot], 1);
+        if (fa == FILTER_ACTION_DROP) {
+            batch->packets_dropped++;
+            return AFXDP_PKT_DONE;
+        }
+    }
+
+    /* Elephant flows: only the first bytes / packets of each flow go out */
+    if (worker->flows && flow_cutoff(worker->flows, &pd, pkt_len, now)) {
+        batch->packets_cutoff++;
+        batch->bytes_cutoff += pkt_len;
+        return AFXDP_PKT_DONE;
+    }
+
+    /* UMEM frame is ours until it goes back on the fill ring: truncate in place */
+    send_len = truncate_apply(pkt_data, pkt_len, config->truncate_enabled, config->truncate_length, &pd);
+    if (send_len < pkt_len) {
+        batch->packets_truncated++;
+        batch->bytes_truncated += (uint64_t)(pkt_len - send_len);
+    }
+
+    /* Copy-free path: hand the frame itself to the output device (MTU permitting) */
+    if (!tunnel_ctx && worker->txsk_fd >= 0 && send_len <= worker->tx.max_tx_len &&
+        txq_push(&worker->txq, desc->addr, send_len) == 0) {
+        batch->packets_sent++;
+        batch->bytes_sent += send_len;
+        batch->packets_copy_free++;
+        return AFXDP_PKT_POSTED;
+    }
+
+    if (tunnel_ctx)
+        ret = tunnel_send(worker->tunnel_tx, pkt_data, send_len, pd.flow_hash) == 0 ? (int)send_len : -1;
+    else
+        ret = tx_ring_write(&worker->tx, pkt_data, send_len, &pd);
+
+    if (ret < 0) {
+        batch->packets_dropped++;
+        return AFXDP_PKT_DONE;
+    }
+    batch->packets_sent++;
+    batch->bytes_sent += (uint32_t)ret;
+    if ((uint32_t)ret < send_len)
+        batch->packets_clamped++;
+    return AFXDP_PKT_COPIED;
+}
+
+/* Worker thread argument */
+struct afxdp_thread_arg {
+    struct afxdp_ctx       *ctx;
+    int                     worker_id;
+    int                     cpu_id;
+};
+
+/*
+ * AF_XDP worker thread main function
+ * Drains the RX ring in batches, flushes output, then recycles the frames
+ * that were not posted to the TX XSK
+ */
+static void *afxdp_worker_thread(void *arg)
+{
+    struct afxdp_thread_arg *targ = (struct afxdp_thread_arg *)arg;
+    struct afxdp_ctx *ctx = targ->ctx;
+    int worker_id = targ->worker_id;
+    int cpu_id = targ->cpu_id;
+    struct afxdp_worker *worker = &ctx->workers[worker_id];
+    const struct xdp_desc *descs = (const struct xdp_desc *)worker->rx.ring;
+    uint64_t addrs[AFXDP_RX_BATCH];
+    struct pollfd pfd;
+
+    /* Pin to CPU */
+    if (pin_to_cpu(cpu_id) == 0) {
+        if (ctx->config.verbose) {
+            printf("AF_XDP: Worker %d (queue %u) pinned to CPU %d\n",
+                   worker_id, worker->queue_id, cpu_id);
+        }
+    }
+
+    /* Free thread argument */
+    free(targ);
+
+    /* Setup poll descriptor (poll also services XDP_RING_NEED_WAKEUP) */
+    pfd.fd = worker->xsk_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    while (ctx->running) {
+        const struct filter_state *fs;
+        uint64_t *hits;
+        struct worker_stats batch = {0};
+        uint32_t n, i;
+        uint32_t copied = 0, posted = 0, recycle = 0;
+        uint64_t now;
+
+        if (worker->txsk_fd >= 0)
+            reap_tx_completions(worker);
+
+        n = ring_cons_peek(&worker->rx, AFXDP_RX_BATCH);
+        if (n == 0) {
+            int ret = poll(&pfd, 1, AFXDP_POLL_TIMEOUT_MS);
+            if (ret < 0 && errno != EINTR) {
+                if (ctx->config.verbose) {
+                    fprintf(stderr, "AF_XDP: Worker %d poll error: %s\n",
+                            worker_id, strerror(errno));
+                }
+            }
+            continue;
+        }
+
+        /* One filter for the whole batch; a reload waits until the batch is done */
+        fs = filter_enter((unsigned int)worker_id);
+        hits = fs ? filter_hits_row(fs, (unsigned int)worker_id) : NULL;
+        now = (worker->flows || worker->dups) ? dedup_clock_ns() : 0;
+        for (i = 0; i < n; i++) {
+            const struct xdp_desc *d = &descs[(worker->rx.cached_cons + i) & worker->rx.mask];
+
+            switch (process_packet(worker, &ctx->config, fs, hits, &batch, d, now)) {
+            case AFXDP_PKT_POSTED:
+                posted++;
+                continue;   /* frame now owned by the TX XSK */
+            case AFXDP_PKT_COPIED:
+                copied++;
+                break;
+            default:
+                break;
+            }
+            addrs[recycle++] = d->addr & ~((uint64_t)AFXDP_FRAME_SIZE - 1);
+        }
+        filter_exit((unsigned int)worker_id);
+        worker_stats_publish(&worker->stats, &batch);
+
+        /* Kick the TX XSK (copy-mode sockets transmit from sendto) */
+        if (posted > 0 && (*worker->txq.flags & XDP_RING_NEED_WAKEUP))
+            sendto(worker->txsk_fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+
+        /* Copied output is read from the frames; flush before they are reused */
+        if (copied > 0) {
+            if (ctx->config.tunnel_ctx)
+                tunnel_flush(worker->tunnel_tx);
+            else
+                tx_ring_flush(&worker->tx);
+        }
+
+        ring_cons_release(&worker->rx, n);
+        fill_ring_push(&worker->fill, addrs, recycle);
+    }
+
+    if (ctx->config.verbose) {
+        printf("AF_XDP: Worker %d exiting\n", worker_id);
+    }
+    return NULL;
+}
+
+/*
+ * Cleanup a single worker's resources
+ */
+static void cleanup_worker(struct afxdp_worker *worker)
+{
+    teardown_tx_xsk(worker);
+    tx_ring_teardown(&worker->tx);
+    tunnel_sender_destroy(worker->tunnel_tx);
+    worker->tunnel_tx = NULL;
+    flow_table_destroy(worker->flows);
+    worker->flows = NULL;
+    dedup_table_destroy(worker->dups);
+    worker->dups = NULL;
+
+    unmap_ring(&worker->rx);
+    unmap_ring(&worker->comp);
+    unmap_ring(&worker->fill);
+    if (worker->xsk_fd >= 0) {
+        close(worker->xsk_fd);
+        worker->xsk_fd = -1;
+    }
+    if (worker->umem_area) {
+        munmap(worker->umem_area, worker->umem_size);
+        worker->umem_area = NULL;
+    }
+}
+
+/*
+ * Read kernel-side XSK counters (zeroed if unavailable)
+ */
+static void read_xdp_stats(const struct afxdp_worker *worker, struct xdp_statistics *st)
+{
+    socklen_t optlen = sizeof(*st);
+
+    memset(st, 0, sizeof(*st));
+    if (worker->xsk_fd >= 0)
+        getsockopt(worker->xsk_fd, SOL_XDP, XDP_STATISTICS, st, &optlen);
+}
+
+static uint64_t xdp_drops(const struct xdp_statistics *st)
+{
+    return st->rx_dropped + st->rx_invalid_descs + st->rx_ring_full;
+}
+
+int afxdp_init(struct afxdp_ctx *ctx, const struct afxdp_config *config)
+{
+    int i, err;
+    int num_queues, out_queues = 0, copy_free = 0;
+
+    if (!ctx || !config) {
+        return -EINVAL;
+    }
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->config = *config;
+    ctx->prog_fd = -1;
+    ctx->xsks_map_fd = -1;
+
+    /* One socket (and worker) per RX queue: RSS spreads flows across them */
+    num_queues = get_rx_queue_count(ctx->config.input_ifindex);
+    if (num_queues > XSK_MAX_QUEUES)
+        num_queues = XSK_MAX_QUEUES;
+    if (ctx->config.num_workers > 0 && ctx->config.num_workers != num_queues) {
+        printf("AF_XDP: %s has %d RX queue(s); using %d worker(s) instead of %d\n",
+               ctx->config.input_ifname, num_queues, num_queues, ctx->config.num_workers);
+    }
+    ctx->config.num_workers = num_queues;
+    if (ctx->config.output_ifindex > 0)
+        out_queues = get_rx_queue_count(ctx->config.output_ifindex);
+
+    /* One filter hit row per worker */
+    err = filter_set_readers((unsigned int)ctx->config.num_workers);
+    if (err) {
+        return err;
+    }
+
+    printf("AF_XDP: Using %d worker thread(s), one per RX queue (%s)\n",
+           ctx->config.num_workers, ctx->config.zero_copy ? "zero-copy" : "copy mode");
+
+    /* Allocate worker array (cache-line aligned: stats are per worker) */
+    ctx->workers = counter_calloc(ctx->config.num_workers, sizeof(struct afxdp_worker));
+    if (!ctx->workers) {
+        return -ENOMEM;
+    }
+
+    /* Initialize each worker */
+    for (i = 0; i < ctx->config.num_workers; i++) {
+        ctx->workers[i].xsk_fd = -1;
+        ctx->workers[i].txsk_fd = -1;
+        ctx->workers[i].tx.fd = -1;
+    }
+
+    err = load_xdp_prog(ctx);
+    if (err)
+        goto err_cleanup;
+
+    /* Setup XSK + UMEM for each queue and publish it in the XSKMAP */
+    for (i = 0; i < ctx->config.num_workers; i++) {
+        __u32 key = (__u32)i;
+
+        err = setup_xsk(&ctx->config, (uint32_t)i, &ctx->workers[i]);
+        if (err) {
+            fprintf(stderr, "AF_XDP: Failed to setup socket for worker %d\n", i);
+            goto err_cleanup;
+        }
+
+        err = bpf_map_update_elem(ctx->xsks_map_fd, &key, &ctx->workers[i].xsk_fd, 0);
+        if (err) {
+            fprintf(stderr, "AF_XDP: Failed to add socket for queue %d to %s: %s\n",
+                    i, XSKS_MAP_NAME, strerror(-err));
+            goto err_cleanup;
+        }
+
+        /* Setup TX ring if output interface configured */
+        if (ctx->config.output_ifindex > 0 && ctx->config.output_ifname[0] != '\0') {
+            err = tx_ring_setup(&ctx->workers[i].tx, ctx->config.output_ifindex,
+                                &ctx->config.tx_ring,
+                                ctx->config.verbose && i == 0, ctx->config.debug);
+            if (err) {
+                fprintf(stderr, "AF_XDP: Failed to setup TX ring for worker %d\n", i);
+                goto err_cleanup;
+            }
+
+            /* Copy-free TX needs a distinct output queue per worker (one UMEM per queue) */
+            if (!ctx->config.tunnel_ctx && i < out_queues) {
+                err = setup_tx_xsk(&ctx->config, (uint32_t)i, &ctx->workers[i]);
+                if (err) {
+                    teardown_tx_xsk(&ctx->workers[i]);
+                    if (ctx->config.verbose) {
+                        printf("AF_XDP: Worker %d: no shared-UMEM TX on %s queue %d (%s); copying via TX ring\n",
+                               i, ctx->config.output_ifname, i, strerror(-err));
+                    }
+                }
+            }
+            if (ctx->workers[i].txsk_fd >= 0)
+                copy_free++;
+        }
+
+        /* Each worker encapsulates into its own buffer and socket */
+        if (ctx->config.tunnel_ctx) {
+            err = tunnel_sender_create(ctx->config.tunnel_ctx, &ctx->config.tx_ring,
+                                       &ctx->workers[i].tunnel_tx);
+            if (err) {
+                fprintf(stderr, "AF_XDP: Failed to setup tunnel sender for worker %d\n", i);
+                goto err_cleanup;
+            }
+        }
+
+        /* RSS keeps a flow on one queue, so each worker counts its own flows */
+        if (ctx->config.flow_cutoff.enabled) {
+            ctx->workers[i].flows = flow_table_create(&ctx->config.flow_cutoff);
+            if (!ctx->workers[i].flows) {
+                err = -ENOMEM;
+                goto err_cleanup;
+            }
+        }
+
+        /* Both copies of a frame hash alike, so RSS puts them on the same queue */
+        if (ctx->config.dedup.enabled) {
+            ctx->workers[i].dups = dedup_table_create(&ctx->config.dedup);
+            if (!ctx->workers[i].dups) {
+                err = -ENOMEM;
+                goto err_cleanup;
+            }
+        }
+
+        sampler_init(&ctx->workers[i].sampler, &ctx->config.sampling);
+    }
+
+    if (!ctx->config.tunnel_ctx && ctx->config.output_ifindex > 0) {
+        printf("AF_XDP: Copy-free forwarding on %d of %d worker(s)\n",
+               copy_free, ctx->config.num_workers);
+    }
+
+    /* Allocate thread handles */
+    ctx->threads = calloc(ctx->config.num_workers, sizeof(pthread_t));
+    if (!ctx->threads) {
+        err = -ENOMEM;
+        goto err_cleanup;
+    }
+
+    err = attach_xdp_prog(ctx);
+    if (err)
+        goto err_cleanup;
+
+    if (!config->tunnel_ctx && !config->output_ifindex) {
+        printf("AF_XDP: No output interface specified - running in drop mode\n");
+    }
+
+    printf("AF_XDP: Initialized %d workers on interface %s (ifindex=%d)\n",
+           ctx->config.num_workers, ctx->config.input_ifname,
+           ctx->config.input_ifindex);
+
+    return 0;
+
+err_cleanup:
+    for (i = 0; i < ctx->config.num_workers; i++) {
+        cleanup_worker(&ctx->workers[i]);
+    }
+    free(ctx->workers);
+    ctx->workers = NULL;
+    free(ctx->threads);
+    ctx->threads = NULL;
+    if (ctx->bpf_obj) {
+        bpf_object__close(ctx->bpf_obj);
+        ctx->bpf_obj = NULL;
+    }
+    return err;
+}
+
+int afxdp_start(struct afxdp_ctx *ctx)
+{
+    int i, err;
+    int num_cpus = get_nprocs();
+
+    if (!ctx || !ctx->workers || !ctx->threads) {
+        return -EINVAL;
+    }
+
+    ctx->running = true;
+
+    for (i = 0; i < ctx->config.num_workers; i++) {
+        struct afxdp_thread_arg *arg = malloc(sizeof(*arg));
+        if (!arg) {
+            ctx->running = false;
+            /* Join already-started threads */
+            for (int j = 0; j < i; j++) {
+                pthread_join(ctx->threads[j], NULL);
+            }
+            return -ENOMEM;
+        }
+
+        arg->ctx = ctx;
+        arg->worker_id = i;
+        arg->cpu_id = i % num_cpus;
+
+        err = pthread_create(&ctx->threads[i], NULL, afxdp_worker_thread, arg);
+        if (err) {
+            free(arg);
+            ctx->running = false;
+            for (int j = 0; j < i; j++) {
+                pthread_join(ctx->threads[j], NULL);
+            }
+            return -err;
+        }
+    }
+
+    printf("AF_XDP: Started %d worker thread(s)\n", ctx->config.num_workers);
+    return 0;
+}
+
+void afxdp_stop(struct afxdp_ctx *ctx)
+{
+    int i;
+
+    if (!ctx || !ctx->running) {
+        return;
+    }
+
+    printf("AF_XDP: Stopping workers...\n");
+    ctx->running = false;
+
+    for (i = 0; i < ctx->config.num_workers; i++) {
+        if (ctx->threads[i]) {
+            pthread_join(ctx->threads[i], NULL);
+        }
+    }
+
+    printf("AF_XDP: All workers stopped\n");
+}
+
+void afxdp_cleanup(struct afxdp_ctx *ctx)
+{
+    int i;
+
+    if (!ctx) {
+        return;
+    }
+
+    if (ctx->running) {
+        afxdp_stop(ctx);
+    }
+
+    /* Detach first so the input interface stops redirecting into our sockets */
+    if (ctx->attached) {
+        bpf_xdp_detach(ctx->config.input_ifindex, ctx->xdp_flags, NULL);
+        ctx->attached = false;
+    }
+
+    if (ctx->workers) {
+        for (i = 0; i < ctx->config.num_workers; i++) {
+            cleanup_worker(&ctx->workers[i]);
+        }
+        free(ctx->workers);
+        ctx->workers = NULL;
+    }
+
+    if (ctx->threads) {
+        free(ctx->threads);
+        ctx->threads = NULL;
+    }
+
+    if (ctx->bpf_obj) {
+        bpf_object__close(ctx->bpf_obj);
+        ctx->bpf_obj = NULL;
+    }
+}
+
+void afxdp_get_stats(struct afxdp_ctx *ctx, struct worker_stats *total)
+{
+    int i;
+
+    if (!ctx || !total) {
+        return;
+    }
+
+    memset(total, 0, sizeof(*total));
+
+    if (!ctx->workers) {
+        return;
+    }
+
+    for (i = 0; i < ctx->config.num_workers; i++) {
+        struct afxdp_worker *w = &ctx->workers[i];
+        struct xdp_statistics st;
+        uint64_t kdrops;
+
+        read_xdp_stats(w, &st);
+        kdrops = xdp_drops(&st) - xdp_drops(&w->xdp_base);
+
+        total->packets_received += counter_read(&w->stats.packets_received) + kdrops;
+        total->packets_sent     += counter_read(&w->stats.packets_sent);
+        total->packets_dropped  += counter_read(&w->stats.packets_dropped) + kdrops;
+        total->bytes_received   += counter_read(&w->stats.bytes_received);
+        total->bytes_sent       += counter_read(&w->stats.bytes_sent);
+        total->packets_truncated += counter_read(&w->stats.packets_truncated);
+        total->bytes_truncated   += counter_read(&w->stats.bytes_truncated);
+        total->packets_copy_free += counter_read(&w->stats.packets_copy_free);
+        total->packets_clamped   += counter_read(&w->stats.packets_clamped);
+        total->packets_cutoff    += counter_read(&w->stats.packets_cutoff);
+        total->bytes_cutoff      += counter_read(&w->stats.bytes_cutoff);
+        total->packets_dup       += counter_read(&w->stats.packets_dup);
+        total->bytes_dup         += counter_read(&w->stats.bytes_dup);
+        total->packets_sampled_out += counter_read(&w->stats.packets_sampled_out);
+        total->bytes_sampled_out   += counter_read(&w->stats.bytes_sampled_out);
+        total->packets_tx_full   += counter_read(&w->tx.full_drops);
+    }
+}
+
+void afxdp_reset_stats(struct afxdp_ctx *ctx)
+{
+    int i;
+
+    if (!ctx || !ctx->workers) {
+        return;
+    }
+
+    for (i = 0; i < ctx->config.num_workers; i++) {
+        struct afxdp_worker *w = &ctx->workers[i];
+
+        read_xdp_stats(w, &w->xdp_base);
+        counter_set(&w->stats.packets_received, 0);
+        counter_set(&w->stats.packets_sent, 0);
+        counter_set(&w->stats.packets_dropped, 0);
+        counter_set(&w->stats.bytes_received, 0);
+        counter_set(&w->stats.bytes_sent, 0);
+        counter_set(&w->stats.packets_truncated, 0);
+        counter_set(&w->stats.bytes_truncated, 0);
+        counter_set(&w->stats.packets_copy_free, 0);
+        counter_set(&w->stats.packets_clamped, 0);
+        counter_set(&w->stats.packets_cutoff, 0);
+        counter_set(&w->stats.bytes_cutoff, 0);
+        counter_set(&w->stats.packets_dup, 0);
+        counter_set(&w->stats.bytes_dup, 0);
+        counter_set(&w->stats.packets_sampled_out, 0);
+        counter_set(&w->stats.bytes_sampled_out, 0);
+        counter_set(&w->tx.full_drops, 0);
+    }
+}
+
+void afxdp_print_per_worker_stats(struct afxdp_ctx *ctx)
+{
+    int i;
+
+    if (!ctx || !ctx->workers) {
+        return;
+    }
+
+    printf("\n--- Per-Worker Statistics ---\n");
+    for (i = 0; i < ctx->config.num_workers; i++) {
+        uint64_t rx   = counter_read(&ctx->workers[i].stats.packets_received);
+        uint64_t tx   = counter_read(&ctx->workers[i].stats.packets_sent);
+        uint64_t drop = counter_read(&ctx->workers[i].stats.packets_dropped);
+        printf("  Worker %d: RX=%lu TX=%lu Dropped=%lu\n",
+               i, (unsigned long)rx, (unsigned long)tx, (unsigned long)drop);
+    }
+    printf("----------------------------\n");
+}
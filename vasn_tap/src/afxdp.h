@@ -0,0 +1,171 @@
+/*
+ * vasn_tap - AF_XDP Capture Backend Header
+ * XDP program redirects each RX queue to its own AF_XDP socket (XSK);
+ * packets land in a per-socket UMEM and are forwarded copy-free through an
+ * XSK on the output interface sharing that UMEM, or via the TX ring/tunnel
+ */
+
+#ifndef __AFXDP_H__
+#define __AFXDP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <linux/if_xdp.h>
+
+struct tunnel_ctx;
+struct tunnel_sender;
+struct bpf_object;
+struct flow_table;
+struct dedup_table;
+
+/* Reuse worker_stats from worker.h for consistent stats interface */
+#include "worker.h"
+#include "tx_ring.h"
+#include "config.h"
+#include "sample.h"
+
+/* UMEM geometry (per socket) */
+#define AFXDP_NUM_FRAMES        4096        /* Frames per UMEM */
+#define AFXDP_FRAME_SIZE        (1 << 11)   /* 2048 bytes per frame (two per page) */
+
+/* Ring sizes (entries, power of two) */
+#define AFXDP_FILL_RING_SIZE    AFXDP_NUM_FRAMES  /* Every frame can sit in the fill ring */
+#define AFXDP_COMP_RING_SIZE    2048
+#define AFXDP_RX_RING_SIZE      2048
+#define AFXDP_TX_RING_SIZE      2048
+
+/* Max RX descriptors handled per batch before flushing output */
+#define AFXDP_RX_BATCH          64
+
+/* Single-producer/single-consumer view of one mmap'd XSK ring */
+struct afxdp_ring {
+    uint32_t   *producer;        /* Shared producer index */
+    uint32_t   *consumer;        /* Shared consumer index */
+    uint32_t   *flags;           /* XDP_RING_NEED_WAKEUP etc. */
+    void       *ring;            /* Descriptor array (u64 addrs or xdp_desc) */
+    uint32_t    size;            /* Number of entries */
+    uint32_t    mask;            /* size - 1 */
+    uint32_t    cached_prod;     /* Local producer copy */
+    uint32_t    cached_cons;     /* Local consumer copy */
+    void       *map;             /* mmap base */
+    size_t      map_len;         /* mmap length */
+};
+
+/* AF_XDP worker configuration */
+struct afxdp_config {
+    char input_ifname[64];        /* Input interface name */
+    int  input_ifindex;           /* Input interface index */
+    char output_ifname[64];       /* Output interface name */
+    int  output_ifindex;          /* Output interface index (0 = drop mode) */
+    struct tunnel_ctx *tunnel_ctx; /* If set, use tunnel_send instead of tx_ring */
+    int  num_workers;             /* Requested workers (informational; one per RX queue) */
+    bool verbose;                 /* Verbose logging */
+    bool debug;                   /* TX debug (hex dumps) */
+    bool truncate_enabled;        /* Truncate allowed packets before send */
+    uint32_t truncate_length;     /* Truncate length when enabled (64..9000) */
+    bool zero_copy;               /* Bind with XDP_ZEROCOPY (driver support required) */
+    enum afxdp_xdp_mode xdp_mode; /* XDP attach mode (auto/native/generic) */
+    bool hugepages;               /* Back each UMEM with hugepages (runtime.rx_ring.hugepages) */
+    struct ring_config tx_ring;   /* TPACKET_V2 TX ring geometry (runtime.tx_ring) */
+    struct flow_cutoff_config flow_cutoff; /* Per-flow cutoff (runtime.flow_cutoff) */
+    struct dedup_config dedup;    /* Duplicate suppression (runtime.dedup) */
+    struct sampling_config sampling; /* Deterministic sampling (runtime.sampling) */
+};
+
+/* Per-worker (per RX queue) state for AF_XDP mode */
+struct afxdp_worker {
+    int                  xsk_fd;         /* AF_XDP socket */
+    uint32_t             queue_id;       /* RX queue bound to this socket */
+    void                *umem_area;      /* Packet buffer memory registered as UMEM */
+    size_t               umem_size;      /* UMEM size in bytes */
+    struct afxdp_ring    fill;           /* Fill ring (frames handed to kernel) */
+    struct afxdp_ring    comp;           /* Completion ring (required by bind; unused) */
+    struct afxdp_ring    rx;             /* RX ring (received descriptors) */
+
+    /*
+     * Copy-free TX: XSK bound to output queue <worker id> with XDP_SHARED_UMEM.
+     * RX frames are posted to txq as-is and come back on tx_comp.
+     */
+    int                  txsk_fd;        /* -1 when not available (copy via tx_ring) */
+    struct afxdp_ring    tx_comp;        /* Completion ring of the TX XSK */
+    struct afxdp_ring    txq;            /* TX descriptor ring */
+
+    /* TX: TPACKET_V2 mmap ring (tx.fd == -1 means drop mode); copy fallback */
+    struct tx_ring_ctx   tx;
+    struct tunnel_sender *tunnel_tx;     /* Own tunnel send state (tunnel mode) */
+    struct flow_table   *flows;          /* Own flow cutoff table (NULL = no cutoff) */
+    struct dedup_table  *dups;           /* Own duplicate table (NULL = no dedup) */
+    struct sampler       sampler;        /* Own sampling state (SAMPLING_NONE = keep all) */
+
+    struct xdp_statistics xdp_base;      /* Kernel XSK counters at last reset */
+    struct worker_stats  stats;          /* Per-worker statistics */
+};
+
+/* AF_XDP capture context */
+struct afxdp_ctx {
+    struct afxdp_config     config;
+    struct bpf_object      *bpf_obj;     /* Loaded xdp_capture object */
+    int                     prog_fd;     /* XDP program FD */
+    int                     xsks_map_fd; /* XSKMAP FD */
+    uint32_t                xdp_flags;   /* Flags the program was attached with */
+    bool                    attached;    /* XDP program attached to input */
+    struct afxdp_worker    *workers;     /* Array of per-queue state */
+    volatile bool           running;     /* Running flag */
+    pthread_t              *threads;     /* Worker thread handles */
+};
+
+/*
+ * Initialize AF_XDP capture context
+ * Loads the XDP program, creates one XSK + UMEM per RX queue of the input
+ * interface and attaches the program (native, generic, or auto fallback)
+ * @param ctx: Context to initialize
+ * @param config: Configuration
+ * @return: 0 on success, negative errno on failure
+ */
+int afxdp_init(struct afxdp_ctx *ctx, const struct afxdp_config *config);
+
+/*
+ * Start all AF_XDP worker threads
+ * @param ctx: Initialized context
+ * @return: 0 on success, negative errno on failure
+ */
+int afxdp_start(struct afxdp_ctx *ctx);
+
+/*
+ * Stop all AF_XDP worker threads
+ * @param ctx: Context with running threads
+ */
+void afxdp_stop(struct afxdp_ctx *ctx);
+
+/*
+ * Detach the XDP program and free all resources
+ * @param ctx: Context to cleanup
+ */
+void afxdp_cleanup(struct afxdp_ctx *ctx);
+
+/*
+ * Get aggregate statistics from all AF_XDP workers
+ * Kernel-side drops (XSK RX ring full, invalid descriptors) count as dropped;
+ * packets_copy_free counts packets sent through the shared-UMEM TX XSK
+ * @param ctx: Context
+ * @param total: Output structure for aggregate stats
+ */
+void afxdp_get_stats(struct afxdp_ctx *ctx, struct worker_stats *total);
+
+/*
+ * Reset all AF_XDP worker statistics (workers stopped: counters have one writer)
+ * @param ctx: Context
+ */
+void afxdp_reset_stats(struct afxdp_ctx *ctx);
+
+/*
+ * Print per-worker statistics breakdown
+ * Outputs one line per worker in parseable format:
+ *   "  Worker <id>: RX=<n> TX=<n> Dropped=<n>"
+ * @param ctx: Context with worker stats
+ */
+void afxdp_print_per_worker_stats(struct afxdp_ctx *ctx);
+
+#endif /* __AFXDP_H__ */
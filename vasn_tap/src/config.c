@@ -9,7 +9,9 @@
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <unistd.h>
 #include <arpa/inet.h>
+#include <linux/if_packet.h>
 
 #include "config.h"
 #include <yaml.h>
@@ -68,6 +70,40 @@ static int parse_cidr(const char *s, uint32_t *addr_out, uint32_t *mask_out)
 	return 0;
 }
 
+/* Parse an IPv6 address with optional "/prefix" into host-order halves and mask, as pkt_desc. */
+static int parse_cidr6(const char *s, uint64_t addr_out[2], uint64_t mask_out[2])
+{
+	char buf[64];
+	char *slash;
+	struct in6_addr in6;
+	unsigned int prefix = 128;
+	int i, k;
+
+	snprintf(buf, sizeof(buf), "%s", s);
+	slash = strchr(buf, '/');
+	if (slash) {
+		*slash = '\0';
+		if (sscanf(slash + 1, "%u", &prefix) != 1 || prefix > 128) {
+			set_error("Invalid CIDR prefix: %s", s);
+			return -1;
+		}
+	}
+	if (inet_pton(AF_INET6, buf, &in6) != 1) {
+		set_error("Invalid IP address: %s", s);
+		return -1;
+	}
+	for (i = 0; i < 2; i++) {
+		unsigned int bits = prefix > 64u * i ? prefix - 64u * i : 0;
+
+		addr_out[i] = 0;
+		for (k = 0; k < 8; k++)
+			addr_out[i] = addr_out[i] << 8 | in6.s6_addr[i * 8 + k];
+		mask_out[i] = bits >= 64 ? ~0ULL : bits == 0 ? 0 : ~0ULL << (64 - bits);
+		addr_out[i] &= mask_out[i];
+	}
+	return 0;
+}
+
 static enum filter_action parse_action(const char *s)
 {
 	if (strcmp(s, "allow") == 0)
@@ -101,12 +137,98 @@ static int parse_bool(const char *s, bool *out)
 	return -1;
 }
 
+/* Decimal unsigned 32-bit integer */
+static int parse_u32(const char *s, uint32_t *out)
+{
+	unsigned long long v;
+	char *end;
+
+	if (!s || *s < '0' || *s > '9')
+		return -1;
+	errno = 0;
+	v = strtoull(s, &end, 10);
+	if (errno != 0 || *end != '\0' || v > UINT32_MAX)
+		return -1;
+	*out = (uint32_t)v;
+	return 0;
+}
+
+/*
+ * Reject ring geometries PACKET_RX_RING / PACKET_TX_RING would refuse (or that
+ * the ring code cannot address): page-aligned blocks, 16-byte aligned frames
+ * that hold at least the TPACKET header, whole frames per block, < 4 GiB total.
+ */
+static int validate_ring(const char *name, const struct ring_config *r, bool tx)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	uint32_t min_frame = tx ? TX_RING_MIN_FRAME_SIZE : (uint32_t)TPACKET3_HDRLEN;
+
+	if (page <= 0)
+		page = 4096;
+	if (r->block_size == 0 || r->block_size % (uint32_t)page != 0 || r->block_size > (1u << 30)) {
+		set_error("runtime %s.block_size must be a multiple of the page size (%ld) up to 1 GiB",
+		          name, page);
+		return -1;
+	}
+	if (r->block_nr == 0) {
+		set_error("runtime %s.block_nr must be at least 1", name);
+		return -1;
+	}
+	if ((uint64_t)r->block_size * r->block_nr > UINT32_MAX) {
+		set_error("runtime %s is too large (block_size * block_nr must be below 4 GiB)", name);
+		return -1;
+	}
+	if (r->frame_size < min_frame || r->frame_size % TPACKET_ALIGNMENT != 0 ||
+	    r->frame_size > r->block_size) {
+		set_error("runtime %s.frame_size must be a multiple of %d in %u..block_size",
+		          name, TPACKET_ALIGNMENT, min_frame);
+		return -1;
+	}
+	if (!tx && r->retire_timeout_ms > 60000) {
+		set_error("runtime %s.retire_timeout_ms must be in range 0-60000", name);
+		return -1;
+	}
+	if (tx && (r->block_timeout_us == 0 || r->block_timeout_us > TX_RING_MAX_BLOCK_TIMEOUT_US)) {
+		set_error("runtime %s.block_timeout_us must be in range 1-%d", name,
+		          TX_RING_MAX_BLOCK_TIMEOUT_US);
+		return -1;
+	}
+	return 0;
+}
+
+/* runtime.sampling (when present) needs a mode and that mode's parameter in range */
+static int validate_sampling(const struct sampling_config *sc)
+{
+	switch (sc->mode) {
+	case SAMPLING_PACKET:
+		if (sc->rate == 0 || sc->rate > SAMPLING_MAX_RATE) {
+			set_error("runtime sampling.rate must be in range 1-%d for mode 'packet'",
+			          SAMPLING_MAX_RATE);
+			return -1;
+		}
+		return 0;
+	case SAMPLING_FLOW:
+		if (sc->flow_percent == 0 || sc->flow_percent > 100) {
+			set_error("runtime sampling.flow_percent must be in range 1-100 for mode 'flow'");
+			return -1;
+		}
+		return 0;
+	default:
+		set_error("runtime sampling.mode is required ('packet' or 'flow')");
+		return -1;
+	}
+}
+
 static enum runtime_mode parse_runtime_mode(const char *s)
 {
 	if (strcmp(s, "ebpf") == 0)
 		return RUNTIME_MODE_EBPF;
+	if (strcmp(s, "ebpf-redirect") == 0)
+		return RUNTIME_MODE_EBPF_REDIRECT;
 	if (strcmp(s, "afpacket") == 0)
 		return RUNTIME_MODE_AFPACKET;
+	if (strcmp(s, "afxdp") == 0)
+		return RUNTIME_MODE_AFXDP;
 	return RUNTIME_MODE_UNSET;
 }
 
@@ -130,20 +252,34 @@ static char *scalar_dup(yaml_event_t *event)
 struct parse_ctx {
 	struct tap_config *cfg;
 	unsigned int rule_idx;
+	unsigned int rule_cap;        /* Allocated entries in cfg->filter.rules */
 	int in_filter;
 	int in_rules;
 	int in_rule;
 	int in_match;
 	int in_runtime;
 	int in_runtime_truncate;
+	int in_runtime_afxdp;
+	struct ring_config *in_runtime_ring; /* runtime.rx_ring or runtime.tx_ring block */
+	int in_runtime_flow_cutoff;
+	int in_runtime_dedup;
+	int in_runtime_sampling;
+	int seen_runtime_sampling;    /* runtime.sampling block was present */
 	int in_tunnel;
+	int in_tunnel_remotes;
 	int depth;                    /* mapping/sequence nesting */
 	int next_mapping_is_runtime;  /* next MAPPING_START is runtime block */
 	int next_mapping_is_runtime_truncate; /* next MAPPING_START is runtime.truncate block */
+	int next_mapping_is_runtime_afxdp; /* next MAPPING_START is runtime.afxdp block */
+	struct ring_config *next_mapping_is_runtime_ring; /* next MAPPING_START is runtime.rx_ring/tx_ring */
+	int next_mapping_is_runtime_flow_cutoff; /* next MAPPING_START is runtime.flow_cutoff block */
+	int next_mapping_is_runtime_dedup; /* next MAPPING_START is runtime.dedup block */
+	int next_mapping_is_runtime_sampling; /* next MAPPING_START is runtime.sampling block */
 	int next_mapping_is_filter;   /* next MAPPING_START is filter block */
 	int next_sequence_is_rules;   /* next SEQUENCE_START is rules */
 	int next_mapping_is_match;    /* next MAPPING_START is match block */
 	int next_mapping_is_tunnel;   /* next MAPPING_START is tunnel block */
+	int next_sequence_is_tunnel_remotes; /* next SEQUENCE_START is tunnel.remotes */
 	int need_value;
 	char *last_key;
 };
@@ -189,12 +325,69 @@ static int parse_yaml_events(yaml_parser_t *parser, struct tap_config *cfg)
 				ctx.cfg->runtime.truncate.enabled = false;
 				ctx.cfg->runtime.truncate.length = 0;
 				ctx.cfg->runtime.truncate.length_set = false;
+				ctx.cfg->runtime.afxdp.zero_copy = false;
+				ctx.cfg->runtime.afxdp.xdp_mode = AFXDP_XDP_MODE_AUTO;
+				ctx.cfg->runtime.rx_ring = (struct ring_config){
+					.block_size = RX_RING_DEFAULT_BLOCK_SIZE,
+					.block_nr = RX_RING_DEFAULT_BLOCK_NR,
+					.frame_size = RX_RING_DEFAULT_FRAME_SIZE,
+					.retire_timeout_ms = RX_RING_DEFAULT_TIMEOUT_MS,
+				};
+				ctx.cfg->runtime.tx_ring = (struct ring_config){
+					.block_size = TX_RING_DEFAULT_BLOCK_SIZE,
+					.block_nr = TX_RING_DEFAULT_BLOCK_NR,
+					.frame_size = TX_RING_DEFAULT_FRAME_SIZE,
+					.full_policy = TX_FULL_DROP,
+					.block_timeout_us = TX_RING_DEFAULT_BLOCK_TIMEOUT_US,
+				};
+				ctx.cfg->runtime.ringbuf_size = RINGBUF_DEFAULT_SIZE;
+				ctx.cfg->runtime.flow_cutoff = (struct flow_cutoff_config){
+					.idle_timeout_ms = FLOW_CUTOFF_DEFAULT_IDLE_MS,
+				};
+				ctx.cfg->runtime.dedup = (struct dedup_config){
+					.window_us = DEDUP_DEFAULT_WINDOW_US,
+				};
+				ctx.cfg->runtime.sampling = (struct sampling_config){
+					.mode = SAMPLING_NONE,
+				};
 			} else if (ctx.next_mapping_is_runtime_truncate) {
 				ctx.in_runtime_truncate = 1;
 				ctx.next_mapping_is_runtime_truncate = 0;
 				ctx.need_value = 0;
 				free(ctx.last_key);
 				ctx.last_key = NULL;
+			} else if (ctx.next_mapping_is_runtime_afxdp) {
+				ctx.in_runtime_afxdp = 1;
+				ctx.next_mapping_is_runtime_afxdp = 0;
+				ctx.need_value = 0;
+				free(ctx.last_key);
+				ctx.last_key = NULL;
+			} else if (ctx.next_mapping_is_runtime_ring) {
+				ctx.in_runtime_ring = ctx.next_mapping_is_runtime_ring;
+				ctx.next_mapping_is_runtime_ring = NULL;
+				ctx.need_value = 0;
+				free(ctx.last_key);
+				ctx.last_key = NULL;
+			} else if (ctx.next_mapping_is_runtime_flow_cutoff) {
+				ctx.in_runtime_flow_cutoff = 1;
+				ctx.next_mapping_is_runtime_flow_cutoff = 0;
+				ctx.need_value = 0;
+				free(ctx.last_key);
+				ctx.last_key = NULL;
+				ctx.cfg->runtime.flow_cutoff.enabled = true;
+			} else if (ctx.next_mapping_is_runtime_dedup) {
+				ctx.in_runtime_dedup = 1;
+				ctx.next_mapping_is_runtime_dedup = 0;
+				ctx.need_value = 0;
+				free(ctx.last_key);
+				ctx.last_key = NULL;
+			} else if (ctx.next_mapping_is_runtime_sampling) {
+				ctx.in_runtime_sampling = 1;
+				ctx.seen_runtime_sampling = 1;
+				ctx.next_mapping_is_runtime_sampling = 0;
+				ctx.need_value = 0;
+				free(ctx.last_key);
+				ctx.last_key = NULL;
 			} else if (ctx.next_mapping_is_filter) {
 				ctx.in_filter = 1;
 				ctx.next_mapping_is_filter = 0;
@@ -209,8 +402,11 @@ static int parse_yaml_events(yaml_parser_t *parser, struct tap_config *cfg)
 				ctx.last_key = NULL;
 				ctx.cfg->tunnel.enabled = true;
 				ctx.cfg->tunnel.dstport = 4789;
+				ctx.cfg->tunnel.srcport_min = 49152;
+				ctx.cfg->tunnel.srcport_max = 65535;
 				ctx.cfg->tunnel.type = TUNNEL_TYPE_NONE;
 				ctx.cfg->tunnel.remote_ip[0] = '\0';
+				ctx.cfg->tunnel.num_remotes = 0;
 				ctx.cfg->tunnel.local_ip[0] = '\0';
 				ctx.cfg->tunnel.vni = 0;
 				ctx.cfg->tunnel.key = 0;
@@ -222,6 +418,26 @@ static int parse_yaml_events(yaml_parser_t *parser, struct tap_config *cfg)
 				ctx.last_key = NULL;
 				match_init(&ctx.cfg->filter.rules[ctx.rule_idx].match);
 			} else if (ctx.in_rules) {
+				if (ctx.rule_idx >= MAX_FILTER_RULES) {
+					set_error("Too many rules (max %u)", (unsigned)MAX_FILTER_RULES);
+					yaml_event_delete(&event);
+					return -1;
+				}
+				if (ctx.rule_idx == ctx.rule_cap) {
+					unsigned int cap = ctx.rule_cap ? ctx.rule_cap * 2 : 16;
+					struct filter_rule *r;
+					if (cap > MAX_FILTER_RULES)
+						cap = MAX_FILTER_RULES;
+					r = realloc(ctx.cfg->filter.rules, cap * sizeof(*r));
+					if (!r) {
+						set_error("Out of memory for filter rules");
+						yaml_event_delete(&event);
+						return -1;
+					}
+					ctx.cfg->filter.rules = r;
+					ctx.rule_cap = cap;
+				}
+				memset(&ctx.cfg->filter.rules[ctx.rule_idx], 0, sizeof(struct filter_rule));
 				ctx.in_rule = 1;
 				ctx.need_value = 0;
 				free(ctx.last_key);
@@ -236,6 +452,16 @@ static int parse_yaml_events(yaml_parser_t *parser, struct tap_config *cfg)
 				ctx.rule_idx++;
 			} else if (ctx.in_runtime_truncate)
 				ctx.in_runtime_truncate = 0;
+			else if (ctx.in_runtime_afxdp)
+				ctx.in_runtime_afxdp = 0;
+			else if (ctx.in_runtime_ring)
+				ctx.in_runtime_ring = NULL;
+			else if (ctx.in_runtime_flow_cutoff)
+				ctx.in_runtime_flow_cutoff = 0;
+			else if (ctx.in_runtime_dedup)
+				ctx.in_runtime_dedup = 0;
+			else if (ctx.in_runtime_sampling)
+				ctx.in_runtime_sampling = 0;
 			else if (ctx.in_tunnel)
 				ctx.in_tunnel = 0;
 			else if (ctx.in_runtime)
@@ -250,17 +476,40 @@ static int parse_yaml_events(yaml_parser_t *parser, struct tap_config *cfg)
 				ctx.need_value = 0;
 				free(ctx.last_key);
 				ctx.last_key = NULL;
+			} else if (ctx.next_sequence_is_tunnel_remotes) {
+				ctx.in_tunnel_remotes = 1;
+				ctx.next_sequence_is_tunnel_remotes = 0;
+				ctx.need_value = 0;
+				free(ctx.last_key);
+				ctx.last_key = NULL;
 			}
 			break;
 		case YAML_SEQUENCE_END_EVENT:
 			if (ctx.in_rules) {
 				ctx.cfg->filter.num_rules = ctx.rule_idx;
 				ctx.in_rules = 0;
-			}
+			} else if (ctx.in_tunnel_remotes)
+				ctx.in_tunnel_remotes = 0;
 			ctx.depth--;
 			break;
 		case YAML_SCALAR_EVENT:
-			if (ctx.need_value && ctx.last_key) {
+			if (ctx.in_tunnel_remotes) {
+				struct tunnel_config *tc = &ctx.cfg->tunnel;
+				const char *val = (const char *)event.data.scalar.value;
+				if (tc->num_remotes >= TUNNEL_MAX_REMOTES) {
+					set_error("Too many tunnel remotes (max %d)", TUNNEL_MAX_REMOTES);
+					yaml_event_delete(&event);
+					return -1;
+				}
+				if (event.data.scalar.length >= sizeof(tc->remotes[0])) {
+					set_error("tunnel remote too long");
+					yaml_event_delete(&event);
+					return -1;
+				}
+				memcpy(tc->remotes[tc->num_remotes], val, event.data.scalar.length);
+				tc->remotes[tc->num_remotes][event.data.scalar.length] = '\0';
+				tc->num_remotes++;
+			} else if (ctx.need_value && ctx.last_key) {
 				char *val = scalar_dup(&event);
 				if (!val) {
 					yaml_event_delete(&event);
@@ -286,6 +535,140 @@ static int parse_yaml_events(yaml_parser_t *parser, struct tap_config *cfg)
 						rc->truncate.length = (uint32_t)tlen;
 						rc->truncate.length_set = true;
 					}
+				} else if (ctx.in_runtime_afxdp && ctx.last_key) {
+					struct runtime_config *rc = &ctx.cfg->runtime;
+					if (strcmp(ctx.last_key, "zero_copy") == 0) {
+						if (parse_bool(val, &rc->afxdp.zero_copy) != 0) {
+							set_error("Invalid runtime afxdp.zero_copy: %s (must be true/false)", val);
+							free(val);
+							yaml_event_delete(&event);
+							return -1;
+						}
+					} else if (strcmp(ctx.last_key, "xdp_mode") == 0) {
+						if (strcmp(val, "auto") == 0)
+							rc->afxdp.xdp_mode = AFXDP_XDP_MODE_AUTO;
+						else if (strcmp(val, "native") == 0)
+							rc->afxdp.xdp_mode = AFXDP_XDP_MODE_NATIVE;
+						else if (strcmp(val, "generic") == 0)
+							rc->afxdp.xdp_mode = AFXDP_XDP_MODE_GENERIC;
+						else {
+							set_error("Invalid runtime afxdp.xdp_mode: %s (must be 'auto', 'native' or 'generic')", val);
+							free(val);
+							yaml_event_delete(&event);
+							return -1;
+						}
+					}
+				} else if (ctx.in_runtime_ring && ctx.last_key) {
+					struct ring_config *ring = ctx.in_runtime_ring;
+					const char *name = ring == &ctx.cfg->runtime.rx_ring ? "rx_ring" : "tx_ring";
+					uint32_t *field = NULL;
+
+					if (strcmp(ctx.last_key, "block_size") == 0)
+						field = &ring->block_size;
+					else if (strcmp(ctx.last_key, "block_nr") == 0)
+						field = &ring->block_nr;
+					else if (strcmp(ctx.last_key, "frame_size") == 0)
+						field = &ring->frame_size;
+					else if (strcmp(ctx.last_key, "retire_timeout_ms") == 0 && ring == &ctx.cfg->runtime.rx_ring)
+						field = &ring->retire_timeout_ms;
+					else if (strcmp(ctx.last_key, "block_timeout_us") == 0 && ring == &ctx.cfg->runtime.tx_ring)
+						field = &ring->block_timeout_us;
+					if (field) {
+						if (parse_u32(val, field) != 0) {
+							set_error("Invalid runtime %s.%s: %s (must be an unsigned integer)",
+							          name, ctx.last_key, val);
+							free(val);
+							yaml_event_delete(&event);
+							return -1;
+						}
+					} else if (strcmp(ctx.last_key, "hugepages") == 0 && ring == &ctx.cfg->runtime.rx_ring) {
+						if (parse_bool(val, &ring->hugepages) != 0) {
+							set_error("Invalid runtime %s.hugepages: %s (must be true/false)", name, val);
+							free(val);
+							yaml_event_delete(&event);
+							return -1;
+						}
+					} else if (strcmp(ctx.last_key, "gso") == 0 && ring == &ctx.cfg->runtime.tx_ring) {
+						if (parse_bool(val, &ring->gso) != 0) {
+							set_error("Invalid runtime %s.gso: %s (must be true/false)", name, val);
+							free(val);
+							yaml_event_delete(&event);
+							return -1;
+						}
+					} else if (strcmp(ctx.last_key, "full_policy") == 0 && ring == &ctx.cfg->runtime.tx_ring) {
+						if (strcmp(val, "drop") == 0) {
+							ring->full_policy = TX_FULL_DROP;
+						} else if (strcmp(val, "block") == 0) {
+							ring->full_policy = TX_FULL_BLOCK;
+						} else {
+							set_error("Invalid runtime %s.full_policy: %s (must be 'drop' or 'block')", name, val);
+							free(val);
+							yaml_event_delete(&event);
+							return -1;
+						}
+					}
+				} else if (ctx.in_runtime_flow_cutoff && ctx.last_key) {
+					struct flow_cutoff_config *fc = &ctx.cfg->runtime.flow_cutoff;
+					uint32_t *field = NULL;
+
+					if (strcmp(ctx.last_key, "bytes") == 0)
+						field = &fc->bytes;
+					else if (strcmp(ctx.last_key, "packets") == 0)
+						field = &fc->packets;
+					else if (strcmp(ctx.last_key, "idle_timeout_ms") == 0)
+						field = &fc->idle_timeout_ms;
+					if (field && parse_u32(val, field) != 0) {
+						set_error("Invalid runtime flow_cutoff.%s: %s (must be an unsigned integer)",
+						          ctx.last_key, val);
+						free(val);
+						yaml_event_delete(&event);
+						return -1;
+					}
+				} else if (ctx.in_runtime_dedup && ctx.last_key) {
+					struct dedup_config *dc = &ctx.cfg->runtime.dedup;
+					if (strcmp(ctx.last_key, "enabled") == 0) {
+						if (parse_bool(val, &dc->enabled) != 0) {
+							set_error("Invalid runtime dedup.enabled: %s (must be true/false)", val);
+							free(val);
+							yaml_event_delete(&event);
+							return -1;
+						}
+					} else if (strcmp(ctx.last_key, "window_us") == 0) {
+						if (parse_u32(val, &dc->window_us) != 0) {
+							set_error("Invalid runtime dedup.window_us: %s (must be an unsigned integer)", val);
+							free(val);
+							yaml_event_delete(&event);
+							return -1;
+						}
+					}
+				} else if (ctx.in_runtime_sampling && ctx.last_key) {
+					struct sampling_config *sc = &ctx.cfg->runtime.sampling;
+					if (strcmp(ctx.last_key, "mode") == 0) {
+						if (strcmp(val, "packet") == 0) {
+							sc->mode = SAMPLING_PACKET;
+						} else if (strcmp(val, "flow") == 0) {
+							sc->mode = SAMPLING_FLOW;
+						} else {
+							set_error("Invalid runtime sampling.mode: %s (must be 'packet' or 'flow')", val);
+							free(val);
+							yaml_event_delete(&event);
+							return -1;
+						}
+					} else if (strcmp(ctx.last_key, "rate") == 0) {
+						if (parse_u32(val, &sc->rate) != 0) {
+							set_error("Invalid runtime sampling.rate: %s (must be an unsigned integer)", val);
+							free(val);
+							yaml_event_delete(&event);
+							return -1;
+						}
+					} else if (strcmp(ctx.last_key, "flow_percent") == 0) {
+						if (parse_u32(val, &sc->flow_percent) != 0) {
+							set_error("Invalid runtime sampling.flow_percent: %s (must be an unsigned integer)", val);
+							free(val);
+							yaml_event_delete(&event);
+							return -1;
+						}
+					}
 				} else if (ctx.in_runtime && ctx.last_key) {
 					struct runtime_config *rc = &ctx.cfg->runtime;
 					if (strcmp(ctx.last_key, "input_iface") == 0) {
@@ -309,7 +692,7 @@ static int parse_yaml_events(yaml_parser_t *parser, struct tap_config *cfg)
 					} else if (strcmp(ctx.last_key, "mode") == 0) {
 						enum runtime_mode m = parse_runtime_mode(val);
 						if (m == RUNTIME_MODE_UNSET) {
-							set_error("Invalid runtime mode: %s (must be 'ebpf' or 'afpacket')", val);
+							set_error("Invalid runtime mode: %s (must be 'ebpf', 'ebpf-redirect', 'afpacket' or 'afxdp')", val);
 							free(val);
 							yaml_event_delete(&event);
 							return -1;
@@ -324,6 +707,13 @@ static int parse_yaml_events(yaml_parser_t *parser, struct tap_config *cfg)
 							return -1;
 						}
 						rc->workers = w;
+					} else if (strcmp(ctx.last_key, "ringbuf_size") == 0) {
+						if (parse_u32(val, &rc->ringbuf_size) != 0) {
+							set_error("Invalid runtime ringbuf_size: %s (must be an unsigned integer)", val);
+							free(val);
+							yaml_event_delete(&event);
+							return -1;
+						}
 					} else if (strcmp(ctx.last_key, "verbose") == 0) {
 						if (parse_bool(val, &rc->verbose) != 0) {
 							set_error("Invalid runtime verbose: %s (must be true/false)", val);
@@ -361,6 +751,16 @@ static int parse_yaml_events(yaml_parser_t *parser, struct tap_config *cfg)
 						}
 					} else if (strcmp(ctx.last_key, "truncate") == 0) {
 						/* runtime.truncate is a mapping, scalar value ignored if present */
+					} else if (strcmp(ctx.last_key, "afxdp") == 0) {
+						/* runtime.afxdp is a mapping, scalar value ignored if present */
+					} else if (strcmp(ctx.last_key, "rx_ring") == 0 || strcmp(ctx.last_key, "tx_ring") == 0) {
+						/* runtime.rx_ring / tx_ring are mappings, scalar value ignored if present */
+					} else if (strcmp(ctx.last_key, "flow_cutoff") == 0) {
+						/* runtime.flow_cutoff is a mapping, scalar value ignored if present */
+					} else if (strcmp(ctx.last_key, "dedup") == 0) {
+						/* runtime.dedup is a mapping, scalar value ignored if present */
+					} else if (strcmp(ctx.last_key, "sampling") == 0) {
+						/* runtime.sampling is a mapping, scalar value ignored if present */
 					}
 				} else if (ctx.in_filter && strcmp(ctx.last_key, "default_action") == 0) {
 					enum filter_action a = parse_action(val);
@@ -372,12 +772,6 @@ static int parse_yaml_events(yaml_parser_t *parser, struct tap_config *cfg)
 					}
 					ctx.cfg->filter.default_action = a;
 				} else if (ctx.in_rule && !ctx.in_match && strcmp(ctx.last_key, "action") == 0) {
-					if (ctx.rule_idx >= MAX_FILTER_RULES) {
-						set_error("Too many rules (max %u)", (unsigned)MAX_FILTER_RULES);
-						free(val);
-						yaml_event_delete(&event);
-						return -1;
-					}
 					enum filter_action a = parse_action(val);
 					if ((int)a < 0) {
 						set_error("Invalid action: %s (must be 'allow' or 'drop')", val);
@@ -418,19 +812,50 @@ static int parse_yaml_events(yaml_parser_t *parser, struct tap_config *cfg)
 						m->port_dst = (uint16_t)p;
 						m->has_port_dst = true;
 					} else if (strcmp(ctx.last_key, "ip_src") == 0) {
-						if (parse_cidr(val, &m->ip_src, &m->ip_src_mask) != 0) {
+						/* IPv4 or IPv6 by the address's form */
+						bool v6 = strchr(val, ':') != NULL;
+						if (v6 ? parse_cidr6(val, m->ip6_src, m->ip6_src_mask) != 0
+						       : parse_cidr(val, &m->ip_src, &m->ip_src_mask) != 0) {
 							free(val);
 							yaml_event_delete(&event);
 							return -1;
 						}
-						m->has_ip_src = true;
+						if (v6)
+							m->has_ip6_src = true;
+						else
+							m->has_ip_src = true;
 					} else if (strcmp(ctx.last_key, "ip_dst") == 0) {
-						if (parse_cidr(val, &m->ip_dst, &m->ip_dst_mask) != 0) {
+						bool v6 = strchr(val, ':') != NULL;
+						if (v6 ? parse_cidr6(val, m->ip6_dst, m->ip6_dst_mask) != 0
+						       : parse_cidr(val, &m->ip_dst, &m->ip_dst_mask) != 0) {
+							free(val);
+							yaml_event_delete(&event);
+							return -1;
+						}
+						if (v6)
+							m->has_ip6_dst = true;
+						else
+							m->has_ip_dst = true;
+					} else if (strcmp(ctx.last_key, "vlan") == 0) {
+						unsigned int vid;
+						if (sscanf(val, "%u", &vid) != 1 || vid > 4095) {
+							set_error("Invalid vlan: %s (must be 0-4095)", val);
+							free(val);
+							yaml_event_delete(&event);
+							return -1;
+						}
+						m->vlan = (uint16_t)vid;
+						m->has_vlan = true;
+					} else if (strcmp(ctx.last_key, "inner_vlan") == 0) {
+						unsigned int vid;
+						if (sscanf(val, "%u", &vid) != 1 || vid > 4095) {
+							set_error("Invalid inner_vlan: %s (must be 0-4095)", val);
 							free(val);
 							yaml_event_delete(&event);
 							return -1;
 						}
-						m->has_ip_dst = true;
+						m->inner_vlan = (uint16_t)vid;
+						m->has_inner_vlan = true;
 					} else if (strcmp(ctx.last_key, "eth_type") == 0) {
 						unsigned int et;
 						if (sscanf(val, "0x%x", &et) != 1 && sscanf(val, "%u", &et) != 1) {
@@ -482,6 +907,19 @@ static int parse_yaml_events(yaml_parser_t *parser, struct tap_config *cfg)
 							return -1;
 						}
 						tc->dstport = (uint16_t)p;
+					} else if (strcmp(ctx.last_key, "srcport_min") == 0 ||
+						   strcmp(ctx.last_key, "srcport_max") == 0) {
+						unsigned int p;
+						if (sscanf(val, "%u", &p) != 1 || p == 0 || p > 65535) {
+							set_error("Invalid tunnel %s: %s (must be 1-65535)", ctx.last_key, val);
+							free(val);
+							yaml_event_delete(&event);
+							return -1;
+						}
+						if (strcmp(ctx.last_key, "srcport_min") == 0)
+							tc->srcport_min = (uint16_t)p;
+						else
+							tc->srcport_max = (uint16_t)p;
 					} else if (strcmp(ctx.last_key, "local_ip") == 0) {
 						if (strlen(val) >= sizeof(tc->local_ip)) {
 							set_error("tunnel local_ip too long");
@@ -515,10 +953,24 @@ static int parse_yaml_events(yaml_parser_t *parser, struct tap_config *cfg)
 					ctx.next_mapping_is_filter = 1;
 				else if (ctx.depth == 1 && ctx.last_key && strcmp(ctx.last_key, "tunnel") == 0)
 					ctx.next_mapping_is_tunnel = 1;
+				else if (ctx.in_tunnel && ctx.depth == 2 && ctx.last_key && strcmp(ctx.last_key, "remotes") == 0)
+					ctx.next_sequence_is_tunnel_remotes = 1;
 				else if (ctx.in_filter && ctx.depth == 2 && ctx.last_key && strcmp(ctx.last_key, "rules") == 0)
 					ctx.next_sequence_is_rules = 1;
 				else if (ctx.in_runtime && ctx.depth == 2 && ctx.last_key && strcmp(ctx.last_key, "truncate") == 0)
 					ctx.next_mapping_is_runtime_truncate = 1;
+				else if (ctx.in_runtime && ctx.depth == 2 && ctx.last_key && strcmp(ctx.last_key, "afxdp") == 0)
+					ctx.next_mapping_is_runtime_afxdp = 1;
+				else if (ctx.in_runtime && ctx.depth == 2 && ctx.last_key && strcmp(ctx.last_key, "rx_ring") == 0)
+					ctx.next_mapping_is_runtime_ring = &ctx.cfg->runtime.rx_ring;
+				else if (ctx.in_runtime && ctx.depth == 2 && ctx.last_key && strcmp(ctx.last_key, "tx_ring") == 0)
+					ctx.next_mapping_is_runtime_ring = &ctx.cfg->runtime.tx_ring;
+				else if (ctx.in_runtime && ctx.depth == 2 && ctx.last_key && strcmp(ctx.last_key, "flow_cutoff") == 0)
+					ctx.next_mapping_is_runtime_flow_cutoff = 1;
+				else if (ctx.in_runtime && ctx.depth == 2 && ctx.last_key && strcmp(ctx.last_key, "dedup") == 0)
+					ctx.next_mapping_is_runtime_dedup = 1;
+				else if (ctx.in_runtime && ctx.depth == 2 && ctx.last_key && strcmp(ctx.last_key, "sampling") == 0)
+					ctx.next_mapping_is_runtime_sampling = 1;
 				else if (ctx.in_rule && ctx.last_key && strcmp(ctx.last_key, "match") == 0)
 					ctx.next_mapping_is_match = 1;
 			}
@@ -532,6 +984,8 @@ static int parse_yaml_events(yaml_parser_t *parser, struct tap_config *cfg)
 
 	if (ctx.last_key)
 		free(ctx.last_key);
+	if (ctx.seen_runtime_sampling && validate_sampling(&cfg->runtime.sampling) != 0)
+		return -1;
 	return 0;
 }
 
@@ -563,7 +1017,7 @@ struct tap_config *config_load(const char *path)
 
 	if (!yaml_parser_initialize(&parser)) {
 		set_error("YAML parser init failed");
-		free(cfg);
+		config_free(cfg);
 		fclose(f);
 		return NULL;
 	}
@@ -573,7 +1027,7 @@ struct tap_config *config_load(const char *path)
 	if (parse_yaml_events(&parser, cfg) != 0) {
 		yaml_parser_delete(&parser);
 		fclose(f);
-		free(cfg);
+		config_free(cfg);
 		return NULL;
 	}
 
@@ -582,21 +1036,21 @@ struct tap_config *config_load(const char *path)
 		set_error("runtime section is required");
 		yaml_parser_delete(&parser);
 		fclose(f);
-		free(cfg);
+		config_free(cfg);
 		return NULL;
 	}
 	if (cfg->runtime.input_iface[0] == '\0') {
 		set_error("runtime input_iface is required");
 		yaml_parser_delete(&parser);
 		fclose(f);
-		free(cfg);
+		config_free(cfg);
 		return NULL;
 	}
 	if (cfg->runtime.mode == RUNTIME_MODE_UNSET) {
-		set_error("runtime mode is required (must be 'ebpf' or 'afpacket')");
+		set_error("runtime mode is required (must be 'ebpf', 'ebpf-redirect', 'afpacket' or 'afxdp')");
 		yaml_parser_delete(&parser);
 		fclose(f);
-		free(cfg);
+		config_free(cfg);
 		return NULL;
 	}
 	if (cfg->runtime.truncate.enabled) {
@@ -604,17 +1058,63 @@ struct tap_config *config_load(const char *path)
 			set_error("runtime truncate.length is required when truncate.enabled is true");
 			yaml_parser_delete(&parser);
 			fclose(f);
-			free(cfg);
+			config_free(cfg);
 			return NULL;
 		}
 		if (cfg->runtime.truncate.length < 64u || cfg->runtime.truncate.length > 9000u) {
 			set_error("runtime truncate.length must be in range 64-9000 when enabled");
 			yaml_parser_delete(&parser);
 			fclose(f);
-			free(cfg);
+			config_free(cfg);
 			return NULL;
 		}
 	}
+	if (cfg->runtime.afxdp.zero_copy && cfg->runtime.afxdp.xdp_mode == AFXDP_XDP_MODE_GENERIC) {
+		set_error("runtime afxdp.zero_copy requires xdp_mode 'native' or 'auto'");
+		yaml_parser_delete(&parser);
+		fclose(f);
+		config_free(cfg);
+		return NULL;
+	}
+	if (cfg->runtime.flow_cutoff.enabled) {
+		if (cfg->runtime.flow_cutoff.bytes == 0 && cfg->runtime.flow_cutoff.packets == 0) {
+			set_error("runtime flow_cutoff needs bytes or packets (non-zero)");
+			yaml_parser_delete(&parser);
+			fclose(f);
+			config_free(cfg);
+			return NULL;
+		}
+		if (cfg->runtime.flow_cutoff.idle_timeout_ms > FLOW_CUTOFF_MAX_IDLE_MS) {
+			set_error("runtime flow_cutoff.idle_timeout_ms must be in range 0-%d",
+				  FLOW_CUTOFF_MAX_IDLE_MS);
+			yaml_parser_delete(&parser);
+			fclose(f);
+			config_free(cfg);
+			return NULL;
+		}
+	}
+	if (cfg->runtime.dedup.enabled &&
+	    (cfg->runtime.dedup.window_us == 0 || cfg->runtime.dedup.window_us > DEDUP_MAX_WINDOW_US)) {
+		set_error("runtime dedup.window_us must be in range 1-%d when enabled", DEDUP_MAX_WINDOW_US);
+		yaml_parser_delete(&parser);
+		fclose(f);
+		config_free(cfg);
+		return NULL;
+	}
+	if (cfg->runtime.ringbuf_size < RINGBUF_MIN_SIZE || cfg->runtime.ringbuf_size > RINGBUF_MAX_SIZE) {
+		set_error("runtime ringbuf_size must be in range %u-%u", RINGBUF_MIN_SIZE, RINGBUF_MAX_SIZE);
+		yaml_parser_delete(&parser);
+		fclose(f);
+		config_free(cfg);
+		return NULL;
+	}
+	if (validate_ring("rx_ring", &cfg->runtime.rx_ring, false) != 0 ||
+	    validate_ring("tx_ring", &cfg->runtime.tx_ring, true) != 0) {
+		yaml_parser_delete(&parser);
+		fclose(f);
+		config_free(cfg);
+		return NULL;
+	}
 
 	/* Validate tunnel section if present */
 	if (cfg->tunnel.enabled) {
@@ -622,21 +1122,63 @@ struct tap_config *config_load(const char *path)
 			set_error("tunnel section present but type not set (must be 'vxlan' or 'gre')");
 			yaml_parser_delete(&parser);
 			fclose(f);
-			free(cfg);
+			config_free(cfg);
+			return NULL;
+		}
+		if (cfg->tunnel.remote_ip[0] == '\0' && cfg->tunnel.num_remotes == 0) {
+			set_error("tunnel remote_ip (or remotes) is required");
+			yaml_parser_delete(&parser);
+			fclose(f);
+			config_free(cfg);
+			return NULL;
+		}
+		if (cfg->tunnel.remote_ip[0] != '\0' && cfg->tunnel.num_remotes > 0) {
+			set_error("tunnel remote_ip and remotes are mutually exclusive");
+			yaml_parser_delete(&parser);
+			fclose(f);
+			config_free(cfg);
 			return NULL;
 		}
-		if (cfg->tunnel.remote_ip[0] == '\0') {
-			set_error("tunnel remote_ip is required");
+		/* Normalize: remotes[] always lists the destinations, remote_ip is the first */
+		if (cfg->tunnel.num_remotes == 0) {
+			memcpy(cfg->tunnel.remotes[0], cfg->tunnel.remote_ip, sizeof(cfg->tunnel.remote_ip));
+			cfg->tunnel.num_remotes = 1;
+		} else {
+			memcpy(cfg->tunnel.remote_ip, cfg->tunnel.remotes[0], sizeof(cfg->tunnel.remote_ip));
+		}
+		if (cfg->tunnel.srcport_min > cfg->tunnel.srcport_max) {
+			set_error("tunnel srcport_min (%u) must not exceed srcport_max (%u)",
+				  (unsigned)cfg->tunnel.srcport_min, (unsigned)cfg->tunnel.srcport_max);
 			yaml_parser_delete(&parser);
 			fclose(f);
-			free(cfg);
+			config_free(cfg);
 			return NULL;
 		}
 		if (cfg->runtime.output_iface[0] == '\0') {
 			set_error("runtime output_iface is required when tunnel is enabled");
 			yaml_parser_delete(&parser);
 			fclose(f);
-			free(cfg);
+			config_free(cfg);
+			return NULL;
+		}
+	}
+
+	/* ebpf-redirect: the TC program clones (and encapsulates) straight to output_iface */
+	if (cfg->runtime.mode == RUNTIME_MODE_EBPF_REDIRECT) {
+		if (cfg->runtime.output_iface[0] == '\0') {
+			set_error("runtime output_iface is required in mode 'ebpf-redirect'");
+			yaml_parser_delete(&parser);
+			fclose(f);
+			config_free(cfg);
+			return NULL;
+		}
+		/* Encapsulated clones are told apart on the way out; plain ones would be mirrored again */
+		if (!cfg->tunnel.enabled &&
+		    strcmp(cfg->runtime.output_iface, cfg->runtime.input_iface) == 0) {
+			set_error("runtime output_iface must differ from input_iface in mode 'ebpf-redirect' without a tunnel");
+			yaml_parser_delete(&parser);
+			fclose(f);
+			config_free(cfg);
 			return NULL;
 		}
 	}
@@ -648,5 +1190,8 @@ struct tap_config *config_load(const char *path)
 
 void config_free(struct tap_config *cfg)
 {
+	if (!cfg)
+		return;
+	free(cfg->filter.rules);
 	free(cfg);
 }
@@ -10,7 +10,7 @@
 #include <stdbool.h>
 
 #ifndef MAX_FILTER_RULES
-#define MAX_FILTER_RULES 64
+#define MAX_FILTER_RULES 100000
 #endif
 
 /* Match criteria: only fields with "present" set are checked */
@@ -26,8 +26,22 @@ struct filter_match {
 	uint32_t ip_dst;         /* IPv4 canonical (same as packet) */
 	uint32_t ip_dst_mask;
 
+	bool has_ip6_src;
+	uint64_t ip6_src[2];     /* IPv6 host order, as pkt_desc: [0] = first 8 bytes */
+	uint64_t ip6_src_mask[2];
+
+	bool has_ip6_dst;
+	uint64_t ip6_dst[2];
+	uint64_t ip6_dst_mask[2];
+
 	bool has_protocol;
-	uint8_t protocol;        /* 1=ICMP, 6=TCP, 17=UDP */
+	uint8_t protocol;        /* 1=ICMP, 6=TCP, 17=UDP; IPv6: next header after extension headers */
+
+	bool has_vlan;
+	uint16_t vlan;           /* Outer (first) VLAN ID */
+
+	bool has_inner_vlan;
+	uint16_t inner_vlan;     /* Second VLAN ID (C-tag under QinQ) */
 
 	bool has_port_src;
 	uint16_t port_src;
@@ -48,7 +62,7 @@ struct filter_rule {
 
 struct filter_config {
 	enum filter_action default_action;  /* when no rule matches */
-	struct filter_rule rules[MAX_FILTER_RULES];
+	struct filter_rule *rules;          /* num_rules entries (heap, freed by config_free) */
 	unsigned int num_rules;
 };
 
@@ -59,12 +73,19 @@ enum tunnel_type {
 	TUNNEL_TYPE_GRE,
 };
 
+/* Max tunnel destinations (tunnel.remotes) */
+#define TUNNEL_MAX_REMOTES 16
+
 /* Tunnel config from YAML (optional). When present, tunnel is enabled. */
 struct tunnel_config {
 	enum tunnel_type type;           /* VXLAN or GRE */
-	char remote_ip[64];              /* Remote VTEP/ASN IP (required) */
+	char remote_ip[64];              /* Remote VTEP/ASN IP (this or remotes required; first remote after load) */
+	char remotes[TUNNEL_MAX_REMOTES][64]; /* Load-balanced destinations; remote_ip alone becomes remotes[0] */
+	unsigned int num_remotes;
 	uint32_t vni;                    /* VXLAN VNI (required for VXLAN) */
 	uint16_t dstport;                /* VXLAN UDP dst port (default 4789) */
+	uint16_t srcport_min;            /* VXLAN UDP src port range for flow entropy (default 49152) */
+	uint16_t srcport_max;            /* (default 65535) */
 	uint32_t key;                    /* GRE key (optional, 0 = not set) */
 	char local_ip[64];               /* Optional local/source IP; empty = derive from -o */
 	bool enabled;                    /* true if tunnel section was present and valid */
@@ -75,13 +96,117 @@ enum runtime_mode {
 	RUNTIME_MODE_UNSET = 0,
 	RUNTIME_MODE_EBPF,
 	RUNTIME_MODE_AFPACKET,
+	RUNTIME_MODE_AFXDP,
+	RUNTIME_MODE_EBPF_REDIRECT,      /* TC program mirrors with bpf_clone_redirect, no workers */
+};
+
+/* XDP attach mode for runtime.mode: afxdp */
+enum afxdp_xdp_mode {
+	AFXDP_XDP_MODE_AUTO = 0,         /* native (driver) if supported, else generic */
+	AFXDP_XDP_MODE_NATIVE,
+	AFXDP_XDP_MODE_GENERIC,          /* skb mode; works on any netdev (e.g. veth) */
+};
+
+/* Packet ring geometry defaults (runtime.rx_ring / runtime.tx_ring) */
+#define RX_RING_DEFAULT_BLOCK_SIZE  (1u << 18)  /* 256 KB per block */
+#define RX_RING_DEFAULT_BLOCK_NR    64          /* 64 blocks = 16 MB per worker */
+#define RX_RING_DEFAULT_FRAME_SIZE  (1u << 11)  /* 2048 bytes per frame */
+#define RX_RING_DEFAULT_TIMEOUT_MS  100         /* Block retire timeout */
+#define TX_RING_DEFAULT_BLOCK_SIZE  (1u << 18)  /* 256 KB per block */
+#define TX_RING_DEFAULT_BLOCK_NR    16          /* 16 blocks = 4 MB per ring */
+#define TX_RING_DEFAULT_FRAME_SIZE  (1u << 11)  /* 2048 bytes per frame */
+
+/* runtime.ringbuf_size: eBPF ring buffer bytes, all worker shards together */
+#define RINGBUF_DEFAULT_SIZE        (32u << 20) /* 8 MB a shard for 4 workers, 512 KB for 64 */
+#define RINGBUF_MIN_SIZE            (1u << 20)
+#define RINGBUF_MAX_SIZE            (1u << 30)
+
+/* Smallest TX frame: tpacket2_hdr (32 bytes aligned) + a 1518-byte Ethernet frame */
+#define TX_RING_MIN_FRAME_SIZE      1552
+
+/* tx_ring.block_timeout_us: default and cap (a worker blocked on TX is not reading RX) */
+#define TX_RING_DEFAULT_BLOCK_TIMEOUT_US  1000
+#define TX_RING_MAX_BLOCK_TIMEOUT_US      100000
+
+/* What a worker does with a packet when its TX ring has no free frame */
+enum tx_full_policy {
+	TX_FULL_DROP = 0,                /* Drop the new packet at once */
+	TX_FULL_BLOCK,                   /* Wait for a free frame up to block_timeout_us per batch, then drop */
+};
+
+/*
+ * One mmap'd packet ring: block_nr blocks of block_size bytes, each cut into
+ * block_size / frame_size frames. rx_ring sizes the AF_PACKET TPACKET_V3 RX
+ * ring, tx_ring every TPACKET_V2 TX ring (AF_PACKET, eBPF and AF_XDP output,
+ * tunnel senders). Both are per worker.
+ */
+struct ring_config {
+	uint32_t block_size;             /* Multiple of the page size */
+	uint32_t block_nr;
+	uint32_t frame_size;             /* Multiple of 16, <= block_size */
+	uint32_t retire_timeout_ms;      /* rx_ring: block retire timeout (0 = kernel picks) */
+	bool hugepages;                  /* rx_ring: back the AF_XDP UMEM with huge pages */
+	bool gso;                        /* tx_ring: kernel segments TCP packets above the MTU */
+	enum tx_full_policy full_policy; /* tx_ring: when no frame is free */
+	uint32_t block_timeout_us;       /* tx_ring: deadline for TX_FULL_BLOCK */
+};
+
+/* runtime.flow_cutoff.idle_timeout_ms default and cap */
+#define FLOW_CUTOFF_DEFAULT_IDLE_MS 30000
+#define FLOW_CUTOFF_MAX_IDLE_MS     3600000
+
+/*
+ * Per-flow cutoff (flow shunting): once a flow (5-tuple, per direction) has
+ * passed `packets` packets or `bytes` bytes, its later packets are dropped
+ * before truncation and TX. A flow idle for idle_timeout_ms starts over.
+ */
+struct flow_cutoff_config {
+	bool enabled;                    /* runtime.flow_cutoff present with a limit */
+	uint32_t bytes;                  /* 0 = no byte limit */
+	uint32_t packets;                /* 0 = no packet limit */
+	uint32_t idle_timeout_ms;        /* 0 = flows never expire (only evicted) */
+};
+
+/* runtime.dedup.window_us default and cap */
+#define DEDUP_DEFAULT_WINDOW_US 1000
+#define DEDUP_MAX_WINDOW_US     1000000
+
+/*
+ * Duplicate suppression: a packet whose IP ID, 5-tuple, IP length and first
+ * L4 bytes match one seen less than window_us earlier is not forwarded (the
+ * same frame captured on ingress and egress, or mirrored twice by a SPAN).
+ */
+struct dedup_config {
+	bool enabled;                    /* optional, default false */
+	uint32_t window_us;              /* 1..DEDUP_MAX_WINDOW_US */
+};
+
+/* runtime.sampling.rate cap (packet mode keeps 1 in rate) */
+#define SAMPLING_MAX_RATE 1000000
+
+enum sampling_mode {
+	SAMPLING_NONE = 0,               /* runtime.sampling absent: forward every packet */
+	SAMPLING_PACKET,                 /* Keep 1 packet in every `rate` */
+	SAMPLING_FLOW,                   /* Keep every packet of flow_percent % of flows */
+};
+
+/*
+ * Deterministic sampling ahead of the filter. Packet mode keeps the 1st,
+ * (rate+1)th, ... packet each worker (or CPU, in the TC program) sees. Flow
+ * mode keeps a flow whole or not at all, chosen by a hash of its addresses
+ * and ports that is the same in both directions.
+ */
+struct sampling_config {
+	enum sampling_mode mode;
+	uint32_t rate;                   /* packet: 1..SAMPLING_MAX_RATE */
+	uint32_t flow_percent;           /* flow: 1..100 */
 };
 
 struct runtime_config {
 	bool configured;                 /* true if runtime section was present */
 	char input_iface[64];            /* required */
 	char output_iface[64];           /* optional unless tunnel enabled */
-	enum runtime_mode mode;          /* required: ebpf or afpacket */
+	enum runtime_mode mode;          /* required: ebpf, ebpf-redirect, afpacket or afxdp */
 	int workers;                     /* optional, 0 = auto */
 	bool verbose;                    /* optional */
 	bool debug;                      /* optional */
@@ -93,6 +218,16 @@ struct runtime_config {
 		uint32_t length;           /* required when enabled: 64..9000 */
 		bool length_set;           /* parser helper for validation */
 	} truncate;
+	struct {
+		bool zero_copy;            /* optional, default false (XDP_COPY) */
+		enum afxdp_xdp_mode xdp_mode; /* optional, default auto */
+	} afxdp;
+	struct ring_config rx_ring;      /* optional, RX_RING_DEFAULT_* */
+	struct ring_config tx_ring;      /* optional, TX_RING_DEFAULT_* */
+	uint32_t ringbuf_size;           /* optional, RINGBUF_DEFAULT_SIZE (mode: ebpf) */
+	struct flow_cutoff_config flow_cutoff; /* optional, disabled by default */
+	struct dedup_config dedup;       /* optional, disabled by default */
+	struct sampling_config sampling; /* optional, SAMPLING_NONE by default */
 };
 
 /* Top-level config: filter and optional tunnel */
@@ -0,0 +1,46 @@
+/*
+ * vasn_tap - Single-writer statistics counters
+ * Each counter is written by one thread only (its worker), so an update is a
+ * plain load/add/store with no locked instruction; other threads read it with
+ * a relaxed load. Relaxed atomics keep both sides free of torn values.
+ */
+
+#ifndef __COUNTER_H__
+#define __COUNTER_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Keep one writer's counters off the cache lines of the others */
+#define COUNTER_CACHE_LINE 64
+
+/* Owner thread only */
+static inline void counter_add(uint64_t *c, uint64_t n)
+{
+    __atomic_store_n(c, *c + n, __ATOMIC_RELAXED);
+}
+
+static inline void counter_set(uint64_t *c, uint64_t v)
+{
+    __atomic_store_n(c, v, __ATOMIC_RELAXED);
+}
+
+/* Any thread */
+static inline uint64_t counter_read(const uint64_t *c)
+{
+    return __atomic_load_n(c, __ATOMIC_RELAXED);
+}
+
+/* Zeroed array of n cache-line-aligned elements (counters embedded in each); free() it */
+static inline void *counter_calloc(size_t n, size_t size)
+{
+    size_t bytes = (n * size + COUNTER_CACHE_LINE - 1) & ~(size_t)(COUNTER_CACHE_LINE - 1);
+    void *p = aligned_alloc(COUNTER_CACHE_LINE, bytes ? bytes : COUNTER_CACHE_LINE);
+
+    if (p)
+        memset(p, 0, bytes);
+    return p;
+}
+
+#endif /* __COUNTER_H__ */
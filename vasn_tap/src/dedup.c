@@ -0,0 +1,105 @@
+/*
+ * vasn_tap - Duplicate suppression (runtime.dedup)
+ * Direct-mapped table of recent packet signatures. A collision only replaces
+ * the older signature (a duplicate may then pass); a false match needs two
+ * different packets with the same 64-bit signature inside the window.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dedup.h"
+
+#define DEDUP_SEED 0x736964656475706bull
+
+struct dedup_table *dedup_table_create(const struct dedup_config *cfg)
+{
+    struct dedup_table *dt;
+
+    if (!cfg)
+        return NULL;
+    dt = calloc(1, sizeof(*dt));
+    if (!dt)
+        return NULL;
+    dt->slots = aligned_alloc(64, DEDUP_TABLE_SIZE * sizeof(struct dedup_entry));
+    if (!dt->slots) {
+        free(dt);
+        return NULL;
+    }
+    memset(dt->slots, 0, DEDUP_TABLE_SIZE * sizeof(struct dedup_entry));
+    dt->mask = DEDUP_TABLE_SIZE - 1;
+    dt->window_ns = (uint64_t)cfg->window_us * 1000ull;
+    return dt;
+}
+
+void dedup_table_destroy(struct dedup_table *dt)
+{
+    if (!dt)
+        return;
+    free(dt->slots);
+    free(dt);
+}
+
+/* Same mix as dedup_mix() in tc_clone.bpf.c */
+static inline uint64_t dedup_mix(uint64_t h, uint64_t w)
+{
+    h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 32);
+}
+
+static inline uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+uint64_t dedup_signature(const uint8_t *pkt, const struct pkt_desc *pd)
+{
+    const uint8_t *ip = pkt + pd->l3_off;
+    uint64_t h, w;
+    uint32_t l3_len, end, off, i;
+
+    if (!(pd->flags & (PKT_F_IPV4 | PKT_F_IPV6)) || pd->l4_off == 0)
+        return 0;
+
+    if (pd->flags & PKT_F_IPV4) {
+        l3_len = get_u16(ip + 2);
+        h = dedup_mix(DEDUP_SEED, ((uint64_t)get_u16(ip + 4) << 48) |
+                      ((uint64_t)get_u16(ip + 6) << 32) | (l3_len << 16) |
+                      ((uint32_t)pd->protocol << 8) | 4);
+        h = dedup_mix(h, ((uint64_t)pd->ip_src << 32) | pd->ip_dst);
+    } else {
+        l3_len = 40u + get_u16(ip + 4);
+        h = dedup_mix(DEDUP_SEED, (l3_len << 16) | ((uint32_t)pd->protocol << 8) | 6);
+        h = dedup_mix(h, pd->ip6_src[0]);
+        h = dedup_mix(h, pd->ip6_src[1]);
+        h = dedup_mix(h, pd->ip6_dst[0]);
+        h = dedup_mix(h, pd->ip6_dst[1]);
+    }
+
+    /* Ethernet padding of short frames is not part of the packet */
+    end = pd->l3_off + l3_len;
+    if (end > pd->len)
+        end = pd->len;
+    off = pd->l4_off;
+    for (i = 0; i < DEDUP_L4_WORDS && off + 8 <= end; i++, off += 8) {
+        memcpy(&w, pkt + off, sizeof(w));
+        h = dedup_mix(h, w);
+    }
+    return h ? h : 1;
+}
+
+bool dedup_seen(struct dedup_table *dt, const uint8_t *pkt, const struct pkt_desc *pd,
+                uint64_t now_ns)
+{
+    uint64_t sig = dedup_signature(pkt, pd);
+    struct dedup_entry *e;
+
+    if (sig == 0)
+        return false;
+    e = &dt->slots[(uint32_t)(sig ^ (sig >> 32)) & dt->mask];
+    if (e->sig == sig && now_ns - e->seen_ns <= dt->window_ns)
+        return true;
+    e->sig = sig;
+    e->seen_ns = now_ns;
+    return false;
+}
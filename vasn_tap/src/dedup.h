@@ -0,0 +1,69 @@
+/*
+ * vasn_tap - Duplicate suppression (runtime.dedup)
+ * One table per worker, owned by that worker: no lock and no atomics. Both
+ * copies of a duplicated frame carry the same 5-tuple, so fanout by flow hash
+ * (PACKET_FANOUT_HASH, RSS queues) hands them to the same worker.
+ */
+
+#ifndef __DEDUP_H__
+#define __DEDUP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "config.h"
+#include "parse.h"
+
+/* Slots per table (power of two) and the L4 bytes hashed, in 8-byte words */
+#define DEDUP_TABLE_SIZE  8192
+#define DEDUP_L4_WORDS    8
+
+/* Signature of the last packet that hashed to this slot; sig == 0 marks a slot never used */
+struct dedup_entry {
+    uint64_t sig;
+    uint64_t seen_ns;
+};
+
+struct dedup_table {
+    struct dedup_entry *slots;
+    uint32_t mask;
+    uint64_t window_ns;
+};
+
+/* Monotonic clock for backends without a per-packet timestamp: read once per batch */
+static inline uint64_t dedup_clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Allocate a table for the given window (enabled)
+ * @return: table, or NULL on allocation failure
+ */
+struct dedup_table *dedup_table_create(const struct dedup_config *cfg);
+
+/* Free a table from dedup_table_create(); NULL is ignored */
+void dedup_table_destroy(struct dedup_table *dt);
+
+/*
+ * Signature of an IPv4/IPv6 packet: IP ID and fragment word (IPv4), IP length,
+ * protocol, addresses, and the first DEDUP_L4_WORDS 8-byte words from l4_off
+ * (ports, TCP sequence numbers, payload) inside the IP length. TTL, MACs and
+ * VLAN tags are left out, so a routed or re-tagged copy still matches.
+ * @return: non-zero signature, or 0 if the frame has no IP header
+ */
+uint64_t dedup_signature(const uint8_t *pkt, const struct pkt_desc *pd);
+
+/*
+ * True if a packet with the same signature was recorded less than the window
+ * before now_ns: the caller drops this copy. Otherwise the packet is recorded
+ * (replacing whatever shared its slot) and false is returned. Owner thread only.
+ */
+bool dedup_seen(struct dedup_table *dt, const uint8_t *pkt, const struct pkt_desc *pd,
+                uint64_t now_ns);
+
+#endif /* __DEDUP_H__ */
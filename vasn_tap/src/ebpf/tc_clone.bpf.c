@@ -1,6 +1,8 @@
 /*
  * vasn_tap - TC Clone eBPF Program
- * Clones packets at TC ingress/egress and sends to userspace via perf buffer
+ * Clones packets at TC ingress/egress, evaluates the ACL in the kernel and
+ * sends allowed packets to userspace via sharded ring buffers, or (ebpf-redirect)
+ * clones them straight to the output device with bpf_clone_redirect
  */
 
 #include "vmlinux.h"
@@ -10,57 +12,1064 @@
 #include "tc_clone.h"
 
 /* TC action return values */
-#define TC_ACT_OK 0
+#define TC_ACT_OK   0
+#define TC_ACT_SHOT 2
+
+/* L2/L3/L4 constants (same parse rules and bounds as parse.c) */
+#define ETH_HLEN           14
+#define VLAN_HLEN          4
+#define MPLS_HLEN          4
+#define IPV6_HLEN          40
+#define ETHERTYPE_IP       0x0800
+#define ETHERTYPE_IPV6     0x86DD
+#define ETHERTYPE_VLAN     0x8100
+#define ETHERTYPE_QINQ     0x88A8
+#define ETHERTYPE_QINQ_OLD 0x9100
+#define ETHERTYPE_MPLS     0x8847
+#define ETHERTYPE_MPLS_MC  0x8848
+#define IPPROTO_TCP        6
+#define IPPROTO_UDP        17
+#define IP6_NH_HOPOPTS     0
+#define IP6_NH_ROUTING     43
+#define IP6_NH_FRAGMENT    44
+#define IP6_NH_AH          51
+#define IP6_NH_DSTOPTS     60
+#define PKT_MAX_VLANS      4
+#define PKT_MAX_MPLS       8
+#define PKT_MAX_IP6_EXT    8
 
 /* Packet metadata structure - must match userspace definition */
 struct pkt_meta {
     __u32 len;
+    __u32 caplen;
     __u32 ifindex;
     __u8  direction;
-    __u8  pad[3];
+    __u8  vlan_present;
+    __u16 vlan_tci;
+    __u32 hash;
     __u64 timestamp;
 } __attribute__((packed));
 
-/* Per-CPU perf event array for sending packets to userspace */
+/* One ring buffer record: metadata followed by packet bytes */
+struct pkt_sample {
+    struct pkt_meta meta;
+    __u8 data[MAX_CAPTURE_LEN];
+};
+
+/* Inner map template for the ring buffer shards (created by userspace) */
+struct ringbuf_shard {
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, RINGBUF_SHARD_SIZE);
+};
+
+/* Ring buffer shards, one per userspace consumer thread */
 struct {
-    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
-    __uint(key_size, sizeof(__u32));
-    __uint(value_size, sizeof(__u32));
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __uint(max_entries, RINGBUF_MAX_SHARDS);
+    __type(key, __u32);
+    __array(values, struct ringbuf_shard);
 } events SEC(".maps");
 
-/* Clone packet and send to userspace via perf buffer */
-static __always_inline int clone_and_send(struct __sk_buff *skb, __u8 direction)
+/* Runtime configuration (shard count, redirect target), written by userspace */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct tc_clone_cfg);
+} config SEC(".maps");
+
+/*
+ * Per-CPU staging buffer for building a sample before bpf_ringbuf_output.
+ * A sample is too large for the BPF stack and for a PERCPU_ARRAY value (32 KB
+ * limit), so this is a plain array keyed by CPU id. max_entries is resized to
+ * the number of possible CPUs by userspace before load.
+ */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 128);
+    __type(key, __u32);
+    __type(value, struct pkt_sample);
+} scratch SEC(".maps");
+
+/* Per-CPU drop counters (see enum tc_clone_counter) */
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, TC_CNT_MAX);
+    __type(key, __u32);
+    __type(value, __u64);
+} counters SEC(".maps");
+
+/* Inner map template for the ACL bank (created by userspace, one per load) */
+struct filter_bank_map {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct tc_filter_bank);
+};
+
+/* In-kernel ACL: the loaded bank (no entry = no ACL, pass everything) */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __array(values, struct filter_bank_map);
+} filter_bank SEC(".maps");
+
+/* Per-CPU rule hit counters per row: [0..num_rules-1] = rules, [num_rules] = default */
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, TC_FILTER_BANKS * TC_FILTER_HITS);
+    __type(key, __u32);
+    __type(value, __u64);
+} filter_hits SEC(".maps");
+
+/*
+ * ebpf-redirect: set on this CPU while bpf_clone_redirect() transmits a clone.
+ * The output device's egress hook runs inside that call, so it tells the clone
+ * (truncate / encapsulate) from the device's own traffic (pass).
+ */
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, __u32);
+} mirror_pending SEC(".maps");
+
+/* ebpf-redirect tunnel: outer headers per remote */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, TC_TUNNEL_MAX_REMOTES);
+    __type(key, __u32);
+    __type(value, struct tc_tunnel_remote);
+} tunnel_remotes SEC(".maps");
+
+/* ebpf-redirect tunnel: flow hash slot -> remote index (TC_TUNNEL_NO_REMOTE = none up) */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, TC_TUNNEL_LB_SIZE);
+    __type(key, __u32);
+    __type(value, __u32);
+} tunnel_lb SEC(".maps");
+
+/* ebpf-redirect tunnel: per-CPU counters per remote */
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, TC_TUNNEL_MAX_REMOTES);
+    __type(key, __u32);
+    __type(value, struct tc_tunnel_stats);
+} tunnel_stats SEC(".maps");
+
+/* Per-flow cutoff policy (key 0) and the flows it is applied to */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct tc_flow_cutoff);
+} flow_cutoff SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, TC_FLOW_TABLE_SIZE);
+    __type(key, struct tc_flow_key);
+    __type(value, struct tc_flow);
+} flow_table SEC(".maps");
+
+/* Duplicate suppression: window in ns (key 0), and the recent signatures */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, __u64);
+} dedup SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, TC_DEDUP_TABLE_SIZE);
+    __type(key, __u32);
+    __type(value, struct tc_dedup_slot);
+} dedup_table SEC(".maps");
+
+/* Sampling mode (key 0), and the per-CPU count of packets still to skip */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct tc_sampling);
+} sampling SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, __u32);
+} sample_countdown SEC(".maps");
+
+/* Header fields the ACL can match on */
+struct pkt_hdrs {
+    __u64 ip6_src[2];     /* host order halves, as pkt_desc */
+    __u64 ip6_dst[2];
+    __u32 ip_src;         /* canonical host order */
+    __u32 ip_dst;
+    __u16 eth_type;
+    __u16 port_src;
+    __u16 port_dst;
+    __u16 vlan_outer;
+    __u16 vlan_inner;
+    __u16 l3_off;         /* IPv4 / IPv6 header (dedup) */
+    __u16 l3_len;         /* IP total length from the header */
+    __u16 l4_off;         /* After the IP and extension headers (0: none) */
+    __u32 ip_id_frag;     /* IPv4 ID, flags and fragment offset */
+    __u8  vlan_count;
+    __u8  protocol;
+    __u8  has_ip;
+    __u8  has_ip6;
+    __u8  has_ports;
+    __u8  parsed;         /* parse_headers() has run */
+};
+
+static __always_inline void count_add(__u32 idx, __u64 n)
+{
+    __u64 *val = bpf_map_lookup_elem(&counters, &idx);
+
+    if (val)
+        *val += n;
+}
+
+static __always_inline void count(__u32 idx)
+{
+    count_add(idx, 1);
+}
+
+static __always_inline __u16 load_u16(const __u8 *p)
+{
+    return (__u16)((p[0] << 8) | p[1]);
+}
+
+static __always_inline __u32 load_u32(const __u8 *p)
 {
-    struct pkt_meta meta = {};
+    return ((__u32)p[0] << 24) | ((__u32)p[1] << 16) | ((__u32)p[2] << 8) | (__u32)p[3];
+}
+
+static __always_inline __u64 load_u64(const __u8 *p)
+{
+    return ((__u64)load_u32(p) << 32) | load_u32(p + 4);
+}
+
+static __always_inline int is_vlan_tpid(__u16 t)
+{
+    return t == ETHERTYPE_VLAN || t == ETHERTYPE_QINQ || t == ETHERTYPE_QINQ_OLD;
+}
+
+static __always_inline int is_ip6_ext(__u8 nh)
+{
+    return nh == IP6_NH_HOPOPTS || nh == IP6_NH_ROUTING || nh == IP6_NH_FRAGMENT ||
+           nh == IP6_NH_AH || nh == IP6_NH_DSTOPTS;
+}
+
+static __always_inline void parse_ports(struct __sk_buff *skb, __u32 len, __u32 l4_off,
+                                        struct pkt_hdrs *h)
+{
+    __u8 l4[4];
+
+    if ((h->protocol == IPPROTO_TCP || h->protocol == IPPROTO_UDP) &&
+        len >= l4_off + 4) {
+        if (bpf_skb_load_bytes(skb, l4_off, l4, sizeof(l4)) < 0)
+            return;
+        h->port_src = load_u16(&l4[0]);
+        h->port_dst = load_u16(&l4[2]);
+        h->has_ports = 1;
+    }
+}
+
+static __always_inline void parse_ipv4(struct __sk_buff *skb, __u32 len, __u32 ip_off,
+                                       struct pkt_hdrs *h)
+{
+    __u8 iph[20];
+    __u32 ihl;
+
+    if (len < ip_off + 20)
+        return;
+    if (bpf_skb_load_bytes(skb, ip_off, iph, sizeof(iph)) < 0)
+        return;
+    ihl = (iph[0] & 0x0f) * 4;
+    if (ihl < 20 || len < ip_off + ihl)
+        return;
+
+    h->protocol = iph[9];
+    h->ip_src = load_u32(&iph[12]);
+    h->ip_dst = load_u32(&iph[16]);
+    h->l3_off = ip_off;
+    h->l3_len = load_u16(&iph[2]);
+    h->l4_off = ip_off + ihl;
+    h->ip_id_frag = load_u32(&iph[4]);
+    h->has_ip = 1;
+    parse_ports(skb, len, ip_off + ihl, h);
+}
+
+/* IPv6 and up to PKT_MAX_IP6_EXT extension headers, as parse_ipv6() in parse.c */
+static __always_inline void parse_ipv6(struct __sk_buff *skb, __u32 len, __u32 ip_off,
+                                       struct pkt_hdrs *h)
+{
+    __u8 ip6[IPV6_HLEN];
+    __u8 x[4];
+    __u32 l4 = ip_off + IPV6_HLEN;
+    __u32 i;
+    __u8 nh;
+
+    if (len < ip_off + IPV6_HLEN)
+        return;
+    if (bpf_skb_load_bytes(skb, ip_off, ip6, sizeof(ip6)) < 0)
+        return;
+
+    h->ip6_src[0] = load_u64(&ip6[8]);
+    h->ip6_src[1] = load_u64(&ip6[16]);
+    h->ip6_dst[0] = load_u64(&ip6[24]);
+    h->ip6_dst[1] = load_u64(&ip6[32]);
+    h->l3_off = ip_off;
+    h->l3_len = IPV6_HLEN + load_u16(&ip6[4]);
+    h->has_ip6 = 1;
+
+    nh = ip6[6];
+    for (i = 0; i < PKT_MAX_IP6_EXT; i++) {
+        if (!is_ip6_ext(nh))
+            break;
+        if (len < l4 + 8)
+            return;
+        if (bpf_skb_load_bytes(skb, l4, x, sizeof(x)) < 0)
+            return;
+        if (nh == IP6_NH_FRAGMENT) {
+            nh = x[0];
+            l4 += 8;
+            if (load_u16(&x[2]) & 0xfff8) {
+                h->protocol = nh;   /* Non-first fragment: no ports */
+                h->l4_off = l4;
+                return;
+            }
+            continue;
+        }
+        l4 += nh == IP6_NH_AH ? (x[1] + 2) * 4 : (x[1] + 1) * 8;
+        nh = x[0];
+    }
+    if (is_ip6_ext(nh) || l4 > len)
+        return;
+    h->protocol = nh;
+    h->l4_off = l4;
+    parse_ports(skb, len, l4, h);
+}
+
+/*
+ * Extract ACL fields from the skb. Mirrors pkt_parse(): Ethernet, up to
+ * PKT_MAX_VLANS 802.1Q/802.1ad tags, an MPLS label stack, IPv4 (plus the
+ * IPv4-at-18 fallback) or IPv6 with extension headers, TCP/UDP ports. An
+ * outer tag the stack already stripped (skb->vlan_present) is the first tag,
+ * as pkt_parse_vlan().
+ */
+static __always_inline void parse_headers(struct __sk_buff *skb, struct pkt_hdrs *h)
+{
+    __u8 eth[ETH_HLEN];
+    __u8 tag[4];
     __u32 len = skb->len;
+    __u32 off = ETH_HLEN;
+    __u32 ver = 4;
+    __u32 i, ihl;
+    __u8 b;
+
+    h->parsed = 1;
+    if (skb->vlan_present) {
+        h->vlan_outer = skb->vlan_tci & 0x0fff;
+        h->vlan_count = 1;
+    }
+    if (bpf_skb_load_bytes(skb, 0, eth, ETH_HLEN) < 0)
+        return;
+    h->eth_type = load_u16(&eth[12]);
+
+    if (h->eth_type != ETHERTYPE_IP) {
+        ver = 0;
+        for (i = 0; i < PKT_MAX_VLANS; i++) {
+            if (!is_vlan_tpid(h->eth_type) || h->vlan_count >= PKT_MAX_VLANS ||
+                len < off + VLAN_HLEN)
+                break;
+            if (bpf_skb_load_bytes(skb, off, tag, sizeof(tag)) < 0)
+                return;
+            if (h->vlan_count == 0)
+                h->vlan_outer = load_u16(&tag[0]) & 0x0fff;
+            else if (h->vlan_count == 1)
+                h->vlan_inner = load_u16(&tag[0]) & 0x0fff;
+            h->vlan_count++;
+            h->eth_type = load_u16(&tag[2]);
+            off += VLAN_HLEN;
+        }
+
+        if (h->eth_type == ETHERTYPE_IP) {
+            ver = 4;
+        } else if (h->eth_type == ETHERTYPE_IPV6) {
+            ver = 6;
+        } else if (h->eth_type == ETHERTYPE_MPLS || h->eth_type == ETHERTYPE_MPLS_MC) {
+            for (i = 0; i < PKT_MAX_MPLS; i++) {
+                if (len < off + MPLS_HLEN)
+                    break;
+                if (bpf_skb_load_bytes(skb, off, tag, sizeof(tag)) < 0)
+                    return;
+                off += MPLS_HLEN;
+                if (!(tag[2] & 0x01))
+                    continue;
+                if (len > off && bpf_skb_load_bytes(skb, off, &b, 1) == 0 &&
+                    ((b >> 4) == 4 || (b >> 4) == 6))
+                    ver = b >> 4;
+                break;
+            }
+        }
+
+        /* Fallback: IPv4 at offset 18 when nothing above found L3 */
+        if (ver == 0 && len >= 18 + 20 && bpf_skb_load_bytes(skb, 18, &b, 1) == 0 &&
+            (b & 0xf0) == 0x40) {
+            ihl = (b & 0x0f) * 4;
+            if (ihl >= 20 && 18 + ihl <= len) {
+                off = 18;
+                h->eth_type = ETHERTYPE_IP;
+                ver = 4;
+            }
+        }
+    }
+
+    if (ver == 4)
+        parse_ipv4(skb, len, off, h);
+    else if (ver == 6)
+        parse_ipv6(skb, len, off, h);
+}
+
+static __always_inline int rule_match(const struct tc_filter_rule *r,
+                                      const struct pkt_hdrs *h)
+{
+    if ((r->fields & TC_F_ETH_TYPE) && r->eth_type != h->eth_type)
+        return 0;
+    if ((r->fields & TC_F_IP_SRC) &&
+        (!h->has_ip || (h->ip_src & r->ip_src_mask) != r->ip_src))
+        return 0;
+    if ((r->fields & TC_F_IP_DST) &&
+        (!h->has_ip || (h->ip_dst & r->ip_dst_mask) != r->ip_dst))
+        return 0;
+    if ((r->fields & TC_F_IP6_SRC) &&
+        (!h->has_ip6 || (h->ip6_src[0] & r->ip6_src_mask[0]) != r->ip6_src[0] ||
+         (h->ip6_src[1] & r->ip6_src_mask[1]) != r->ip6_src[1]))
+        return 0;
+    if ((r->fields & TC_F_IP6_DST) &&
+        (!h->has_ip6 || (h->ip6_dst[0] & r->ip6_dst_mask[0]) != r->ip6_dst[0] ||
+         (h->ip6_dst[1] & r->ip6_dst_mask[1]) != r->ip6_dst[1]))
+        return 0;
+    if ((r->fields & TC_F_PROTOCOL) && r->protocol != h->protocol)
+        return 0;
+    if ((r->fields & TC_F_VLAN) &&
+        (h->vlan_count < 1 || r->vlan != h->vlan_outer))
+        return 0;
+    if ((r->fields & TC_F_INNER_VLAN) &&
+        (h->vlan_count < 2 || r->inner_vlan != h->vlan_inner))
+        return 0;
+    if ((r->fields & TC_F_PORT_SRC) &&
+        (!h->has_ports || r->port_src != h->port_src))
+        return 0;
+    if ((r->fields & TC_F_PORT_DST) &&
+        (!h->has_ports || r->port_dst != h->port_dst))
+        return 0;
+    return 1;
+}
+
+static __always_inline void filter_hit(__u32 idx)
+{
+    __u64 *val = bpf_map_lookup_elem(&filter_hits, &idx);
+
+    if (val)
+        *val += 1;
+}
+
+/*
+ * Evaluate the in-kernel ACL of the loaded bank. Returns TC_FILTER_ALLOW when
+ * there is none. The bank is looked up once and never changes after it is
+ * published, so a reload never mixes two rule sets. Headers are parsed into
+ * *h unless an earlier stage already did.
+ */
+static __always_inline int filter_skb(struct __sk_buff *skb, struct pkt_hdrs *h)
+{
+    struct tc_filter_bank *b;
+    struct tc_filter_rule *r;
+    __u32 key = 0;
+    __u32 row, i;
+    void *inner;
+
+    inner = bpf_map_lookup_elem(&filter_bank, &key);
+    if (!inner)
+        return TC_FILTER_ALLOW;
+    b = bpf_map_lookup_elem(inner, &key);
+    if (!b || !b->state.enabled || skb->len < ETH_HLEN)
+        return TC_FILTER_ALLOW;
+    row = (b->state.hits & 1) * TC_FILTER_HITS;
+
+    if (!h->parsed)
+        parse_headers(skb, h);
+
+    for (i = 0; i < TC_FILTER_MAX_RULES; i++) {
+        if (i >= b->state.num_rules)
+            break;
+        r = &b->rules[i];
+        if (rule_match(r, h)) {
+            filter_hit(row + i);
+            return r->action;
+        }
+    }
+
+    filter_hit(row + b->state.num_rules);
+    return b->state.default_action;
+}
+
+/*
+ * Per-flow cutoff: true if the flow of skb has already passed its packet or
+ * byte limit. Counts are updated atomically (a flow may be seen on several
+ * CPUs, e.g. ingress and egress of a routed flow); the limit check is not, so
+ * a flow can overshoot by a packet per CPU.
+ */
+static __always_inline int flow_cut(struct __sk_buff *skb, struct pkt_hdrs *h)
+{
+    struct tc_flow_cutoff *fc;
+    struct tc_flow_key key = {};
+    struct tc_flow *f;
+    __u32 zero = 0;
+    __u64 now;
+
+    fc = bpf_map_lookup_elem(&flow_cutoff, &zero);
+    if (!fc || (fc->bytes == 0 && fc->packets == 0))
+        return 0;
+    if (!h->parsed && skb->len >= ETH_HLEN)
+        parse_headers(skb, h);
+
+    if (h->has_ip) {
+        key.src[1] = h->ip_src;
+        key.dst[1] = h->ip_dst;
+        key.family = 4;
+    } else if (h->has_ip6) {
+        key.src[0] = h->ip6_src[0];
+        key.src[1] = h->ip6_src[1];
+        key.dst[0] = h->ip6_dst[0];
+        key.dst[1] = h->ip6_dst[1];
+        key.family = 6;
+    } else {
+        return 0;
+    }
+    key.protocol = h->protocol;
+    if (h->has_ports) {
+        key.port_src = h->port_src;
+        key.port_dst = h->port_dst;
+    }
+
+    now = bpf_ktime_get_ns();
+    f = bpf_map_lookup_elem(&flow_table, &key);
+    if (!f) {
+        struct tc_flow nf = { .packets = 1, .bytes = skb->len, .last_ns = now };
+
+        bpf_map_update_elem(&flow_table, &key, &nf, BPF_NOEXIST);
+        return 0;
+    }
+
+    if (fc->idle_ns && now - f->last_ns > fc->idle_ns) {
+        f->packets = 0;
+        f->bytes = 0;
+    }
+    f->last_ns = now;
+    if ((fc->packets && f->packets >= fc->packets) ||
+        (fc->bytes && f->bytes >= fc->bytes))
+        return 1;
+    __sync_fetch_and_add(&f->packets, 1);
+    __sync_fetch_and_add(&f->bytes, skb->len);
+    return 0;
+}
+
+/* Same mix as dedup_mix() in dedup.c */
+static __always_inline __u64 dedup_mix(__u64 h, __u64 w)
+{
+    h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 32);
+}
+
+/*
+ * Duplicate suppression: true if a packet with the same signature (see
+ * dedup_signature() in dedup.c) was recorded less than the window ago on any
+ * CPU. Slots are written without locking; a race between two CPUs only costs
+ * a missed duplicate.
+ */
+static __always_inline int dedup_seen(struct __sk_buff *skb, struct pkt_hdrs *h)
+{
+    struct tc_dedup_slot *e;
+    __u64 *window;
+    __u64 sig, w, now;
+    __u32 zero = 0;
+    __u32 end, off, i, slot;
+
+    window = bpf_map_lookup_elem(&dedup, &zero);
+    if (!window || *window == 0)
+        return 0;
+    if (!h->parsed && skb->len >= ETH_HLEN)
+        parse_headers(skb, h);
+    if (h->l4_off == 0)
+        return 0;
+
+    if (h->has_ip) {
+        sig = dedup_mix(0x736964656475706bull, ((__u64)h->ip_id_frag << 32) |
+                        ((__u64)h->l3_len << 16) | ((__u64)h->protocol << 8) | 4);
+        sig = dedup_mix(sig, ((__u64)h->ip_src << 32) | h->ip_dst);
+    } else if (h->has_ip6) {
+        sig = dedup_mix(0x736964656475706bull, ((__u64)h->l3_len << 16) |
+                        ((__u64)h->protocol << 8) | 6);
+        sig = dedup_mix(sig, h->ip6_src[0]);
+        sig = dedup_mix(sig, h->ip6_src[1]);
+        sig = dedup_mix(sig, h->ip6_dst[0]);
+        sig = dedup_mix(sig, h->ip6_dst[1]);
+    } else {
+        return 0;
+    }
+
+    end = h->l3_off + h->l3_len;
+    if (end > skb->len)
+        end = skb->len;
+    off = h->l4_off;
+    for (i = 0; i < TC_DEDUP_L4_WORDS; i++) {
+        if (off + 8 > end || bpf_skb_load_bytes(skb, off, &w, sizeof(w)) < 0)
+            break;
+        sig = dedup_mix(sig, w);
+        off += 8;
+    }
+    if (sig == 0)
+        sig = 1;
+
+    slot = (__u32)(sig ^ (sig >> 32)) & (TC_DEDUP_TABLE_SIZE - 1);
+    e = bpf_map_lookup_elem(&dedup_table, &slot);
+    if (!e)
+        return 0;
+    now = bpf_ktime_get_ns();
+    if (e->sig == sig && now - e->seen_ns <= *window)
+        return 1;
+    e->sig = sig;
+    e->seen_ns = now;
+    return 0;
+}
+
+/*
+ * RFC 1624 incremental checksum update for one 16-bit field change
+ */
+static __always_inline __u16 csum_replace16(__u16 check, __u16 old, __u16 new)
+{
+    __u32 sum = (__u32)(~check & 0xffff) + (__u32)(~old & 0xffff) + new;
+
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (__u16)~sum;
+}
+
+/* Deepest IPv4 header offset (after VLAN tags and MPLS labels) */
+#define IPV4_OFF_MAX (ETH_HLEN + PKT_MAX_VLANS * VLAN_HLEN + PKT_MAX_MPLS * MPLS_HLEN)
+
+/*
+ * Offset of the IPv4 header within the first caplen bytes, walking the same
+ * tag stack as parse_headers(): up to PKT_MAX_VLANS 802.1Q/802.1ad tags, then
+ * an MPLS label stack. 0 when there is none; as truncate_apply(), the IPv4-at-18
+ * guess is not rewritten.
+ */
+static __always_inline __u32 ipv4_offset(struct __sk_buff *skb, __u32 caplen)
+{
+    __u8 tag[4];
+    __u8 b;
+    __u16 eth_type;
+    __u32 off = ETH_HLEN;
+    __u32 i;
+
+    if (bpf_skb_load_bytes(skb, 12, tag, 2) < 0)
+        return 0;
+    eth_type = load_u16(&tag[0]);
+    for (i = 0; i < PKT_MAX_VLANS; i++) {
+        if (!is_vlan_tpid(eth_type) || caplen < off + VLAN_HLEN)
+            break;
+        if (bpf_skb_load_bytes(skb, off, tag, sizeof(tag)) < 0)
+            return 0;
+        eth_type = load_u16(&tag[2]);
+        off += VLAN_HLEN;
+    }
+    if (eth_type == ETHERTYPE_IP)
+        return off;
+    if (eth_type != ETHERTYPE_MPLS && eth_type != ETHERTYPE_MPLS_MC)
+        return 0;
+    for (i = 0; i < PKT_MAX_MPLS; i++) {
+        if (caplen < off + MPLS_HLEN || bpf_skb_load_bytes(skb, off, tag, sizeof(tag)) < 0)
+            return 0;
+        off += MPLS_HLEN;
+        if (!(tag[2] & 0x01))
+            continue;
+        /* Bottom of stack: IPv4 only by its version nibble, as pkt_parse() */
+        if (caplen > off && bpf_skb_load_bytes(skb, off, &b, 1) == 0 && (b >> 4) == 4)
+            return off;
+        return 0;
+    }
+    return 0;
+}
+
+/*
+ * Fix IPv4 total length and header checksum of a sample truncated to caplen,
+ * wherever ipv4_offset() finds the header (behind tags or labels too).
+ */
+static __always_inline void fixup_truncated_ipv4(struct __sk_buff *skb, struct pkt_sample *sample,
+                                                 __u32 caplen)
+{
+    __u8 *d = sample->data;
+    __u16 old_tot, new_tot, check;
+    __u32 off, ihl;
+
+    off = ipv4_offset(skb, caplen);
+    if (off == 0 || off > IPV4_OFF_MAX || caplen < off + 20)
+        return;
+    if ((d[off] >> 4) != 4)
+        return;
+    ihl = (d[off] & 0x0f) * 4;
+    if (ihl < 20 || caplen < off + ihl)
+        return;
+    old_tot = load_u16(&d[off + 2]);
+    new_tot = (__u16)(caplen - off);
+    check = load_u16(&d[off + 10]);
+    check = csum_replace16(check, old_tot, new_tot);
+    d[off + 2] = new_tot >> 8;
+    d[off + 3] = new_tot & 0xff;
+    d[off + 10] = check >> 8;
+    d[off + 11] = check & 0xff;
+}
+
+/* Same mix as hash_mix32() in parse.h (tunnel remote choice) */
+static __always_inline __u32 hash_mix32(__u32 h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+/*
+ * True if runtime.sampling leaves this packet out. Runs before the ACL and
+ * the copy, so a sampled-out packet costs one or two map lookups. The skb
+ * hash is mixed again so the kept flows do not all fall on low shards.
+ */
+static __always_inline int sampled_out(struct __sk_buff *skb)
+{
+    struct tc_sampling *s;
+    __u32 *left;
+    __u32 zero = 0;
+
+    s = bpf_map_lookup_elem(&sampling, &zero);
+    if (!s || s->mode == TC_SAMPLE_NONE)
+        return 0;
+    if (s->mode == TC_SAMPLE_FLOW)
+        return (__u64)hash_mix32(bpf_get_hash_recalc(skb)) >= s->flow_threshold;
+
+    left = bpf_map_lookup_elem(&sample_countdown, &zero);
+    if (!left)
+        return 0;
+    if (*left > 0) {
+        *left -= 1;
+        return 1;
+    }
+    *left = s->rate - 1;
+    return 0;
+}
+
+static __always_inline void store_u16(__u8 *p, __u16 v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+static __always_inline void set_mirror_pending(__u32 v)
+{
+    __u32 key = 0;
+    __u32 *p = bpf_map_lookup_elem(&mirror_pending, &key);
+
+    if (p)
+        *p = v;
+}
+
+/* True (once) if skb is the clone bpf_clone_redirect() is transmitting on this CPU */
+static __always_inline int mirror_claim(void)
+{
+    __u32 key = 0;
+    __u32 *p = bpf_map_lookup_elem(&mirror_pending, &key);
+
+    if (!p || !*p)
+        return 0;
+    *p = 0;
+    return 1;
+}
+
+/*
+ * Fix IPv4 total length and header checksum after a clone was cut to caplen.
+ * Same header layouts as fixup_truncated_ipv4().
+ */
+static __always_inline void fixup_snapped_ipv4(struct __sk_buff *skb, __u32 caplen)
+{
+    __u8 iph[4];
+    __u16 old_tot, new_tot;
+    __u32 ip_off, ihl;
+
+    ip_off = ipv4_offset(skb, caplen);
+    if (ip_off == 0 || ip_off > IPV4_OFF_MAX || caplen < ip_off + 20 ||
+        bpf_skb_load_bytes(skb, ip_off, iph, sizeof(iph)) < 0)
+        return;
+    if ((iph[0] >> 4) != 4)
+        return;
+    ihl = (iph[0] & 0x0f) * 4;
+    old_tot = load_u16(&iph[2]);
+    new_tot = (__u16)(caplen - ip_off);
+    if (ihl < 20 || caplen < ip_off + ihl || old_tot <= new_tot)
+        return;
+
+    bpf_l3_csum_replace(skb, ip_off + 10, bpf_htons(old_tot), bpf_htons(new_tot), 2);
+    new_tot = bpf_htons(new_tot);
+    bpf_skb_store_bytes(skb, ip_off + 2, &new_tot, sizeof(new_tot), 0);
+}
+
+/*
+ * Prepend the outer headers of the flow's remote, as tunnel_send() builds them.
+ * IP packets get the room from bpf_skb_adjust_room() with the encap flags, so a
+ * GSO clone is segmented as a tunnel packet by the output device; other frames
+ * (ARP, ...) fall back to bpf_skb_change_head(). Returns the TC verdict.
+ */
+static __always_inline int tunnel_encap(struct __sk_buff *skb, const struct tc_clone_cfg *cfg)
+{
+    struct tc_tunnel_remote *r;
+    struct tc_tunnel_stats *st;
+    __u8 hdr[TC_TUNNEL_HDR_MAX];
+    __u8 eth[ETH_HLEN];
+    __u32 hash = bpf_get_hash_recalc(skb);
+    __u32 idx = 0, slot, len, hlen;
+    __u16 old_tot, new_tot;
     __u64 flags;
+    __u32 *e;
 
-    /* Populate metadata */
-    meta.len = len;
-    meta.ifindex = skb->ifindex;
-    meta.direction = direction;
-    meta.timestamp = bpf_ktime_get_ns();
+    if (cfg->tunnel_num_remotes > 1) {
+        slot = (__u32)(((__u64)hash_mix32(hash) * TC_TUNNEL_LB_SIZE) >> 32);
+        e = bpf_map_lookup_elem(&tunnel_lb, &slot);
+        if (!e || *e >= TC_TUNNEL_MAX_REMOTES)
+            return TC_ACT_SHOT;     /* No remote up */
+        idx = *e;
+    }
+    r = bpf_map_lookup_elem(&tunnel_remotes, &idx);
+    st = bpf_map_lookup_elem(&tunnel_stats, &idx);
+    if (!r || !st)
+        return TC_ACT_SHOT;
+
+    /* Inner VLAN tag held in skb metadata would end up on the outer frame */
+    if (skb->vlan_present)
+        bpf_skb_vlan_pop(skb);
+
+    if (skb->gso_size == 0 && skb->len > cfg->tunnel_max_inner)
+        goto drop;
+    if (bpf_skb_load_bytes(skb, 0, eth, ETH_HLEN) < 0)
+        goto drop;
+
+    if (cfg->tunnel_type == TC_TUNNEL_VXLAN) {
+        hlen = TC_TUNNEL_VXLAN_HLEN;
+        flags = BPF_F_ADJ_ROOM_ENCAP_L4_UDP;
+    } else {
+        hlen = TC_TUNNEL_GRE_HLEN;
+        flags = BPF_F_ADJ_ROOM_ENCAP_L4_GRE;
+    }
+    flags |= BPF_F_ADJ_ROOM_ENCAP_L3_IPV4 | BPF_F_ADJ_ROOM_ENCAP_L2_ETH |
+             BPF_F_ADJ_ROOM_ENCAP_L2(ETH_HLEN);
+
+    /* Room goes in after the inner Ethernet header, which moves behind the outer headers */
+    if (bpf_skb_adjust_room(skb, hlen, BPF_ADJ_ROOM_MAC, flags) == 0) {
+        if (bpf_skb_store_bytes(skb, hlen, eth, ETH_HLEN, 0) < 0)
+            goto drop;
+    } else if (skb->gso_size || bpf_skb_change_head(skb, hlen, 0) < 0) {
+        goto drop;
+    }
+
+    /* Template lengths are for an empty payload: patch them and the IPv4 checksum */
+    __builtin_memcpy(hdr, r->hdr, TC_TUNNEL_HDR_MAX);
+    len = skb->len;
+    old_tot = load_u16(&hdr[ETH_HLEN + 2]);
+    new_tot = (__u16)(len - ETH_HLEN);
+    store_u16(&hdr[ETH_HLEN + 2], new_tot);
+    store_u16(&hdr[ETH_HLEN + 10], csum_replace16(load_u16(&hdr[ETH_HLEN + 10]), old_tot, new_tot));
+
+    if (cfg->tunnel_type == TC_TUNNEL_VXLAN) {
+        /* Source port from the inner flow hash, scaled into the range as tunnel_send() */
+        store_u16(&hdr[ETH_HLEN + 20], (__u16)(cfg->tunnel_srcport_min +
+                  (__u32)(((__u64)hash * cfg->tunnel_srcport_range) >> 32)));
+        store_u16(&hdr[ETH_HLEN + 24], (__u16)(len - ETH_HLEN - 20));
+        if (bpf_skb_store_bytes(skb, 0, hdr, TC_TUNNEL_VXLAN_HLEN, 0) < 0)
+            goto drop;
+    } else {
+        if (bpf_skb_store_bytes(skb, 0, hdr, TC_TUNNEL_GRE_HLEN, 0) < 0)
+            goto drop;
+    }
+
+    st->packets += 1;
+    st->bytes += len;
+    return TC_ACT_OK;
+
+drop:
+    st->dropped += 1;
+    return TC_ACT_SHOT;
+}
+
+/*
+ * Output side of ebpf-redirect, on the clone only: cut it to snap_len, then
+ * encapsulate it. Dropping the clone here (TC_ACT_SHOT) makes the
+ * bpf_clone_redirect() that sent it fail, so it counts as a failed redirect.
+ */
+static __always_inline int mirror_out(struct __sk_buff *skb, const struct tc_clone_cfg *cfg)
+{
+    __u32 len = skb->len;
+
+    if (cfg->snap_len && len > cfg->snap_len &&
+        bpf_skb_change_tail(skb, cfg->snap_len, 0) == 0) {
+        fixup_snapped_ipv4(skb, cfg->snap_len);
+        count(TC_CNT_SNAP);
+        count_add(TC_CNT_SNAP_BYTES, len - cfg->snap_len);
+    }
+    if (cfg->tunnel_type != TC_TUNNEL_NONE)
+        return tunnel_encap(skb, cfg);
+    return TC_ACT_OK;
+}
+
+/*
+ * ebpf-redirect: transmit a clone of the packet on the output device; the
+ * original continues through the stack. A clone dropped by the output qdisc
+ * or device (non-zero return) counts as failed.
+ */
+static __always_inline int mirror_redirect(struct __sk_buff *skb, const struct tc_clone_cfg *cfg)
+{
+    int claim = cfg->snap_len || cfg->tunnel_type != TC_TUNNEL_NONE;
+    __u32 len = skb->len;
+    long ret;
+
+    if (claim)
+        set_mirror_pending(1);
+    ret = bpf_clone_redirect(skb, cfg->redirect_ifindex, 0);
+    if (claim)
+        set_mirror_pending(0);
+
+    if (ret != 0) {
+        count(TC_CNT_REDIRECT_FAIL);
+        count_add(TC_CNT_REDIRECT_FAIL_BYTES, len);
+    } else {
+        count(TC_CNT_REDIRECT);
+        count_add(TC_CNT_REDIRECT_BYTES, len);
+    }
+    return TC_ACT_OK;
+}
+
+/* Filter, then clone packet and send to userspace via the ring buffer shard for its flow */
+static __always_inline int clone_and_send(struct __sk_buff *skb, __u8 direction)
+{
+    struct tc_clone_cfg *cfg;
+    struct pkt_sample *sample;
+    struct pkt_hdrs h = {};
+    void *rb;
+    __u32 key = 0;
+    __u32 cpu;
+    __u32 shard, hash;
+    __u32 len = skb->len;
+    __u32 caplen;
+
+    cfg = bpf_map_lookup_elem(&config, &key);
+    if (!cfg || (cfg->nr_shards == 0 && cfg->redirect_ifindex == 0))
+        return TC_ACT_OK;
+
+    /* Output is the input device (tunnel): our own clone on its way out */
+    if (cfg->redirect_ifindex && direction == 1 && mirror_claim())
+        return mirror_out(skb, cfg);
+
+    /* Left out by sampling: no parse, no ACL, no copy */
+    if (sampled_out(skb)) {
+        count(TC_CNT_SAMPLED_OUT);
+        count_add(TC_CNT_SAMPLED_OUT_BYTES, skb->len);
+        return TC_ACT_OK;
+    }
+
+    /* Second copy of a frame (ingress + egress of a routed or bridged path) */
+    if (dedup_seen(skb, &h)) {
+        count(TC_CNT_DUP);
+        count_add(TC_CNT_DUP_BYTES, skb->len);
+        return TC_ACT_OK;
+    }
+
+    /* Denied packets are counted here and never copied to userspace */
+    if (filter_skb(skb, &h) == TC_FILTER_DROP) {
+        count(TC_CNT_FILTER_DROP);
+        count_add(TC_CNT_FILTER_DROP_BYTES, skb->len);
+        return TC_ACT_OK;
+    }
 
-    /* Cap packet length to avoid verifier issues */
-    if (len > MAX_CAPTURE_LEN)
-        len = MAX_CAPTURE_LEN;
+    /* Flow past its cutoff: neither copied nor mirrored */
+    if (flow_cut(skb, &h)) {
+        count(TC_CNT_CUTOFF);
+        count_add(TC_CNT_CUTOFF_BYTES, skb->len);
+        return TC_ACT_OK;
+    }
+
+    if (cfg->redirect_ifindex)
+        return mirror_redirect(skb, cfg);
 
     /*
-     * Use BPF_F_CURRENT_CPU to send to the perf buffer of the current CPU
-     * The upper 32 bits contain the size of the packet data to include
+     * Pick the shard by flow hash so one flow always lands on the same
+     * consumer thread (same per-flow affinity as PACKET_FANOUT_HASH).
      */
-    flags = ((__u64)len << 32) | BPF_F_CURRENT_CPU;
+    hash = bpf_get_hash_recalc(skb);
+    shard = hash % cfg->nr_shards;
+    rb = bpf_map_lookup_elem(&events, &shard);
+    if (!rb) {
+        count(TC_CNT_RINGBUF_DROP);
+        return TC_ACT_OK;
+    }
+
+    cpu = bpf_get_smp_processor_id();
+    sample = bpf_map_lookup_elem(&scratch, &cpu);
+    if (!sample) {
+        count(TC_CNT_RINGBUF_DROP);
+        return TC_ACT_OK;
+    }
 
     /*
-     * bpf_perf_event_output sends:
-     * 1. The metadata struct (meta)
-     * 2. The packet data from skb (len bytes)
-     * This handles variable-length packets natively!
+     * Copy only the truncate length when truncation runs in the kernel
+     * (snap_len), and cap packet length to avoid verifier issues
      */
-    bpf_perf_event_output(skb, &events, flags, &meta, sizeof(meta));
+    caplen = len;
+    if (cfg->snap_len && caplen > cfg->snap_len)
+        caplen = cfg->snap_len;
+    if (caplen > MAX_CAPTURE_LEN)
+        caplen = MAX_CAPTURE_LEN;
+    if (caplen == 0)
+        return TC_ACT_OK;
+
+    /* Populate metadata */
+    sample->meta.len = len;
+    sample->meta.caplen = caplen;
+    sample->meta.ifindex = skb->ifindex;
+    sample->meta.direction = direction;
+    sample->meta.vlan_present = skb->vlan_present;
+    sample->meta.vlan_tci = skb->vlan_tci;
+    sample->meta.hash = hash;
+    sample->meta.timestamp = bpf_ktime_get_ns();
+
+    if (bpf_skb_load_bytes(skb, 0, sample->data, caplen) < 0) {
+        count(TC_CNT_RINGBUF_DROP);
+        return TC_ACT_OK;
+    }
+
+    if (cfg->snap_len && caplen < len)
+        fixup_truncated_ipv4(skb, sample, caplen);
+
+    if (bpf_ringbuf_output(rb, sample, sizeof(struct pkt_meta) + caplen, 0) < 0)
+        count(TC_CNT_RINGBUF_DROP);
 
-    /* 
-     * Return TC_ACT_OK regardless of perf output result
+    /*
+     * Return TC_ACT_OK regardless of ring buffer result
      * This ensures the original packet continues through the stack
      */
     return TC_ACT_OK;
@@ -84,4 +1093,20 @@ int tc_egress(struct __sk_buff *skb)
     return clone_and_send(skb, 1); /* PKT_DIR_EGRESS */
 }
 
+/*
+ * TC Egress hook of the ebpf-redirect output device (when it is not the input
+ * device) - truncates and encapsulates the clones, passes everything else
+ */
+SEC("classifier/mirror_out")
+int tc_mirror_out(struct __sk_buff *skb)
+{
+    struct tc_clone_cfg *cfg;
+    __u32 key = 0;
+
+    cfg = bpf_map_lookup_elem(&config, &key);
+    if (!cfg || !mirror_claim())
+        return TC_ACT_OK;
+    return mirror_out(skb, cfg);
+}
+
 char LICENSE[] SEC("license") = "GPL";
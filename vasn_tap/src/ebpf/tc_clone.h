@@ -9,7 +9,212 @@
 /* Maximum packet size to capture */
 #define MAX_CAPTURE_LEN 65535
 
-/* Ring buffer map name */
+/* Ring buffer map name (BPF_MAP_TYPE_ARRAY_OF_MAPS of per-shard ring buffers) */
 #define EVENTS_MAP_NAME "events"
 
+/* Other maps shared between the TC program and userspace */
+#define CONFIG_MAP_NAME   "config"
+#define SCRATCH_MAP_NAME  "scratch"
+#define COUNTERS_MAP_NAME "counters"
+#define FILTER_BANK_MAP_NAME  "filter_bank"
+#define FILTER_HITS_MAP_NAME  "filter_hits"
+#define TUNNEL_REMOTES_MAP_NAME "tunnel_remotes"
+#define TUNNEL_LB_MAP_NAME      "tunnel_lb"
+#define TUNNEL_STATS_MAP_NAME   "tunnel_stats"
+#define FLOW_CUTOFF_MAP_NAME    "flow_cutoff"
+#define DEDUP_MAP_NAME          "dedup"
+#define SAMPLING_MAP_NAME       "sampling"
+
+/*
+ * Ring buffer sharding: one BPF_MAP_TYPE_RINGBUF per consumer thread, sized by
+ * workers_init() from runtime.ringbuf_size (power of two, page aligned). Since
+ * 5.10 the kernel does not compare max_entries of ring buffer inner maps, so
+ * RINGBUF_SHARD_SIZE only sizes the inner map template in tc_clone.bpf.c.
+ */
+#define RINGBUF_MAX_SHARDS      64
+#define RINGBUF_SHARD_SIZE      (8 * 1024 * 1024)   /* Inner map template */
+#define RINGBUF_MIN_SHARD_SIZE  (256 * 1024)        /* Smallest shard, whatever the share */
+
+/* Runtime configuration written by userspace into the config map (key 0) */
+struct tc_clone_cfg {
+    __u32 nr_shards;      /* Active ring buffer shards (0 = not ready, pass only) */
+    __u32 snap_len;       /* Truncate samples to this many bytes + fix IPv4 header (0 = full) */
+    __u32 redirect_ifindex; /* ebpf-redirect: clone allowed packets to this device (0 = off) */
+    __u32 tunnel_type;    /* ebpf-redirect: TC_TUNNEL_* encapsulation of the clones */
+    __u32 tunnel_max_inner;   /* Largest inner frame (output MTU - outer headers) */
+    __u32 tunnel_num_remotes; /* 1 = always remote 0, else pick through tunnel_lb */
+    __u32 tunnel_srcport_min; /* VXLAN outer UDP source port range */
+    __u32 tunnel_srcport_range;
+};
+
+/* Per-CPU counter indices in the counters map */
+enum tc_clone_counter {
+    TC_CNT_RINGBUF_DROP = 0,      /* Sample lost: shard full or missing */
+    TC_CNT_FILTER_DROP,           /* Denied by in-kernel ACL (never sent to userspace) */
+    TC_CNT_FILTER_DROP_BYTES,     /* Bytes of packets denied by in-kernel ACL */
+    TC_CNT_REDIRECT,              /* ebpf-redirect: clones handed to the output device */
+    TC_CNT_REDIRECT_BYTES,
+    TC_CNT_REDIRECT_FAIL,         /* ebpf-redirect: clone or transmit failed */
+    TC_CNT_REDIRECT_FAIL_BYTES,
+    TC_CNT_SNAP,                  /* ebpf-redirect: clones truncated on the output egress */
+    TC_CNT_SNAP_BYTES,            /* Bytes removed from them */
+    TC_CNT_CUTOFF,                /* Allowed, but the flow is past its cutoff (not sent) */
+    TC_CNT_CUTOFF_BYTES,
+    TC_CNT_DUP,                   /* Duplicate within the dedup window (not sent) */
+    TC_CNT_DUP_BYTES,
+    TC_CNT_SAMPLED_OUT,           /* Left out by runtime.sampling (not sent) */
+    TC_CNT_SAMPLED_OUT_BYTES,
+    TC_CNT_MAX,
+};
+
+/*
+ * ebpf-redirect tunnel (filled from tunnel_get_encap() by tap_set_redirect()).
+ * tunnel_remotes[i] holds remote i's outer headers for an empty payload, as
+ * tunnel_send() uses them; tunnel_lb maps hash_mix32(flow hash) * TC_TUNNEL_LB_SIZE >> 32
+ * to a remote index (tunnel_lb_sample()).
+ */
+#define TC_TUNNEL_NONE        0
+#define TC_TUNNEL_VXLAN       1
+#define TC_TUNNEL_GRE         2
+#define TC_TUNNEL_MAX_REMOTES 16      /* TUNNEL_MAX_REMOTES */
+#define TC_TUNNEL_HDR_MAX     50      /* TUNNEL_HDR_MAX */
+#define TC_TUNNEL_VXLAN_HLEN  50      /* Eth + IPv4 + UDP + VXLAN */
+#define TC_TUNNEL_GRE_HLEN    38      /* Eth + IPv4 + GRE */
+#define TC_TUNNEL_LB_SIZE     4096
+#define TC_TUNNEL_NO_REMOTE   0xff    /* TUNNEL_NO_REMOTE */
+
+struct tc_tunnel_remote {
+    __u8 hdr[TC_TUNNEL_HDR_MAX];
+};
+
+/* Per-CPU, per remote */
+struct tc_tunnel_stats {
+    __u64 packets;        /* Encapsulated and handed to the output device */
+    __u64 bytes;          /* Outer frame bytes */
+    __u64 dropped;        /* Too large for the MTU, no remote up, or encapsulation failed */
+};
+
+/*
+ * Per-flow cutoff (runtime.flow_cutoff, written by tap_set_flow_cutoff()).
+ * Flows are tracked in an LRU hash keyed on the 5-tuple, shared by all CPUs;
+ * a flow that has passed `packets` packets or `bytes` bytes is cut until it
+ * has been idle for idle_ns. Same policy as flow_cutoff() in flow.c.
+ */
+#define TC_FLOW_TABLE_SIZE 65536     /* FLOW_TABLE_SIZE */
+
+struct tc_flow_cutoff {
+    __u64 bytes;          /* 0 = no byte limit */
+    __u64 packets;        /* 0 = no packet limit (both 0 = cutoff off) */
+    __u64 idle_ns;        /* 0 = never expire (LRU eviction only) */
+};
+
+struct tc_flow_key {
+    __u64 src[2];         /* IPv6 halves; IPv4: src[1] = address */
+    __u64 dst[2];
+    __u16 port_src;
+    __u16 port_dst;
+    __u8  protocol;
+    __u8  family;         /* 4 or 6 */
+    __u8  pad[2];
+};
+
+struct tc_flow {
+    __u64 packets;
+    __u64 bytes;
+    __u64 last_ns;        /* bpf_ktime_get_ns() of the last packet */
+};
+
+/*
+ * Duplicate suppression (runtime.dedup, written by tap_set_dedup()). The
+ * dedup map (key 0) holds the window in ns (0 = off); dedup_table is a
+ * direct-mapped array of recent signatures shared by all CPUs, since the
+ * ingress and egress copies of a frame may run on different CPUs. Same
+ * signature as dedup_signature() in dedup.c.
+ */
+#define TC_DEDUP_TABLE_SIZE 65536
+#define TC_DEDUP_L4_WORDS   8        /* DEDUP_L4_WORDS */
+
+struct tc_dedup_slot {
+    __u64 sig;            /* 0 = never used */
+    __u64 seen_ns;        /* bpf_ktime_get_ns() when sig was recorded */
+};
+
+/*
+ * Deterministic sampling (runtime.sampling, written by tap_set_sampling()).
+ * Packet mode keeps 1 in rate packets per CPU (countdown in a per-CPU map);
+ * flow mode keeps a flow when the mixed skb hash (the kernel flow dissector
+ * hash, the same in both directions) is below flow_threshold.
+ */
+#define TC_SAMPLE_NONE   0        /* SAMPLING_NONE */
+#define TC_SAMPLE_PACKET 1        /* SAMPLING_PACKET */
+#define TC_SAMPLE_FLOW   2        /* SAMPLING_FLOW */
+
+struct tc_sampling {
+    __u32 mode;           /* TC_SAMPLE_* */
+    __u32 rate;           /* packet: keep 1 in rate */
+    __u64 flow_threshold; /* flow: flow_percent of 2^32 */
+};
+
+/*
+ * In-kernel ACL (compiled from filter_config by tap_load_filter()).
+ * Same first-match semantics as filter_packet(). Each load builds a whole
+ * struct tc_filter_bank in a new one-entry array map and swaps it into the
+ * filter_bank map-in-map; the kernel returns from that update only after an
+ * RCU grace period, so no TC program still reads the old bank. Hits go to
+ * one of two per-CPU rows, which a load alternates: rule i of a bank counts
+ * at filter_hits[hits * TC_FILTER_HITS + i] and its default at
+ * filter_hits[hits * TC_FILTER_HITS + num_rules].
+ */
+#define TC_FILTER_MAX_RULES 64
+#define TC_FILTER_BANKS     2
+#define TC_FILTER_HITS      (TC_FILTER_MAX_RULES + 1)
+
+/* tc_filter_rule.fields: which match fields are present */
+#define TC_F_ETH_TYPE   (1u << 0)
+#define TC_F_IP_SRC     (1u << 1)
+#define TC_F_IP_DST     (1u << 2)
+#define TC_F_PROTOCOL   (1u << 3)
+#define TC_F_PORT_SRC   (1u << 4)
+#define TC_F_PORT_DST   (1u << 5)
+#define TC_F_IP6_SRC    (1u << 6)
+#define TC_F_IP6_DST    (1u << 7)
+#define TC_F_VLAN       (1u << 8)
+#define TC_F_INNER_VLAN (1u << 9)
+
+/* tc_filter_rule.action / tc_filter_state.default_action (= enum filter_action) */
+#define TC_FILTER_ALLOW 0
+#define TC_FILTER_DROP  1
+
+struct tc_filter_rule {
+    __u32 fields;         /* TC_F_* */
+    __u32 ip_src;         /* IPv4 canonical host order, as struct filter_match */
+    __u32 ip_src_mask;
+    __u32 ip_dst;
+    __u32 ip_dst_mask;
+    __u16 eth_type;
+    __u16 port_src;
+    __u16 port_dst;
+    __u8  protocol;
+    __u8  action;         /* TC_FILTER_ALLOW or TC_FILTER_DROP */
+    __u16 vlan;           /* Outer VLAN ID */
+    __u16 inner_vlan;     /* Second VLAN ID */
+    __u64 ip6_src[2];     /* IPv6 host order halves, as struct filter_match */
+    __u64 ip6_src_mask[2];
+    __u64 ip6_dst[2];
+    __u64 ip6_dst_mask[2];
+};
+
+struct tc_filter_state {
+    __u32 enabled;        /* 0 = no in-kernel ACL, pass everything to userspace */
+    __u32 num_rules;
+    __u32 default_action;
+    __u32 hits;           /* Hit counter row of this bank (0 .. TC_FILTER_BANKS - 1) */
+};
+
+/* Value of the inner filter_bank map (key 0): never written once published */
+struct tc_filter_bank {
+    struct tc_filter_state state;
+    struct tc_filter_rule rules[TC_FILTER_MAX_RULES];
+};
+
 #endif /* __TC_CLONE_H__ */
@@ -0,0 +1,27 @@
+/*
+ * vasn_tap - XDP Capture eBPF Program
+ * Redirects every received frame to the AF_XDP socket bound to its RX queue
+ * (runtime.mode: afxdp). Queues without a socket fall back to the stack.
+ */
+
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+
+#include "xdp_capture.h"
+
+/* AF_XDP sockets, indexed by RX queue id (populated by userspace) */
+struct {
+    __uint(type, BPF_MAP_TYPE_XSKMAP);
+    __uint(max_entries, XSK_MAX_QUEUES);
+    __type(key, __u32);
+    __type(value, __u32);
+} xsks_map SEC(".maps");
+
+SEC("xdp")
+int xdp_capture(struct xdp_md *ctx)
+{
+    /* Lower bits of flags are the action used when the queue has no socket */
+    return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS);
+}
+
+char LICENSE[] SEC("license") = "GPL";
@@ -0,0 +1,16 @@
+/*
+ * vasn_tap - XDP Capture Shared Definitions
+ * Shared between eBPF program and userspace (runtime.mode: afxdp)
+ */
+
+#ifndef __XDP_CAPTURE_H__
+#define __XDP_CAPTURE_H__
+
+/* Upper bound on RX queues bound to AF_XDP sockets (XSKMAP size) */
+#define XSK_MAX_QUEUES  64
+
+/* Map and program names (must match the eBPF object) */
+#define XSKS_MAP_NAME       "xsks_map"
+#define XDP_CAPTURE_PROG    "xdp_capture"
+
+#endif /* __XDP_CAPTURE_H__ */
@@ -1,86 +1,381 @@
 /*
  * vasn_tap - Packet filter (ACL)
- * Parses L2 (ethertype), L3 (IPv4 src/dst, protocol), L4 (TCP/UDP ports).
+ * Matches L2 (ethertype, outer/inner VLAN ID), L3 (IPv4 or IPv6 src/dst,
+ * protocol / IPv6 next header), L4 (TCP/UDP ports) as parsed by pkt_parse().
  * First matching rule wins; else default_action.
+ * filter_packet() scans the rules linearly; filter_classify() runs the same
+ * decision through a classifier compiled from the rules at load time.
  */
 
 #define _GNU_SOURCE
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <arpa/inet.h>
 #include "filter.h"
 
 #define ETH_ALEN      6
 #define ETH_HLEN      14
-#define ETHERTYPE_IP  0x0800
-#define ETHERTYPE_VLAN 0x8100
-#ifndef IPPROTO_TCP
-#define IPPROTO_TCP   6
-#endif
-#ifndef IPPROTO_UDP
-#define IPPROTO_UDP   17
-#endif
 
-const struct filter_config *g_filter_config = NULL;
+/* The published filter; swapped whole by filter_publish() */
+static const struct filter_state *_Atomic g_filter;
 
-/* Per-rule hit counts: [0..num_rules-1] = rules, [num_rules] = default. */
-_Atomic uint64_t filter_rule_hits[MAX_FILTER_RULES + 1];
+/*
+ * Epoch-based reclamation. A worker stores the epoch it entered in (0 = not
+ * inside) before it loads g_filter; after a swap the writer bumps the epoch and
+ * waits until no reader is still inside an older one. One cache line per reader.
+ */
+struct filter_reader {
+	_Atomic uint64_t epoch;
+} __attribute__((aligned(64)));
+
+static struct filter_reader filter_readers[FILTER_MAX_READERS];
+static _Atomic uint64_t filter_epoch = 1;
+
+/* Worker hit rows per published state (filter_set_readers) */
+static unsigned int filter_nreaders = 1;
+
+const struct filter_state *filter_enter(unsigned int reader)
+{
+	struct filter_reader *r = &filter_readers[reader % FILTER_MAX_READERS];
+
+	/* seq_cst store then load: the writer either sees us inside or we see its swap */
+	atomic_store(&r->epoch, atomic_load_explicit(&filter_epoch, memory_order_relaxed));
+	return atomic_load(&g_filter);
+}
 
-void filter_set_config(const struct filter_config *cfg)
+void filter_exit(unsigned int reader)
 {
-	g_filter_config = cfg;
+	atomic_store_explicit(&filter_readers[reader % FILTER_MAX_READERS].epoch, 0,
+	                      memory_order_release);
 }
 
-void filter_stats_reset(unsigned int num_rules)
+/* Wait until every reader that could hold the previous g_filter has left */
+void filter_synchronize(void)
 {
+	uint64_t e = atomic_fetch_add(&filter_epoch, 1) + 1;
 	unsigned int i;
-	if (num_rules > MAX_FILTER_RULES)
-		num_rules = MAX_FILTER_RULES;
-	for (i = 0; i <= num_rules; i++)
-		__atomic_store_n(&filter_rule_hits[i], 0, __ATOMIC_RELAXED);
+
+	for (i = 0; i < FILTER_MAX_READERS; i++) {
+		uint64_t v;
+
+		while ((v = atomic_load(&filter_readers[i].epoch)) != 0 && v < e)
+			sched_yield();
+	}
+}
+
+const struct filter_state *filter_current(void)
+{
+	return atomic_load_explicit(&g_filter, memory_order_acquire);
+}
+
+uint64_t filter_hits_get(const struct filter_state *fs, unsigned int slot)
+{
+	uint64_t sum = 0;
+	unsigned int r;
+
+	for (r = 0; r <= fs->readers; r++)
+		sum += counter_read(&filter_hits_row(fs, r)[slot]);
+	return sum;
+}
+
+static void filter_state_free(struct filter_state *fs)
+{
+	if (!fs)
+		return;
+	filter_classifier_free(fs->fc);
+	free(fs->carry);
+	free(fs->hits);
+	free(fs);
 }
 
-static uint16_t get_u16(const void *p)
+/* Compile cfg; one zeroed, cache-aligned hit row per reader plus the publisher's */
+static struct filter_state *filter_state_new(const struct filter_config *cfg)
 {
-	const uint8_t *u = (const uint8_t *)p;
-	return (uint16_t)((u[0] << 8) | u[1]);
+	const unsigned int per_line = COUNTER_CACHE_LINE / sizeof(uint64_t);
+	struct filter_state *fs;
+	size_t size;
+
+	fs = calloc(1, sizeof(*fs));
+	if (!fs)
+		return NULL;
+	fs->cfg = cfg;
+	fs->readers = filter_nreaders;
+	fs->hit_stride = (cfg->num_rules + 1 + per_line - 1) / per_line * per_line;
+	size = (size_t)(fs->readers + 1) * fs->hit_stride * sizeof(*fs->hits);
+	fs->hits = aligned_alloc(COUNTER_CACHE_LINE, size);
+	fs->fc = filter_compile(cfg);
+	if (!fs->fc || !fs->hits) {
+		filter_state_free(fs);
+		return NULL;
+	}
+	memset(fs->hits, 0, size);
+	return fs;
 }
 
-static bool match_rule(const struct filter_rule *rule, uint16_t eth_type,
-                      uint32_t ip_src, uint32_t ip_dst, uint8_t protocol,
-                      uint16_t port_src, uint16_t port_dst,
-                      bool has_ip, bool has_ports)
+/* Rule identity for hit carry-over: same action and same present match fields */
+static bool rule_same(const struct filter_rule *a, const struct filter_rule *b)
+{
+	const struct filter_match *x = &a->match, *y = &b->match;
+
+	if (a->action != b->action ||
+	    x->has_eth_type != y->has_eth_type || x->has_ip_src != y->has_ip_src ||
+	    x->has_ip_dst != y->has_ip_dst || x->has_ip6_src != y->has_ip6_src ||
+	    x->has_ip6_dst != y->has_ip6_dst || x->has_protocol != y->has_protocol ||
+	    x->has_vlan != y->has_vlan || x->has_inner_vlan != y->has_inner_vlan ||
+	    x->has_port_src != y->has_port_src || x->has_port_dst != y->has_port_dst)
+		return false;
+	if (x->has_eth_type && x->eth_type != y->eth_type)
+		return false;
+	if (x->has_ip_src && (x->ip_src != y->ip_src || x->ip_src_mask != y->ip_src_mask))
+		return false;
+	if (x->has_ip_dst && (x->ip_dst != y->ip_dst || x->ip_dst_mask != y->ip_dst_mask))
+		return false;
+	if (x->has_ip6_src && (memcmp(x->ip6_src, y->ip6_src, sizeof(x->ip6_src)) != 0 ||
+	                       memcmp(x->ip6_src_mask, y->ip6_src_mask, sizeof(x->ip6_src_mask)) != 0))
+		return false;
+	if (x->has_ip6_dst && (memcmp(x->ip6_dst, y->ip6_dst, sizeof(x->ip6_dst)) != 0 ||
+	                       memcmp(x->ip6_dst_mask, y->ip6_dst_mask, sizeof(x->ip6_dst_mask)) != 0))
+		return false;
+	if (x->has_protocol && x->protocol != y->protocol)
+		return false;
+	if (x->has_vlan && x->vlan != y->vlan)
+		return false;
+	if (x->has_inner_vlan && x->inner_vlan != y->inner_vlan)
+		return false;
+	if (x->has_port_src && x->port_src != y->port_src)
+		return false;
+	if (x->has_port_dst && x->port_dst != y->port_dst)
+		return false;
+	return true;
+}
+
+static uint32_t rule_hash(const struct filter_rule *r)
+{
+	const struct filter_match *m = &r->match;
+	uint32_t h = hash_mix32((uint32_t)r->action + 1);
+
+	if (m->has_eth_type)
+		h = hash_mix32(h ^ m->eth_type);
+	if (m->has_ip_src)
+		h = hash_mix32(h ^ m->ip_src ^ hash_mix32(m->ip_src_mask));
+	if (m->has_ip_dst)
+		h = hash_mix32(h ^ m->ip_dst ^ hash_mix32(~m->ip_dst_mask));
+	if (m->has_ip6_src)
+		h = hash_mix32(h ^ (uint32_t)m->ip6_src[0] ^ (uint32_t)(m->ip6_src[1] >> 32) ^ 0x6a5);
+	if (m->has_ip6_dst)
+		h = hash_mix32(h ^ (uint32_t)m->ip6_dst[0] ^ (uint32_t)(m->ip6_dst[1] >> 32) ^ 0x6d5);
+	if (m->has_protocol)
+		h = hash_mix32(h ^ 0x100u ^ m->protocol);
+	if (m->has_vlan)
+		h = hash_mix32(h ^ 0x10000u ^ m->vlan);
+	if (m->has_inner_vlan)
+		h = hash_mix32(h ^ 0x20000u ^ m->inner_vlan);
+	if (m->has_port_src)
+		h = hash_mix32(h ^ 0x30000u ^ m->port_src);
+	if (m->has_port_dst)
+		h = hash_mix32(h ^ 0x40000u ^ m->port_dst);
+	return h;
+}
+
+int filter_rule_map(const struct filter_config *from, const struct filter_config *to,
+                    unsigned int *map)
+{
+	uint32_t *table, cap = 16, mask, i;
+
+	for (i = 0; i < to->num_rules; i++)
+		map[i] = FILTER_NO_RULE;
+	map[to->num_rules] = from->num_rules;	/* Default slot stays the default slot */
+	if (from->num_rules == 0 || to->num_rules == 0)
+		return 0;
+
+	/* Open addressing over the old rules; each old rule is claimed at most once */
+	while (cap < from->num_rules * 2u)
+		cap <<= 1;
+	mask = cap - 1;
+	table = malloc(cap * sizeof(*table));
+	if (!table)
+		return -ENOMEM;
+	memset(table, 0xff, cap * sizeof(*table));
+	for (i = 0; i < from->num_rules; i++) {
+		uint32_t h = rule_hash(&from->rules[i]) & mask;
+
+		while (table[h] != UINT32_MAX)
+			h = (h + 1) & mask;
+		table[h] = i;
+	}
+	for (i = 0; i < to->num_rules; i++) {
+		uint32_t h = rule_hash(&to->rules[i]) & mask;
+
+		/* Identical rules hash alike and were inserted in order: first unclaimed wins */
+		for (; table[h] != UINT32_MAX; h = (h + 1) & mask) {
+			uint32_t o = table[h];
+
+			if (o != UINT32_MAX - 1 && rule_same(&from->rules[o], &to->rules[i])) {
+				map[i] = o;
+				table[h] = UINT32_MAX - 1;	/* Claimed (tombstone keeps probe chains) */
+				break;
+			}
+		}
+	}
+	free(table);
+	return 0;
+}
+
+/* Build the state for cfg and (carry) the slot map from the current one */
+static struct filter_state *filter_prepare(const struct filter_config *cfg, bool carry)
+{
+	const struct filter_state *old = filter_current();
+	struct filter_state *fs;
+
+	fs = filter_state_new(cfg);
+	if (!fs)
+		return NULL;
+	if (carry && old) {
+		fs->carry = malloc((cfg->num_rules + 1) * sizeof(*fs->carry));
+		if (!fs->carry || filter_rule_map(old->cfg, cfg, fs->carry) != 0) {
+			filter_state_free(fs);
+			return NULL;
+		}
+	}
+	return fs;
+}
+
+/*
+ * Swap fs in (NULL clears the filter), wait out the readers of the old one,
+ * then add the old counters into the new slots of the same rules.
+ */
+static void filter_commit(struct filter_state *fs)
+{
+	struct filter_state *old = (struct filter_state *)filter_current();
+	unsigned int i;
+
+	atomic_store(&g_filter, fs);
+	filter_synchronize();
+
+	if (fs && fs->carry && old) {
+		/* No worker counts into old any more; the old totals go to our own row */
+		uint64_t *own = filter_hits_row(fs, fs->readers);
+
+		for (i = 0; i <= fs->cfg->num_rules; i++) {
+			if (fs->carry[i] != FILTER_NO_RULE)
+				counter_add(&own[i], filter_hits_get(old, fs->carry[i]));
+		}
+	}
+	if (fs) {
+		free(fs->carry);
+		fs->carry = NULL;
+	}
+	filter_state_free(old);
+}
+
+static int filter_publish(const struct filter_config *cfg, bool carry)
+{
+	struct filter_state *fs = NULL;
+
+	if (cfg) {
+		fs = filter_prepare(cfg, carry);
+		if (!fs)
+			return -ENOMEM;
+	}
+	filter_commit(fs);
+	return 0;
+}
+
+int filter_set_config(const struct filter_config *cfg)
+{
+	return filter_publish(cfg, false);
+}
+
+int filter_reload(const struct filter_config *cfg)
+{
+	return filter_publish(cfg, true);
+}
+
+struct filter_state *filter_reload_prepare(const struct filter_config *cfg)
+{
+	return cfg ? filter_prepare(cfg, true) : NULL;
+}
+
+void filter_reload_commit(struct filter_state *fs)
+{
+	if (fs)
+		filter_commit(fs);
+}
+
+void filter_reload_abort(struct filter_state *fs)
+{
+	filter_state_free(fs);
+}
+
+int filter_set_readers(unsigned int n)
+{
+	const struct filter_state *cur = filter_current();
+	unsigned int prev = filter_nreaders;
+	int err;
+
+	if (n == 0 || n > FILTER_MAX_READERS)
+		return -EINVAL;
+	filter_nreaders = n;
+	err = cur ? filter_publish(cur->cfg, true) : 0;
+	if (err)
+		filter_nreaders = prev;
+	return err;
+}
+
+static bool match_rule(const struct filter_rule *rule, const struct pkt_desc *pd)
 {
 	const struct filter_match *m = &rule->match;
 
-	if (m->has_eth_type && m->eth_type != eth_type)
+	if (m->has_eth_type && m->eth_type != pd->eth_type)
 		return false;
 	if (m->has_ip_src) {
-		if (!has_ip)
+		if (!(pd->flags & PKT_F_IPV4))
 			return false;
-		if ((ip_src & m->ip_src_mask) != m->ip_src)
+		if ((pd->ip_src & m->ip_src_mask) != m->ip_src)
 			return false;
 	}
 	if (m->has_ip_dst) {
-		if (!has_ip)
+		if (!(pd->flags & PKT_F_IPV4))
+			return false;
+		if ((pd->ip_dst & m->ip_dst_mask) != m->ip_dst)
+			return false;
+	}
+	if (m->has_ip6_src) {
+		if (!(pd->flags & PKT_F_IPV6))
+			return false;
+		if ((pd->ip6_src[0] & m->ip6_src_mask[0]) != m->ip6_src[0] ||
+		    (pd->ip6_src[1] & m->ip6_src_mask[1]) != m->ip6_src[1])
+			return false;
+	}
+	if (m->has_ip6_dst) {
+		if (!(pd->flags & PKT_F_IPV6))
 			return false;
-		if ((ip_dst & m->ip_dst_mask) != m->ip_dst)
+		if ((pd->ip6_dst[0] & m->ip6_dst_mask[0]) != m->ip6_dst[0] ||
+		    (pd->ip6_dst[1] & m->ip6_dst_mask[1]) != m->ip6_dst[1])
 			return false;
 	}
-	if (m->has_protocol && m->protocol != protocol)
+	if (m->has_protocol && m->protocol != pd->protocol)
+		return false;
+	if (m->has_vlan && (pd->vlan_count < 1 || m->vlan != pd->vlan_outer))
+		return false;
+	if (m->has_inner_vlan && (pd->vlan_count < 2 || m->inner_vlan != pd->vlan_inner))
 		return false;
 	if (m->has_port_src) {
-		if (!has_ports)
+		if (!(pd->flags & PKT_F_PORTS))
 			return false;
-		if (m->port_src != port_src)
+		if (m->port_src != pd->port_src)
 			return false;
 	}
 	if (m->has_port_dst) {
-		if (!has_ports)
+		if (!(pd->flags & PKT_F_PORTS))
 			return false;
-		if (m->port_dst != port_dst)
+		if (m->port_dst != pd->port_dst)
 			return false;
 	}
 	return true;
@@ -90,12 +385,7 @@ enum filter_action filter_packet(const struct filter_config *cfg,
                                   const void *pkt_data, uint32_t pkt_len,
                                   int *matched_rule_index)
 {
-	const uint8_t *pkt = (const uint8_t *)pkt_data;
-	uint16_t eth_type;
-	uint32_t ip_src = 0, ip_dst = 0;
-	uint8_t protocol = 0;
-	uint16_t port_src = 0, port_dst = 0;
-	bool has_ip = false, has_ports = false;
+	struct pkt_desc pd;
 	unsigned int i;
 
 	if (!cfg || pkt_len < ETH_HLEN)
@@ -103,63 +393,750 @@ enum filter_action filter_packet(const struct filter_config *cfg,
 	if (matched_rule_index)
 		*matched_rule_index = -1;
 
-	/* Find IP header: standard Ethernet (14) or after 802.1Q VLAN (18) */
-	uint32_t ip_off = 0;
-	eth_type = get_u16(pkt + 12);
-	if (eth_type == ETHERTYPE_IP && pkt_len >= ETH_HLEN + 20u) {
-		ip_off = ETH_HLEN;
-	} else if (eth_type == ETHERTYPE_VLAN && pkt_len >= ETH_HLEN + 4u + 20u) {
-		eth_type = get_u16(pkt + 16);
-		if (eth_type == ETHERTYPE_IP)
-			ip_off = ETH_HLEN + 4;
-	}
-
-	/* Fallback: look for IPv4 at offset 18 in case L2 is 18 bytes (e.g. VLAN with no 0x0800/0x8100 at 12) */
-	if (ip_off == 0 && pkt_len >= 18u + 20u && (pkt[18] & 0xf0) == 0x40) {
-		uint8_t ihl = (pkt[18] & 0x0f) * 4;
-		if (ihl >= 20 && 18u + (uint32_t)ihl <= pkt_len) {
-			ip_off = 18;
-			eth_type = ETHERTYPE_IP;
+	pkt_parse(pkt_data, pkt_len, &pd);
+	for (i = 0; i < cfg->num_rules; i++) {
+		if (match_rule(&cfg->rules[i], &pd)) {
+			if (matched_rule_index)
+				*matched_rule_index = (int)i;
+			return cfg->rules[i].action;
 		}
 	}
 
-	if (ip_off != 0 && pkt_len >= ip_off + 20u) {
-		uint8_t ihl = (pkt[ip_off] & 0x0f) * 4;
-		if (ihl >= 20 && pkt_len >= ip_off + (uint32_t)ihl) {
-			protocol = pkt[ip_off + 9];
-			/* IP addresses in canonical form (same as config parse_cidr) */
-			ip_src = (uint32_t)pkt[ip_off + 12] << 24 |
-			         (uint32_t)pkt[ip_off + 13] << 16 |
-			         (uint32_t)pkt[ip_off + 14] << 8 |
-			         (uint32_t)pkt[ip_off + 15];
-			ip_dst = (uint32_t)pkt[ip_off + 16] << 24 |
-			         (uint32_t)pkt[ip_off + 17] << 16 |
-			         (uint32_t)pkt[ip_off + 18] << 8 |
-			         (uint32_t)pkt[ip_off + 19];
-			has_ip = true;
-
-			if ((protocol == IPPROTO_TCP || protocol == IPPROTO_UDP) &&
-			    pkt_len >= ip_off + (uint32_t)ihl + 4u) {
-				const uint8_t *l4 = pkt + ip_off + ihl;
-				port_src = get_u16(l4 + 0);
-				port_dst = get_u16(l4 + 2);
-				has_ports = true;
+	if (matched_rule_index)
+		*matched_rule_index = -1;
+	return cfg->default_action;
+}
+
+/*
+ * Compiled classifier.
+ *
+ * Rules with an IPv4 prefix (ip_dst, else ip_src) live in an LPM table on that
+ * field. An address maps to its longest matching rule prefix (a "class"); each
+ * class lists its own rules in index order and links to the class of the next
+ * shorter covering prefix. Candidates along that chain are confirmed with
+ * match_rule() on the remaining fields, which for blocklist-style rules is one
+ * or two checks per packet whatever the rule count. The table is DIR-16 with
+ * range buckets: the top 16 address bits index an array of offsets into the
+ * sorted interval starts (low 16 bits) of that /16, so a lookup is one index
+ * plus a short binary search and memory stays a few bytes per prefix (a flat
+ * DIR-24-8 costs 64 MiB up front plus 1 KiB per /32).
+ *
+ * Rules with an IPv6 prefix and no IPv4 one do the same on ip6_dst (else
+ * ip6_src), with one hash of (prefix length, prefix) instead of the ranges: a
+ * lookup probes the distinct rule prefix lengths from the longest down, so it
+ * costs one probe per length in use (a single one for a feed of /48s).
+ *
+ * The remaining rules are grouped by the set of exact fields they name
+ * (eth_type, protocol, the ports, the two VLAN IDs): a "tuple", as in tuple
+ * space search (Srinivasan et al. 1999). One open-addressing hash maps
+ * (tuple, values) to the rules of that tuple naming exactly those values, in
+ * index order. A packet probes each tuple with its own values, tuples in order
+ * of their lowest rule index, and stops once that index is past the best match
+ * so far. Memory is a few words per rule however many distinct values there
+ * are; the per-packet cost grows with the number of tuples (at most
+ * FC_TUPLES), not with the rules. A rule with an address that is not a prefix
+ * is confirmed with match_rule(), and its tuple also records the address
+ * family, so IPv6 rules are never tried on IPv4 packets or the reverse.
+ *
+ * The answer is the lowest rule index found on either side, so first-match
+ * semantics are those of filter_packet().
+ */
+#define FC_NONE         0xffffffffu
+#define FC_BUCKETS      65536u
+#define FC_T_ETH_TYPE   0x01u
+#define FC_T_PROTOCOL   0x02u
+#define FC_T_PORT_SRC   0x04u
+#define FC_T_PORT_DST   0x08u
+#define FC_T_VLAN       0x10u
+#define FC_T_INNER_VLAN 0x20u
+#define FC_T_IPV4       0x40u		/* Rule names an IPv4 address */
+#define FC_T_IPV6       0x80u		/* Rule names an IPv6 address */
+#define FC_T_PORTS      (FC_T_PORT_SRC | FC_T_PORT_DST)
+#define FC_TUPLES       256u		/* Every subset of the FC_T_* fields */
+#define FC_VERIFY       0x80000000u	/* In fc_tuples.list: confirm with match_rule() */
+
+/* Classes of an LPM table: one per distinct rule prefix */
+struct fc_classes {
+	uint32_t *parent;	/* Per class: class of the next shorter covering prefix */
+	uint32_t *rule_off;	/* Per class (+1): range of rules[] */
+	uint32_t *rules;	/* Rule indexes, ascending within a class */
+	uint32_t nclasses, nrules;
+};
+
+/* LPM table over one IPv4 field */
+struct fc_lpm {
+	uint32_t *bucket;	/* FC_BUCKETS + 1 offsets into start[] / cls[] */
+	uint16_t *start;	/* Interval starts (low 16 bits), ascending within a bucket */
+	uint32_t *cls;		/* Class of each interval (FC_NONE: no rule prefix) */
+	uint32_t nranges;
+	struct fc_classes cl;
+};
+
+/* One IPv6 prefix: the class of (a, plen) */
+struct fc_slot6 {
+	uint64_t a[2];		/* Prefix, host order as pkt_desc */
+	uint32_t plen;
+	uint32_t cls;		/* FC_NONE = empty slot */
+};
+
+/* LPM table over one IPv6 field */
+struct fc_lpm6 {
+	struct fc_slot6 *slots;
+	uint32_t mask;		/* Slots - 1 */
+	uint8_t lens[129];	/* Distinct prefix lengths, longest first */
+	uint32_t nlens;
+	struct fc_classes cl;
+};
+
+/* One hash slot: tuple fields and values packed as in fc_key(), and its rule list */
+struct fc_slot {
+	uint64_t k0;		/* eth_type << 48 | port_src << 32 | port_dst << 16 | protocol << 8 | tuple */
+	uint32_t k1;		/* vlan << 16 | inner_vlan */
+	uint32_t list;		/* Index into list_off[] (FC_NONE = empty slot) */
+};
+
+/* Tuple part: the rules not in an LPM table */
+struct fc_tuples {
+	uint32_t fields[FC_TUPLES];	/* FC_T_* of each tuple present ... */
+	uint32_t min_rule[FC_TUPLES];	/* ... and its lowest rule index, ascending */
+	uint32_t ntuples;
+	struct fc_slot *slots;
+	uint32_t mask;			/* Slots - 1 */
+	uint32_t *list_off;		/* Per key (+1): range of list[] */
+	uint32_t *list;			/* Rule index | FC_VERIFY, ascending within a key */
+	uint32_t nkeys, nlist;
+};
+
+struct filter_classifier {
+	const struct filter_config *cfg;
+	struct fc_lpm lpm[2];		/* 0 = ip_src, 1 = ip_dst */
+	struct fc_lpm6 lpm6[2];		/* 0 = ip6_src, 1 = ip6_dst */
+	struct fc_tuples tup;
+};
+
+static inline uint32_t fc_hash(uint32_t v)
+{
+	v ^= v >> 16; v *= 0x85ebca6bu;
+	v ^= v >> 13; v *= 0xc2b2ae35u;
+	v ^= v >> 16;
+	return v;
+}
+
+static inline uint32_t fc_slot_hash(uint64_t k0, uint32_t k1)
+{
+	return fc_hash((uint32_t)(k0 >> 32) ^ fc_hash((uint32_t)k0 ^ fc_hash(k1)));
+}
+
+/* Exact fields a rule names and the address family it needs (its tuple) */
+static uint32_t rule_tuple(const struct filter_match *m)
+{
+	return (m->has_eth_type ? FC_T_ETH_TYPE : 0) | (m->has_protocol ? FC_T_PROTOCOL : 0) |
+	       (m->has_port_src ? FC_T_PORT_SRC : 0) | (m->has_port_dst ? FC_T_PORT_DST : 0) |
+	       (m->has_vlan ? FC_T_VLAN : 0) | (m->has_inner_vlan ? FC_T_INNER_VLAN : 0) |
+	       (m->has_ip_src || m->has_ip_dst ? FC_T_IPV4 : 0) |
+	       (m->has_ip6_src || m->has_ip6_dst ? FC_T_IPV6 : 0);
+}
+
+/* Hash key of a tuple's values; unnamed fields are 0 */
+static inline void fc_key(uint32_t t, uint16_t eth_type, uint8_t protocol, uint16_t port_src,
+                          uint16_t port_dst, uint16_t vlan, uint16_t inner_vlan,
+                          uint64_t *k0, uint32_t *k1)
+{
+	*k0 = (t & FC_T_ETH_TYPE ? (uint64_t)eth_type << 48 : 0) |
+	      (t & FC_T_PORT_SRC ? (uint64_t)port_src << 32 : 0) |
+	      (t & FC_T_PORT_DST ? (uint64_t)port_dst << 16 : 0) |
+	      (t & FC_T_PROTOCOL ? (uint64_t)protocol << 8 : 0) | t;
+	*k1 = (t & FC_T_VLAN ? (uint32_t)vlan << 16 : 0) |
+	      (t & FC_T_INNER_VLAN ? inner_vlan : 0);
+}
+
+static uint32_t fc_slot_lookup(const struct fc_tuples *tp, uint64_t k0, uint32_t k1)
+{
+	uint32_t h = fc_slot_hash(k0, k1) & tp->mask;
+
+	while (tp->slots[h].list != FC_NONE) {
+		if (tp->slots[h].k0 == k0 && tp->slots[h].k1 == k1)
+			return tp->slots[h].list;
+		h = (h + 1) & tp->mask;
+	}
+	return FC_NONE;
+}
+
+/* Tuple-part entry for sorting (build time only) */
+struct fc_entry {
+	uint64_t k0;
+	uint32_t k1;
+	uint32_t rule;		/* | FC_VERIFY */
+};
+
+static int fc_entry_cmp(const void *a, const void *b)
+{
+	const struct fc_entry *x = a, *y = b;
+
+	if (x->k0 != y->k0)
+		return x->k0 < y->k0 ? -1 : 1;
+	if (x->k1 != y->k1)
+		return x->k1 < y->k1 ? -1 : 1;
+	return (x->rule & ~FC_VERIFY) < (y->rule & ~FC_VERIFY) ? -1 : 1;
+}
+
+/*
+ * Build the tuple part from n entries (rule indexes ascending): tuples in order
+ * of first appearance, so min_rule ascends; entries sorted by key, one list per
+ * distinct key.
+ */
+static int fc_build_tuples(struct fc_tuples *tp, struct fc_entry *e, uint32_t n)
+{
+	uint32_t slots = 4, i, h;
+	bool seen[FC_TUPLES] = { false };
+
+	for (i = 0; i < n; i++) {
+		uint32_t t = (uint32_t)(e[i].k0 & (FC_TUPLES - 1));
+
+		if (!seen[t]) {
+			seen[t] = true;
+			tp->fields[tp->ntuples] = t;
+			tp->min_rule[tp->ntuples++] = e[i].rule & ~FC_VERIFY;
+		}
+	}
+
+	qsort(e, n, sizeof(*e), fc_entry_cmp);
+	tp->list = malloc(n * sizeof(uint32_t));
+	tp->list_off = malloc((n + 1) * sizeof(uint32_t));
+	while (slots < 2 * n)
+		slots *= 2;
+	tp->slots = malloc(slots * sizeof(struct fc_slot));
+	if (!tp->list || !tp->list_off || !tp->slots)
+		return -ENOMEM;
+	for (i = 0; i < slots; i++)
+		tp->slots[i].list = FC_NONE;
+	tp->mask = slots - 1;
+
+	for (i = 0; i < n; i++) {
+		if (i == 0 || e[i].k0 != e[i - 1].k0 || e[i].k1 != e[i - 1].k1) {
+			h = fc_slot_hash(e[i].k0, e[i].k1) & tp->mask;
+			while (tp->slots[h].list != FC_NONE)
+				h = (h + 1) & tp->mask;
+			tp->slots[h] = (struct fc_slot){ e[i].k0, e[i].k1, tp->nkeys };
+			tp->list_off[tp->nkeys++] = i;
+		}
+		tp->list[i] = e[i].rule;
+	}
+	tp->list_off[tp->nkeys] = n;
+	tp->nlist = n;
+	return 0;
+}
+
+/* First rule below best in the tuple part that matches in full */
+static uint32_t fc_tuple_match(const struct filter_config *cfg, const struct fc_tuples *tp,
+                               const struct pkt_desc *pd, uint32_t best)
+{
+	uint32_t t, k;
+
+	for (t = 0; t < tp->ntuples && tp->min_rule[t] < best; t++) {
+		uint32_t f = tp->fields[t], list, k1;
+		uint64_t k0;
+
+		if (((f & FC_T_IPV4) && !(pd->flags & PKT_F_IPV4)) ||
+		    ((f & FC_T_IPV6) && !(pd->flags & PKT_F_IPV6)) ||
+		    ((f & FC_T_PORTS) && !(pd->flags & PKT_F_PORTS)) ||
+		    ((f & FC_T_VLAN) && pd->vlan_count < 1) ||
+		    ((f & FC_T_INNER_VLAN) && pd->vlan_count < 2))
+			continue;
+		fc_key(f, pd->eth_type, pd->protocol, pd->port_src, pd->port_dst,
+		       pd->vlan_outer, pd->vlan_inner, &k0, &k1);
+		list = fc_slot_lookup(tp, k0, k1);
+		if (list == FC_NONE)
+			continue;
+		for (k = tp->list_off[list]; k < tp->list_off[list + 1]; k++) {
+			uint32_t e = tp->list[k], r = e & ~FC_VERIFY;
+
+			if (r >= best)
+				break;
+			if (!(e & FC_VERIFY) || match_rule(&cfg->rules[r], pd)) {
+				best = r;
+				break;
 			}
 		}
 	}
+	return best;
+}
+
+static uint32_t fc_lpm_lookup(const struct fc_lpm *l, uint32_t ip)
+{
+	uint32_t lo = l->bucket[ip >> 16], hi = l->bucket[(ip >> 16) + 1];
+	uint16_t key = (uint16_t)ip;
+
+	/* Last interval starting at or before key; each bucket's first starts at 0 */
+	while (hi - lo > 1) {
+		uint32_t mid = (lo + hi) / 2;
+		if (l->start[mid] <= key)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return l->cls[lo];
+}
+
+/* Rule prefix on one field, for sorting (build time only) */
+struct fc_prefix {
+	uint32_t ip;
+	uint32_t plen;
+	uint32_t rule;
+	uint32_t cls;	/* Class, set by fc_build_lpm() */
+};
+
+static int fc_prefix_cmp(const void *a, const void *b)
+{
+	const struct fc_prefix *x = a, *y = b;
+
+	if (x->ip != y->ip)
+		return x->ip < y->ip ? -1 : 1;
+	if (x->plen != y->plen)
+		return x->plen < y->plen ? -1 : 1;
+	return x->rule < y->rule ? -1 : (x->rule > y->rule);
+}
+
+static inline uint64_t prefix_end(uint32_t ip, uint32_t plen)
+{
+	return (uint64_t)ip + (1ULL << (32 - plen)) - 1;
+}
+
+/*
+ * Build the LPM table from n rule prefixes (sorted in place). Equal prefixes
+ * become one class; a sweep in address order with a stack of open prefixes
+ * cuts the address space into intervals labelled with their deepest class,
+ * and the intervals are then split into /16 buckets.
+ */
+static int fc_build_lpm(struct fc_lpm *l, struct fc_prefix *p, uint32_t n)
+{
+	uint32_t *istart = NULL, *icls = NULL;
+	uint32_t stack[33], sp = 0, ni = 0, i, k, b, j;
+	uint64_t cursor = 0;
+	int err = -ENOMEM;
+
+	qsort(p, n, sizeof(*p), fc_prefix_cmp);
+	l->cl.rules = malloc((n ? n : 1) * sizeof(uint32_t));
+	l->cl.rule_off = malloc((n + 1) * sizeof(uint32_t));
+	l->cl.parent = malloc((n ? n : 1) * sizeof(uint32_t));
+	istart = malloc((2 * n + 2) * sizeof(uint32_t));
+	icls = malloc((2 * n + 2) * sizeof(uint32_t));
+	if (!l->cl.rules || !l->cl.rule_off || !l->cl.parent || !istart || !icls)
+		goto out;
+
+	/* Classes: one per distinct prefix, own rules ascending */
+	for (i = 0; i < n; i++) {
+		if (i == 0 || p[i].ip != p[i - 1].ip || p[i].plen != p[i - 1].plen)
+			l->cl.rule_off[l->cl.nclasses++] = i;
+		l->cl.rules[i] = p[i].rule;
+		p[i].cls = l->cl.nclasses - 1;
+	}
+	l->cl.rule_off[l->cl.nclasses] = n;
+	l->cl.nrules = n;
+
+#define EMIT(s, c) do { istart[ni] = (uint32_t)(s); icls[ni] = (c); ni++; } while (0)
+	for (i = 0; i < n; i++) {
+		uint64_t s = p[i].ip;
+
+		if (i > 0 && p[i].cls == p[i - 1].cls)
+			continue;
+		/* Close the open prefixes that end before this one starts */
+		while (sp > 0 && prefix_end(p[stack[sp - 1]].ip, p[stack[sp - 1]].plen) < s) {
+			uint32_t top = stack[--sp];
+			uint64_t end = prefix_end(p[top].ip, p[top].plen);
+			if (cursor <= end)
+				EMIT(cursor, p[top].cls);
+			cursor = end + 1;
+		}
+		if (cursor < s)
+			EMIT(cursor, sp ? p[stack[sp - 1]].cls : FC_NONE);
+		cursor = s;
+		l->cl.parent[p[i].cls] = sp ? p[stack[sp - 1]].cls : FC_NONE;
+		stack[sp++] = i;
+	}
+	while (sp > 0) {
+		uint32_t top = stack[--sp];
+		uint64_t end = prefix_end(p[top].ip, p[top].plen);
+		if (cursor <= end)
+			EMIT(cursor, p[top].cls);
+		cursor = end + 1;
+	}
+	if (cursor <= 0xffffffffu)
+		EMIT(cursor, FC_NONE);
+#undef EMIT
+
+	/* Split into /16 buckets: the interval covering the bucket start, then those starting inside */
+	l->bucket = malloc((FC_BUCKETS + 1) * sizeof(uint32_t));
+	l->start = malloc((FC_BUCKETS + ni) * sizeof(uint16_t));
+	l->cls = malloc((FC_BUCKETS + ni) * sizeof(uint32_t));
+	if (!l->bucket || !l->start || !l->cls)
+		goto out;
+	for (b = 0, j = 0, k = 0; b < FC_BUCKETS; b++) {
+		uint32_t base = b << 16;
+
+		while (j + 1 < ni && istart[j + 1] <= base)
+			j++;
+		l->bucket[b] = k;
+		l->start[k] = 0;
+		l->cls[k++] = icls[j];
+		while (j + 1 < ni && (istart[j + 1] >> 16) == b) {
+			j++;
+			l->start[k] = (uint16_t)istart[j];
+			l->cls[k++] = icls[j];
+		}
+	}
+	l->bucket[FC_BUCKETS] = k;
+	l->nranges = k;
+	err = 0;
+out:
+	free(istart);
+	free(icls);
+	return err;
+}
+
+/* Prefix-usable IP constraint: true with ip/plen set; *never when it cannot match */
+static bool rule_prefix(bool has, uint32_t ip, uint32_t mask, uint32_t *plen, bool *never)
+{
+	if (!has || (~mask & (~mask + 1)) != 0)
+		return false;	/* Absent, or not a prefix mask */
+	if ((ip & mask) != ip) {
+		*never = true;	/* Host bits set: match_rule() never matches it either */
+		return false;
+	}
+	*plen = (uint32_t)__builtin_popcount(mask);
+	return true;
+}
+
+/* IPv6 rule prefix, for sorting (build time only) */
+struct fc_prefix6 {
+	uint64_t a[2];
+	uint32_t plen;
+	uint32_t rule;
+};
+
+static int fc_prefix6_cmp(const void *a, const void *b)
+{
+	const struct fc_prefix6 *x = a, *y = b;
+
+	if (x->plen != y->plen)
+		return x->plen > y->plen ? -1 : 1;	/* Longest first */
+	if (x->a[0] != y->a[0])
+		return x->a[0] < y->a[0] ? -1 : 1;
+	if (x->a[1] != y->a[1])
+		return x->a[1] < y->a[1] ? -1 : 1;
+	return x->rule < y->rule ? -1 : (x->rule > y->rule);
+}
+
+/* a masked to its first plen bits */
+static inline void prefix6(const uint64_t *a, uint32_t plen, uint64_t *out)
+{
+	out[0] = plen == 0 ? 0 : plen >= 64 ? a[0] : a[0] & (~0ULL << (64 - plen));
+	out[1] = plen <= 64 ? 0 : a[1] & (~0ULL << (128 - plen));
+}
+
+static inline uint32_t fc_slot6_hash(const uint64_t *a, uint32_t plen)
+{
+	return fc_hash((uint32_t)(a[0] >> 32) ^ fc_hash((uint32_t)a[0] ^
+	       fc_hash((uint32_t)(a[1] >> 32) ^ fc_hash((uint32_t)a[1] ^ plen))));
+}
+
+static uint32_t fc_lpm6_find(const struct fc_lpm6 *l, const uint64_t *a, uint32_t plen)
+{
+	uint32_t h = fc_slot6_hash(a, plen) & l->mask;
+
+	while (l->slots[h].cls != FC_NONE) {
+		if (l->slots[h].plen == plen && l->slots[h].a[0] == a[0] && l->slots[h].a[1] == a[1])
+			return l->slots[h].cls;
+		h = (h + 1) & l->mask;
+	}
+	return FC_NONE;
+}
+
+/* Class of the longest rule prefix covering addr, from the lengths at or after lens[from] */
+static uint32_t fc_lpm6_lookup(const struct fc_lpm6 *l, const uint64_t *addr, uint32_t from)
+{
+	uint64_t a[2];
+	uint32_t i, c;
+
+	for (i = from; i < l->nlens; i++) {
+		prefix6(addr, l->lens[i], a);
+		c = fc_lpm6_find(l, a, l->lens[i]);
+		if (c != FC_NONE)
+			return c;
+	}
+	return FC_NONE;
+}
+
+/*
+ * Build the IPv6 LPM table from n rule prefixes (sorted in place, longest
+ * first). Equal prefixes become one class; a class's parent is found by the
+ * same lookup as a packet's, on the lengths shorter than its own.
+ */
+static int fc_build_lpm6(struct fc_lpm6 *l, struct fc_prefix6 *p, uint32_t n)
+{
+	struct fc_classes *cl = &l->cl;
+	uint32_t slots = 4, i, h, c;
+
+	qsort(p, n, sizeof(*p), fc_prefix6_cmp);
+	while (slots < 2 * n)
+		slots *= 2;
+	cl->rules = malloc(n * sizeof(uint32_t));
+	cl->rule_off = malloc((n + 1) * sizeof(uint32_t));
+	cl->parent = malloc(n * sizeof(uint32_t));
+	l->slots = malloc(slots * sizeof(struct fc_slot6));
+	if (!cl->rules || !cl->rule_off || !cl->parent || !l->slots)
+		return -ENOMEM;
+	for (i = 0; i < slots; i++)
+		l->slots[i].cls = FC_NONE;
+	l->mask = slots - 1;
+
+	for (i = 0; i < n; i++) {
+		if (i == 0 || p[i].plen != p[i - 1].plen ||
+		    p[i].a[0] != p[i - 1].a[0] || p[i].a[1] != p[i - 1].a[1]) {
+			if (l->nlens == 0 || l->lens[l->nlens - 1] != p[i].plen)
+				l->lens[l->nlens++] = (uint8_t)p[i].plen;
+			h = fc_slot6_hash(p[i].a, p[i].plen) & l->mask;
+			while (l->slots[h].cls != FC_NONE)
+				h = (h + 1) & l->mask;
+			l->slots[h] = (struct fc_slot6){ { p[i].a[0], p[i].a[1] }, p[i].plen, cl->nclasses };
+			cl->rule_off[cl->nclasses++] = i;
+		}
+		cl->rules[i] = p[i].rule;
+	}
+	cl->rule_off[cl->nclasses] = n;
+	cl->nrules = n;
 
+	/* Classes are numbered longest first: the lengths after this class's own */
+	for (c = 0, h = 0; c < cl->nclasses; c++) {
+		const struct fc_prefix6 *q = &p[cl->rule_off[c]];
+
+		while (l->lens[h] != q->plen)
+			h++;
+		cl->parent[c] = fc_lpm6_lookup(l, q->a, h + 1);
+	}
+	return 0;
+}
+
+/* Prefix-usable IPv6 constraint, as rule_prefix() */
+static bool rule_prefix6(bool has, const uint64_t *ip, const uint64_t *mask,
+                         uint32_t *plen, bool *never)
+{
+	uint64_t a[2];
+
+	if (!has)
+		return false;
+	*plen = (uint32_t)(__builtin_popcountll(mask[0]) + __builtin_popcountll(mask[1]));
+	prefix6((const uint64_t[2]){ ~0ULL, ~0ULL }, *plen, a);
+	if (a[0] != mask[0] || a[1] != mask[1])
+		return false;	/* Not a prefix mask */
+	if ((ip[0] & mask[0]) != ip[0] || (ip[1] & mask[1]) != ip[1]) {
+		*never = true;
+		return false;
+	}
+	return true;
+}
+
+struct filter_classifier *filter_compile(const struct filter_config *cfg)
+{
+	struct filter_classifier *fc;
+	struct fc_prefix *pfx[2] = { NULL, NULL };
+	struct fc_prefix6 *pfx6[2] = { NULL, NULL };
+	struct fc_entry *ent = NULL;
+	uint32_t npfx[2] = { 0, 0 }, npfx6[2] = { 0, 0 }, nent = 0;
+	unsigned int i;
+	int f;
+
+	if (!cfg)
+		return NULL;
+	fc = calloc(1, sizeof(*fc));
+	if (!fc)
+		return NULL;
+	fc->cfg = cfg;
+	if (cfg->num_rules == 0)
+		return fc;	/* No rules: always the default action */
+
+	pfx[0] = malloc(cfg->num_rules * sizeof(struct fc_prefix));
+	pfx[1] = malloc(cfg->num_rules * sizeof(struct fc_prefix));
+	pfx6[0] = malloc(cfg->num_rules * sizeof(struct fc_prefix6));
+	pfx6[1] = malloc(cfg->num_rules * sizeof(struct fc_prefix6));
+	ent = malloc(cfg->num_rules * sizeof(struct fc_entry));
+	if (!pfx[0] || !pfx[1] || !pfx6[0] || !pfx6[1] || !ent)
+		goto fail;
+
+	/*
+	 * Partition: IP prefix rules to an LPM table (IPv4 before IPv6, dst before
+	 * src), the rest to the tuples
+	 */
 	for (i = 0; i < cfg->num_rules; i++) {
-		if (match_rule(&cfg->rules[i], eth_type, ip_src, ip_dst,
-		               protocol, port_src, port_dst, has_ip, has_ports)) {
-			if (matched_rule_index)
-				*matched_rule_index = (int)i;
-			return cfg->rules[i].action;
+		const struct filter_match *m = &cfg->rules[i].match;
+		bool never = false;
+		uint32_t plen_s = 0, plen_d = 0, plen6_s = 0, plen6_d = 0, t;
+		bool ps = rule_prefix(m->has_ip_src, m->ip_src, m->ip_src_mask, &plen_s, &never);
+		bool pd = rule_prefix(m->has_ip_dst, m->ip_dst, m->ip_dst_mask, &plen_d, &never);
+		bool ps6 = rule_prefix6(m->has_ip6_src, m->ip6_src, m->ip6_src_mask, &plen6_s, &never);
+		bool pd6 = rule_prefix6(m->has_ip6_dst, m->ip6_dst, m->ip6_dst_mask, &plen6_d, &never);
+
+		if (never)
+			continue;
+		if (pd) {
+			pfx[1][npfx[1]++] = (struct fc_prefix){ m->ip_dst, plen_d, i, 0 };
+		} else if (ps) {
+			pfx[0][npfx[0]++] = (struct fc_prefix){ m->ip_src, plen_s, i, 0 };
+		} else if (pd6) {
+			pfx6[1][npfx6[1]++] = (struct fc_prefix6){ { m->ip6_dst[0], m->ip6_dst[1] }, plen6_d, i };
+		} else if (ps6) {
+			pfx6[0][npfx6[0]++] = (struct fc_prefix6){ { m->ip6_src[0], m->ip6_src[1] }, plen6_s, i };
+		} else {
+			t = rule_tuple(m);
+			fc_key(t, m->eth_type, m->protocol, m->port_src, m->port_dst,
+			       m->vlan, m->inner_vlan, &ent[nent].k0, &ent[nent].k1);
+			ent[nent].rule = i;
+			if (m->has_ip_src || m->has_ip_dst || m->has_ip6_src || m->has_ip6_dst)
+				ent[nent].rule |= FC_VERIFY;
+			nent++;
+		}
+	}
+	for (f = 0; f < 2; f++) {
+		if (npfx[f] && fc_build_lpm(&fc->lpm[f], pfx[f], npfx[f]) != 0)
+			goto fail;
+		if (npfx6[f] && fc_build_lpm6(&fc->lpm6[f], pfx6[f], npfx6[f]) != 0)
+			goto fail;
+	}
+	if (nent && fc_build_tuples(&fc->tup, ent, nent) != 0)
+		goto fail;
+
+	free(pfx[0]);
+	free(pfx[1]);
+	free(pfx6[0]);
+	free(pfx6[1]);
+	free(ent);
+	return fc;
+fail:
+	free(pfx[0]);
+	free(pfx[1]);
+	free(pfx6[0]);
+	free(pfx6[1]);
+	free(ent);
+	filter_classifier_free(fc);
+	return NULL;
+}
+
+static void fc_classes_free(struct fc_classes *cl)
+{
+	free(cl->parent);
+	free(cl->rule_off);
+	free(cl->rules);
+}
+
+static size_t fc_classes_mem(const struct fc_classes *cl)
+{
+	return (size_t)cl->nclasses * 2 * sizeof(uint32_t) + (size_t)cl->nrules * sizeof(uint32_t);
+}
+
+void filter_classifier_free(struct filter_classifier *fc)
+{
+	int f;
+
+	if (!fc)
+		return;
+	for (f = 0; f < 2; f++) {
+		struct fc_lpm *l = &fc->lpm[f];
+		struct fc_lpm6 *l6 = &fc->lpm6[f];
+		free(l->bucket);
+		free(l->start);
+		free(l->cls);
+		fc_classes_free(&l->cl);
+		free(l6->slots);
+		fc_classes_free(&l6->cl);
+	}
+	free(fc->tup.slots);
+	free(fc->tup.list_off);
+	free(fc->tup.list);
+	free(fc);
+}
+
+size_t filter_classifier_mem(const struct filter_classifier *fc)
+{
+	size_t bytes;
+	int f;
+
+	if (!fc)
+		return 0;
+	bytes = sizeof(*fc);
+	if (fc->tup.slots)
+		bytes += (size_t)(fc->tup.mask + 1) * sizeof(struct fc_slot) +
+		         (size_t)(fc->tup.nkeys + 1 + fc->tup.nlist) * sizeof(uint32_t);
+	for (f = 0; f < 2; f++) {
+		const struct fc_lpm *l = &fc->lpm[f];
+		const struct fc_lpm6 *l6 = &fc->lpm6[f];
+		if (l->bucket)
+			bytes += (FC_BUCKETS + 1) * sizeof(uint32_t) +
+			         (size_t)l->nranges * (sizeof(uint16_t) + sizeof(uint32_t)) +
+			         fc_classes_mem(&l->cl);
+		if (l6->slots)
+			bytes += (size_t)(l6->mask + 1) * sizeof(struct fc_slot6) + fc_classes_mem(&l6->cl);
+	}
+	return bytes;
+}
+
+/* First rule below best on the class chain from c that matches in full */
+static uint32_t fc_chain_match(const struct filter_config *cfg, const struct fc_classes *cl,
+                               uint32_t c, const struct pkt_desc *pd, uint32_t best)
+{
+	uint32_t k;
+
+	for (; c != FC_NONE; c = cl->parent[c]) {
+		for (k = cl->rule_off[c]; k < cl->rule_off[c + 1]; k++) {
+			uint32_t r = cl->rules[k];
+			if (r >= best)
+				break;
+			if (match_rule(&cfg->rules[r], pd)) {
+				best = r;
+				break;
+			}
 		}
 	}
+	return best;
+}
 
+enum filter_action filter_classify(const struct filter_classifier *fc,
+                                   const struct pkt_desc *pd,
+                                   int *matched_rule_index)
+{
+	const struct filter_config *cfg;
+	uint32_t best = FC_NONE;
+
+	if (!fc || pd->len < ETH_HLEN)
+		return FILTER_ACTION_ALLOW;
+	cfg = fc->cfg;
 	if (matched_rule_index)
 		*matched_rule_index = -1;
-	return cfg->default_action;
+	if (cfg->num_rules == 0)
+		return cfg->default_action;
+
+	if (pd->flags & PKT_F_IPV4) {
+		if (fc->lpm[1].bucket)
+			best = fc_chain_match(cfg, &fc->lpm[1].cl, fc_lpm_lookup(&fc->lpm[1], pd->ip_dst),
+			                      pd, best);
+		if (fc->lpm[0].bucket)
+			best = fc_chain_match(cfg, &fc->lpm[0].cl, fc_lpm_lookup(&fc->lpm[0], pd->ip_src),
+			                      pd, best);
+	}
+	if (pd->flags & PKT_F_IPV6) {
+		if (fc->lpm6[1].slots)
+			best = fc_chain_match(cfg, &fc->lpm6[1].cl, fc_lpm6_lookup(&fc->lpm6[1], pd->ip6_dst, 0),
+			                      pd, best);
+		if (fc->lpm6[0].slots)
+			best = fc_chain_match(cfg, &fc->lpm6[0].cl, fc_lpm6_lookup(&fc->lpm6[0], pd->ip6_src, 0),
+			                      pd, best);
+	}
+	if (fc->tup.ntuples)
+		best = fc_tuple_match(cfg, &fc->tup, pd, best);
+	if (best == FC_NONE)
+		return cfg->default_action;
+	if (matched_rule_index)
+		*matched_rule_index = (int)best;
+	return cfg->rules[best].action;
 }
 
 static const char *protocol_name(uint8_t p)
@@ -173,6 +1150,25 @@ static const char *protocol_name(uint8_t p)
 	}
 }
 
+/* " key=addr[/prefix]" for an IPv6 match (host-order halves, as pkt_desc) */
+static int format_ip6(char *p, size_t left, const char *key,
+                      const uint64_t addr[2], const uint64_t mask[2])
+{
+	char addrbuf[INET6_ADDRSTRLEN];
+	struct in6_addr a6;
+	unsigned int prefix = (unsigned int)(__builtin_popcountll(mask[0]) + __builtin_popcountll(mask[1]));
+	int i, k;
+
+	for (i = 0; i < 2; i++)
+		for (k = 0; k < 8; k++)
+			a6.s6_addr[i * 8 + k] = (uint8_t)(addr[i] >> (56 - 8 * k));
+	if (!inet_ntop(AF_INET6, &a6, addrbuf, sizeof(addrbuf)))
+		return 0;
+	if (prefix == 128)
+		return snprintf(p, left, " %s=%s", key, addrbuf);
+	return snprintf(p, left, " %s=%s/%u", key, addrbuf, prefix);
+}
+
 void filter_format_rule(const struct filter_config *cfg, unsigned int rule_index,
                         char *buf, size_t buf_size)
 {
@@ -206,6 +1202,7 @@ void filter_format_rule(const struct filter_config *cfg, unsigned int rule_index
 	left -= (size_t)n;
 
 	if (!m->has_eth_type && !m->has_ip_src && !m->has_ip_dst &&
+	    !m->has_ip6_src && !m->has_ip6_dst && !m->has_vlan && !m->has_inner_vlan &&
 	    !m->has_protocol && !m->has_port_src && !m->has_port_dst) {
 		snprintf(p, left, "match: (any)");
 		return;
@@ -221,6 +1218,14 @@ void filter_format_rule(const struct filter_config *cfg, unsigned int rule_index
 		n = snprintf(p, left, " eth_type=0x%x", m->eth_type);
 		if (n > 0 && (size_t)n < left) { p += n; left -= (size_t)n; }
 	}
+	if (m->has_vlan) {
+		n = snprintf(p, left, " vlan=%u", m->vlan);
+		if (n > 0 && (size_t)n < left) { p += n; left -= (size_t)n; }
+	}
+	if (m->has_inner_vlan) {
+		n = snprintf(p, left, " inner_vlan=%u", m->inner_vlan);
+		if (n > 0 && (size_t)n < left) { p += n; left -= (size_t)n; }
+	}
 	if (m->has_protocol) {
 		const char *name = protocol_name(m->protocol);
 		if (name)
@@ -269,4 +1274,10 @@ void filter_format_rule(const struct filter_config *cfg, unsigned int rule_index
 			if (n > 0 && (size_t)n < left) { p += n; left -= (size_t)n; }
 		}
 	}
+	if (m->has_ip6_src) {
+		n = format_ip6(p, left, "ip_src", m->ip6_src, m->ip6_src_mask);
+		if (n > 0 && (size_t)n < left) { p += n; left -= (size_t)n; }
+	}
+	if (m->has_ip6_dst)
+		format_ip6(p, left, "ip_dst", m->ip6_dst, m->ip6_dst_mask);
 }
@@ -7,6 +7,8 @@
 #define __FILTER_H__
 
 #include "config.h"
+#include "counter.h"
+#include "parse.h"
 #include <stddef.h>
 #include <stdint.h>
 
@@ -20,21 +22,125 @@ enum filter_action filter_packet(const struct filter_config *cfg,
                                   const void *pkt_data, uint32_t pkt_len,
                                   int *matched_rule_index);
 
+/* Classifier compiled from a filter_config (opaque; read-only once built) */
+struct filter_classifier;
+
+/*
+ * Compile cfg into a classifier: IP prefix rules go to a longest-prefix-match table
+ * on ip_dst (else ip_src, ip6_dst, ip6_src), the rest to a hash keyed by the exact
+ * fields they name (eth_type, protocol, ports, VLANs) holding sparse rule lists, so
+ * neither the per-packet cost nor the memory grows with a full match per rule.
+ * cfg must outlive the classifier.
+ * Returns NULL on allocation failure.
+ */
+struct filter_classifier *filter_compile(const struct filter_config *cfg);
+
+void filter_classifier_free(struct filter_classifier *fc);
+
+/*
+ * Same decision and matched_rule_index as filter_packet() on the compiled config,
+ * for a frame already parsed by pkt_parse(). fc may be NULL (no filtering) -> allow.
+ * Thread-safe.
+ */
+enum filter_action filter_classify(const struct filter_classifier *fc,
+                                   const struct pkt_desc *pd,
+                                   int *matched_rule_index);
+
+/* Heap bytes held by a compiled classifier (0 for NULL), for --validate-config */
+size_t filter_classifier_mem(const struct filter_classifier *fc);
+
+/* Worker reader slots for filter_enter(); one per worker id (runtime.workers <= 128) */
+#define FILTER_MAX_READERS 128
+
+/* filter_rule_map(): new rule with no counterpart in the old config */
+#define FILTER_NO_RULE ((unsigned int)-1)
+
+/*
+ * The published filter: config, compiled classifier and per-rule hit counters.
+ * Swapped as one pointer, so a worker never pairs one config's classifier with
+ * another's counters. Each reader counts into its own cache-aligned row of hits
+ * (filter_hits_row()), slots 0..num_rules-1 = rule index, num_rules = default;
+ * row `readers` belongs to the publishing thread (carried-over and kernel hits).
+ */
+struct filter_state {
+	const struct filter_config *cfg;
+	struct filter_classifier *fc;
+	uint64_t *hits;
+	unsigned int hit_stride;	/* Entries per row (num_rules + 1, padded to a cache line) */
+	unsigned int readers;		/* Worker rows; reader ids 0..readers-1 */
+	unsigned int *carry;		/* Prepared, not yet published: filter_rule_map() from the current */
+};
+
+/* Row of hit counters written only by reader (or by the publisher, reader == fs->readers) */
+static inline uint64_t *filter_hits_row(const struct filter_state *fs, unsigned int reader)
+{
+	return fs->hits + (size_t)reader * fs->hit_stride;
+}
+
+/* Hits of one slot summed over all rows (relaxed reads; any thread) */
+uint64_t filter_hits_get(const struct filter_state *fs, unsigned int slot);
+
+/*
+ * Worker side, lock-free: filter_enter() returns the current filter (NULL = no
+ * filtering), valid until filter_exit() with the same reader id (0..FILTER_MAX_READERS-1,
+ * unique per thread). Hold it across one batch, never across an unbounded wait:
+ * a reload waits for every reader inside to leave. The only wait allowed inside
+ * is TX_FULL_BLOCK's, bounded by block_timeout_us per batch.
+ */
+const struct filter_state *filter_enter(unsigned int reader);
+void filter_exit(unsigned int reader);
+
 /*
- * Global filter config set by main after config load.
- * NULL = no filtering (allow all). Read by afpacket and worker.
+ * Wait until every reader has left the batch it was in when called. Anything a
+ * worker reads only between filter_enter() and filter_exit() (the filter, the
+ * tunnel lookup table and header templates) and that was unpublished before
+ * the call can be freed after it. Any thread; waits at most one batch.
  */
-extern const struct filter_config *g_filter_config;
+void filter_synchronize(void);
 
-void filter_set_config(const struct filter_config *cfg);
+/* Current filter, for the thread that publishes it (main). NULL = no filtering. */
+const struct filter_state *filter_current(void);
 
 /*
- * Per-rule hit counters (only when -F/--filter-stats: aggregate and print).
- * filter_rule_hits[0..num_rules-1] = rule index; filter_rule_hits[num_rules] = default.
+ * Publish (and compile) cfg as the filter, with zeroed hit counters; NULL clears
+ * it. Returns once no worker can still see the previous filter, which is then
+ * freed (its filter_config stays the caller's). Returns 0 on success, -ENOMEM
+ * if compiling failed (previous filter left in place). Call from one thread only.
  */
-extern _Atomic uint64_t filter_rule_hits[];
+int filter_set_config(const struct filter_config *cfg);
 
-void filter_stats_reset(unsigned int num_rules);
+/*
+ * Same as filter_set_config() while workers run (SIGHUP reload), but each rule
+ * keeps the hit count of the identical rule (same action and match) in the
+ * previous config, and the default slot keeps the default's.
+ */
+int filter_reload(const struct filter_config *cfg);
+
+/*
+ * filter_reload() in two steps, for a caller that has to apply the same rules
+ * elsewhere in between (the in-kernel ACL): filter_reload_prepare() does all
+ * that can fail and returns the new filter unpublished (NULL: -ENOMEM);
+ * filter_reload_commit() publishes it and cannot fail; filter_reload_abort()
+ * frees it instead. Nothing else may be published in between.
+ */
+struct filter_state *filter_reload_prepare(const struct filter_config *cfg);
+void filter_reload_commit(struct filter_state *fs);
+void filter_reload_abort(struct filter_state *fs);
+
+/*
+ * Number of worker hit rows in every filter published from now on (default 1);
+ * republishes the current filter with n rows, keeping its counts. Call before
+ * workers with ids 0..n-1 start counting. Returns 0, -EINVAL or -ENOMEM.
+ */
+int filter_set_readers(unsigned int n);
+
+/*
+ * For each slot of to (0..to->num_rules), the slot of the identical rule in from,
+ * or FILTER_NO_RULE. Each rule of from is used at most once; default maps to
+ * default. map has to->num_rules + 1 entries. Returns 0 or -ENOMEM.
+ */
+int filter_rule_map(const struct filter_config *from, const struct filter_config *to,
+                    unsigned int *map);
 
 /*
  * Format one rule (or default when rule_index == num_rules) for dump. Returns buf.
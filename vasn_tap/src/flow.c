@@ -0,0 +1,114 @@
+/*
+ * vasn_tap - Per-flow cutoff table (runtime.flow_cutoff)
+ * Open addressing with linear probing over FLOW_PROBE_MAX slots. Slots are
+ * never emptied, only reused (expired or least recently seen flow), so a probe
+ * can stop at the first unused slot.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "flow.h"
+
+struct flow_table *flow_table_create(const struct flow_cutoff_config *cfg)
+{
+    struct flow_table *ft;
+
+    if (!cfg)
+        return NULL;
+    ft = calloc(1, sizeof(*ft));
+    if (!ft)
+        return NULL;
+    ft->slots = aligned_alloc(64, FLOW_TABLE_SIZE * sizeof(struct flow_entry));
+    if (!ft->slots) {
+        free(ft);
+        return NULL;
+    }
+    memset(ft->slots, 0, FLOW_TABLE_SIZE * sizeof(struct flow_entry));
+    ft->mask = FLOW_TABLE_SIZE - 1;
+    ft->max_packets = cfg->packets;
+    ft->max_bytes = cfg->bytes;
+    ft->idle_ns = (uint64_t)cfg->idle_timeout_ms * 1000000ull;
+    return ft;
+}
+
+void flow_table_destroy(struct flow_table *ft)
+{
+    if (!ft)
+        return;
+    free(ft->slots);
+    free(ft);
+}
+
+/* Fill the 5-tuple of e from pd; false if the frame has no IP header */
+static bool flow_key(struct flow_entry *e, const struct pkt_desc *pd)
+{
+    if (pd->flags & PKT_F_IPV4) {
+        e->src[0] = 0;
+        e->src[1] = pd->ip_src;
+        e->dst[0] = 0;
+        e->dst[1] = pd->ip_dst;
+        e->family = 4;
+    } else if (pd->flags & PKT_F_IPV6) {
+        e->src[0] = pd->ip6_src[0];
+        e->src[1] = pd->ip6_src[1];
+        e->dst[0] = pd->ip6_dst[0];
+        e->dst[1] = pd->ip6_dst[1];
+        e->family = 6;
+    } else {
+        return false;
+    }
+    e->hash = pd->flow_hash;
+    e->protocol = pd->protocol;
+    e->port_src = (pd->flags & PKT_F_PORTS) ? pd->port_src : 0;
+    e->port_dst = (pd->flags & PKT_F_PORTS) ? pd->port_dst : 0;
+    return true;
+}
+
+static bool flow_key_equal(const struct flow_entry *a, const struct flow_entry *b)
+{
+    return a->hash == b->hash && a->family == b->family && a->protocol == b->protocol &&
+           a->port_src == b->port_src && a->port_dst == b->port_dst &&
+           a->src[0] == b->src[0] && a->src[1] == b->src[1] &&
+           a->dst[0] == b->dst[0] && a->dst[1] == b->dst[1];
+}
+
+bool flow_cutoff(struct flow_table *ft, const struct pkt_desc *pd, uint32_t len, uint64_t now_ns)
+{
+    struct flow_entry key;
+    struct flow_entry *e, *victim = NULL;
+    uint32_t i;
+
+    if (!flow_key(&key, pd))
+        return false;
+
+    for (i = 0; i < FLOW_PROBE_MAX; i++) {
+        e = &ft->slots[(key.hash + i) & ft->mask];
+        if (e->last_seen == 0) {
+            victim = e;
+            break;
+        }
+        if (flow_key_equal(e, &key)) {
+            if (ft->idle_ns && now_ns - e->last_seen > ft->idle_ns) {
+                e->packets = 0;
+                e->bytes = 0;
+            }
+            e->last_seen = now_ns;
+            if ((ft->max_packets && e->packets >= ft->max_packets) ||
+                (ft->max_bytes && e->bytes >= ft->max_bytes))
+                return true;
+            e->packets++;
+            e->bytes += len;
+            return false;
+        }
+        if (!victim || e->last_seen < victim->last_seen)
+            victim = e;
+    }
+
+    /* New flow: its first packet always passes (limits are at least 1) */
+    key.packets = 1;
+    key.bytes = len;
+    key.last_seen = now_ns;
+    *victim = key;
+    return false;
+}
@@ -0,0 +1,70 @@
+/*
+ * vasn_tap - Per-flow cutoff table (runtime.flow_cutoff)
+ * One table per worker, owned by that worker: no lock and no atomics. Fanout
+ * by flow hash (PACKET_FANOUT_HASH, RSS queues) keeps a flow on one worker.
+ */
+
+#ifndef __FLOW_H__
+#define __FLOW_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "config.h"
+#include "parse.h"
+
+/* Slots per table (power of two) and the probe window of one lookup */
+#define FLOW_TABLE_SIZE   65536
+#define FLOW_PROBE_MAX    8
+
+/* One flow, one cache line. last_seen == 0 marks a slot never used. */
+struct flow_entry {
+    uint64_t src[2];          /* IPv6 halves as pkt_desc; IPv4: src[1] = address */
+    uint64_t dst[2];
+    uint64_t bytes;           /* Passed since the flow (re)started */
+    uint64_t last_seen;       /* flow_clock_ns() of the last packet */
+    uint32_t hash;            /* pkt_desc.flow_hash */
+    uint32_t packets;
+    uint16_t port_src;
+    uint16_t port_dst;
+    uint8_t  protocol;
+    uint8_t  family;          /* 4 or 6 */
+};
+
+struct flow_table {
+    struct flow_entry *slots;
+    uint32_t mask;
+    uint32_t max_packets;     /* 0 = no packet limit */
+    uint64_t max_bytes;       /* 0 = no byte limit */
+    uint64_t idle_ns;         /* 0 = never expire */
+};
+
+/* Coarse monotonic clock: read once per batch, not per packet */
+static inline uint64_t flow_clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Allocate a table for the given policy (enabled, with a limit)
+ * @return: table, or NULL on allocation failure
+ */
+struct flow_table *flow_table_create(const struct flow_cutoff_config *cfg);
+
+/* Free a table from flow_table_create(); NULL is ignored */
+void flow_table_destroy(struct flow_table *ft);
+
+/*
+ * Account one packet of len bytes (as received) to its flow at time now_ns.
+ * Returns true if the flow had already reached its packet or byte limit: the
+ * caller drops the packet. A flow idle for longer than the idle timeout starts
+ * over; frames without IPv4/IPv6 are never cut. When the probe window is full,
+ * the least recently seen flow in it is replaced. Owner thread only.
+ */
+bool flow_cutoff(struct flow_table *ft, const struct pkt_desc *pd, uint32_t len, uint64_t now_ns);
+
+#endif /* __FLOW_H__ */
@@ -21,6 +21,7 @@
 #include "tap.h"
 #include "worker.h"
 #include "afpacket.h"
+#include "afxdp.h"
 #include "cli.h"
 #include "config.h"
 #include "filter.h"
@@ -41,10 +42,14 @@
 static struct tap_ctx g_tap_ctx;
 static struct worker_ctx g_worker_ctx;
 static struct afpacket_ctx g_afpacket_ctx;
+static struct afxdp_ctx g_afxdp_ctx;
 static enum runtime_mode g_capture_mode = RUNTIME_MODE_EBPF;
 static volatile bool g_running = true;
 static struct tap_config *g_tap_config = NULL;
 static struct tunnel_ctx *g_tunnel_ctx = NULL;
+/* Config whose filter section is published; differs from g_tap_config after a reload */
+static struct tap_config *g_filter_owner = NULL;
+static volatile sig_atomic_t g_reload = 0;
 
 /* Statistics interval in seconds */
 #define STATS_INTERVAL_SEC 1
@@ -91,6 +96,15 @@ static void signal_handler(int sig)
     }
 }
 
+/*
+ * SIGHUP: reload the filter from the main loop
+ */
+static void reload_handler(int sig)
+{
+    (void)sig;
+    g_reload = 1;
+}
+
 /*
  * Setup signal handlers
  */
@@ -103,6 +117,72 @@ static void setup_signals(void)
 
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
+
+    sa.sa_handler = reload_handler;
+    sigaction(SIGHUP, &sa, NULL);
+}
+
+/*
+ * Re-read the config file and publish its filter section while the workers
+ * keep running (hit counts carry over to identical rules). Runtime and tunnel
+ * settings only take effect on restart. On any error the current filter stays,
+ * in the workers and in the TC program alike.
+ */
+static void reload_filter(const char *path)
+{
+    struct tap_config *cfg = config_load(path);
+    struct filter_state *fs;
+    bool ebpf = g_capture_mode == RUNTIME_MODE_EBPF || g_capture_mode == RUNTIME_MODE_EBPF_REDIRECT;
+    int err = 0;
+
+    if (!cfg) {
+        fprintf(stderr, "Filter reload failed, keeping current rules: %s\n", config_get_error());
+        return;
+    }
+    /* Kernel hit counts into the current state, so they carry over even if the ACL moves to the workers */
+    if (ebpf)
+        tap_sync_filter_hits(&g_tap_ctx);
+    /* Everything that can fail on the userspace side, before the kernel ACL changes */
+    fs = filter_reload_prepare(&cfg->filter);
+    if (!fs) {
+        fprintf(stderr, "Filter reload failed, keeping current rules: %s\n", strerror(ENOMEM));
+        config_free(cfg);
+        return;
+    }
+    /* The TC program keeps evaluating the ACL itself: switch its rule bank first */
+    if (ebpf && g_tap_ctx.filter_in_kernel) {
+        err = tap_load_filter(&g_tap_ctx, &cfg->filter);
+        if (err == -E2BIG && g_capture_mode == RUNTIME_MODE_EBPF) {
+            /*
+             * Too many rules for the kernel: filter in the workers, as at
+             * startup. They take over the current rules before the kernel
+             * stops applying them, so the two never disagree.
+             */
+            err = workers_filter_in_userspace(&g_worker_ctx);
+            if (err == 0) {
+                err = tap_unload_filter(&g_tap_ctx);
+            }
+            if (err == 0) {
+                fprintf(stderr, "In-kernel filter unavailable (%s); filtering in userspace\n",
+                        strerror(E2BIG));
+            }
+        }
+        if (err) {
+            fprintf(stderr, "Filter reload failed, keeping current rules: in-kernel ACL: %s\n",
+                    strerror(-err));
+            filter_reload_abort(fs);
+            config_free(cfg);
+            return;
+        }
+    }
+    filter_reload_commit(fs);
+
+    if (g_filter_owner != g_tap_config) {
+        config_free(g_filter_owner);
+    }
+    g_filter_owner = cfg;
+    printf("Filter reloaded from %s: %u rule(s), default %s\n", path, cfg->filter.num_rules,
+           cfg->filter.default_action == FILTER_ACTION_DROP ? "drop" : "allow");
 }
 
 /* Previous stats for calculating per-interval rates */
@@ -147,6 +227,31 @@ static void print_stats_generic(struct worker_stats *stats, double elapsed_sec)
     printf("Truncated: %lu total, %lu bytes removed\n",
            (unsigned long)stats->packets_truncated,
            (unsigned long)stats->bytes_truncated);
+    if (stats->packets_tx_full > 0) {
+        printf("TX ring full: %lu dropped\n", (unsigned long)stats->packets_tx_full);
+    }
+    if (stats->packets_cutoff > 0) {
+        printf("Flow cutoff: %lu not sent, %lu bytes\n",
+               (unsigned long)stats->packets_cutoff, (unsigned long)stats->bytes_cutoff);
+    }
+    if (stats->packets_dup > 0) {
+        printf("Duplicates: %lu suppressed, %lu bytes\n",
+               (unsigned long)stats->packets_dup, (unsigned long)stats->bytes_dup);
+    }
+    if (stats->packets_sampled_out > 0) {
+        printf("Sampled out: %lu not sent, %lu bytes\n",
+               (unsigned long)stats->packets_sampled_out,
+               (unsigned long)stats->bytes_sampled_out);
+    }
+    if (stats->packets_clamped > 0) {
+        printf("Clamped: %lu total (longer than the output MTU or TX frame)\n",
+               (unsigned long)stats->packets_clamped);
+    }
+    if (g_capture_mode == RUNTIME_MODE_AFXDP && !g_tunnel_ctx) {
+        printf("Forwarding: %lu copy-free, %lu copied\n",
+               (unsigned long)stats->packets_copy_free,
+               (unsigned long)(stats->packets_sent - stats->packets_copy_free));
+    }
     printf("----------------------------------\n");
 
     /* Save current stats for next interval */
@@ -169,23 +274,48 @@ static void print_tunnel_stats_if_active(void)
         tname = (g_tap_config->tunnel.type == TUNNEL_TYPE_VXLAN) ? "VXLAN" : "GRE";
     }
     printf("Tunnel (%s): %lu packets sent, %lu bytes\n", tname, (unsigned long)pkts, (unsigned long)bytes);
+
+    /* Per-remote breakdown when load balancing */
+    if (g_tap_config && g_tap_config->tunnel.num_remotes > 1) {
+        struct tunnel_remote_stats rs[TUNNEL_MAX_REMOTES];
+        unsigned int i, n = tunnel_get_remote_stats(g_tunnel_ctx, rs, TUNNEL_MAX_REMOTES);
+
+        for (i = 0; i < n; i++)
+            printf("  Remote %s (%s): %lu packets sent, %lu bytes, %lu dropped\n",
+                   rs[i].ip, rs[i].up ? "up" : "down", (unsigned long)rs[i].packets_sent,
+                   (unsigned long)rs[i].bytes_sent, (unsigned long)rs[i].packets_dropped);
+    }
+}
+
+/* Monotonic clock in milliseconds, for the --validate-config timings */
+static double monotonic_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
 }
 
 /*
  * Dump filter rules and per-rule counters. Only called when show_filter_stats
- * and g_filter_config are set (no aggregation/print without the flag).
+ * is set and a filter is published (no aggregation/print without the flag).
  */
 static void print_filter_stats_dump(void)
 {
-    const struct filter_config *cfg = g_filter_config;
+    const struct filter_state *fs = filter_current();
+    const struct filter_config *cfg;
     unsigned int i;
     char line[256];
 
-    if (!cfg)
+    if (!fs)
         return;
+    cfg = fs->cfg;
+    /* eBPF modes: rule hits are counted in the TC program when the ACL runs in the kernel */
+    if (g_capture_mode == RUNTIME_MODE_EBPF || g_capture_mode == RUNTIME_MODE_EBPF_REDIRECT)
+        tap_sync_filter_hits(&g_tap_ctx);
     printf("\n--- Filter rules (hits) ---\n");
     for (i = 0; i <= cfg->num_rules; i++) {
-        uint64_t count = atomic_load(&filter_rule_hits[i]);
+        uint64_t count = filter_hits_get(fs, i);
         filter_format_rule(cfg, i, line, sizeof(line));
         printf("  %s  -> %lu\n", line, (unsigned long)count);
     }
@@ -334,6 +464,11 @@ static void collect_and_print_stats(double elapsed_sec, bool show_filter_stats,
 
     if (g_capture_mode == RUNTIME_MODE_AFPACKET) {
         afpacket_get_stats(&g_afpacket_ctx, &stats);
+    } else if (g_capture_mode == RUNTIME_MODE_AFXDP) {
+        afxdp_get_stats(&g_afxdp_ctx, &stats);
+    } else if (g_capture_mode == RUNTIME_MODE_EBPF_REDIRECT) {
+        tap_get_redirect_stats(&g_tap_ctx, &stats);
+        tap_sync_tunnel(&g_tap_ctx);
     } else {
         workers_get_stats(&g_worker_ctx, &stats);
     }
@@ -349,7 +484,7 @@ static void collect_and_print_stats(double elapsed_sec, bool show_filter_stats,
     print_stats_generic(&stats, elapsed_sec);
     print_tunnel_stats_if_active();
 
-    if (show_filter_stats && g_filter_config)
+    if (show_filter_stats && filter_current())
         print_filter_stats_dump();
 
     if (show_resource_usage)
@@ -360,6 +495,7 @@ int main(int argc, char **argv)
 {
     struct cli_args args;
     time_t start_time, last_stats_time;
+    double t_load, t_compile, t_done;
     int err;
     int ret;
 
@@ -381,14 +517,29 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    t_load = monotonic_ms();
     g_tap_config = config_load(args.config_path);
     if (!g_tap_config) {
         fprintf(stderr, "Config error: %s\n", config_get_error());
         return 1;
     }
-    filter_set_config(&g_tap_config->filter);
-    filter_stats_reset(g_tap_config->filter.num_rules);
+    t_compile = monotonic_ms();
+    if (filter_set_config(&g_tap_config->filter) != 0) {
+        fprintf(stderr, "Filter compile failed: %s\n", strerror(ENOMEM));
+        config_free(g_tap_config);
+        return 1;
+    }
+    t_done = monotonic_ms();
+    g_filter_owner = g_tap_config;
     if (args.validate_config) {
+        const struct filter_config *fcfg = &g_tap_config->filter;
+        size_t rules_mem = (size_t)fcfg->num_rules * sizeof(struct filter_rule);
+        size_t fc_mem = filter_classifier_mem(filter_current()->fc);
+
+        printf("Filter rules:     %u (parse %.1f ms, compile %.1f ms)\n",
+               fcfg->num_rules, t_compile - t_load, t_done - t_compile);
+        printf("Filter memory:    %.1f KiB (rules %.1f KiB, classifier %.1f KiB)\n",
+               (rules_mem + fc_mem) / 1024.0, rules_mem / 1024.0, fc_mem / 1024.0);
         printf("Config valid.\n");
         config_free(g_tap_config);
         g_tap_config = NULL;
@@ -423,24 +574,54 @@ int main(int argc, char **argv)
     setvbuf(stderr, NULL, _IONBF, 0);
 
     printf("=== vasn_tap v%s (%s %s) ===\n", VERSION, VASN_TAP_GIT_COMMIT, VASN_TAP_BUILD_DATETIME);
-    printf("Capture mode:     %s\n", g_capture_mode == RUNTIME_MODE_AFPACKET ? "afpacket" : "ebpf");
+    printf("Capture mode:     %s\n", g_capture_mode == RUNTIME_MODE_AFPACKET ? "afpacket" :
+                                     g_capture_mode == RUNTIME_MODE_AFXDP ? "afxdp" :
+                                     g_capture_mode == RUNTIME_MODE_EBPF_REDIRECT ? "ebpf-redirect" : "ebpf");
     printf("Input interface:  %s\n", g_tap_config->runtime.input_iface);
     printf("Output interface: %s\n",
            g_tap_config->runtime.output_iface[0] ? g_tap_config->runtime.output_iface : "(drop mode)");
-    printf("Worker threads:   %d\n",
-           g_tap_config->runtime.workers > 0 ? g_tap_config->runtime.workers : get_nprocs());
+    if (g_capture_mode == RUNTIME_MODE_EBPF_REDIRECT) {
+        printf("Worker threads:   none (mirrored in the kernel)\n");
+    } else {
+        printf("Worker threads:   %d\n",
+               g_tap_config->runtime.workers > 0 ? g_tap_config->runtime.workers : get_nprocs());
+    }
     printf("Truncate:         %s\n",
            g_tap_config->runtime.truncate.enabled ? "enabled" : "disabled");
     if (g_tap_config->runtime.truncate.enabled) {
         printf("Truncate length:  %u\n", (unsigned)g_tap_config->runtime.truncate.length);
     }
+    if (g_tap_config->runtime.flow_cutoff.enabled) {
+        printf("Flow cutoff:      %u bytes, %u packets (0 = no limit), idle %u ms\n",
+               (unsigned)g_tap_config->runtime.flow_cutoff.bytes,
+               (unsigned)g_tap_config->runtime.flow_cutoff.packets,
+               (unsigned)g_tap_config->runtime.flow_cutoff.idle_timeout_ms);
+    }
+    if (g_tap_config->runtime.dedup.enabled) {
+        printf("Dedup window:     %u us\n", (unsigned)g_tap_config->runtime.dedup.window_us);
+    }
+    if (g_tap_config->runtime.sampling.mode == SAMPLING_PACKET) {
+        printf("Sampling:         1 in %u packets\n",
+               (unsigned)g_tap_config->runtime.sampling.rate);
+    } else if (g_tap_config->runtime.sampling.mode == SAMPLING_FLOW) {
+        printf("Sampling:         %u%% of flows\n",
+               (unsigned)g_tap_config->runtime.sampling.flow_percent);
+    }
     printf("Filter config:    %s\n", args.config_path);
     if (g_tap_config && g_tap_config->tunnel.enabled) {
+        const char *remotes[TUNNEL_MAX_REMOTES];
+        unsigned int r;
+
+        for (r = 0; r < g_tap_config->tunnel.num_remotes; r++)
+            remotes[r] = g_tap_config->tunnel.remotes[r];
         err = tunnel_init(&g_tunnel_ctx,
                          g_tap_config->tunnel.type,
-                         g_tap_config->tunnel.remote_ip,
+                         remotes,
+                         g_tap_config->tunnel.num_remotes,
                          g_tap_config->tunnel.vni,
                          g_tap_config->tunnel.dstport,
+                         g_tap_config->tunnel.srcport_min,
+                         g_tap_config->tunnel.srcport_max,
                          g_tap_config->tunnel.key,
                          g_tap_config->tunnel.local_ip[0] ? g_tap_config->tunnel.local_ip : NULL,
                          g_tap_config->runtime.output_iface);
@@ -473,6 +654,11 @@ int main(int argc, char **argv)
         aconfig.debug = g_tap_config->runtime.debug;
         aconfig.truncate_enabled = g_tap_config->runtime.truncate.enabled;
         aconfig.truncate_length = g_tap_config->runtime.truncate.length;
+        aconfig.rx_ring = g_tap_config->runtime.rx_ring;
+        aconfig.tx_ring = g_tap_config->runtime.tx_ring;
+        aconfig.flow_cutoff = g_tap_config->runtime.flow_cutoff;
+        aconfig.dedup = g_tap_config->runtime.dedup;
+        aconfig.sampling = g_tap_config->runtime.sampling;
 
         err = afpacket_init(&g_afpacket_ctx, &aconfig);
         if (err) {
@@ -486,6 +672,98 @@ int main(int argc, char **argv)
             afpacket_cleanup(&g_afpacket_ctx);
             return 1;
         }
+    } else if (g_capture_mode == RUNTIME_MODE_AFXDP) {
+        /* --- AF_XDP mode (ingress only; input traffic is consumed) --- */
+        struct afxdp_config xconfig = {0};
+        snprintf(xconfig.input_ifname, sizeof(xconfig.input_ifname), "%s", g_tap_config->runtime.input_iface);
+        xconfig.input_ifindex = if_nametoindex(g_tap_config->runtime.input_iface);
+        if (xconfig.input_ifindex == 0) {
+            fprintf(stderr, "Error: Input interface %s not found\n", g_tap_config->runtime.input_iface);
+            return 1;
+        }
+        if (g_tap_config->runtime.output_iface[0]) {
+            snprintf(xconfig.output_ifname, sizeof(xconfig.output_ifname), "%s", g_tap_config->runtime.output_iface);
+            xconfig.output_ifindex = g_tunnel_ctx ? 0 : if_nametoindex(g_tap_config->runtime.output_iface);
+        }
+        xconfig.tunnel_ctx = g_tunnel_ctx;
+        xconfig.num_workers = g_tap_config->runtime.workers;
+        xconfig.verbose = g_tap_config->runtime.verbose;
+        xconfig.debug = g_tap_config->runtime.debug;
+        xconfig.truncate_enabled = g_tap_config->runtime.truncate.enabled;
+        xconfig.truncate_length = g_tap_config->runtime.truncate.length;
+        xconfig.zero_copy = g_tap_config->runtime.afxdp.zero_copy;
+        xconfig.xdp_mode = g_tap_config->runtime.afxdp.xdp_mode;
+        xconfig.hugepages = g_tap_config->runtime.rx_ring.hugepages;
+        xconfig.tx_ring = g_tap_config->runtime.tx_ring;
+        xconfig.flow_cutoff = g_tap_config->runtime.flow_cutoff;
+        xconfig.dedup = g_tap_config->runtime.dedup;
+        xconfig.sampling = g_tap_config->runtime.sampling;
+
+        err = afxdp_init(&g_afxdp_ctx, &xconfig);
+        if (err) {
+            fprintf(stderr, "Failed to initialize AF_XDP: %s\n", strerror(-err));
+            return 1;
+        }
+
+        err = afxdp_start(&g_afxdp_ctx);
+        if (err) {
+            fprintf(stderr, "Failed to start AF_XDP workers: %s\n", strerror(-err));
+            afxdp_cleanup(&g_afxdp_ctx);
+            return 1;
+        }
+    } else if (g_capture_mode == RUNTIME_MODE_EBPF_REDIRECT) {
+        /* --- eBPF redirect mode: no workers, the TC program mirrors --- */
+        err = tap_init(&g_tap_ctx, g_tap_config->runtime.input_iface);
+        if (err) {
+            fprintf(stderr, "Failed to initialize tap: %s\n", strerror(-err));
+            return 1;
+        }
+
+        /* No userspace path to fall back on: the ACL has to fit the kernel */
+        err = tap_load_filter(&g_tap_ctx, &g_tap_config->filter);
+        if (err) {
+            fprintf(stderr, "Failed to load in-kernel filter: %s\n", strerror(-err));
+            tap_cleanup(&g_tap_ctx);
+            return 1;
+        }
+
+        err = tap_set_flow_cutoff(&g_tap_ctx, &g_tap_config->runtime.flow_cutoff);
+        if (err) {
+            fprintf(stderr, "Failed to set up the flow cutoff: %s\n", strerror(-err));
+            tap_cleanup(&g_tap_ctx);
+            return 1;
+        }
+
+        err = tap_set_dedup(&g_tap_ctx, &g_tap_config->runtime.dedup);
+        if (err) {
+            fprintf(stderr, "Failed to set up duplicate suppression: %s\n", strerror(-err));
+            tap_cleanup(&g_tap_ctx);
+            return 1;
+        }
+
+        err = tap_set_sampling(&g_tap_ctx, &g_tap_config->runtime.sampling);
+        if (err) {
+            fprintf(stderr, "Failed to set up sampling: %s\n", strerror(-err));
+            tap_cleanup(&g_tap_ctx);
+            return 1;
+        }
+
+        err = tap_set_redirect(&g_tap_ctx, g_tap_config->runtime.output_iface,
+                               g_tap_config->runtime.truncate.enabled ?
+                               g_tap_config->runtime.truncate.length : 0,
+                               g_tunnel_ctx);
+        if (err) {
+            fprintf(stderr, "Failed to set up in-kernel mirroring: %s\n", strerror(-err));
+            tap_cleanup(&g_tap_ctx);
+            return 1;
+        }
+
+        err = tap_attach(&g_tap_ctx);
+        if (err) {
+            fprintf(stderr, "Failed to attach eBPF programs: %s\n", strerror(-err));
+            tap_cleanup(&g_tap_ctx);
+            return 1;
+        }
     } else {
         /* --- eBPF mode --- */
         struct worker_config wconfig = {0};
@@ -494,6 +772,8 @@ int main(int argc, char **argv)
         wconfig.debug = g_tap_config->runtime.debug;
         wconfig.truncate_enabled = g_tap_config->runtime.truncate.enabled;
         wconfig.truncate_length = g_tap_config->runtime.truncate.length;
+        wconfig.tx_ring = g_tap_config->runtime.tx_ring;
+        wconfig.ringbuf_size = g_tap_config->runtime.ringbuf_size;
         if (g_tap_config->runtime.output_iface[0]) {
             snprintf(wconfig.output_ifname, sizeof(wconfig.output_ifname), "%s", g_tap_config->runtime.output_iface);
             wconfig.output_ifindex = g_tunnel_ctx ? 0 : if_nametoindex(g_tap_config->runtime.output_iface);
@@ -506,6 +786,36 @@ int main(int argc, char **argv)
             return 1;
         }
 
+        /* Evaluate the ACL in the TC program when it fits; else filter in workers */
+        err = tap_load_filter(&g_tap_ctx, &g_tap_config->filter);
+        if (err) {
+            fprintf(stderr, "In-kernel filter unavailable (%s); filtering in userspace\n",
+                    strerror(-err));
+        }
+        wconfig.filter_in_kernel = g_tap_ctx.filter_in_kernel;
+
+        /* Flows are counted in the TC program, before the ring buffer copy */
+        err = tap_set_flow_cutoff(&g_tap_ctx, &g_tap_config->runtime.flow_cutoff);
+        if (err) {
+            fprintf(stderr, "Failed to set up the flow cutoff: %s\n", strerror(-err));
+            tap_cleanup(&g_tap_ctx);
+            return 1;
+        }
+
+        err = tap_set_dedup(&g_tap_ctx, &g_tap_config->runtime.dedup);
+        if (err) {
+            fprintf(stderr, "Failed to set up duplicate suppression: %s\n", strerror(-err));
+            tap_cleanup(&g_tap_ctx);
+            return 1;
+        }
+
+        err = tap_set_sampling(&g_tap_ctx, &g_tap_config->runtime.sampling);
+        if (err) {
+            fprintf(stderr, "Failed to set up sampling: %s\n", strerror(-err));
+            tap_cleanup(&g_tap_ctx);
+            return 1;
+        }
+
         err = workers_init(&g_worker_ctx, g_tap_ctx.obj, &wconfig);
         if (err) {
             fprintf(stderr, "Failed to initialize workers: %s\n", strerror(-err));
@@ -531,7 +841,7 @@ int main(int argc, char **argv)
         }
     }
 
-    printf("\nPacket tap running. Press Ctrl+C to stop.\n");
+    printf("\nPacket tap running. Press Ctrl+C to stop, send SIGHUP to reload the filter.\n");
 
     /* Main loop - wait for signal */
     start_time = time(NULL);
@@ -540,6 +850,16 @@ int main(int argc, char **argv)
     while (g_running) {
         sleep(1);
 
+        if (g_reload) {
+            g_reload = 0;
+            reload_filter(args.config_path);
+        }
+
+        /* Follow tunnel remotes going up/down and changing MAC in the TC program's maps */
+        if (g_capture_mode == RUNTIME_MODE_EBPF_REDIRECT) {
+            tap_sync_tunnel(&g_tap_ctx);
+        }
+
         if (g_tap_config->runtime.show_stats) {
             time_t now = time(NULL);
             if (now - last_stats_time >= STATS_INTERVAL_SEC) {
@@ -558,32 +878,46 @@ int main(int argc, char **argv)
                                 g_tap_config->runtime.show_filter_stats,
                                 g_tap_config->runtime.show_resource_usage);
 
-        /* Print per-worker breakdown for AF_PACKET (useful for fanout verification) */
+        /* Print per-worker breakdown for AF_PACKET / AF_XDP (useful for fanout verification) */
         if (g_capture_mode == RUNTIME_MODE_AFPACKET) {
             afpacket_print_per_worker_stats(&g_afpacket_ctx);
+        } else if (g_capture_mode == RUNTIME_MODE_AFXDP) {
+            afxdp_print_per_worker_stats(&g_afxdp_ctx);
         }
     }
 
     /* Cleanup based on mode */
     printf("Cleaning up...\n");
-    if (g_tunnel_ctx) {
-        tunnel_cleanup(g_tunnel_ctx);
-        g_tunnel_ctx = NULL;
-    }
-    filter_set_config(NULL);
-    if (g_tap_config) {
-        config_free(g_tap_config);
-        g_tap_config = NULL;
-    }
     if (g_capture_mode == RUNTIME_MODE_AFPACKET) {
         afpacket_stop(&g_afpacket_ctx);
         afpacket_cleanup(&g_afpacket_ctx);
+    } else if (g_capture_mode == RUNTIME_MODE_AFXDP) {
+        afxdp_stop(&g_afxdp_ctx);
+        afxdp_cleanup(&g_afxdp_ctx);
+    } else if (g_capture_mode == RUNTIME_MODE_EBPF_REDIRECT) {
+        tap_detach(&g_tap_ctx);
+        tap_cleanup(&g_tap_ctx);
     } else {
         workers_stop(&g_worker_ctx);
         tap_detach(&g_tap_ctx);
         workers_cleanup(&g_worker_ctx);
         tap_cleanup(&g_tap_ctx);
     }
+    /* After the backend: workers' tunnel senders reference the context */
+    if (g_tunnel_ctx) {
+        tunnel_cleanup(g_tunnel_ctx);
+        g_tunnel_ctx = NULL;
+    }
+    /* Workers read the filter until they stop */
+    filter_set_config(NULL);
+    if (g_filter_owner != g_tap_config) {
+        config_free(g_filter_owner);
+    }
+    g_filter_owner = NULL;
+    if (g_tap_config) {
+        config_free(g_tap_config);
+        g_tap_config = NULL;
+    }
 
     printf("Done.\n");
     return 0;
@@ -0,0 +1,264 @@
+/*
+ * vasn_tap - Single-pass packet parser
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "parse.h"
+
+#define ETH_HLEN          14
+#define VLAN_HLEN         4
+#define MPLS_HLEN         4
+#define IPV6_HLEN         40
+#define ETHERTYPE_IP      0x0800
+#define ETHERTYPE_IPV6    0x86DD
+#define ETHERTYPE_VLAN    0x8100
+#define ETHERTYPE_QINQ    0x88A8
+#define ETHERTYPE_QINQ_OLD 0x9100	/* Pre-802.1ad S-tag */
+#define ETHERTYPE_MPLS    0x8847
+#define ETHERTYPE_MPLS_MC 0x8848
+#ifndef IPPROTO_TCP
+#define IPPROTO_TCP    6
+#endif
+#ifndef IPPROTO_UDP
+#define IPPROTO_UDP    17
+#endif
+#ifndef IPPROTO_SCTP
+#define IPPROTO_SCTP   132
+#endif
+
+/* IPv6 extension headers skipped on the way to the upper-layer protocol */
+#define IP6_NH_HOPOPTS  0
+#define IP6_NH_ROUTING  43
+#define IP6_NH_FRAGMENT 44
+#define IP6_NH_AH       51
+#define IP6_NH_DSTOPTS  60
+
+static inline uint16_t get_u16(const uint8_t *p)
+{
+	return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t get_u32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline uint64_t get_u64(const uint8_t *p)
+{
+	return (uint64_t)get_u32(p) << 32 | get_u32(p + 4);
+}
+
+static inline bool is_vlan_tpid(uint16_t t)
+{
+	return t == ETHERTYPE_VLAN || t == ETHERTYPE_QINQ || t == ETHERTYPE_QINQ_OLD;
+}
+
+static inline bool is_ip6_ext(uint8_t nh)
+{
+	return nh == IP6_NH_HOPOPTS || nh == IP6_NH_ROUTING || nh == IP6_NH_FRAGMENT ||
+	       nh == IP6_NH_AH || nh == IP6_NH_DSTOPTS;
+}
+
+/* TCP/UDP ports at l4_off (SCTP ports too, for the flow hash only) */
+static inline void parse_ports(const uint8_t *pkt, uint32_t pkt_len, struct pkt_desc *pd)
+{
+	if ((pd->protocol == IPPROTO_TCP || pd->protocol == IPPROTO_UDP ||
+	     pd->protocol == IPPROTO_SCTP) && pkt_len >= pd->l4_off + 4u) {
+		pd->port_src = get_u16(pkt + pd->l4_off);
+		pd->port_dst = get_u16(pkt + pd->l4_off + 2);
+		if (pd->protocol != IPPROTO_SCTP)
+			pd->flags |= PKT_F_PORTS;
+	}
+}
+
+static void parse_ipv4(const uint8_t *pkt, uint32_t pkt_len, uint32_t off, struct pkt_desc *pd)
+{
+	const uint8_t *ip = pkt + off;
+	uint32_t ihl;
+
+	if (pkt_len < off + 20u)
+		return;
+	ihl = (ip[0] & 0x0f) * 4u;
+	if (ihl < 20 || pkt_len < off + ihl)
+		return;
+
+	pd->flags |= PKT_F_IPV4;
+	pd->l3_off = (uint16_t)off;
+	pd->l4_off = (uint16_t)(off + ihl);
+	pd->protocol = ip[9];
+	pd->ip_src = get_u32(ip + 12);
+	pd->ip_dst = get_u32(ip + 16);
+	if ((ip[6] & 0x3f) != 0 || ip[7] != 0)
+		pd->flags |= PKT_F_FRAGMENT;
+	parse_ports(pkt, pkt_len, pd);
+}
+
+/*
+ * IPv6 header at off, then up to PKT_MAX_IP6_EXT extension headers. A deeper
+ * or truncated chain leaves protocol and l4_off zero. A non-first fragment ends
+ * the walk at its fragment header: what follows is payload, so no ports.
+ */
+static void parse_ipv6(const uint8_t *pkt, uint32_t pkt_len, uint32_t off, struct pkt_desc *pd)
+{
+	const uint8_t *ip = pkt + off;
+	uint32_t l4 = off + IPV6_HLEN;
+	unsigned int i;
+	uint8_t nh;
+
+	if (pkt_len < off + IPV6_HLEN)
+		return;
+	nh = ip[6];
+
+	pd->flags |= PKT_F_IPV6;
+	pd->l3_off = (uint16_t)off;
+	pd->ip6_src[0] = get_u64(ip + 8);
+	pd->ip6_src[1] = get_u64(ip + 16);
+	pd->ip6_dst[0] = get_u64(ip + 24);
+	pd->ip6_dst[1] = get_u64(ip + 32);
+
+	for (i = 0; is_ip6_ext(nh); i++) {
+		const uint8_t *x = pkt + l4;
+
+		if (i == PKT_MAX_IP6_EXT || pkt_len < l4 + 8u)
+			return;
+		if (nh == IP6_NH_FRAGMENT) {
+			uint16_t frag = get_u16(x + 2);	/* Offset (13 bits), 2 reserved, M */
+
+			nh = x[0];
+			l4 += 8;
+			if (frag & 0xfff9)
+				pd->flags |= PKT_F_FRAGMENT;
+			if (frag & 0xfff8) {
+				pd->protocol = nh;
+				pd->l4_off = (uint16_t)l4;
+				return;
+			}
+			continue;
+		}
+		l4 += nh == IP6_NH_AH ? (x[1] + 2u) * 4u : (x[1] + 1u) * 8u;
+		nh = x[0];
+	}
+	if (l4 > pkt_len)
+		return;
+	pd->protocol = nh;
+	pd->l4_off = (uint16_t)l4;
+	parse_ports(pkt, pkt_len, pd);
+}
+
+/*
+ * Everything but untagged IPv4: VLAN tags, then IPv6, an MPLS label stack or
+ * the IPv4-at-18 guess. Sets eth_type and the VLAN fields, advances *off to
+ * the L3 header and returns its IP version (0: none).
+ */
+static unsigned int parse_l2(const uint8_t *pkt, uint32_t pkt_len, uint32_t *off,
+                             struct pkt_desc *pd)
+{
+	uint16_t eth_type = pd->eth_type;
+	unsigned int i, ihl;
+
+	/* 802.1Q / 802.1ad tags: the ethertype after the last one names the payload */
+	while (is_vlan_tpid(eth_type) && pd->vlan_count < PKT_MAX_VLANS &&
+	       pkt_len >= *off + VLAN_HLEN) {
+		uint16_t vid = get_u16(pkt + *off) & 0x0fff;
+
+		if (pd->vlan_count == 0)
+			pd->vlan_outer = vid;
+		else if (pd->vlan_count == 1)
+			pd->vlan_inner = vid;
+		pd->vlan_count++;
+		eth_type = get_u16(pkt + *off + 2);
+		*off += VLAN_HLEN;
+	}
+	pd->eth_type = eth_type;
+
+	if (eth_type == ETHERTYPE_IP)
+		return 4;
+	if (eth_type == ETHERTYPE_IPV6)
+		return 6;
+	if (eth_type == ETHERTYPE_MPLS || eth_type == ETHERTYPE_MPLS_MC) {
+		/* Labels down to bottom-of-stack; the payload's version nibble picks IPv4 or IPv6 */
+		for (i = 0; i < PKT_MAX_MPLS && pkt_len >= *off + MPLS_HLEN; i++) {
+			*off += MPLS_HLEN;
+			if (!(pkt[*off - 2] & 0x01))
+				continue;
+			if (pkt_len > *off && ((pkt[*off] >> 4) == 4 || (pkt[*off] >> 4) == 6))
+				return pkt[*off] >> 4;
+			break;
+		}
+	}
+
+	/* Fallback: look for IPv4 at offset 18 in case L2 is 18 bytes (e.g. VLAN with no 0x0800/0x8100 at 12) */
+	if (pkt_len >= 18u + 20u && (pkt[18] & 0xf0) == 0x40) {
+		ihl = (pkt[18] & 0x0f) * 4u;
+		if (ihl >= 20 && 18u + ihl <= pkt_len) {
+			*off = 18;
+			pd->eth_type = ETHERTYPE_IP;
+			pd->flags |= PKT_F_L3_GUESSED;
+			return 4;
+		}
+	}
+	return 0;
+}
+
+static inline uint32_t fold64(uint64_t v)
+{
+	return (uint32_t)(v ^ (v >> 32));
+}
+
+/* pkt_parse() and pkt_parse_vlan(); a stripped outer tag is the first tag */
+static void parse_frame(const uint8_t *pkt, uint32_t pkt_len, bool stripped,
+                        uint16_t vlan_tci, struct pkt_desc *pd)
+{
+	uint32_t off = ETH_HLEN;
+	unsigned int ver = 4;
+
+	/* The IPv6 addresses are left as they are: only read under PKT_F_IPV6 */
+	memset(pd, 0, offsetof(struct pkt_desc, ip6_src));
+	pd->len = pkt_len;
+	if (stripped) {
+		pd->vlan_outer = vlan_tci & 0x0fff;
+		pd->vlan_count = 1;
+	}
+	if (!pkt || pkt_len < ETH_HLEN)
+		return;
+
+	/* Untagged IPv4 needs no L2 walk */
+	pd->eth_type = get_u16(pkt + 12);
+	if (pd->eth_type != ETHERTYPE_IP)
+		ver = parse_l2(pkt, pkt_len, &off, pd);
+	if (ver == 4)
+		parse_ipv4(pkt, pkt_len, off, pd);
+	else if (ver == 6)
+		parse_ipv6(pkt, pkt_len, off, pd);
+
+	if (pd->flags & (PKT_F_IPV4 | PKT_F_IPV6)) {
+		/* Ports only on unfragmented TCP/UDP/SCTP: later fragments carry none */
+		uint32_t ports = (pd->flags & PKT_F_FRAGMENT) ? 0 :
+		                 (uint32_t)pd->port_src << 16 | pd->port_dst;
+		uint32_t src = pd->ip_src, dst = pd->ip_dst, h;
+
+		if (pd->flags & PKT_F_IPV6) {
+			src = hash_mix32(fold64(pd->ip6_src[0]) * 0x9e3779b1u ^ fold64(pd->ip6_src[1]));
+			dst = fold64(pd->ip6_dst[0]) * 0x9e3779b1u ^ fold64(pd->ip6_dst[1]);
+		}
+		h = hash_mix32(src * 0x9e3779b1u ^ dst);
+		pd->flow_hash = hash_mix32(h ^ ports ^ ((uint32_t)pd->protocol << 24));
+	} else {
+		/* Non-IP: MAC pair and ethertype still separate conversations */
+		uint32_t m0, m1, m2;
+		memcpy(&m0, pkt, 4); memcpy(&m1, pkt + 4, 4); memcpy(&m2, pkt + 8, 4);
+		pd->flow_hash = hash_mix32(m0 ^ hash_mix32(m1 ^ hash_mix32(m2 ^ pd->eth_type)));
+	}
+}
+
+void pkt_parse(const void *pkt, uint32_t pkt_len, struct pkt_desc *pd)
+{
+	parse_frame((const uint8_t *)pkt, pkt_len, false, 0, pd);
+}
+
+void pkt_parse_vlan(const void *pkt, uint32_t pkt_len, uint16_t vlan_tci, struct pkt_desc *pd)
+{
+	parse_frame((const uint8_t *)pkt, pkt_len, true, vlan_tci, pd);
+}
@@ -0,0 +1,73 @@
+/*
+ * vasn_tap - Single-pass packet parser
+ * pkt_parse() walks L2 (stacked 802.1Q/802.1ad tags, an MPLS label stack), IPv4
+ * or IPv6 (skipping extension headers) and the L4 ports once per packet and
+ * fills a pkt_desc; filter, truncation and tunnel loop detection read the
+ * descriptor instead of re-parsing the frame.
+ */
+
+#ifndef __PARSE_H__
+#define __PARSE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* pkt_desc.flags */
+#define PKT_F_IPV4       0x01	/* l3_off/l4_off, protocol and IPs are valid */
+#define PKT_F_PORTS      0x02	/* TCP or UDP ports are valid */
+#define PKT_F_FRAGMENT   0x04	/* IPv4 or IPv6 fragment (MF set or non-zero offset) */
+#define PKT_F_L3_GUESSED 0x08	/* IPv4 found at offset 18 without a matching ethertype */
+#define PKT_F_IPV6       0x10	/* l3_off/l4_off, protocol and ip6 addresses are valid */
+
+/* Parse bounds: deeper stacks stop the walk (no L3 / no upper-layer protocol) */
+#define PKT_MAX_VLANS    4
+#define PKT_MAX_MPLS     8
+#define PKT_MAX_IP6_EXT  8
+
+/* Parsed headers of one frame. Offsets are from the start of the frame. */
+struct pkt_desc {
+	uint32_t len;		/* Frame length that was parsed */
+	uint32_t flow_hash;	/* 5-tuple hash (IPv4/IPv6), else MACs + ethertype */
+	uint32_t ip_src;	/* Canonical (host) order, as config parse_cidr */
+	uint32_t ip_dst;
+	uint16_t eth_type;	/* Ethertype after the VLAN tags (0x8847/0x8848 for MPLS) */
+	uint16_t l3_off;	/* IPv4 / IPv6 header (0: none) */
+	uint16_t l4_off;	/* First byte after the IP header and IPv6 extension headers (0: none) */
+	uint16_t port_src;
+	uint16_t port_dst;
+	uint16_t vlan_outer;	/* VID of the first tag (vlan_count >= 1), stripped or in the frame */
+	uint16_t vlan_inner;	/* VID of the second tag (vlan_count >= 2) */
+	uint8_t vlan_count;
+	uint8_t protocol;	/* IPv4 protocol or final IPv6 next header */
+	uint8_t flags;		/* PKT_F_* */
+	/* Set only with PKT_F_IPV6; pkt_parse() does not clear them, so read them only then: */
+	uint64_t ip6_src[2];	/* Host order: [0] = first 8 bytes, [1] = last 8 */
+	uint64_t ip6_dst[2];
+};
+
+/* Final avalanche of a 32-bit hash (murmur3 fmix32) */
+static inline uint32_t hash_mix32(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+/*
+ * Parse pkt_len bytes at pkt into *pd. Never fails: fields that are not present
+ * (short frame, non-IP) are left zero and their flag clear, except the IPv6
+ * addresses, which are only valid with PKT_F_IPV6. Thread-safe.
+ */
+void pkt_parse(const void *pkt, uint32_t pkt_len, struct pkt_desc *pd);
+
+/*
+ * pkt_parse() for a frame whose outer tag the kernel already stripped into
+ * metadata (TP_STATUS_VLAN_VALID + tp_vlan_tci, skb->vlan_tci): vlan_tci is
+ * the first tag, and the tags still in the frame come after it.
+ */
+void pkt_parse_vlan(const void *pkt, uint32_t pkt_len, uint16_t vlan_tci, struct pkt_desc *pd);
+
+#endif /* __PARSE_H__ */
@@ -0,0 +1,51 @@
+/*
+ * vasn_tap - Deterministic sampling (runtime.sampling)
+ */
+
+#include <string.h>
+
+#include "sample.h"
+
+void sampler_init(struct sampler *s, const struct sampling_config *cfg)
+{
+    memset(s, 0, sizeof(*s));
+    if (!cfg)
+        return;
+    s->mode = cfg->mode;
+    s->rate = cfg->rate ? cfg->rate : 1;
+    /* flow_percent of the 2^32 hash space; 100 keeps every flow */
+    s->flow_threshold = ((uint64_t)cfg->flow_percent << 32) / 100;
+}
+
+static inline uint32_t fold64(uint64_t v)
+{
+    return (uint32_t)(v ^ (v >> 32));
+}
+
+uint32_t sample_flow_hash(const struct pkt_desc *pd)
+{
+    uint32_t a, b, t;
+    uint16_t pa = 0, pb = 0, pt;
+
+    if (!(pd->flags & (PKT_F_IPV4 | PKT_F_IPV6)))
+        return pd->flow_hash;
+
+    if (pd->flags & PKT_F_IPV6) {
+        a = hash_mix32(fold64(pd->ip6_src[0]) * 0x9e3779b1u ^ fold64(pd->ip6_src[1]));
+        b = hash_mix32(fold64(pd->ip6_dst[0]) * 0x9e3779b1u ^ fold64(pd->ip6_dst[1]));
+    } else {
+        a = pd->ip_src;
+        b = pd->ip_dst;
+    }
+    /* Fragments after the first carry no ports: leave them out for all */
+    if ((pd->flags & PKT_F_PORTS) && !(pd->flags & PKT_F_FRAGMENT)) {
+        pa = pd->port_src;
+        pb = pd->port_dst;
+    }
+    if (a > b || (a == b && pa > pb)) {
+        t = a; a = b; b = t;
+        pt = pa; pa = pb; pb = pt;
+    }
+    t = hash_mix32(a * 0x9e3779b1u ^ b);
+    return hash_mix32(t ^ ((uint32_t)pa << 16 | pb) ^ ((uint32_t)pd->protocol << 24));
+}
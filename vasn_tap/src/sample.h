@@ -0,0 +1,49 @@
+/*
+ * vasn_tap - Deterministic sampling (runtime.sampling)
+ * One sampler per worker, owned by that worker: no lock and no atomics. The
+ * same traffic in the same worker order is always sampled the same way.
+ */
+
+#ifndef __SAMPLE_H__
+#define __SAMPLE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+#include "parse.h"
+
+struct sampler {
+    enum sampling_mode mode;      /* SAMPLING_NONE = forward everything */
+    uint32_t rate;                /* packet: keep 1 in rate */
+    uint32_t countdown;           /* packet: packets still to skip (0 = keep the next) */
+    uint64_t flow_threshold;      /* flow: keep if sample_flow_hash() is below this */
+};
+
+/* Set up a sampler from the config (SAMPLING_NONE gives a pass-through sampler) */
+void sampler_init(struct sampler *s, const struct sampling_config *cfg);
+
+/*
+ * Flow key hash for flow sampling: addresses, protocol and (unfragmented)
+ * ports in a canonical order, so both directions of a conversation hash the
+ * same. Frames without IP use pkt_desc.flow_hash.
+ */
+uint32_t sample_flow_hash(const struct pkt_desc *pd);
+
+/* True if the packet is sampled out: the caller counts and skips it */
+static inline bool sampler_skip(struct sampler *s, const struct pkt_desc *pd)
+{
+    if (s->mode == SAMPLING_PACKET) {
+        if (s->countdown > 0) {
+            s->countdown--;
+            return true;
+        }
+        s->countdown = s->rate - 1;
+        return false;
+    }
+    if (s->mode == SAMPLING_FLOW)
+        return (uint64_t)sample_flow_hash(pd) >= s->flow_threshold;
+    return false;
+}
+
+#endif /* __SAMPLE_H__ */
@@ -9,17 +9,28 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <stdatomic.h>
 #include <unistd.h>
 #include <net/if.h>
 #include <bpf/bpf.h>
 #include <bpf/libbpf.h>
 
 #include "tap.h"
+#include "filter.h"
+#include "worker.h"
+#include "tunnel.h"
+#include "flow.h"
+#include "ebpf/tc_clone.h"
 #include "../include/common.h"
 
 /* Path to compiled eBPF object */
 #define BPF_OBJ_PATH "tc_clone.bpf.o"
 
+_Static_assert(TC_TUNNEL_MAX_REMOTES == TUNNEL_MAX_REMOTES, "tunnel_remotes map size");
+_Static_assert(TC_TUNNEL_HDR_MAX == TUNNEL_HDR_MAX, "tunnel header template size");
+_Static_assert(TC_TUNNEL_NO_REMOTE == TUNNEL_NO_REMOTE, "tunnel_lb empty slot");
+_Static_assert(TC_FLOW_TABLE_SIZE == FLOW_TABLE_SIZE, "flow_table map size");
+
 /* Libbpf print callback for debug/error messages */
 static int libbpf_print_fn(enum libbpf_print_level level, const char *format, va_list args)
 {
@@ -89,43 +100,48 @@ static int pin_bpf_prog(int prog_fd, const char *path)
 }
 
 /*
- * Attach TC program using tc command
+ * Our TC filters sit at one fixed pref/handle on each hook, so attaching and
+ * detaching never touch the filters an operator has on the same device
+ */
+#define TAP_TC_PREF   0x7661
+#define TAP_TC_HANDLE 1
+
+/*
+ * Detach our TC program using tc command (no-op if it is not there)
  */
-static int attach_tc_prog_cmd(const char *ifname, const char *pin_path,
-                               const char *direction, const char *section)
+static void detach_tc_prog_cmd(const char *ifname, const char *direction)
+{
+    run_tc_cmd("tc filter del dev %s %s pref %u handle %u protocol all bpf 2>/dev/null",
+               ifname, direction, TAP_TC_PREF, TAP_TC_HANDLE);
+}
+
+/*
+ * Attach the pinned TC program using tc command. It must be the program of
+ * our loaded object: a copy loaded from the object file would have maps of
+ * its own that nothing configures, so there is no fallback.
+ */
+static int attach_tc_prog_cmd(const char *ifname, const char *pin_path, const char *direction)
 {
     int ret;
 
-    /* First try to delete any existing filter */
-    run_tc_cmd("tc filter del dev %s %s 2>/dev/null", ifname, direction);
+    /* Only a filter of ours that an earlier run left behind */
+    detach_tc_prog_cmd(ifname, direction);
 
-    /* Attach BPF program using pinned path */
-    ret = run_tc_cmd("tc filter add dev %s %s bpf da pinned %s",
-                     ifname, direction, pin_path);
+    ret = run_tc_cmd("tc filter add dev %s %s pref %u handle %u protocol all bpf da pinned %s",
+                     ifname, direction, TAP_TC_PREF, TAP_TC_HANDLE, pin_path);
     if (ret != 0) {
-        /* Fallback: try with object file and section */
-        ret = run_tc_cmd("tc filter add dev %s %s bpf da obj %s sec %s",
-                         ifname, direction, BPF_OBJ_PATH, section);
-        if (ret != 0) {
-            fprintf(stderr, "Failed to attach TC %s program on %s\n",
-                    direction, ifname);
-            return -EINVAL;
-        }
+        fprintf(stderr, "Failed to attach TC %s program on %s (pref %u handle %u)\n",
+                direction, ifname, TAP_TC_PREF, TAP_TC_HANDLE);
+        return -EINVAL;
     }
     return 0;
 }
 
-/*
- * Detach TC program using tc command
- */
-static void detach_tc_prog_cmd(const char *ifname, const char *direction)
-{
-    run_tc_cmd("tc filter del dev %s %s 2>/dev/null", ifname, direction);
-}
-
 int tap_init(struct tap_ctx *ctx, const char *ifname)
 {
     struct bpf_program *prog;
+    struct bpf_map *map;
+    int ncpus;
     int err;
 
     if (!ctx || !ifname) {
@@ -133,6 +149,7 @@ int tap_init(struct tap_ctx *ctx, const char *ifname)
     }
 
     memset(ctx, 0, sizeof(*ctx));
+    ctx->filter_bank_fd = -1;
     snprintf(ctx->ifname, sizeof(ctx->ifname), "%s", ifname);
 
     /* Get interface index */
@@ -153,6 +170,17 @@ int tap_init(struct tap_ctx *ctx, const char *ifname)
         return err;
     }
 
+    /* Size the per-CPU sample staging map to the number of possible CPUs */
+    map = bpf_object__find_map_by_name(ctx->obj, SCRATCH_MAP_NAME);
+    ncpus = libbpf_num_possible_cpus();
+    if (map && ncpus > 0) {
+        err = bpf_map__set_max_entries(map, (__u32)ncpus);
+        if (err) {
+            fprintf(stderr, "Failed to size %s map: %s\n", SCRATCH_MAP_NAME, strerror(-err));
+            goto err_close;
+        }
+    }
+
     err = bpf_object__load(ctx->obj);
     if (err) {
         fprintf(stderr, "Failed to load BPF object: %s\n", strerror(-err));
@@ -187,6 +215,571 @@ err_close:
     return err;
 }
 
+/* Sum of one per-CPU map slot over all CPUs (vals: ncpus entries of scratch) */
+static uint64_t percpu_sum(int fd, __u32 key, __u64 *vals, int ncpus)
+{
+    uint64_t sum = 0;
+    int c;
+
+    if (bpf_map_lookup_elem(fd, &key, vals) != 0) {
+        return 0;
+    }
+    for (c = 0; c < ncpus; c++) {
+        sum += vals[c];
+    }
+    return sum;
+}
+
+static int find_map_fd(struct bpf_object *obj, const char *name)
+{
+    struct bpf_map *map = bpf_object__find_map_by_name(obj, name);
+
+    return map ? bpf_map__fd(map) : -ENOENT;
+}
+
+/* Rule i of cfg as the TC program matches it */
+static void tc_rule_from(const struct filter_rule *rule, struct tc_filter_rule *r)
+{
+    const struct filter_match *m = &rule->match;
+
+    memset(r, 0, sizeof(*r));
+    if (m->has_eth_type) {
+        r->fields |= TC_F_ETH_TYPE;
+        r->eth_type = m->eth_type;
+    }
+    if (m->has_ip_src) {
+        r->fields |= TC_F_IP_SRC;
+        r->ip_src = m->ip_src;
+        r->ip_src_mask = m->ip_src_mask;
+    }
+    if (m->has_ip_dst) {
+        r->fields |= TC_F_IP_DST;
+        r->ip_dst = m->ip_dst;
+        r->ip_dst_mask = m->ip_dst_mask;
+    }
+    if (m->has_ip6_src) {
+        r->fields |= TC_F_IP6_SRC;
+        memcpy(r->ip6_src, m->ip6_src, sizeof(r->ip6_src));
+        memcpy(r->ip6_src_mask, m->ip6_src_mask, sizeof(r->ip6_src_mask));
+    }
+    if (m->has_ip6_dst) {
+        r->fields |= TC_F_IP6_DST;
+        memcpy(r->ip6_dst, m->ip6_dst, sizeof(r->ip6_dst));
+        memcpy(r->ip6_dst_mask, m->ip6_dst_mask, sizeof(r->ip6_dst_mask));
+    }
+    if (m->has_protocol) {
+        r->fields |= TC_F_PROTOCOL;
+        r->protocol = m->protocol;
+    }
+    if (m->has_vlan) {
+        r->fields |= TC_F_VLAN;
+        r->vlan = m->vlan;
+    }
+    if (m->has_inner_vlan) {
+        r->fields |= TC_F_INNER_VLAN;
+        r->inner_vlan = m->inner_vlan;
+    }
+    if (m->has_port_src) {
+        r->fields |= TC_F_PORT_SRC;
+        r->port_src = m->port_src;
+    }
+    if (m->has_port_dst) {
+        r->fields |= TC_F_PORT_DST;
+        r->port_dst = m->port_dst;
+    }
+    r->action = rule->action == FILTER_ACTION_DROP ? TC_FILTER_DROP : TC_FILTER_ALLOW;
+}
+
+int tap_load_filter(struct tap_ctx *ctx, const struct filter_config *cfg)
+{
+    struct tc_filter_bank *b = NULL;
+    int outer_fd, hits_fd, bank_fd = -1;
+    unsigned int *map = NULL;
+    uint64_t *base = NULL;
+    __u64 *vals = NULL;
+    __u32 row, old_row;
+    unsigned int i;
+    int ncpus;
+    int err = 0;
+    __u32 key;
+
+    if (!ctx || !ctx->obj) {
+        return -EINVAL;
+    }
+
+    if (!cfg) {
+        return 0;
+    }
+    if (cfg->num_rules > TC_FILTER_MAX_RULES) {
+        return -E2BIG;
+    }
+
+    outer_fd = find_map_fd(ctx->obj, FILTER_BANK_MAP_NAME);
+    hits_fd = find_map_fd(ctx->obj, FILTER_HITS_MAP_NAME);
+    if (outer_fd < 0 || hits_fd < 0) {
+        return -ENOENT;
+    }
+    ncpus = libbpf_num_possible_cpus();
+    if (ncpus <= 0) {
+        return ncpus < 0 ? ncpus : -EINVAL;
+    }
+
+    /* Always the hit row the loaded bank (if any) does not count into */
+    old_row = ctx->filter_bank;
+    row = old_row ^ 1;
+
+    b = calloc(1, sizeof(*b));
+    vals = calloc(ncpus, sizeof(*vals));
+    base = calloc(cfg->num_rules + 1, sizeof(*base));
+    if (ctx->filter_in_kernel) {
+        map = malloc((cfg->num_rules + 1) * sizeof(*map));
+    }
+    if (!b || !vals || !base || (ctx->filter_in_kernel &&
+                                 (!map || filter_rule_map(ctx->filter_cfg, cfg, map) != 0))) {
+        err = -ENOMEM;
+        goto out;
+    }
+
+    /* Zero that row: what is left there is from an older load */
+    for (i = 0; i <= cfg->num_rules; i++) {
+        key = row * TC_FILTER_HITS + i;
+        if (bpf_map_update_elem(hits_fd, &key, vals, BPF_ANY) != 0) {
+            err = -errno;
+            fprintf(stderr, "Failed to reset BPF filter hits: %s\n", strerror(-err));
+            goto out;
+        }
+    }
+
+    /* The whole bank goes into a map no TC program can see yet */
+    for (i = 0; i < cfg->num_rules; i++) {
+        tc_rule_from(&cfg->rules[i], &b->rules[i]);
+    }
+    b->state.enabled = 1;
+    b->state.num_rules = cfg->num_rules;
+    b->state.default_action = cfg->default_action == FILTER_ACTION_DROP ? TC_FILTER_DROP : TC_FILTER_ALLOW;
+    b->state.hits = row;
+
+    bank_fd = bpf_map_create(BPF_MAP_TYPE_ARRAY, "vasn_acl", sizeof(__u32),
+                             sizeof(struct tc_filter_bank), 1, NULL);
+    if (bank_fd < 0) {
+        err = -errno;
+        fprintf(stderr, "Failed to create BPF filter bank: %s\n", strerror(-err));
+        goto out;
+    }
+    key = 0;
+    if (bpf_map_update_elem(bank_fd, &key, b, BPF_ANY) != 0) {
+        err = -errno;
+        fprintf(stderr, "Failed to load filter rules into BPF: %s\n", strerror(-err));
+        goto out;
+    }
+
+    /*
+     * Publish. For a map-in-map the kernel returns from the update only after
+     * an RCU grace period (synchronize_rcu()), so no TC program still reads
+     * the old bank or counts into its row once this succeeds.
+     */
+    if (bpf_map_update_elem(outer_fd, &key, &bank_fd, BPF_ANY) != 0) {
+        err = -errno;
+        fprintf(stderr, "Failed to enable BPF filter: %s\n", strerror(-err));
+        goto out;
+    }
+
+    /* The old row is final: its totals carry over to the identical rules */
+    if (ctx->filter_in_kernel) {
+        for (i = 0; i <= cfg->num_rules; i++) {
+            unsigned int o = map[i];
+
+            if (o == FILTER_NO_RULE) {
+                continue;
+            }
+            base[i] = ctx->filter_hits_base[o] +
+                      percpu_sum(hits_fd, old_row * TC_FILTER_HITS + o, vals, ncpus);
+        }
+    }
+
+    if (ctx->filter_bank_fd >= 0) {
+        close(ctx->filter_bank_fd);
+    }
+    ctx->filter_bank_fd = bank_fd;
+    bank_fd = -1;
+    free(ctx->filter_hits_base);
+    ctx->filter_hits_base = base;
+    base = NULL;
+    ctx->filter_cfg = cfg;
+    ctx->filter_bank = row;
+    ctx->filter_in_kernel = true;
+    ctx->filter_num_rules = cfg->num_rules;
+    printf("Loaded %u filter rule(s) into TC program (in-kernel ACL)\n", cfg->num_rules);
+
+out:
+    if (bank_fd >= 0) {
+        close(bank_fd);
+    }
+    free(map);
+    free(base);
+    free(vals);
+    free(b);
+    return err;
+}
+
+int tap_unload_filter(struct tap_ctx *ctx)
+{
+    int outer_fd;
+    __u32 key = 0;
+
+    if (!ctx || !ctx->obj) {
+        return -EINVAL;
+    }
+    if (!ctx->filter_in_kernel) {
+        return 0;
+    }
+    outer_fd = find_map_fd(ctx->obj, FILTER_BANK_MAP_NAME);
+    if (outer_fd < 0) {
+        return -ENOENT;
+    }
+
+    /* No bank: the TC program passes everything (returns after a grace period, as a load) */
+    if (bpf_map_delete_elem(outer_fd, &key) != 0) {
+        return -errno;
+    }
+    close(ctx->filter_bank_fd);
+    ctx->filter_bank_fd = -1;
+    ctx->filter_in_kernel = false;
+    ctx->filter_num_rules = 0;
+    printf("In-kernel ACL disabled; filtering in userspace\n");
+    return 0;
+}
+
+void tap_sync_filter_hits(struct tap_ctx *ctx)
+{
+    const struct filter_state *fs = filter_current();
+    __u64 *vals;
+    int ncpus, fd;
+    __u32 i;
+
+    if (!ctx || !ctx->obj || !ctx->filter_in_kernel || !fs) {
+        return;
+    }
+
+    fd = find_map_fd(ctx->obj, FILTER_HITS_MAP_NAME);
+    ncpus = libbpf_num_possible_cpus();
+    if (fd < 0 || ncpus <= 0) {
+        return;
+    }
+
+    vals = calloc(ncpus, sizeof(*vals));
+    if (!vals) {
+        return;
+    }
+    for (i = 0; i <= ctx->filter_num_rules && i <= fs->cfg->num_rules; i++) {
+        uint64_t sum = percpu_sum(fd, ctx->filter_bank * TC_FILTER_HITS + i, vals, ncpus);
+
+        counter_set(&filter_hits_row(fs, fs->readers)[i], ctx->filter_hits_base[i] + sum);
+    }
+    free(vals);
+}
+
+/* Remote headers and lookup table into the tunnel maps, when the tunnel changed since the last call */
+static int sync_tunnel_maps(struct tap_ctx *ctx, const struct tunnel_encap *enc)
+{
+    struct tc_tunnel_remote r;
+    uint8_t lb[TC_TUNNEL_LB_SIZE];
+    int remotes_fd, lb_fd;
+    __u32 i, v;
+
+    if (ctx->tunnel_synced && enc->generation == ctx->tunnel_generation) {
+        return 0;
+    }
+    remotes_fd = find_map_fd(ctx->obj, TUNNEL_REMOTES_MAP_NAME);
+    lb_fd = find_map_fd(ctx->obj, TUNNEL_LB_MAP_NAME);
+    if (remotes_fd < 0 || lb_fd < 0) {
+        return -ENOENT;
+    }
+
+    /* Headers first: a slot never points at a remote without them */
+    for (i = 0; i < enc->num_remotes; i++) {
+        memcpy(r.hdr, enc->hdr[i], sizeof(r.hdr));
+        if (bpf_map_update_elem(remotes_fd, &i, &r, BPF_ANY) != 0) {
+            return -errno;
+        }
+    }
+    tunnel_lb_sample(ctx->tunnel, lb, TC_TUNNEL_LB_SIZE);
+    for (i = 0; i < TC_TUNNEL_LB_SIZE; i++) {
+        v = lb[i];
+        if (bpf_map_update_elem(lb_fd, &i, &v, BPF_ANY) != 0) {
+            return -errno;
+        }
+    }
+    ctx->tunnel_generation = enc->generation;
+    ctx->tunnel_synced = true;
+    return 0;
+}
+
+int tap_set_flow_cutoff(struct tap_ctx *ctx, const struct flow_cutoff_config *fc)
+{
+    struct tc_flow_cutoff val = {0};
+    __u32 key = 0;
+    int fd;
+
+    if (!ctx || !ctx->obj || !fc) {
+        return -EINVAL;
+    }
+    if (!fc->enabled) {
+        return 0;
+    }
+
+    fd = find_map_fd(ctx->obj, FLOW_CUTOFF_MAP_NAME);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to find '%s' map in BPF object\n", FLOW_CUTOFF_MAP_NAME);
+        return -ENOENT;
+    }
+    val.bytes = fc->bytes;
+    val.packets = fc->packets;
+    val.idle_ns = (__u64)fc->idle_timeout_ms * 1000000ull;
+    if (bpf_map_update_elem(fd, &key, &val, BPF_ANY) < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+int tap_set_dedup(struct tap_ctx *ctx, const struct dedup_config *dc)
+{
+    __u64 window_ns;
+    __u32 key = 0;
+    int fd;
+
+    if (!ctx || !ctx->obj || !dc) {
+        return -EINVAL;
+    }
+    if (!dc->enabled) {
+        return 0;
+    }
+
+    fd = find_map_fd(ctx->obj, DEDUP_MAP_NAME);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to find '%s' map in BPF object\n", DEDUP_MAP_NAME);
+        return -ENOENT;
+    }
+    window_ns = (__u64)dc->window_us * 1000ull;
+    if (bpf_map_update_elem(fd, &key, &window_ns, BPF_ANY) < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+int tap_set_sampling(struct tap_ctx *ctx, const struct sampling_config *sc)
+{
+    struct tc_sampling val = {0};
+    __u32 key = 0;
+    int fd;
+
+    if (!ctx || !ctx->obj || !sc) {
+        return -EINVAL;
+    }
+    if (sc->mode == SAMPLING_NONE) {
+        return 0;
+    }
+
+    fd = find_map_fd(ctx->obj, SAMPLING_MAP_NAME);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to find '%s' map in BPF object\n", SAMPLING_MAP_NAME);
+        return -ENOENT;
+    }
+    val.mode = sc->mode == SAMPLING_PACKET ? TC_SAMPLE_PACKET : TC_SAMPLE_FLOW;
+    val.rate = sc->rate ? sc->rate : 1;
+    val.flow_threshold = ((__u64)sc->flow_percent << 32) / 100;
+    if (bpf_map_update_elem(fd, &key, &val, BPF_ANY) < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+int tap_set_redirect(struct tap_ctx *ctx, const char *out_ifname, uint32_t snap_len,
+                     struct tunnel_ctx *tunnel)
+{
+    struct tc_clone_cfg cfg = {0};
+    struct tunnel_encap enc;
+    struct bpf_program *prog;
+    char pin_path[256];
+    __u32 key = 0;
+    int ifindex, fd, err;
+
+    if (!ctx || !ctx->obj || !out_ifname) {
+        return -EINVAL;
+    }
+
+    ifindex = if_nametoindex(out_ifname);
+    if (ifindex == 0) {
+        fprintf(stderr, "Output interface %s not found\n", out_ifname);
+        return -ENODEV;
+    }
+    /* A plain clone sent out of the input would hit the egress hook and be mirrored again */
+    if (ifindex == ctx->ifindex && !tunnel) {
+        fprintf(stderr, "Output interface must differ from input interface %s\n", ctx->ifname);
+        return -EINVAL;
+    }
+
+    fd = find_map_fd(ctx->obj, CONFIG_MAP_NAME);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to find '%s' map in BPF object\n", CONFIG_MAP_NAME);
+        return fd;
+    }
+
+    snprintf(ctx->redirect_ifname, sizeof(ctx->redirect_ifname), "%s", out_ifname);
+    ctx->tunnel = tunnel;
+
+    if (tunnel) {
+        err = tunnel_get_encap(tunnel, &enc);
+        if (!err) {
+            err = sync_tunnel_maps(ctx, &enc);
+        }
+        if (err) {
+            fprintf(stderr, "Failed to load tunnel into BPF maps: %s\n", strerror(-err));
+            return err;
+        }
+        cfg.tunnel_type = enc.type == TUNNEL_TYPE_VXLAN ? TC_TUNNEL_VXLAN : TC_TUNNEL_GRE;
+        cfg.tunnel_max_inner = enc.max_inner;
+        cfg.tunnel_num_remotes = enc.num_remotes;
+        cfg.tunnel_srcport_min = enc.srcport_min;
+        cfg.tunnel_srcport_range = enc.srcport_range;
+    }
+
+    /*
+     * Output hook goes in first, so no clone leaves unprocessed. On the input
+     * device, tc_egress handles the clones itself.
+     */
+    if ((snap_len > 0 || tunnel) && ifindex != ctx->ifindex) {
+        prog = bpf_object__find_program_by_name(ctx->obj, "tc_mirror_out");
+        if (!prog) {
+            fprintf(stderr, "Failed to find tc_mirror_out program\n");
+            return -ENOENT;
+        }
+        err = create_clsact_qdisc(out_ifname);
+        if (err) {
+            return err;
+        }
+        run_tc_cmd("mkdir -p /sys/fs/bpf/vasn_tap 2>/dev/null");
+        snprintf(pin_path, sizeof(pin_path), "/sys/fs/bpf/vasn_tap/%s_mirror", out_ifname);
+        err = pin_bpf_prog(bpf_program__fd(prog), pin_path);
+        if (err) {
+            return err;
+        }
+        err = attach_tc_prog_cmd(out_ifname, pin_path, "egress");
+        if (err) {
+            unlink(pin_path);
+            return err;
+        }
+        ctx->mirror_out_attached = true;
+    }
+    if (snap_len > 0) {
+        printf("Truncating mirrored packets to %u bytes on %s egress\n", snap_len, out_ifname);
+    }
+
+    cfg.snap_len = snap_len;
+    cfg.redirect_ifindex = (__u32)ifindex;
+    if (bpf_map_update_elem(fd, &key, &cfg, BPF_ANY) != 0) {
+        err = -errno;
+        fprintf(stderr, "Failed to write BPF config map: %s\n", strerror(-err));
+        return err;
+    }
+    ctx->redirect_ifindex = ifindex;
+    printf("Mirroring to %s in the TC program (bpf_clone_redirect%s)\n", out_ifname,
+           !tunnel ? "" : enc.type == TUNNEL_TYPE_VXLAN ? ", VXLAN" : ", GRE");
+    return 0;
+}
+
+void tap_sync_tunnel(struct tap_ctx *ctx)
+{
+    struct tc_tunnel_stats *vals;
+    struct tunnel_encap enc;
+    int ncpus, fd, c;
+    __u32 i;
+
+    if (!ctx || !ctx->obj || !ctx->tunnel) {
+        return;
+    }
+    if (tunnel_get_encap(ctx->tunnel, &enc) != 0) {
+        return;
+    }
+    if (sync_tunnel_maps(ctx, &enc) != 0) {
+        fprintf(stderr, "Failed to update tunnel BPF maps\n");
+    }
+
+    fd = find_map_fd(ctx->obj, TUNNEL_STATS_MAP_NAME);
+    ncpus = libbpf_num_possible_cpus();
+    if (fd < 0 || ncpus <= 0) {
+        return;
+    }
+    vals = calloc(ncpus, sizeof(*vals));
+    if (!vals) {
+        return;
+    }
+    for (i = 0; i < enc.num_remotes; i++) {
+        uint64_t packets = 0, bytes = 0, dropped = 0;
+
+        if (bpf_map_lookup_elem(fd, &i, vals) != 0) {
+            continue;
+        }
+        for (c = 0; c < ncpus; c++) {
+            packets += vals[c].packets;
+            bytes += vals[c].bytes;
+            dropped += vals[c].dropped;
+        }
+        tunnel_set_external_stats(ctx->tunnel, i, packets, bytes, dropped);
+    }
+    free(vals);
+}
+
+void tap_get_redirect_stats(struct tap_ctx *ctx, struct worker_stats *total)
+{
+    uint64_t c[TC_CNT_MAX];
+    __u64 *vals;
+    int ncpus, fd;
+    __u32 i;
+
+    if (!total) {
+        return;
+    }
+    memset(total, 0, sizeof(*total));
+    if (!ctx || !ctx->obj) {
+        return;
+    }
+
+    fd = find_map_fd(ctx->obj, COUNTERS_MAP_NAME);
+    ncpus = libbpf_num_possible_cpus();
+    if (fd < 0 || ncpus <= 0) {
+        return;
+    }
+    vals = calloc(ncpus, sizeof(*vals));
+    if (!vals) {
+        return;
+    }
+    for (i = 0; i < TC_CNT_MAX; i++) {
+        c[i] = percpu_sum(fd, i, vals, ncpus);
+    }
+    free(vals);
+
+    total->packets_received = c[TC_CNT_REDIRECT] + c[TC_CNT_REDIRECT_FAIL] +
+                              c[TC_CNT_FILTER_DROP] + c[TC_CNT_CUTOFF] + c[TC_CNT_DUP] +
+                              c[TC_CNT_SAMPLED_OUT];
+    total->bytes_received = c[TC_CNT_REDIRECT_BYTES] + c[TC_CNT_REDIRECT_FAIL_BYTES] +
+                            c[TC_CNT_FILTER_DROP_BYTES] + c[TC_CNT_CUTOFF_BYTES] +
+                            c[TC_CNT_DUP_BYTES] + c[TC_CNT_SAMPLED_OUT_BYTES];
+    total->packets_sent = c[TC_CNT_REDIRECT];
+    /* Clones are cut on the way out, after the redirect counted their full length */
+    total->bytes_sent = c[TC_CNT_REDIRECT_BYTES] > c[TC_CNT_SNAP_BYTES] ?
+                        c[TC_CNT_REDIRECT_BYTES] - c[TC_CNT_SNAP_BYTES] : 0;
+    total->packets_dropped = c[TC_CNT_REDIRECT_FAIL] + c[TC_CNT_FILTER_DROP];
+    total->packets_truncated = c[TC_CNT_SNAP];
+    total->bytes_truncated = c[TC_CNT_SNAP_BYTES];
+    total->packets_cutoff = c[TC_CNT_CUTOFF];
+    total->bytes_cutoff = c[TC_CNT_CUTOFF_BYTES];
+    total->packets_dup = c[TC_CNT_DUP];
+    total->bytes_dup = c[TC_CNT_DUP_BYTES];
+    total->packets_sampled_out = c[TC_CNT_SAMPLED_OUT];
+    total->bytes_sampled_out = c[TC_CNT_SAMPLED_OUT_BYTES];
+}
+
 int tap_attach(struct tap_ctx *ctx)
 {
     int err;
@@ -213,7 +806,7 @@ int tap_attach(struct tap_ctx *ctx)
         return err;
     }
 
-    err = attach_tc_prog_cmd(ctx->ifname, pin_path, "ingress", "classifier/ingress");
+    err = attach_tc_prog_cmd(ctx->ifname, pin_path, "ingress");
     if (err) {
         unlink(pin_path);
         return err;
@@ -231,7 +824,7 @@ int tap_attach(struct tap_ctx *ctx)
         return err;
     }
 
-    err = attach_tc_prog_cmd(ctx->ifname, pin_path, "egress", "classifier/egress");
+    err = attach_tc_prog_cmd(ctx->ifname, pin_path, "egress");
     if (err) {
         detach_tc_prog_cmd(ctx->ifname, "ingress");
         snprintf(pin_path, sizeof(pin_path), "/sys/fs/bpf/vasn_tap/%s_ingress",
@@ -281,8 +874,27 @@ void tap_cleanup(struct tap_ctx *ctx)
         tap_detach(ctx);
     }
 
+    /* After the input hooks: no more clones reach the output device */
+    if (ctx->mirror_out_attached) {
+        char pin_path[256];
+
+        detach_tc_prog_cmd(ctx->redirect_ifname, "egress");
+        snprintf(pin_path, sizeof(pin_path), "/sys/fs/bpf/vasn_tap/%s_mirror",
+                 ctx->redirect_ifname);
+        unlink(pin_path);
+        ctx->mirror_out_attached = false;
+    }
+    ctx->tunnel = NULL;
+
     if (ctx->obj) {
         bpf_object__close(ctx->obj);
         ctx->obj = NULL;
     }
+    if (ctx->filter_bank_fd >= 0) {
+        close(ctx->filter_bank_fd);
+        ctx->filter_bank_fd = -1;
+    }
+    free(ctx->filter_hits_base);
+    ctx->filter_hits_base = NULL;
+    ctx->filter_cfg = NULL;
 }
@@ -7,9 +7,16 @@
 #define __TAP_H__
 
 #include <stdbool.h>
+#include <stdint.h>
 
 /* Forward declarations */
 struct bpf_object;
+struct filter_config;
+struct flow_cutoff_config;
+struct dedup_config;
+struct sampling_config;
+struct worker_stats;
+struct tunnel_ctx;
 
 /* Tap context structure */
 struct tap_ctx {
@@ -19,6 +26,18 @@ struct tap_ctx {
     int ifindex;                   /* Interface index */
     char ifname[64];               /* Interface name */
     bool attached;                 /* Whether programs are attached */
+    bool filter_in_kernel;         /* ACL compiled into BPF maps (tap_load_filter) */
+    unsigned int filter_num_rules; /* Rule count loaded into the kernel ACL */
+    unsigned int filter_bank;      /* Hit counter row of the loaded bank (tc_filter_state.hits) */
+    int filter_bank_fd;            /* Inner filter_bank map of the loaded ACL (-1: none) */
+    const struct filter_config *filter_cfg; /* Config in that bank (hit carry-over) */
+    uint64_t *filter_hits_base;    /* Per slot: hits carried over from earlier loads */
+    int redirect_ifindex;          /* ebpf-redirect output device (0 = ring buffer mode) */
+    char redirect_ifname[64];
+    bool mirror_out_attached;      /* tc_mirror_out attached to redirect_ifname egress */
+    struct tunnel_ctx *tunnel;     /* ebpf-redirect: encapsulated in the TC program (not owned) */
+    unsigned int tunnel_generation; /* tunnel_encap.generation loaded into the maps */
+    bool tunnel_synced;
 };
 
 /*
@@ -29,6 +48,101 @@ struct tap_ctx {
  */
 int tap_init(struct tap_ctx *ctx, const char *ifname);
 
+/*
+ * Compile filter rules into the BPF ACL maps so denied packets are dropped
+ * in the TC program and never copied to userspace. Every call builds a new
+ * rule bank map and swaps it in with one map-in-map update, which returns
+ * after an RCU grace period; on a reload, hit counts then carry over to
+ * identical rules.
+ * @param ctx: Initialized tap context
+ * @param cfg: Filter config (NULL = no filtering); must stay valid until the
+ *             next call or tap_cleanup()
+ * @return: 0 on success (ctx->filter_in_kernel set), -E2BIG if the rules do
+ *          not fit the BPF rule map (caller keeps filtering in userspace),
+ *          other negative errno on failure; the ACL already loaded, if
+ *          any, stays in place on failure
+ */
+int tap_load_filter(struct tap_ctx *ctx, const struct filter_config *cfg);
+
+/*
+ * Turn the in-kernel ACL off (the TC program passes every packet to the
+ * workers) once they filter in userspace; no-op if it is not loaded
+ * @param ctx: Tap context
+ * @return: 0 on success, negative errno on failure (the ACL stays on)
+ */
+int tap_unload_filter(struct tap_ctx *ctx);
+
+/*
+ * Copy in-kernel ACL hit counts (summed over CPUs, plus carried-over counts)
+ * into the current filter's own hit row (the workers do not count these)
+ * No-op unless the ACL was loaded with tap_load_filter()
+ * @param ctx: Tap context
+ */
+void tap_sync_filter_hits(struct tap_ctx *ctx);
+
+/*
+ * Apply runtime.flow_cutoff in the TC program: packets the ACL allows are
+ * dropped (before the ring buffer copy or the redirect) once their flow is
+ * past the limit. Flows live in an LRU hash map of TC_FLOW_TABLE_SIZE entries.
+ * @param ctx: Initialized tap context
+ * @param fc: Cutoff policy (no-op unless enabled)
+ * @return: 0 on success, negative errno on failure
+ */
+int tap_set_flow_cutoff(struct tap_ctx *ctx, const struct flow_cutoff_config *fc);
+
+/*
+ * Apply runtime.dedup in the TC program: a packet matching one seen within
+ * the window (on either hook, any CPU) is dropped before the ACL, counted as
+ * TC_CNT_DUP. Signatures live in a TC_DEDUP_TABLE_SIZE-slot array map.
+ * @param ctx: Initialized tap context
+ * @param dc: Dedup settings (no-op unless enabled)
+ * @return: 0 on success, negative errno on failure
+ */
+int tap_set_dedup(struct tap_ctx *ctx, const struct dedup_config *dc);
+
+/*
+ * Apply runtime.sampling in the TC program: packets it leaves out are counted
+ * as TC_CNT_SAMPLED_OUT before the ACL and are never copied or cloned.
+ * @param ctx: Initialized tap context
+ * @param sc: Sampling settings (no-op for SAMPLING_NONE)
+ * @return: 0 on success, negative errno on failure
+ */
+int tap_set_sampling(struct tap_ctx *ctx, const struct sampling_config *sc);
+
+/*
+ * ebpf-redirect: make the TC programs clone every packet the ACL allows
+ * straight to out_ifname (bpf_clone_redirect) instead of the ring buffers.
+ * With snap_len or a tunnel, tc_mirror_out on the egress of out_ifname cuts
+ * the clones to snap_len bytes and encapsulates them; the device's own
+ * traffic and its other TC filters are left alone. Fails if tc_mirror_out
+ * cannot be attached, since the clones would then go out unprocessed.
+ * Call before tap_attach().
+ * @param ctx: Initialized tap context
+ * @param out_ifname: Output interface (may be the input interface only with a tunnel)
+ * @param snap_len: Truncate mirrored packets to this length (0 = full)
+ * @param tunnel: Encapsulate as this tunnel (NULL = none); must outlive ctx
+ * @return: 0 on success, negative errno on failure
+ */
+int tap_set_redirect(struct tap_ctx *ctx, const char *out_ifname, uint32_t snap_len,
+                     struct tunnel_ctx *tunnel);
+
+/*
+ * ebpf-redirect with a tunnel: reload the remote headers and lookup table
+ * into the BPF maps if the health thread changed them, and hand the
+ * per-CPU tunnel counters to tunnel_set_external_stats(). Call periodically
+ * from the stats thread; no-op without a tunnel.
+ * @param ctx: Tap context
+ */
+void tap_sync_tunnel(struct tap_ctx *ctx);
+
+/*
+ * ebpf-redirect: fill total from the per-CPU counters of the TC programs
+ * (received = mirrored + failed + denied by the ACL + past the flow cutoff)
+ * @param ctx: Tap context
+ * @param total: Output stats
+ */
+void tap_get_redirect_stats(struct tap_ctx *ctx, struct worker_stats *total);
+
 /*
  * Attach eBPF programs to TC hooks
  * @param ctx: Initialized tap context
@@ -7,12 +7,6 @@
 
 #include "truncate.h"
 
-#define ETH_HLEN_LOCAL 14u
-#define VLAN_HLEN_LOCAL 4u
-#define ETH_P_IP_LOCAL 0x0800u
-#define ETH_P_8021Q_LOCAL 0x8100u
-#define ETH_P_8021AD_LOCAL 0x88A8u
-
 static uint16_t csum16(const uint8_t *buf, uint32_t len)
 {
     uint32_t sum = 0;
@@ -30,17 +24,13 @@ static uint16_t csum16(const uint8_t *buf, uint32_t len)
     return (uint16_t)(~sum);
 }
 
-static uint16_t be16_at(const uint8_t *p)
-{
-    return (uint16_t)((p[0] << 8) | p[1]);
-}
-
-uint32_t truncate_apply(void *pkt_data, uint32_t pkt_len, bool enabled, uint32_t truncate_len)
+uint32_t truncate_apply(void *pkt_data, uint32_t pkt_len, bool enabled, uint32_t truncate_len,
+                        const struct pkt_desc *pd)
 {
     uint8_t *pkt = (uint8_t *)pkt_data;
+    struct pkt_desc local;
     uint32_t new_len;
-    uint32_t ip_off = 0;
-    uint16_t eth_type;
+    uint32_t ip_off;
     uint8_t ihl;
     uint16_t ip_total_len;
 
@@ -49,35 +39,31 @@ uint32_t truncate_apply(void *pkt_data, uint32_t pkt_len, bool enabled, uint32_t
     }
 
     new_len = truncate_len;
-
-    /* Best-effort IPv4 header fixup for ETH+IPv4 and ETH+VLAN+IPv4. */
-    if (new_len >= ETH_HLEN_LOCAL) {
-        eth_type = be16_at(pkt + 12);
-        if (eth_type == ETH_P_IP_LOCAL) {
-            ip_off = ETH_HLEN_LOCAL;
-        } else if ((eth_type == ETH_P_8021Q_LOCAL || eth_type == ETH_P_8021AD_LOCAL) &&
-                   new_len >= ETH_HLEN_LOCAL + VLAN_HLEN_LOCAL) {
-            if (be16_at(pkt + 16) == ETH_P_IP_LOCAL) {
-                ip_off = ETH_HLEN_LOCAL + VLAN_HLEN_LOCAL;
-            }
-        }
+    if (!pd) {
+        pkt_parse(pkt, pkt_len, &local);
+        pd = &local;
     }
 
-    if (ip_off > 0 && new_len >= ip_off + 20u) {
-        if ((pkt[ip_off] >> 4) == 4u) {
-            ihl = (uint8_t)((pkt[ip_off] & 0x0Fu) * 4u);
-            if (ihl >= 20u && new_len >= ip_off + ihl) {
-                ip_total_len = (uint16_t)(new_len - ip_off);
-                pkt[ip_off + 2] = (uint8_t)(ip_total_len >> 8);
-                pkt[ip_off + 3] = (uint8_t)(ip_total_len & 0xFFu);
+    /*
+     * Best-effort IPv4 header fixup wherever pkt_parse() found IPv4 (behind VLAN
+     * tags or MPLS labels too). Not when the parser only guessed IPv4 at offset
+     * 18: the header is not rewritten on a guess. IPv6 has no header checksum;
+     * its payload length is left as captured.
+     */
+    if ((pd->flags & (PKT_F_IPV4 | PKT_F_L3_GUESSED)) == PKT_F_IPV4) {
+        ip_off = pd->l3_off;
+        ihl = (uint8_t)(pd->l4_off - pd->l3_off);
+        if (new_len >= ip_off + ihl && (pkt[ip_off] >> 4) == 4u) {
+            ip_total_len = (uint16_t)(new_len - ip_off);
+            pkt[ip_off + 2] = (uint8_t)(ip_total_len >> 8);
+            pkt[ip_off + 3] = (uint8_t)(ip_total_len & 0xFFu);
 
-                pkt[ip_off + 10] = 0;
-                pkt[ip_off + 11] = 0;
-                {
-                    uint16_t sum = csum16(pkt + ip_off, ihl);
-                    pkt[ip_off + 10] = (uint8_t)(sum >> 8);
-                    pkt[ip_off + 11] = (uint8_t)(sum & 0xFFu);
-                }
+            pkt[ip_off + 10] = 0;
+            pkt[ip_off + 11] = 0;
+            {
+                uint16_t sum = csum16(pkt + ip_off, ihl);
+                pkt[ip_off + 10] = (uint8_t)(sum >> 8);
+                pkt[ip_off + 11] = (uint8_t)(sum & 0xFFu);
             }
         }
     }
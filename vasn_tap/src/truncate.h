@@ -8,13 +8,17 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "parse.h"
+
 /*
  * Apply runtime truncation in-place.
  *
  * Returns effective packet length after truncation decision.
- * If packet is truncated and L3 is IPv4 (Ethernet or single VLAN + IPv4),
- * updates IPv4 total length and header checksum.
+ * If packet is truncated and L3 is IPv4 (directly, behind VLAN tags or behind
+ * MPLS labels), updates IPv4 total length and header checksum. pd is the frame as parsed by
+ * pkt_parse() (pkt_data may be a copy of that frame), or NULL to parse here.
  */
-uint32_t truncate_apply(void *pkt_data, uint32_t pkt_len, bool enabled, uint32_t truncate_len);
+uint32_t truncate_apply(void *pkt_data, uint32_t pkt_len, bool enabled, uint32_t truncate_len,
+                        const struct pkt_desc *pd);
 
 #endif /* __TRUNCATE_H__ */
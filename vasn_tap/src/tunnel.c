@@ -3,11 +3,15 @@
  */
 #define _GNU_SOURCE
 #include "tunnel.h"
+#include "tx_ring.h"
+#include "counter.h"
+#include "filter.h"
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <pthread.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
@@ -25,27 +29,79 @@
 #define GRE_HDR_LEN    4
 #define OUTER_IP_LEN   20
 #define OUTER_UDP_LEN  8
-#define ENCAP_BUF_SIZE 2048
+#define HDR_TMPL_SIZE  TUNNEL_HDR_MAX  /* Eth + IPv4 + UDP + VXLAN, the largest outer header */
 #define DEFAULT_MTU    1500
 
+/* Multi-remote load balancing and health checking */
+#define LB_TABLE_SIZE       65537   /* Maglev lookup table size (prime, >> 100 x TUNNEL_MAX_REMOTES) */
+#define LB_SLOT_EMPTY       0xff
+#define HEALTH_INTERVAL_MS  1000    /* Probe every remote this often */
+#define HEALTH_FAIL_LIMIT   3       /* Consecutive failed probes before a remote is taken out */
+#define HEALTH_PROBE_PORT   9       /* UDP discard: the probe datagram only drives ARP */
+
 struct vxlanhdr { __u32 vx_flags; __u32 vx_vni; } __attribute__((packed));
 struct grehdr { __u16 flags; __u16 protocol; } __attribute__((packed));
 
+/* One tunnel destination */
+struct tunnel_remote {
+	uint32_t ip_be;
+	uint8_t mac[ETH_ALEN];			/* Health thread (or init) only */
+	_Atomic(const uint8_t *) hdr_tmpl;	/* Outer headers for an empty payload (HDR_TMPL_SIZE) */
+	_Atomic bool up;			/* In the lookup table (health thread writes) */
+	unsigned int fails;			/* Consecutive failed probes (health thread only) */
+};
+
+/*
+ * Shared tunnel parameters. Read-only on the send path once tunnel_init()
+ * returns, except for the lookup table and the header templates, which the
+ * health thread replaces by pointer and frees once every worker is past its
+ * batch (tunnel_retire). The mutex guards the sender list (create/destroy/stats)
+ * and the tables and templates read outside a worker batch, and is never taken
+ * on the send path.
+ */
 struct tunnel_ctx {
-	int fd;
 	enum tunnel_type type;
-	uint32_t local_ip_be, remote_ip_be;
+	int ifindex;
+	char ifname[IFNAMSIZ];
+	uint32_t local_ip_be;
 	uint16_t dstport;
+	uint16_t srcport_min;
+	uint32_t srcport_range;	/* srcport_max - srcport_min + 1 */
 	uint32_t vni, key;
-	uint8_t src_mac[ETH_ALEN], dst_mac[ETH_ALEN];
+	uint8_t src_mac[ETH_ALEN];
 	unsigned int max_inner;
-	uint8_t *encap_buf;
-	pthread_mutex_t mutex;
+	unsigned int hdr_len;			/* Bytes of hdr_tmpl used (VXLAN 50, GRE 38) */
+	struct tunnel_remote remotes[TUNNEL_MAX_REMOTES];
+	unsigned int num_remotes;
+	_Atomic(const uint8_t *) lb_table;	/* Maglev table: slot -> remote index (NULL: none up) */
+	pthread_t health_thread;
+	_Atomic bool health_running;
+	_Atomic unsigned int generation;	/* tunnel_encap.generation (health thread bumps) */
 	int verbose;
-	_Atomic uint64_t packets_sent;
-	_Atomic uint64_t bytes_sent;
+	pthread_mutex_t mutex;
+	struct tunnel_sender *senders;
+	uint64_t retired_packets[TUNNEL_MAX_REMOTES];	/* Totals of destroyed senders */
+	uint64_t retired_bytes[TUNNEL_MAX_REMOTES];
+	uint64_t retired_dropped[TUNNEL_MAX_REMOTES];
+	uint64_t external_packets[TUNNEL_MAX_REMOTES];	/* tunnel_set_external_stats() */
+	uint64_t external_bytes[TUNNEL_MAX_REMOTES];
+	uint64_t external_dropped[TUNNEL_MAX_REMOTES];
 };
 
+/*
+ * Per-worker send state: owned and used by a single thread. Outer headers
+ * and the inner frame are written straight into the sender's TX ring, which
+ * tunnel_flush() hands to the kernel in one syscall.
+ */
+struct tunnel_sender {
+	const struct tunnel_ctx *ctx;
+	struct tx_ring_ctx ring;
+	struct tunnel_sender *next;
+	uint64_t packets_sent[TUNNEL_MAX_REMOTES];	/* Owner worker only (counter_add) */
+	uint64_t bytes_sent[TUNNEL_MAX_REMOTES];
+	uint64_t packets_dropped[TUNNEL_MAX_REMOTES];
+} __attribute__((aligned(COUNTER_CACHE_LINE)));
+
 static unsigned int get_iface_mtu(const char *ifname)
 {
 	struct ifreq ifr;
@@ -151,21 +207,244 @@ static __u16 ip_csum(const void *data, size_t len)
 	return (__u16)~sum;
 }
 
+/*
+ * Build the outer header template (Eth + IPv4 + UDP/VXLAN or GRE) for an
+ * empty payload into tmpl (HDR_TMPL_SIZE bytes). Everything except the length
+ * fields and IP checksum is the same for every packet of this tunnel.
+ */
+static void build_hdr_template(struct tunnel_ctx *ctx, const struct tunnel_remote *r, uint8_t *tmpl)
+{
+	uint8_t *p = tmpl;
+	struct iphdr *ip;
+
+	memset(tmpl, 0, HDR_TMPL_SIZE);
+	memcpy(p, r->mac, ETH_ALEN); memcpy(p+ETH_ALEN, ctx->src_mac, ETH_ALEN);
+	p[12] = (ETH_P_IP>>8)&0xff; p[13] = ETH_P_IP&0xff;
+	p += ETH_HLEN;
+	ip = (struct iphdr *)p;
+	ip->version=4; ip->ihl=5; ip->tos=0; ip->id=0; ip->frag_off=0; ip->ttl=64;
+	ip->saddr=ctx->local_ip_be; ip->daddr=r->ip_be;
+	p += OUTER_IP_LEN;
+	if (ctx->type == TUNNEL_TYPE_VXLAN) {
+		struct udphdr *udp = (struct udphdr *)p;
+		struct vxlanhdr *vx = (struct vxlanhdr *)(p + OUTER_UDP_LEN);
+		uint8_t *vni_b = (uint8_t *)&vx->vx_vni;
+		ip->protocol = IPPROTO_UDP;
+		udp->source=0; udp->dest=htons(ctx->dstport); udp->len=htons(OUTER_UDP_LEN+VXLAN_HDR_LEN); udp->check=0;
+		vx->vx_flags = htonl(0x08000000);
+		/* RFC 7348: VNI 24 bits in bytes 4-6 (big-endian); write explicitly for portability */
+		vni_b[0] = (ctx->vni >> 16) & 0xff;
+		vni_b[1] = (ctx->vni >> 8) & 0xff;
+		vni_b[2] = (ctx->vni) & 0xff;
+		vni_b[3] = 0;
+		ctx->hdr_len = ETH_HLEN + OUTER_IP_LEN + OUTER_UDP_LEN + VXLAN_HDR_LEN;
+	} else {
+		struct grehdr *gre = (struct grehdr *)p;
+		ip->protocol = IPPROTO_GRE;
+		gre->flags=0; gre->protocol=htons(0x6558);
+		ctx->hdr_len = ETH_HLEN + OUTER_IP_LEN + GRE_HDR_LEN;
+	}
+	ip->tot_len = htons(ctx->hdr_len - ETH_HLEN);
+	ip->check = 0;
+	ip->check = htons(ip_csum(ip, OUTER_IP_LEN));
+}
+
+/*
+ * RFC 1624 eqn. 3: HC' = ~(~HC + ~m + m') for one 16-bit field change.
+ * All values in network byte order.
+ */
+static inline __u16 csum_replace16(__u16 check, __u16 old, __u16 new_val)
+{
+	__u32 sum = (__u16)~ntohs(check) + (__u16)~ntohs(old) + ntohs(new_val);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	return htons((__u16)~sum);
+}
+
+/*
+ * Free a lookup table or header template the health thread has just replaced.
+ * tunnel_send() runs only inside a worker's filter_enter()/filter_exit() batch,
+ * so once filter_synchronize() returns no worker holds it; the mutex waits out
+ * tunnel_get_encap() and tunnel_lb_sample(), which read it outside a batch.
+ */
+static void tunnel_retire(struct tunnel_ctx *ctx, const void *old)
+{
+	if (!old) return;
+	filter_synchronize();
+	pthread_mutex_lock(&ctx->mutex);
+	free((void *)old);
+	pthread_mutex_unlock(&ctx->mutex);
+}
+
+/*
+ * Rebuild the Maglev lookup table (Eisenbud et al., NSDI 2016) over the remotes
+ * that are up and publish it. Each remote walks its own permutation of the
+ * slots, derived from its IP only, so removing a remote moves just the slots it
+ * owned and the other flows keep their destination. The previous table is freed
+ * once no worker can still be using it. Health thread (or init) only.
+ */
+static int lb_rebuild(struct tunnel_ctx *ctx)
+{
+	uint32_t offset[TUNNEL_MAX_REMOTES], skip[TUNNEL_MAX_REMOTES], next[TUNNEL_MAX_REMOTES];
+	unsigned int live[TUNNEL_MAX_REMOTES], n = 0, i, filled = 0;
+	uint8_t *table = NULL;
+	const uint8_t *old;
+
+	for (i = 0; i < ctx->num_remotes; i++)
+		if (atomic_load(&ctx->remotes[i].up)) live[n++] = i;
+	if (n > 0) {
+		table = malloc(LB_TABLE_SIZE);
+		if (!table) return -ENOMEM;
+		memset(table, LB_SLOT_EMPTY, LB_TABLE_SIZE);
+		for (i = 0; i < n; i++) {
+			uint32_t ip = ctx->remotes[live[i]].ip_be;
+			offset[i] = hash_mix32(ip) % LB_TABLE_SIZE;
+			skip[i] = hash_mix32(ip ^ 0x5bd1e995u) % (LB_TABLE_SIZE - 1) + 1;
+			next[i] = 0;
+		}
+		while (filled < LB_TABLE_SIZE) {
+			for (i = 0; i < n && filled < LB_TABLE_SIZE; i++) {
+				uint32_t c;
+				do {
+					c = (uint32_t)((offset[i] + (uint64_t)next[i] * skip[i]) % LB_TABLE_SIZE);
+					next[i]++;
+				} while (table[c] != LB_SLOT_EMPTY);
+				table[c] = (uint8_t)live[i];
+				filled++;
+			}
+		}
+	}
+	old = atomic_exchange(&ctx->lb_table, table);
+	tunnel_retire(ctx, old);
+	return 0;
+}
+
+/*
+ * One health probe: send an empty datagram to the remote so the kernel
+ * revalidates (or resolves) its neighbour entry, then read the entry back.
+ * A remote that stops answering ARP ends up FAILED after the kernel's own
+ * probe cycle and loses ATF_COM. Returns true with mac_out filled if complete.
+ */
+static bool probe_remote(const struct tunnel_ctx *ctx, int arp_fd, uint32_t ip_be, uint8_t *mac_out)
+{
+	struct sockaddr_in d = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = ip_be,
+		.sin_port = htons(HEALTH_PROBE_PORT)
+	};
+	struct arpreq req;
+	int s = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (s >= 0) {
+		setsockopt(s, SOL_SOCKET, SO_BINDTODEVICE, ctx->ifname, strlen(ctx->ifname) + 1);
+		sendto(s, "", 0, MSG_DONTWAIT, (struct sockaddr *)&d, sizeof(d));
+		close(s);
+	}
+	memset(&req, 0, sizeof(req));
+	((struct sockaddr_in *)&req.arp_pa)->sin_family = AF_INET;
+	((struct sockaddr_in *)&req.arp_pa)->sin_addr.s_addr = ip_be;
+	req.arp_ha.sa_family = ARPHRD_ETHER;
+	memcpy(req.arp_dev, ctx->ifname, sizeof(req.arp_dev));	/* Both IFNAMSIZ, NUL-terminated */
+	if (ioctl(arp_fd, SIOCGARP, &req) != 0 || !(req.arp_flags & ATF_COM))
+		return false;
+	memcpy(mac_out, req.arp_ha.sa_data, ETH_ALEN);
+	return true;
+}
+
+/*
+ * New MAC for remote r: publish a copy of its header template with the new
+ * destination, so a racing send uses either the old or the new one whole.
+ * Returns false if out of memory (the old template stays).
+ */
+static bool set_remote_mac(struct tunnel_ctx *ctx, struct tunnel_remote *r, const uint8_t *mac)
+{
+	uint8_t *tmpl = malloc(HDR_TMPL_SIZE);
+	const uint8_t *old;
+
+	if (!tmpl) return false;
+	memcpy(tmpl, atomic_load(&r->hdr_tmpl), HDR_TMPL_SIZE);
+	memcpy(tmpl, mac, ETH_ALEN);
+	memcpy(r->mac, mac, ETH_ALEN);
+	old = atomic_exchange(&r->hdr_tmpl, tmpl);
+	tunnel_retire(ctx, old);
+	return true;
+}
+
+/*
+ * Health thread (multi-remote only): probe every remote each HEALTH_INTERVAL_MS.
+ * A remote is taken out after HEALTH_FAIL_LIMIT consecutive failures and put
+ * back on the first success; any change rebuilds the lookup table.
+ */
+static void *health_thread_fn(void *arg)
+{
+	struct tunnel_ctx *ctx = arg;
+	const struct timespec tick = { .tv_sec = 0, .tv_nsec = 100 * 1000000L };
+	int arp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	unsigned int i, t;
+
+	if (arp_fd < 0) {
+		fprintf(stderr, "Tunnel: health check socket failed: %s\n", strerror(errno));
+		return NULL;
+	}
+	while (atomic_load(&ctx->health_running)) {
+		bool changed = false;
+
+		for (i = 0; i < ctx->num_remotes; i++) {
+			struct tunnel_remote *r = &ctx->remotes[i];
+			bool up = atomic_load(&r->up);
+			uint8_t mac[ETH_ALEN];
+			char b[INET_ADDRSTRLEN];
+
+			if (probe_remote(ctx, arp_fd, r->ip_be, mac)) {
+				r->fails = 0;
+				if (memcmp(mac, r->mac, ETH_ALEN) != 0) {
+					if (set_remote_mac(ctx, r, mac))
+						atomic_fetch_add(&ctx->generation, 1);
+					else
+						fprintf(stderr, "Tunnel: header template update failed\n");
+				}
+				if (!up) {
+					atomic_store(&r->up, true);
+					changed = true;
+					inet_ntop(AF_INET, &r->ip_be, b, sizeof(b));
+					printf("Tunnel: remote %s is up\n", b);
+				}
+			} else if (up && ++r->fails >= HEALTH_FAIL_LIMIT) {
+				atomic_store(&r->up, false);
+				changed = true;
+				inet_ntop(AF_INET, &r->ip_be, b, sizeof(b));
+				printf("Tunnel: remote %s is down (%u failed probes)\n", b, r->fails);
+			}
+		}
+		if (changed && lb_rebuild(ctx) != 0)
+			fprintf(stderr, "Tunnel: lookup table rebuild failed\n");
+		if (changed)
+			atomic_fetch_add(&ctx->generation, 1);
+		for (t = 0; t < HEALTH_INTERVAL_MS / 100 && atomic_load(&ctx->health_running); t++)
+			nanosleep(&tick, NULL);
+	}
+	close(arp_fd);
+	return NULL;
+}
+
 int tunnel_init(struct tunnel_ctx **ctx_out,
                 enum tunnel_type type,
-                const char *remote_ip,
+                const char *const *remote_ips,
+                unsigned int num_remotes,
                 uint32_t vni,
                 uint16_t dstport,
+                uint16_t srcport_min,
+                uint16_t srcport_max,
                 uint32_t key,
                 const char *local_ip,
                 const char *output_ifname)
 {
 	struct tunnel_ctx *ctx;
-	struct sockaddr_ll sll;
-	unsigned int overhead, mtu;
+	unsigned int overhead, mtu, i, up = 0;
 	int ifindex, err;
 
-	if (!ctx_out || !remote_ip || !output_ifname || type == TUNNEL_TYPE_NONE) {
+	if (!ctx_out || !remote_ips || num_remotes == 0 || num_remotes > TUNNEL_MAX_REMOTES ||
+	    !output_ifname || type == TUNNEL_TYPE_NONE) {
 		if (ctx_out) *ctx_out = NULL;
 		return -EINVAL;
 	}
@@ -176,187 +455,179 @@ int tunnel_init(struct tunnel_ctx **ctx_out,
 	}
 	ctx = calloc(1, sizeof(*ctx));
 	if (!ctx) return -ENOMEM;
-	ctx->encap_buf = malloc(ENCAP_BUF_SIZE);
-	if (!ctx->encap_buf) { free(ctx); return -ENOMEM; }
 	ctx->type = type;
 	ctx->vni = vni;
 	ctx->dstport = dstport ? dstport : 4789;
+	if (srcport_min == 0 || srcport_max < srcport_min) {
+		srcport_min = 49152;
+		srcport_max = 65535;
+	}
+	ctx->srcport_min = srcport_min;
+	ctx->srcport_range = (uint32_t)srcport_max - srcport_min + 1;
 	ctx->key = key;
 	ctx->verbose = 1;
 	pthread_mutex_init(&ctx->mutex, NULL);
 
-	if (inet_pton(AF_INET, remote_ip, &ctx->remote_ip_be) != 1) {
-		fprintf(stderr, "Tunnel: invalid remote_ip %s\n", remote_ip);
-		err = -EINVAL; goto fail;
+	for (i = 0; i < num_remotes; i++) {
+		if (inet_pton(AF_INET, remote_ips[i], &ctx->remotes[i].ip_be) != 1) {
+			fprintf(stderr, "Tunnel: invalid remote_ip %s\n", remote_ips[i]);
+			err = -EINVAL; goto fail;
+		}
 	}
+	ctx->num_remotes = num_remotes;
+	snprintf(ctx->ifname, sizeof(ctx->ifname), "%s", output_ifname);
 	ifindex = if_nametoindex(output_ifname);
 	if (ifindex == 0) { fprintf(stderr, "Tunnel: interface %s not found\n", output_ifname); err = -ENODEV; goto fail; }
+	ctx->ifindex = ifindex;
 	if (get_iface_mac(output_ifname, ctx->src_mac) != 0) { fprintf(stderr, "Tunnel: get MAC failed\n"); err = -errno; goto fail; }
 	if (local_ip && local_ip[0]) {
 		if (inet_pton(AF_INET, local_ip, &ctx->local_ip_be) != 1) { fprintf(stderr, "Tunnel: invalid local_ip\n"); err = -EINVAL; goto fail; }
 	} else {
 		if (get_iface_ip(output_ifname, &ctx->local_ip_be) != 0) { fprintf(stderr, "Tunnel: no IP on interface\n"); err = -EADDRNOTAVAIL; goto fail; }
 	}
-	if (resolve_arp(output_ifname, ctx->remote_ip_be, ctx->dst_mac, ctx->verbose) != 0) { err = -ENXIO; goto fail; }
+	/* Unresolved remotes start down (health thread brings them in); at least one must resolve */
+	for (i = 0; i < num_remotes; i++) {
+		struct tunnel_remote *r = &ctx->remotes[i];
+		if (resolve_arp(output_ifname, r->ip_be, r->mac, ctx->verbose) == 0) {
+			atomic_store(&r->up, true);
+			up++;
+		}
+	}
+	if (up == 0) { err = -ENXIO; goto fail; }
 
 	mtu = get_iface_mtu(output_ifname);
 	overhead = (type == TUNNEL_TYPE_VXLAN) ? ETH_HLEN+OUTER_IP_LEN+OUTER_UDP_LEN+VXLAN_HDR_LEN : ETH_HLEN+OUTER_IP_LEN+GRE_HDR_LEN;
 	ctx->max_inner = (mtu > overhead) ? (mtu - overhead) : 0;
+	for (i = 0; i < num_remotes; i++) {
+		uint8_t *tmpl = malloc(HDR_TMPL_SIZE);
+		if (!tmpl) { err = -ENOMEM; goto fail; }
+		build_hdr_template(ctx, &ctx->remotes[i], tmpl);
+		atomic_store(&ctx->remotes[i].hdr_tmpl, tmpl);
+	}
 
-	ctx->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
-	if (ctx->fd < 0) { err = -errno; fprintf(stderr, "Tunnel: socket %s\n", strerror(errno)); goto fail; }
-	memset(&sll, 0, sizeof(sll));
-	sll.sll_family = AF_PACKET;
-	sll.sll_ifindex = ifindex;
-	sll.sll_protocol = htons(ETH_P_ALL);
-	if (bind(ctx->fd, (struct sockaddr *)&sll, sizeof(sll)) != 0) {
-		err = -errno; close(ctx->fd); ctx->fd = -1; fprintf(stderr, "Tunnel: bind %s\n", strerror(errno)); goto fail;
+	if (num_remotes > 1) {
+		err = lb_rebuild(ctx);
+		if (err) goto fail;
+		atomic_store(&ctx->health_running, true);
+		err = pthread_create(&ctx->health_thread, NULL, health_thread_fn, ctx);
+		if (err) {
+			atomic_store(&ctx->health_running, false);
+			fprintf(stderr, "Tunnel: health thread: %s\n", strerror(err));
+			err = -err; goto fail;
+		}
 	}
+
 	*ctx_out = ctx;
 	if (ctx->verbose) {
 		char r[INET_ADDRSTRLEN], l[INET_ADDRSTRLEN];
-		inet_ntop(AF_INET, &ctx->remote_ip_be, r, sizeof(r));
 		inet_ntop(AF_INET, &ctx->local_ip_be, l, sizeof(l));
-		printf("Tunnel: %s %s -> %s VNI=%u on %s max_inner=%u\n", type==TUNNEL_TYPE_VXLAN?"VXLAN":"GRE", l, r, (unsigned)vni, output_ifname, ctx->max_inner);
+		for (i = 0; i < num_remotes; i++) {
+			inet_ntop(AF_INET, &ctx->remotes[i].ip_be, r, sizeof(r));
+			printf("Tunnel: %s %s -> %s VNI=%u on %s max_inner=%u%s\n", type==TUNNEL_TYPE_VXLAN?"VXLAN":"GRE", l, r, (unsigned)vni, output_ifname, ctx->max_inner,
+			       atomic_load(&ctx->remotes[i].up) ? "" : " (down)");
+		}
 	}
 	return 0;
 fail:
-	if (ctx->encap_buf) free(ctx->encap_buf);
-	if (ctx->fd >= 0) close(ctx->fd);
+	for (i = 0; i < num_remotes; i++)
+		free((void *)atomic_load(&ctx->remotes[i].hdr_tmpl));
+	free((void *)atomic_load(&ctx->lb_table));
 	pthread_mutex_destroy(&ctx->mutex);
 	free(ctx);
 	return err;
 }
 
-static int send_vxlan(struct tunnel_ctx *ctx, const void *inner, uint32_t len)
+int tunnel_sender_create(struct tunnel_ctx *ctx, const struct ring_config *geom,
+                         struct tunnel_sender **tx_out)
 {
-	uint8_t *p = ctx->encap_buf;
-	struct iphdr *ip;
-	struct udphdr *udp;
-	struct vxlanhdr *vx;
-	uint32_t total;
-	if (len > ctx->max_inner) return -1;
-	memcpy(p, ctx->dst_mac, ETH_ALEN); memcpy(p+ETH_ALEN, ctx->src_mac, ETH_ALEN);
-	p[12] = (ETH_P_IP>>8)&0xff; p[13] = ETH_P_IP&0xff;
-	p += ETH_HLEN;
-	ip = (struct iphdr *)p;
-	ip->version=4; ip->ihl=5; ip->tos=0; ip->tot_len=htons(OUTER_IP_LEN+OUTER_UDP_LEN+VXLAN_HDR_LEN+len); ip->id=0; ip->frag_off=0; ip->ttl=64; ip->protocol=IPPROTO_UDP; ip->check=0;
-	ip->saddr=ctx->local_ip_be; ip->daddr=ctx->remote_ip_be; ip->check=ip_csum(ip, OUTER_IP_LEN);
-	p += OUTER_IP_LEN;
-	udp = (struct udphdr *)p;
-	udp->source=0; udp->dest=htons(ctx->dstport); udp->len=htons(OUTER_UDP_LEN+VXLAN_HDR_LEN+len); udp->check=0;
-	p += OUTER_UDP_LEN;
-	vx = (struct vxlanhdr *)p;
-	vx->vx_flags = htonl(0x08000000);
-	/* RFC 7348: VNI 24 bits in bytes 4-6 (big-endian); write explicitly for portability */
-	{
-		uint8_t *vni_b = (uint8_t *)&vx->vx_vni;
-		vni_b[0] = (ctx->vni >> 16) & 0xff;
-		vni_b[1] = (ctx->vni >> 8) & 0xff;
-		vni_b[2] = (ctx->vni) & 0xff;
-		vni_b[3] = 0;
-	}
-	p += VXLAN_HDR_LEN;
-	memcpy(p, inner, len);
-	total = (uint32_t)(p - ctx->encap_buf) + len;
-	if (send(ctx->fd, ctx->encap_buf, total, MSG_DONTWAIT) != (ssize_t)total)
-		return -1;
-	atomic_fetch_add(&ctx->packets_sent, 1);
-	atomic_fetch_add(&ctx->bytes_sent, (uint64_t)total);
+	struct tunnel_sender *tx;
+	int err;
+
+	if (!tx_out) return -EINVAL;
+	*tx_out = NULL;
+	if (!ctx) return -EINVAL;
+	tx = aligned_alloc(COUNTER_CACHE_LINE, sizeof(*tx));
+	if (!tx) return -ENOMEM;
+	memset(tx, 0, sizeof(*tx));
+	tx->ctx = ctx;
+
+	err = tx_ring_setup(&tx->ring, ctx->ifindex, geom, false, false);
+	if (err) { fprintf(stderr, "Tunnel: TX ring setup failed: %s\n", strerror(-err)); free(tx); return err; }
+
+	pthread_mutex_lock(&ctx->mutex);
+	tx->next = ctx->senders;
+	ctx->senders = tx;
+	pthread_mutex_unlock(&ctx->mutex);
+	*tx_out = tx;
 	return 0;
 }
 
-static int send_gre(struct tunnel_ctx *ctx, const void *inner, uint32_t len)
+void tunnel_sender_destroy(struct tunnel_sender *tx)
 {
-	uint8_t *p = ctx->encap_buf;
-	struct iphdr *ip;
-	struct grehdr *gre;
-	uint32_t total;
-	if (len > ctx->max_inner) return -1;
-	memcpy(p, ctx->dst_mac, ETH_ALEN); memcpy(p+ETH_ALEN, ctx->src_mac, ETH_ALEN);
-	p[12] = (ETH_P_IP>>8)&0xff; p[13] = ETH_P_IP&0xff;
-	p += ETH_HLEN;
-	ip = (struct iphdr *)p;
-	ip->version=4; ip->ihl=5; ip->tos=0; ip->tot_len=htons(OUTER_IP_LEN+GRE_HDR_LEN+len); ip->id=0; ip->frag_off=0; ip->ttl=64; ip->protocol=IPPROTO_GRE; ip->check=0;
-	ip->saddr=ctx->local_ip_be; ip->daddr=ctx->remote_ip_be; ip->check=ip_csum(ip, OUTER_IP_LEN);
-	p += OUTER_IP_LEN;
-	gre = (struct grehdr *)p; gre->flags=0; gre->protocol=htons(0x6558);
-	p += GRE_HDR_LEN;
-	memcpy(p, inner, len);
-	total = (uint32_t)(p - ctx->encap_buf) + len;
-	if (send(ctx->fd, ctx->encap_buf, total, MSG_DONTWAIT) != (ssize_t)total)
-		return -1;
-	atomic_fetch_add(&ctx->packets_sent, 1);
-	atomic_fetch_add(&ctx->bytes_sent, (uint64_t)total);
-	return 0;
+	struct tunnel_ctx *ctx;
+	struct tunnel_sender **pp;
+	unsigned int i;
+
+	if (!tx) return;
+	/* Shared params are read-only on the send path; only the list is mutable */
+	ctx = (struct tunnel_ctx *)tx->ctx;
+	pthread_mutex_lock(&ctx->mutex);
+	for (pp = &ctx->senders; *pp; pp = &(*pp)->next) {
+		if (*pp == tx) { *pp = tx->next; break; }
+	}
+	for (i = 0; i < ctx->num_remotes; i++) {
+		ctx->retired_packets[i] += counter_read(&tx->packets_sent[i]);
+		ctx->retired_bytes[i] += counter_read(&tx->bytes_sent[i]);
+		ctx->retired_dropped[i] += counter_read(&tx->packets_dropped[i]);
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+	tx_ring_teardown(&tx->ring);
+	free(tx);
 }
 
-#define ETHERTYPE_IP   0x0800
-#define ETHERTYPE_VLAN 0x8100
 #define GRE_ETH        0x6558  /* Transparent Ethernet Bridging (GRE) */
 
-/* Returns 1 if at l2_off we see our tunnel (IP pair, UDP port, VNI). */
-static int is_our_tunnel_at(const struct tunnel_ctx *ctx, const uint8_t *pkt,
-                            uint32_t pkt_len, uint32_t l2_off)
+static int is_remote_ip(const struct tunnel_ctx *ctx, uint32_t ip)
 {
-	uint32_t ip_off;
-	uint16_t eth_type;
-	uint8_t ihl, protocol;
-	uint32_t ip_src_be, ip_dst_be;
-
-	if (pkt_len < l2_off + ETH_HLEN + 20u)
-		return 0;
+	unsigned int i;
+	for (i = 0; i < ctx->num_remotes; i++)
+		if (ctx->remotes[i].ip_be == ip) return 1;
+	return 0;
+}
 
-	eth_type = (uint16_t)((pkt[l2_off + 12] << 8) | pkt[l2_off + 13]);
-	if (eth_type == ETHERTYPE_IP)
-		ip_off = l2_off + ETH_HLEN;
-	else if (eth_type == ETHERTYPE_VLAN && pkt_len >= l2_off + ETH_HLEN + 4u + 20u) {
-		eth_type = (uint16_t)((pkt[l2_off + 16] << 8) | pkt[l2_off + 17]);
-		if (eth_type != ETHERTYPE_IP)
-			return 0;
-		ip_off = l2_off + ETH_HLEN + 4;
-	} else
-		return 0;
+/* IPv4 local -> one of our remotes (pd IPs are host order, ctx ones network order) */
+static int has_our_ips(const struct tunnel_ctx *ctx, const struct pkt_desc *pd)
+{
+	return (pd->flags & (PKT_F_IPV4 | PKT_F_L3_GUESSED)) == PKT_F_IPV4 &&
+	       pd->ip_src == ntohl(ctx->local_ip_be) && is_remote_ip(ctx, htonl(pd->ip_dst));
+}
 
-	if (pkt_len < ip_off + 20u)
-		return 0;
-	ihl = (pkt[ip_off] & 0x0f) * 4;
-	if (ihl < 20 || pkt_len < ip_off + (uint32_t)ihl)
-		return 0;
+/* VXLAN-shaped: UDP to our destination port with a full VXLAN header */
+static int is_vxlan_to_us(const struct tunnel_ctx *ctx, const struct pkt_desc *pd)
+{
+	return (pd->flags & PKT_F_PORTS) && pd->protocol == IPPROTO_UDP &&
+	       pd->port_dst == ctx->dstport && pd->len >= pd->l4_off + 8u + VXLAN_HDR_LEN;
+}
 
-	protocol = pkt[ip_off + 9];
-	ip_src_be = (uint32_t)pkt[ip_off + 12] << 24 | (uint32_t)pkt[ip_off + 13] << 16 |
-	            (uint32_t)pkt[ip_off + 14] << 8 | (uint32_t)pkt[ip_off + 15];
-	ip_dst_be = (uint32_t)pkt[ip_off + 16] << 24 | (uint32_t)pkt[ip_off + 17] << 16 |
-	            (uint32_t)pkt[ip_off + 18] << 8 | (uint32_t)pkt[ip_off + 19];
+static uint32_t vxlan_vni_at(const uint8_t *pkt, const struct pkt_desc *pd)
+{
+	const uint8_t *vx = pkt + pd->l4_off + 8;
+	return (uint32_t)vx[4] << 16 | (uint32_t)vx[5] << 8 | (uint32_t)vx[6];
+}
 
-	if (ip_src_be != ctx->local_ip_be || ip_dst_be != ctx->remote_ip_be)
+/* Returns 1 if the parsed frame is our tunnel (IP pair, UDP port, VNI; or GRE TEB). */
+static int is_our_tunnel(const struct tunnel_ctx *ctx, const uint8_t *pkt, const struct pkt_desc *pd)
+{
+	if (!has_our_ips(ctx, pd))
 		return 0;
 
-	if (ctx->type == TUNNEL_TYPE_VXLAN) {
-		uint16_t udp_dst;
-		uint32_t vni_from_pkt;
-		if (protocol != IPPROTO_UDP || pkt_len < ip_off + (uint32_t)ihl + 8u + 8u)
-			return 0;
-		udp_dst = (uint16_t)((pkt[ip_off + ihl + 2] << 8) | pkt[ip_off + ihl + 3]);
-		if (udp_dst != htons(ctx->dstport))
-			return 0;
-		vni_from_pkt = (uint32_t)pkt[ip_off + ihl + 8 + 4] << 16 |
-		               (uint32_t)pkt[ip_off + ihl + 8 + 5] << 8 |
-		               (uint32_t)pkt[ip_off + ihl + 8 + 6];
-		if (vni_from_pkt != ctx->vni)
-			return 0;
-		return 1;
-	}
+	if (ctx->type == TUNNEL_TYPE_VXLAN)
+		return is_vxlan_to_us(ctx, pd) && vxlan_vni_at(pkt, pd) == ctx->vni;
 
 	if (ctx->type == TUNNEL_TYPE_GRE) {
-		uint16_t gre_proto;
-		if (protocol != IPPROTO_GRE || pkt_len < ip_off + (uint32_t)ihl + 4u)
+		if (pd->protocol != IPPROTO_GRE || pd->len < pd->l4_off + 4u)
 			return 0;
-		gre_proto = (uint16_t)((pkt[ip_off + ihl + 2] << 8) | pkt[ip_off + ihl + 3]);
-		if (gre_proto != GRE_ETH)
-			return 0;
-		return 1;
+		return ((pkt[pd->l4_off + 2] << 8) | pkt[pd->l4_off + 3]) == GRE_ETH;
 	}
 	return 0;
 }
@@ -365,24 +636,27 @@ static int is_our_tunnel_at(const struct tunnel_ctx *ctx, const uint8_t *pkt,
  * Returns 1 if pkt looks like our own tunnel output (skip when -i and -o are the same).
  * Also skips if the packet already contains our encapsulation (e.g. inner after one VXLAN).
  */
-int tunnel_is_own_packet(const struct tunnel_ctx *ctx, const void *pkt_data, uint32_t pkt_len)
+int tunnel_is_own_packet(const struct tunnel_ctx *ctx, const void *pkt_data, const struct pkt_desc *pd)
 {
 	const uint8_t *pkt = (const uint8_t *)pkt_data;
-	uint32_t outer_len;
+	struct pkt_desc inner;
+	uint32_t inner_off;
 
-	if (!ctx || !pkt || pkt_len < ETH_HLEN)
+	if (!ctx || !pkt || pd->len < ETH_HLEN)
 		return 0;
 
 	/* Check outer encapsulation at start of packet */
-	if (is_our_tunnel_at(ctx, pkt, pkt_len, 0))
+	if (is_our_tunnel(ctx, pkt, pd))
 		return 1;
 
-	/* If packet is already encapsulated (outer Eth+IP+UDP+VXLAN = 50 bytes), check inner */
-	outer_len = ETH_HLEN + 20 + 8 + 8;  /* eth + ip + udp + vxlan */
-	if (pkt_len >= outer_len + ETH_HLEN + 20u && is_our_tunnel_at(ctx, pkt, pkt_len, outer_len))
-		return 1;
-
-	return 0;
+	/* If packet is already VXLAN-encapsulated, check the inner frame */
+	if (!is_vxlan_to_us(ctx, pd))
+		return 0;
+	inner_off = pd->l4_off + 8u + VXLAN_HDR_LEN;
+	if (pd->len < inner_off + ETH_HLEN + 20u)
+		return 0;
+	pkt_parse(pkt + inner_off, pd->len - inner_off, &inner);
+	return is_our_tunnel(ctx, pkt + inner_off, &inner);
 }
 
 /*
@@ -390,88 +664,185 @@ int tunnel_is_own_packet(const struct tunnel_ctx *ctx, const void *pkt_data, uin
  * IP pair matches our tunnel (local->remote) but we didn't skip it, so we can see
  * UDP port / VNI mismatch. No-op if ctx is NULL or !ctx->verbose.
  */
-void tunnel_debug_own_mismatch(const struct tunnel_ctx *ctx, const void *pkt_data, uint32_t pkt_len)
+void tunnel_debug_own_mismatch(const struct tunnel_ctx *ctx, const void *pkt_data, const struct pkt_desc *pd)
 {
 	const uint8_t *pkt = (const uint8_t *)pkt_data;
-	uint32_t ip_off = 0;
-	uint16_t eth_type;
-	uint8_t ihl, protocol;
-	uint32_t ip_src_be, ip_dst_be;
 	static int logged;
 
-	if (!ctx || !ctx->verbose || !pkt || pkt_len < ETH_HLEN || logged)
-		return;
-
-	eth_type = (uint16_t)((pkt[12] << 8) | pkt[13]);
-	if (eth_type == ETHERTYPE_IP)
-		ip_off = ETH_HLEN;
-	else if (eth_type == ETHERTYPE_VLAN && pkt_len >= ETH_HLEN + 4u + 20u) {
-		eth_type = (uint16_t)((pkt[16] << 8) | pkt[17]);
-		if (eth_type == ETHERTYPE_IP)
-			ip_off = ETH_HLEN + 4;
-		else
-			return;
-	} else
-		return;
-
-	if (pkt_len < ip_off + 20u)
-		return;
-	ihl = (pkt[ip_off] & 0x0f) * 4;
-	if (ihl < 20 || pkt_len < ip_off + (uint32_t)ihl)
-		return;
-
-	protocol = pkt[ip_off + 9];
-	ip_src_be = (uint32_t)pkt[ip_off + 12] << 24 | (uint32_t)pkt[ip_off + 13] << 16 |
-	            (uint32_t)pkt[ip_off + 14] << 8 | (uint32_t)pkt[ip_off + 15];
-	ip_dst_be = (uint32_t)pkt[ip_off + 16] << 24 | (uint32_t)pkt[ip_off + 17] << 16 |
-	            (uint32_t)pkt[ip_off + 18] << 8 | (uint32_t)pkt[ip_off + 19];
-
-	if (ip_src_be != ctx->local_ip_be || ip_dst_be != ctx->remote_ip_be)
+	if (!ctx || !ctx->verbose || !pkt || logged || !has_our_ips(ctx, pd))
 		return;
 
 	/* Packet has our tunnel IPs but we didn't skip - log why (UDP/VNI) */
 	logged = 1;
-	if (ctx->type == TUNNEL_TYPE_VXLAN && protocol == IPPROTO_UDP &&
-	    pkt_len >= ip_off + (uint32_t)ihl + 8u + 8u) {
-		uint16_t udp_dst = (uint16_t)((pkt[ip_off + ihl + 2] << 8) | pkt[ip_off + ihl + 3]);
-		uint32_t vni_pkt = (uint32_t)pkt[ip_off + ihl + 8 + 4] << 16 |
-		                   (uint32_t)pkt[ip_off + ihl + 8 + 5] << 8 |
-		                   (uint32_t)pkt[ip_off + ihl + 8 + 6];
+	if (ctx->type == TUNNEL_TYPE_VXLAN && pd->protocol == IPPROTO_UDP &&
+	    pd->len >= pd->l4_off + 8u + VXLAN_HDR_LEN) {
 		fprintf(stderr, "vasn_tap: packet with our tunnel IPs was not skipped (re-encap?): "
 		        "pkt udp_dst=%u vni=%u, ctx dstport=%u vni=%u\n",
-		        (unsigned)ntohs(udp_dst), (unsigned)vni_pkt,
+		        (unsigned)pd->port_dst, (unsigned)vxlan_vni_at(pkt, pd),
 		        (unsigned)ctx->dstport, (unsigned)ctx->vni);
 	} else {
 		fprintf(stderr, "vasn_tap: packet with our tunnel IPs was not skipped: "
-		        "protocol=%u (expected UDP 17)\n", (unsigned)protocol);
+		        "protocol=%u (expected UDP 17)\n", (unsigned)pd->protocol);
 	}
 }
 
-int tunnel_send(struct tunnel_ctx *ctx, const void *inner, uint32_t len)
+int tunnel_send(struct tunnel_sender *tx, const void *inner, uint32_t len, uint32_t flow_hash)
 {
-	int ret = -1;
-	if (!ctx || ctx->fd < 0 || !inner) return -1;
+	const struct tunnel_ctx *ctx;
+	const uint8_t *tmpl;
+	const struct iphdr *tmpl_ip;
+	struct iphdr *ip;
+	uint32_t total, cap;
+	unsigned int idx = 0;
+	uint8_t *p;
+
+	if (!tx || tx->ring.fd < 0 || !inner) return -1;
+	ctx = tx->ctx;
+	if (ctx->num_remotes > 1) {
+		const uint8_t *table = atomic_load_explicit(&ctx->lb_table, memory_order_acquire);
+		if (!table) return -1;	/* No remote up */
+		/* Remix so the remote choice is independent of the source port below */
+		idx = table[((uint64_t)hash_mix32(flow_hash) * LB_TABLE_SIZE) >> 32];
+	}
+	if (len > ctx->max_inner) goto drop;
+	total = ctx->hdr_len + len;
+	p = tx_ring_reserve(&tx->ring, &cap);
+	if (!p || total > cap) goto drop;
+
+	/* Fixed-size template copy (bytes past hdr_len are overwritten by inner) */
+	tmpl = atomic_load_explicit(&ctx->remotes[idx].hdr_tmpl, memory_order_acquire);
+	memcpy(p, tmpl, HDR_TMPL_SIZE);
+	tmpl_ip = (const struct iphdr *)(tmpl + ETH_HLEN);
+	ip = (struct iphdr *)(p + ETH_HLEN);
+	ip->tot_len = htons(total - ETH_HLEN);
+	ip->check = csum_replace16(tmpl_ip->check, tmpl_ip->tot_len, ip->tot_len);
+	if (ctx->type == TUNNEL_TYPE_VXLAN) {
+		struct udphdr *udp = (struct udphdr *)(p + ETH_HLEN + OUTER_IP_LEN);
+		/* Scale the hash into the port range (no modulo); UDP checksum stays 0 */
+		udp->source = htons((uint16_t)(ctx->srcport_min +
+			(uint32_t)(((uint64_t)flow_hash * ctx->srcport_range) >> 32)));
+		udp->len = htons(total - ETH_HLEN - OUTER_IP_LEN);
+	}
+	memcpy(p + ctx->hdr_len, inner, len);
+	tx_ring_commit(&tx->ring, total);
+	counter_add(&tx->packets_sent[idx], 1);
+	counter_add(&tx->bytes_sent[idx], (uint64_t)total);
+	return 0;
+drop:
+	counter_add(&tx->packets_dropped[idx], 1);
+	return -1;
+}
+
+void tunnel_flush(struct tunnel_sender *tx)
+{
+	if (tx) tx_ring_flush(&tx->ring);
+}
+
+int tunnel_get_encap(const struct tunnel_ctx *ctx, struct tunnel_encap *out)
+{
+	struct tunnel_ctx *c = (struct tunnel_ctx *)ctx;
+	unsigned int i;
+
+	if (!ctx || !out) return -EINVAL;
+	memset(out, 0, sizeof(*out));
+	pthread_mutex_lock(&c->mutex);
+	out->generation = atomic_load(&ctx->generation);
+	out->type = ctx->type;
+	out->hdr_len = ctx->hdr_len;
+	out->max_inner = ctx->max_inner;
+	out->srcport_min = ctx->srcport_min;
+	out->srcport_range = ctx->srcport_range;
+	out->num_remotes = ctx->num_remotes;
+	for (i = 0; i < ctx->num_remotes; i++)
+		memcpy(out->hdr[i], atomic_load(&c->remotes[i].hdr_tmpl), HDR_TMPL_SIZE);
+	pthread_mutex_unlock(&c->mutex);
+	return 0;
+}
+
+void tunnel_lb_sample(const struct tunnel_ctx *ctx, uint8_t *out, unsigned int n)
+{
+	struct tunnel_ctx *c = (struct tunnel_ctx *)ctx;
+	const uint8_t *table;
+	unsigned int s;
+
+	if (!ctx || !out) return;
+	if (ctx->num_remotes <= 1) {
+		/* tunnel_send() always uses remote 0 */
+		memset(out, 0, n);
+		return;
+	}
+	pthread_mutex_lock(&c->mutex);
+	table = atomic_load_explicit(&ctx->lb_table, memory_order_acquire);
+	for (s = 0; s < n; s++)
+		out[s] = table ? table[(uint64_t)s * LB_TABLE_SIZE / n] : TUNNEL_NO_REMOTE;
+	pthread_mutex_unlock(&c->mutex);
+}
+
+void tunnel_set_external_stats(struct tunnel_ctx *ctx, unsigned int idx,
+                               uint64_t packets, uint64_t bytes, uint64_t dropped)
+{
+	if (!ctx || idx >= ctx->num_remotes) return;
 	pthread_mutex_lock(&ctx->mutex);
-	if (ctx->type == TUNNEL_TYPE_VXLAN) ret = send_vxlan(ctx, inner, len);
-	else if (ctx->type == TUNNEL_TYPE_GRE) ret = send_gre(ctx, inner, len);
+	ctx->external_packets[idx] = packets;
+	ctx->external_bytes[idx] = bytes;
+	ctx->external_dropped[idx] = dropped;
 	pthread_mutex_unlock(&ctx->mutex);
-	return ret;
 }
 
-void tunnel_flush(struct tunnel_ctx *ctx) { (void)ctx; }
-
 void tunnel_cleanup(struct tunnel_ctx *ctx)
 {
+	unsigned int i;
+
 	if (!ctx) return;
-	if (ctx->fd >= 0) { close(ctx->fd); ctx->fd = -1; }
-	if (ctx->encap_buf) { free(ctx->encap_buf); ctx->encap_buf = NULL; }
+	if (atomic_exchange(&ctx->health_running, false))
+		pthread_join(ctx->health_thread, NULL);
+	while (ctx->senders)
+		tunnel_sender_destroy(ctx->senders);
+	for (i = 0; i < ctx->num_remotes; i++)
+		free((void *)atomic_load(&ctx->remotes[i].hdr_tmpl));
+	free((void *)atomic_load(&ctx->lb_table));
 	pthread_mutex_destroy(&ctx->mutex);
 	free(ctx);
 }
 
 void tunnel_get_stats(const struct tunnel_ctx *ctx, uint64_t *packets_sent, uint64_t *bytes_sent)
 {
+	struct tunnel_remote_stats rs[TUNNEL_MAX_REMOTES];
+	uint64_t pkts = 0, bytes = 0;
+	unsigned int i, n;
+
 	if (!ctx) return;
-	if (packets_sent) *packets_sent = atomic_load(&ctx->packets_sent);
-	if (bytes_sent) *bytes_sent = atomic_load(&ctx->bytes_sent);
+	n = tunnel_get_remote_stats(ctx, rs, TUNNEL_MAX_REMOTES);
+	for (i = 0; i < n; i++) {
+		pkts += rs[i].packets_sent;
+		bytes += rs[i].bytes_sent;
+	}
+	if (packets_sent) *packets_sent = pkts;
+	if (bytes_sent) *bytes_sent = bytes;
+}
+
+unsigned int tunnel_get_remote_stats(const struct tunnel_ctx *ctx, struct tunnel_remote_stats *out, unsigned int max)
+{
+	struct tunnel_ctx *c = (struct tunnel_ctx *)ctx;
+	const struct tunnel_sender *tx;
+	unsigned int i, n;
+
+	if (!ctx || !out) return 0;
+	n = ctx->num_remotes < max ? ctx->num_remotes : max;
+	pthread_mutex_lock(&c->mutex);
+	for (i = 0; i < n; i++) {
+		struct tunnel_remote_stats *s = &out[i];
+		inet_ntop(AF_INET, &ctx->remotes[i].ip_be, s->ip, sizeof(s->ip));
+		s->up = atomic_load(&c->remotes[i].up);
+		s->packets_sent = c->retired_packets[i] + c->external_packets[i];
+		s->bytes_sent = c->retired_bytes[i] + c->external_bytes[i];
+		s->packets_dropped = c->retired_dropped[i] + c->external_dropped[i];
+		for (tx = c->senders; tx; tx = tx->next) {
+			s->packets_sent += counter_read(&tx->packets_sent[i]);
+			s->bytes_sent += counter_read(&tx->bytes_sent[i]);
+			s->packets_dropped += counter_read(&tx->packets_dropped[i]);
+		}
+	}
+	pthread_mutex_unlock(&c->mutex);
+	return n;
 }
@@ -1,28 +1,71 @@
 /*
  * vasn_tap - Userspace VXLAN/GRE tunnel (encap only, no kernel device)
  * Builds outer L2/IP/UDP|GRE header and sends via raw socket on output interface.
+ * tunnel_ctx holds the shared, read-only parameters; each worker sends through
+ * its own tunnel_sender (buffer + socket), so the send path takes no lock.
  */
 
 #ifndef __TUNNEL_H__
 #define __TUNNEL_H__
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdatomic.h>
 #include "config.h"
+#include "parse.h"
 
-/* Opaque context for tunnel send path */
+/* Opaque shared tunnel parameters (MACs, IPs, VNI/key, MTU) */
 struct tunnel_ctx;
 
+/* Opaque per-worker send state; used by one thread only */
+struct tunnel_sender;
+
+/* Outer header bytes of the largest encapsulation (Eth + IPv4 + UDP + VXLAN) */
+#define TUNNEL_HDR_MAX 50
+
+/* tunnel_lb_sample(): no remote is up */
+#define TUNNEL_NO_REMOTE 0xff
+
+/*
+ * Encapsulation parameters for a sender outside this module (the TC program in
+ * ebpf-redirect mode): per remote, the outer headers tunnel_send() starts from.
+ */
+struct tunnel_encap {
+	enum tunnel_type type;
+	unsigned int hdr_len;		/* Bytes of each hdr used (VXLAN 50, GRE 38) */
+	unsigned int max_inner;		/* Largest inner frame for the output MTU */
+	uint16_t srcport_min;
+	uint32_t srcport_range;		/* srcport_max - srcport_min + 1 */
+	unsigned int num_remotes;
+	uint8_t hdr[TUNNEL_MAX_REMOTES][TUNNEL_HDR_MAX];	/* IPv4 checksum for tot_len = hdr_len - 14 */
+	unsigned int generation;	/* Changes when a remote's MAC or up state changes */
+};
+
+/* Per-remote counters (tunnel_get_remote_stats) */
+struct tunnel_remote_stats {
+	char ip[16];			/* Dotted-quad remote address */
+	bool up;			/* Currently receiving flows */
+	uint64_t packets_sent;
+	uint64_t bytes_sent;
+	uint64_t packets_dropped;	/* Oversize or TX ring full */
+};
+
 /*
- * Initialize tunnel: resolve MACs (ARP), open raw socket bound to output_ifname.
- * local_ip may be NULL or empty to derive from output interface.
- * Returns 0 on success, negative errno on failure.
+ * Initialize tunnel: resolve MACs (ARP) and outer header parameters for output_ifname.
+ * remote_ips holds num_remotes (1..TUNNEL_MAX_REMOTES) destinations. With more than one,
+ * flows are spread by a Maglev table over the remotes that are up, and a health thread
+ * re-checks each remote's ARP entry every second, taking it out after 3 failures.
+ * Init fails only if no remote resolves. local_ip may be NULL or empty to derive from
+ * output interface. Returns 0 on success, negative errno on failure.
  */
 int tunnel_init(struct tunnel_ctx **ctx_out,
                 enum tunnel_type type,
-                const char *remote_ip,
+                const char *const *remote_ips,
+                unsigned int num_remotes,
                 uint32_t vni,
                 uint16_t dstport,
+                uint16_t srcport_min,
+                uint16_t srcport_max,
                 uint32_t key,
                 const char *local_ip,
                 const char *output_ifname);
@@ -30,37 +73,80 @@ int tunnel_init(struct tunnel_ctx **ctx_out,
 /*
  * Returns 1 if the packet looks like our own tunnel output (VXLAN/GRE to remote).
  * Used when -i and -o are the same interface to avoid re-capturing and re-encapsulating.
- * Safe to call with NULL ctx (returns 0). Thread-safe (read-only on ctx).
+ * pd is the frame as parsed by pkt_parse(). Safe to call with NULL ctx (returns 0).
+ * Thread-safe (read-only on ctx).
  */
-int tunnel_is_own_packet(const struct tunnel_ctx *ctx, const void *pkt_data, uint32_t pkt_len);
+int tunnel_is_own_packet(const struct tunnel_ctx *ctx, const void *pkt_data, const struct pkt_desc *pd);
 
 /*
  * When ctx->verbose: log once if a packet has our tunnel IPs but was not skipped (UDP/VNI mismatch).
  * No-op if ctx is NULL or !ctx->verbose. Thread-safe (uses static for one-time message).
  */
-void tunnel_debug_own_mismatch(const struct tunnel_ctx *ctx, const void *pkt_data, uint32_t pkt_len);
+void tunnel_debug_own_mismatch(const struct tunnel_ctx *ctx, const void *pkt_data, const struct pkt_desc *pd);
+
+/*
+ * Create a per-worker sender: own encap buffer and raw socket bound to the output interface.
+ * geom: TX ring geometry (runtime.tx_ring); NULL = built-in defaults.
+ * Returns 0 on success, negative errno on failure (*tx_out set to NULL).
+ */
+int tunnel_sender_create(struct tunnel_ctx *ctx, const struct ring_config *geom,
+                         struct tunnel_sender **tx_out);
+
+/*
+ * Close the sender's socket and free it; its counts stay in tunnel_get_stats(). Safe to call with NULL.
+ */
+void tunnel_sender_destroy(struct tunnel_sender *tx);
 
 /*
  * Send one inner L2 frame (encapsulated and sent). Clamps to MTU; drops if too large.
- * Thread-safe. Returns 0 on success, -1 on drop/error.
+ * flow_hash (kernel-provided, or pkt_desc.flow_hash) picks the remote (multi-remote) and
+ * the VXLAN UDP source port within [srcport_min, srcport_max] (RFC 7348 section 5) so
+ * flows spread over ECMP paths and receiver RSS queues.
+ * Not thread-safe: only the sender's owning worker may call it. Returns 0 on success, -1 on drop/error.
  */
-int tunnel_send(struct tunnel_ctx *ctx, const void *inner, uint32_t len);
+int tunnel_send(struct tunnel_sender *tx, const void *inner, uint32_t len, uint32_t flow_hash);
 
 /*
  * Flush any buffered sends. No-op for synchronous send path.
- * Thread-safe.
  */
-void tunnel_flush(struct tunnel_ctx *ctx);
+void tunnel_flush(struct tunnel_sender *tx);
 
 /*
- * Cleanup and free context. Safe to call with NULL.
+ * Copy the encapsulation parameters into out. Returns 0, or -EINVAL if ctx or out is NULL.
+ * Any thread but a worker inside a batch (takes the mutex a retired template is freed under).
+ */
+int tunnel_get_encap(const struct tunnel_ctx *ctx, struct tunnel_encap *out);
+
+/*
+ * Sample the remote lookup table into n slots: out[s] is the remote tunnel_send() picks
+ * for a flow in slot s of n (hash_mix32(flow_hash) * n >> 32; close to its own choice,
+ * and a remote going down moves only its slots), or TUNNEL_NO_REMOTE if none is up.
+ */
+void tunnel_lb_sample(const struct tunnel_ctx *ctx, uint8_t *out, unsigned int n);
+
+/*
+ * Running totals of remote idx counted outside tunnel_send() (in-kernel encapsulation);
+ * replaces the previous totals and adds to tunnel_get_stats(). Stats thread only.
+ */
+void tunnel_set_external_stats(struct tunnel_ctx *ctx, unsigned int idx,
+                               uint64_t packets, uint64_t bytes, uint64_t dropped);
+
+/*
+ * Cleanup and free context, including any senders not yet destroyed. Safe to call with NULL.
+ * Call only after all workers have stopped.
  */
 void tunnel_cleanup(struct tunnel_ctx *ctx);
 
 /*
- * Get tunnel send stats (packets and bytes encapsulated and sent).
+ * Get tunnel send stats (packets and bytes encapsulated and sent), summed over all senders.
  * Safe to call with NULL ctx (then *packets_sent and *bytes_sent are unchanged).
  */
 void tunnel_get_stats(const struct tunnel_ctx *ctx, uint64_t *packets_sent, uint64_t *bytes_sent);
 
+/*
+ * Per-remote send stats, in config order. Fills up to max entries of out and returns the
+ * number filled (0 if ctx is NULL).
+ */
+unsigned int tunnel_get_remote_stats(const struct tunnel_ctx *ctx, struct tunnel_remote_stats *out, unsigned int max);
+
 #endif /* __TUNNEL_H__ */
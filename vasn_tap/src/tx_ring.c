@@ -9,32 +9,72 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
-#include <sched.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
 #include <linux/if_ether.h>
 #include <linux/if_packet.h>
+#include <linux/virtio_net.h>
 #include <arpa/inet.h>
+#include <endian.h>
 
 #include "tx_ring.h"
 
-/* Ring configuration (same defaults as previous AF_PACKET TX ring) */
-#define TX_RING_BLOCK_SIZE  (1 << 18)   /* 256 KB per block */
-#define TX_RING_BLOCK_NR    16          /* 16 blocks = 4 MB */
-#define TX_RING_FRAME_SIZE  (1 << 11)   /* 2048 bytes per frame */
+/* Geometry when the caller passes none (runtime.tx_ring defaults) */
+static const struct ring_config tx_ring_default_geom = {
+    .block_size = TX_RING_DEFAULT_BLOCK_SIZE,
+    .block_nr   = TX_RING_DEFAULT_BLOCK_NR,
+    .frame_size = TX_RING_DEFAULT_FRAME_SIZE,
+    .full_policy = TX_FULL_DROP,
+    .block_timeout_us = TX_RING_DEFAULT_BLOCK_TIMEOUT_US,
+};
+
+/* Frames checked per completion scan (tx_ring_scan()) */
+#define TX_RING_SCAN_WINDOW  64
 
 /* TX ring payload starts right after the aligned tpacket2_hdr (no sockaddr_ll).
  * TPACKET2_HDRLEN includes sockaddr_ll for RX; kernel TX expects payload here. */
 #define TX_PAYLOAD_OFFSET  TPACKET_ALIGN(sizeof(struct tpacket2_hdr))
 
+/* Frames never straddle blocks: a block may end in a gap when frame_size does not divide it */
 static inline struct tpacket2_hdr *get_frame(struct tx_ring_ctx *ctx, unsigned int idx)
 {
-    return (struct tpacket2_hdr *)((uint8_t *)ctx->ring + (idx * ctx->frame_size));
+    size_t off = (size_t)(idx / ctx->frames_per_block) * ctx->block_size +
+                 (size_t)(idx % ctx->frames_per_block) * ctx->frame_size;
+
+    return (struct tpacket2_hdr *)((uint8_t *)ctx->ring + off);
+}
+
+/*
+ * Largest frame the interface accepts: L3 MTU + Ethernet header, so we never
+ * send frames larger than allowed (avoids "packet size is too long")
+ */
+static unsigned int output_mtu_frame(int ifindex)
+{
+    char ifname[IFNAMSIZ];
+    struct ifreq ifr = {0};
+    unsigned int len = TX_RING_DEFAULT_MTU_FRAME;
+    int mtu_sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (mtu_sock < 0) {
+        return len;
+    }
+    if (if_indextoname(ifindex, ifname) != NULL) {
+        strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name) - 1);
+        ifr.ifr_name[sizeof(ifr.ifr_name) - 1] = '\0';
+        if (ioctl(mtu_sock, SIOCGIFMTU, &ifr) == 0 && ifr.ifr_mtu > 0) {
+            len = (unsigned int)ifr.ifr_mtu + ETH_HLEN;
+        }
+    }
+    close(mtu_sock);
+    return len;
 }
 
-int tx_ring_setup(struct tx_ring_ctx *ctx, int ifindex, bool verbose, bool debug)
+int tx_ring_setup(struct tx_ring_ctx *ctx, int ifindex, const struct ring_config *geom,
+                  bool verbose, bool debug)
 {
     int fd;
     int ver = TPACKET_V2;
@@ -43,6 +83,7 @@ int tx_ring_setup(struct tx_ring_ctx *ctx, int ifindex, bool verbose, bool debug
     void *ring;
     unsigned int ring_size;
     unsigned int frame_nr;
+    unsigned int frame_size, block_size, min_frame;
 
     if (!ctx || ifindex <= 0) {
         return -EINVAL;
@@ -50,6 +91,9 @@ int tx_ring_setup(struct tx_ring_ctx *ctx, int ifindex, bool verbose, bool debug
 
     memset(ctx, 0, sizeof(*ctx));
     ctx->fd = -1;
+    if (!geom) {
+        geom = &tx_ring_default_geom;
+    }
 
     fd = socket(AF_PACKET, SOCK_RAW, 0);
     if (fd < 0) {
@@ -63,7 +107,8 @@ int tx_ring_setup(struct tx_ring_ctx *ctx, int ifindex, bool verbose, bool debug
         return -errno;
     }
 
-    {
+    /* Direct xmit drops packets that need software segmentation: keep the qdisc path for gso */
+    if (!geom->gso) {
         int opt = 1;
         setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &opt, sizeof(opt));
     }
@@ -75,10 +120,40 @@ int tx_ring_setup(struct tx_ring_ctx *ctx, int ifindex, bool verbose, bool debug
         }
     }
 
-    frame_nr = (TX_RING_BLOCK_SIZE / TX_RING_FRAME_SIZE) * TX_RING_BLOCK_NR;
-    req.tp_block_size = TX_RING_BLOCK_SIZE;
-    req.tp_block_nr   = TX_RING_BLOCK_NR;
-    req.tp_frame_size = TX_RING_FRAME_SIZE;
+    /* Must precede PACKET_TX_RING; the kernel then segments by the header's gso_size */
+    if (geom->gso) {
+        int opt = 1;
+        if (setsockopt(fd, SOL_PACKET, PACKET_VNET_HDR, &opt, sizeof(opt)) < 0) {
+            fprintf(stderr, "TX ring: Failed to enable PACKET_VNET_HDR: %s\n", strerror(errno));
+            close(fd);
+            return -errno;
+        }
+        ctx->vnet_hdr_len = sizeof(struct virtio_net_hdr);
+    }
+
+    /* Jumbo MTU: grow the frames (and, if needed, the blocks) to hold a full frame */
+    ctx->max_tx_len = output_mtu_frame(ifindex);
+    frame_size = geom->frame_size;
+    block_size = geom->block_size;
+    min_frame = TPACKET_ALIGN(TX_PAYLOAD_OFFSET + ctx->vnet_hdr_len + ctx->max_tx_len);
+    if (frame_size < min_frame) {
+        frame_size = min_frame;
+        if (block_size < frame_size) {
+            long page = sysconf(_SC_PAGESIZE);
+            if (page <= 0)
+                page = 4096;
+            block_size = (frame_size + (unsigned int)page - 1) & ~((unsigned int)page - 1);
+        }
+        if (verbose) {
+            printf("TX ring: frame size %u -> %u for MTU frame %u\n",
+                   geom->frame_size, frame_size, ctx->max_tx_len);
+        }
+    }
+
+    frame_nr = (block_size / frame_size) * geom->block_nr;
+    req.tp_block_size = block_size;
+    req.tp_block_nr   = geom->block_nr;
+    req.tp_frame_size = frame_size;
     req.tp_frame_nr   = frame_nr;
 
     if (setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
@@ -98,26 +173,6 @@ int tx_ring_setup(struct tx_ring_ctx *ctx, int ifindex, bool verbose, bool debug
         return -errno;
     }
 
-    /* Get output interface MTU so we never send frames larger than allowed (avoids "packet size is too long") */
-    {
-        char ifname[IFNAMSIZ];
-        struct ifreq ifr = {0};
-        int mtu_sock = socket(AF_INET, SOCK_DGRAM, 0);
-        ctx->max_tx_len = TX_RING_DEFAULT_MTU_FRAME;
-        if (mtu_sock >= 0) {
-            if (if_indextoname(ifindex, ifname) != NULL) {
-                strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name) - 1);
-                ifr.ifr_name[sizeof(ifr.ifr_name) - 1] = '\0';
-                if (ioctl(mtu_sock, SIOCGIFMTU, &ifr) == 0) {
-                    ctx->max_tx_len = (unsigned int)ifr.ifr_mtu + 14; /* L3 MTU + Ethernet header */
-                    if (ctx->max_tx_len > TX_RING_DEFAULT_MTU_FRAME)
-                        ctx->max_tx_len = TX_RING_DEFAULT_MTU_FRAME;
-                }
-            }
-            close(mtu_sock);
-        }
-    }
-
     ring_size = req.tp_block_size * req.tp_block_nr;
     ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
                 MAP_SHARED | MAP_LOCKED, fd, 0);
@@ -137,13 +192,18 @@ int tx_ring_setup(struct tx_ring_ctx *ctx, int ifindex, bool verbose, bool debug
     ctx->ring        = ring;
     ctx->ring_size   = ring_size;
     ctx->frame_nr    = frame_nr;
-    ctx->frame_size  = TX_RING_FRAME_SIZE;
+    ctx->frame_size  = frame_size;
+    ctx->block_size  = block_size;
+    ctx->frames_per_block = block_size / frame_size;
     ctx->current     = 0;
+    ctx->full_policy = geom->full_policy;
+    ctx->block_timeout_us = geom->block_timeout_us;
     ctx->debug       = debug;
 
     if (verbose) {
-        printf("TX ring: %u frames x %u bytes = %u KB, max_tx_len=%u\n",
-               frame_nr, TX_RING_FRAME_SIZE, ring_size / 1024, ctx->max_tx_len);
+        printf("TX ring: %u frames x %u bytes = %u KB, max_tx_len=%u%s\n",
+               frame_nr, frame_size, ring_size / 1024, ctx->max_tx_len,
+               ctx->vnet_hdr_len ? ", gso" : "");
     }
 
     return 0;
@@ -164,47 +224,115 @@ void tx_ring_teardown(struct tx_ring_ctx *ctx)
     }
 }
 
-int tx_ring_write(struct tx_ring_ctx *ctx, const void *data, uint32_t len)
+/*
+ * Count the frames the kernel has handed back, from current on, in one pass
+ * over up to TX_RING_SCAN_WINDOW headers; reserve then uses them without
+ * looking at tp_status again. Stops at the first frame still queued or sending.
+ */
+static unsigned int tx_ring_scan(struct tx_ring_ctx *ctx)
 {
-    struct tpacket2_hdr *txhdr;
-    uint32_t max_payload;
+    unsigned int idx = ctx->current;
+    unsigned int n;
 
-    if (!ctx || ctx->fd < 0 || !data) {
-        return -1;
+    for (n = 0; n < TX_RING_SCAN_WINDOW && n < ctx->frame_nr; n++) {
+        uint32_t status = __atomic_load_n(&get_frame(ctx, idx)->tp_status, __ATOMIC_ACQUIRE);
+
+        if (status != TP_STATUS_AVAILABLE && status != TP_STATUS_WRONG_FORMAT)
+            break;
+        if (++idx == ctx->frame_nr)
+            idx = 0;
     }
+    ctx->free = n;
+    return n;
+}
 
-    /* Clamp to interface MTU to avoid kernel "packet size is too long (N > 1518)" and TX ring stuck state */
-    if (len > ctx->max_tx_len) {
-        len = ctx->max_tx_len;
+/* Hand the committed frames to the kernel (one sendto()) */
+static void tx_ring_kick(struct tx_ring_ctx *ctx)
+{
+    sendto(ctx->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+    ctx->unflushed = 0;
+}
+
+/*
+ * TX_FULL_BLOCK: wait for the kernel to complete a frame (POLLOUT). The
+ * deadline is per batch: the first wait since the last tx_ring_flush() sets it
+ * block_timeout_us ahead and later waits share it, so a batch blocks for at
+ * most block_timeout_us in total, and once it has passed the rest of the batch
+ * is dropped without waiting. Returns true once a frame is free.
+ */
+static bool tx_ring_wait(struct tx_ring_ctx *ctx)
+{
+    struct pollfd pfd = { .fd = ctx->fd, .events = POLLOUT };
+    struct timespec now, left;
+
+    if (!ctx->wait_armed) {
+        clock_gettime(CLOCK_MONOTONIC, &ctx->wait_deadline);
+        ctx->wait_deadline.tv_nsec += (long)ctx->block_timeout_us * 1000;
+        ctx->wait_deadline.tv_sec += ctx->wait_deadline.tv_nsec / 1000000000L;
+        ctx->wait_deadline.tv_nsec %= 1000000000L;
+        ctx->wait_armed = true;
     }
 
-    max_payload = ctx->frame_size - TX_PAYLOAD_OFFSET;
-    if (len > max_payload) {
-        len = max_payload;
+    for (;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left.tv_sec = ctx->wait_deadline.tv_sec - now.tv_sec;
+        left.tv_nsec = ctx->wait_deadline.tv_nsec - now.tv_nsec;
+        if (left.tv_nsec < 0) {
+            left.tv_sec--;
+            left.tv_nsec += 1000000000L;
+        }
+        if (left.tv_sec < 0)
+            return false;
+        if (ppoll(&pfd, 1, &left, NULL) < 0 && errno != EINTR)
+            return false;
+        if (tx_ring_scan(ctx) > 0)
+            return true;
     }
+}
 
-    txhdr = get_frame(ctx, ctx->current);
+void *tx_ring_reserve(struct tx_ring_ctx *ctx, uint32_t *cap)
+{
+    struct tpacket2_hdr *txhdr;
+    uint32_t max_payload;
 
-    if (txhdr->tp_status != TP_STATUS_AVAILABLE &&
-        txhdr->tp_status != TP_STATUS_WRONG_FORMAT) {
-        tx_ring_flush(ctx);
-        {
-            int retries = 64;
-            while (retries-- > 0 &&
-                   txhdr->tp_status != TP_STATUS_AVAILABLE &&
-                   txhdr->tp_status != TP_STATUS_WRONG_FORMAT) {
-                sched_yield();
-            }
+    if (!ctx || ctx->fd < 0) {
+        return NULL;
+    }
+
+    if (ctx->free == 0 && tx_ring_scan(ctx) == 0) {
+        /* Full: kick what is still queued, look once more, then drop (or wait) */
+        if (ctx->unflushed > 0) {
+            tx_ring_kick(ctx);
+            tx_ring_scan(ctx);
         }
-        if (txhdr->tp_status != TP_STATUS_AVAILABLE &&
-            txhdr->tp_status != TP_STATUS_WRONG_FORMAT) {
-            return -1;
+        if (ctx->free == 0 &&
+            (ctx->full_policy != TX_FULL_BLOCK || !tx_ring_wait(ctx))) {
+            counter_add(&ctx->full_drops, 1);
+            return NULL;
         }
     }
 
+    txhdr = get_frame(ctx, ctx->current);
+
+    /* Clamp to interface MTU to avoid kernel "packet size is too long (N > 1518)" and TX ring stuck state */
+    max_payload = ctx->frame_size - TX_PAYLOAD_OFFSET - ctx->vnet_hdr_len;
+    if (cap) {
+        *cap = ctx->max_tx_len < max_payload ? ctx->max_tx_len : max_payload;
+    }
+    if (ctx->vnet_hdr_len) {
+        /* No offload unless tx_ring_write() fills it in */
+        memset((uint8_t *)txhdr + TX_PAYLOAD_OFFSET, 0, ctx->vnet_hdr_len);
+    }
+    return (uint8_t *)txhdr + TX_PAYLOAD_OFFSET + ctx->vnet_hdr_len;
+}
+
+void tx_ring_commit(struct tx_ring_ctx *ctx, uint32_t len)
+{
+    struct tpacket2_hdr *txhdr = get_frame(ctx, ctx->current);
+
+    len += ctx->vnet_hdr_len;
     txhdr->tp_len     = len;
     txhdr->tp_snaplen = len;
-    memcpy((uint8_t *)txhdr + TX_PAYLOAD_OFFSET, data, len);
     /* DEBUG: dump first packet written to TX ring once (only if ctx->debug) */
     {
         static int tx_debug_dumped;
@@ -222,7 +350,96 @@ int tx_ring_write(struct tx_ring_ctx *ctx, const void *data, uint32_t len)
     txhdr->tp_status = TP_STATUS_SEND_REQUEST;
 
     ctx->current = (ctx->current + 1) % ctx->frame_nr;
-    return 0;
+    ctx->free--;
+    ctx->unflushed++;
+}
+
+/* Sum of 16-bit big-endian words, for the TCP pseudo-header */
+static uint32_t csum_add_be16(uint32_t sum, const uint8_t *p, unsigned int n)
+{
+    unsigned int i;
+
+    for (i = 0; i + 1 < n; i += 2)
+        sum += (uint32_t)p[i] << 8 | p[i + 1];
+    return sum;
+}
+
+/*
+ * Turn the frame just copied to pkt into a TCP GSO packet: the kernel cuts it
+ * into segments of at most max_tx_len bytes and completes each TCP checksum
+ * from the pseudo-header sum left in th->check (CHECKSUM_PARTIAL, as for a
+ * locally sent TSO packet). Returns false when the packet does not qualify.
+ */
+static bool tx_ring_set_gso(const struct tx_ring_ctx *ctx, uint8_t *pkt, uint32_t len,
+                            const struct pkt_desc *pd)
+{
+    struct virtio_net_hdr *vh = (struct virtio_net_hdr *)(pkt - ctx->vnet_hdr_len);
+    uint32_t l4 = pd->l4_off, thl, hdr_len, sum;
+    uint8_t *th;
+
+    /* virtio_net_hdr_set_proto() takes the L3 protocol from gso_type: no VLAN tags */
+    if (pd->protocol != IPPROTO_TCP || (pd->flags & (PKT_F_FRAGMENT | PKT_F_L3_GUESSED)) ||
+        !(pd->flags & (PKT_F_IPV4 | PKT_F_IPV6)) || pd->l3_off != ETH_HLEN ||
+        pd->len != len || l4 + 20 > len)
+        return false;
+    th = pkt + l4;
+    thl = (uint32_t)(th[12] >> 4) * 4;
+    hdr_len = l4 + thl;
+    if (thl < 20 || hdr_len >= len || hdr_len >= ctx->max_tx_len)
+        return false;
+
+    sum = IPPROTO_TCP + (len - l4);
+    if (pd->flags & PKT_F_IPV4) {
+        sum = csum_add_be16(sum, pkt + pd->l3_off + 12, 8);   /* saddr, daddr */
+        vh->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+    } else {
+        sum = csum_add_be16(sum, pkt + pd->l3_off + 8, 32);   /* ip6 saddr, daddr */
+        vh->gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
+    }
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    th[16] = (uint8_t)(sum >> 8);
+    th[17] = (uint8_t)sum;
+
+    vh->flags       = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    vh->hdr_len     = htole16((uint16_t)hdr_len);
+    vh->gso_size    = htole16((uint16_t)(ctx->max_tx_len - hdr_len));
+    vh->csum_start  = htole16((uint16_t)l4);
+    vh->csum_offset = htole16(16);                            /* offsetof(struct tcphdr, check) */
+    return true;
+}
+
+int tx_ring_write(struct tx_ring_ctx *ctx, const void *data, uint32_t len,
+                  const struct pkt_desc *pd)
+{
+    uint32_t cap;
+    uint8_t *frame;
+
+    if (!data) {
+        return -1;
+    }
+    frame = tx_ring_reserve(ctx, &cap);
+    if (!frame) {
+        return -1;
+    }
+    if (len > cap) {
+        uint32_t room = ctx->frame_size - TX_PAYLOAD_OFFSET - ctx->vnet_hdr_len;
+
+        /* GSO: the whole packet goes if it fits the frame and is TCP */
+        if (ctx->vnet_hdr_len && pd && len <= room && len <= 0xffff) {
+            memcpy(frame, data, len);
+            if (tx_ring_set_gso(ctx, frame, len, pd)) {
+                tx_ring_commit(ctx, len);
+                return (int)len;
+            }
+            tx_ring_commit(ctx, cap);
+            return (int)cap;
+        }
+        len = cap;
+    }
+    memcpy(frame, data, len);
+    tx_ring_commit(ctx, len);
+    return (int)len;
 }
 
 void tx_ring_flush(struct tx_ring_ctx *ctx)
@@ -230,5 +447,6 @@ void tx_ring_flush(struct tx_ring_ctx *ctx)
     if (!ctx || ctx->fd < 0) {
         return;
     }
-    sendto(ctx->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+    tx_ring_kick(ctx);
+    ctx->wait_armed = false;    /* End of batch: the next wait gets a fresh deadline */
 }
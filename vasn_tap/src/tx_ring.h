@@ -8,8 +8,12 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <time.h>
+#include "config.h"
+#include "counter.h"
+#include "parse.h"
 
-/* Default max Ethernet frame (kernel rejects larger, see "af_packet: packet size is too long") */
+/* Max Ethernet frame when the output MTU cannot be read (kernel rejects larger, see "af_packet: packet size is too long") */
 #define TX_RING_DEFAULT_MTU_FRAME  1518
 
 /* Opaque state for one TX ring (one AF_PACKET socket + mmap'd ring) */
@@ -19,20 +23,34 @@ struct tx_ring_ctx {
     unsigned int ring_size;    /* Total mmap size in bytes */
     unsigned int frame_nr;     /* Number of frames in ring */
     unsigned int frame_size;   /* Bytes per frame */
+    unsigned int block_size;   /* Bytes per block */
+    unsigned int frames_per_block;
     unsigned int current;      /* Next frame index to write */
-    unsigned int max_tx_len;   /* Clamp packet length to avoid kernel reject (<= interface MTU frame) */
+    unsigned int free;         /* Frames known free from current on (last tx_ring_scan()) */
+    unsigned int unflushed;    /* Frames committed since the last tx_ring_flush() */
+    unsigned int max_tx_len;   /* Clamp packet length to avoid kernel reject (interface MTU + Ethernet header) */
+    unsigned int vnet_hdr_len; /* virtio_net_hdr before each frame's payload (gso), else 0 */
+    enum tx_full_policy full_policy; /* Ring full: drop at once or wait up to block_timeout_us */
+    uint32_t     block_timeout_us;
+    bool         wait_armed;   /* TX_FULL_BLOCK: wait_deadline set for this batch */
+    struct timespec wait_deadline;
     bool         debug;        /* Enable TX hex dump (first packet only) */
+    uint64_t     full_drops;   /* Packets refused because no frame was free (owner writes, counter_read()) */
 };
 
 /*
  * Setup a TPACKET_V2 TX ring bound to the given interface.
+ * Frames are grown (and blocks with them) to hold a full frame at the interface MTU.
+ * With geom->gso the socket takes a virtio_net_hdr per frame (PACKET_VNET_HDR).
  * @param ctx: Context to initialize (zeroed by caller)
  * @param ifindex: Output interface index
+ * @param geom: Ring geometry (runtime.tx_ring, validated by config_load); NULL = TX_RING_DEFAULT_*
  * @param verbose: Enable verbose logging
  * @param debug: Enable TX hex dump of first packet (for debugging)
  * @return: 0 on success, negative errno on failure
  */
-int tx_ring_setup(struct tx_ring_ctx *ctx, int ifindex, bool verbose, bool debug);
+int tx_ring_setup(struct tx_ring_ctx *ctx, int ifindex, const struct ring_config *geom,
+                  bool verbose, bool debug);
 
 /*
  * Tear down the TX ring and release resources.
@@ -41,18 +59,43 @@ int tx_ring_setup(struct tx_ring_ctx *ctx, int ifindex, bool verbose, bool debug
 void tx_ring_teardown(struct tx_ring_ctx *ctx);
 
 /*
- * Write one packet into the next TX ring frame.
+ * Reserve the next TX ring frame so a caller can build a packet in place.
+ * Never spins: when no frame is free it kicks pending frames and rescans once,
+ * then fails (counted in full_drops) or, with TX_FULL_BLOCK, waits for a
+ * completion. With TX_FULL_BLOCK all waits between two tx_ring_flush() calls
+ * share one deadline, block_timeout_us after the first: once it has passed,
+ * the rest of the batch is dropped without waiting.
+ * Must be followed by tx_ring_commit() before the next reserve/write.
+ * @param ctx: TX ring context
+ * @param cap: Output: max bytes that may be written (frame and MTU limit)
+ * @return: Pointer to the frame payload, NULL if the ring is full
+ */
+void *tx_ring_reserve(struct tx_ring_ctx *ctx, uint32_t *cap);
+
+/*
+ * Queue the frame returned by tx_ring_reserve() with len bytes (len <= cap).
+ * @param ctx: TX ring context
+ * @param len: Bytes written into the reserved frame
+ */
+void tx_ring_commit(struct tx_ring_ctx *ctx, uint32_t len);
+
+/*
+ * Write one packet into the next TX ring frame (reserve + copy + commit).
  * Caller should call tx_ring_flush() periodically (e.g. after a batch).
+ * With gso, an untagged TCP packet (per pd) longer than the MTU frame is queued
+ * whole for the kernel to segment; anything else is clamped to max_tx_len.
  * @param ctx: TX ring context
  * @param data: Packet payload
- * @param len: Packet length (truncated if larger than frame capacity)
- * @return: 0 on success (packet queued), -1 if dropped (ring full after retry)
+ * @param len: Packet length (clamped if larger than frame or MTU capacity)
+ * @param pd: data parsed by pkt_parse(), or NULL (no segmentation)
+ * @return: Bytes queued (< len if clamped), -1 if dropped (ring full, see tx_ring_reserve())
  */
-int tx_ring_write(struct tx_ring_ctx *ctx, const void *data, uint32_t len);
+int tx_ring_write(struct tx_ring_ctx *ctx, const void *data, uint32_t len,
+                  const struct pkt_desc *pd);
 
 /*
- * Flush all pending TX ring frames to the wire (one sendto() syscall).
- * No-op if ctx->fd < 0.
+ * Flush all pending TX ring frames to the wire (one sendto() syscall) and end
+ * the batch for the TX_FULL_BLOCK deadline. No-op if ctx->fd < 0.
  */
 void tx_ring_flush(struct tx_ring_ctx *ctx);
 
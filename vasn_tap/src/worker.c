@@ -1,7 +1,9 @@
 /*
  * vasn_tap - Worker Thread Implementation
  * CPU-pinned pthread workers for high-performance packet processing
- * Uses perf buffer for kernel-to-userspace transfer
+ * Uses sharded BPF ring buffers for kernel-to-userspace transfer: the TC
+ * program picks a shard by flow hash and each worker polls only its own shard,
+ * so workers are fully independent (own ring, own TX ring, own scratch buffer).
  */
 
 #define _GNU_SOURCE
@@ -15,6 +17,7 @@
 #include <sys/sysinfo.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
 #include <net/if.h>
 #include <netpacket/packet.h>
 #include <net/ethernet.h>
@@ -28,18 +31,18 @@
 #include "tx_ring.h"
 #include "filter.h"
 #include "truncate.h"
+#include "parse.h"
+#include "ebpf/tc_clone.h"
 #include "../include/common.h"
 
-/* Perf buffer configuration */
-#define PERF_BUFFER_PAGES 64
-#define PERF_POLL_TIMEOUT_MS 100
+/* Ring buffer poll timeout (also bounds shutdown latency) */
+#define RINGBUF_POLL_TIMEOUT_MS 100
 
-/* Writable buffer for truncation in eBPF path (perf buffer is read-only) */
-#define WORKER_TRUNCATE_BUF_SIZE 9216
-static __u8 g_truncate_buf[WORKER_TRUNCATE_BUF_SIZE];
+/* Flush TX after this many queued packets even within one poll batch */
+#define WORKER_TX_BATCH 32
 
-/* Global worker context for perf buffer callback */
-static struct worker_ctx *g_worker_ctx = NULL;
+/* Publish stats after this many packets if a consume call runs that long */
+#define WORKER_STATS_BATCH 256
 
 /* Worker thread argument */
 struct worker_thread_arg {
@@ -49,125 +52,130 @@ struct worker_thread_arg {
 };
 
 /*
- * Perf buffer sample callback - called for each packet
+ * Flush pending TX for a worker (end of poll batch or batch limit reached)
  */
-static void handle_sample(void *ctx, int cpu, void *data, __u32 size)
+static void worker_flush(struct ebpf_worker *w)
 {
-    (void)ctx; /* Use global context */
-    (void)cpu; /* CPU info available if needed */
-    struct worker_ctx *wctx = g_worker_ctx;
+    if (w->tx_pending == 0)
+        return;
+    if (w->ctx->config.tunnel_ctx)
+        tunnel_flush(w->tunnel_tx);
+    else if (w->tx.fd >= 0)
+        tx_ring_flush(&w->tx);
+    w->tx_pending = 0;
+}
+
+/*
+ * Ring buffer sample callback - called for each packet on this worker's shard
+ */
+static int handle_sample(void *ctx, void *data, size_t size)
+{
+    struct ebpf_worker *w = (struct ebpf_worker *)ctx;
+    struct worker_ctx *wctx = w->ctx;
     struct pkt_meta *meta = (struct pkt_meta *)data;
-    struct worker_stats *stats;
+    struct worker_stats *stats = &w->batch;
 
-    if (!wctx || !meta || size < sizeof(struct pkt_meta)) {
-        return;
+    if (!meta || size < sizeof(struct pkt_meta)) {
+        return 0;
     }
 
-    /* Use stats[0] for simplicity (single worker handles all) */
-    stats = &wctx->stats[0];
+    if (stats->packets_received >= WORKER_STATS_BATCH)
+        worker_stats_publish(&wctx->stats[w->id], stats);
 
     /* Update receive stats */
-    atomic_fetch_add(&stats->packets_received, 1);
-    atomic_fetch_add(&stats->bytes_received, meta->len);
+    stats->packets_received++;
+    stats->bytes_received += meta->len;
 
-    /* Get packet data pointer (after metadata). Perf buffer is read-only. */
+    /*
+     * Get packet data pointer (after metadata). Ring buffer data is read-only.
+     * pkt_len is what was captured; meta->len is the length on the wire
+     * (larger when the BPF program already truncated the sample).
+     */
     __u8 *pkt_data = meta->data;
-    __u32 pkt_len = meta->len;
+    __u32 pkt_len = meta->caplen;
     __u32 send_len = pkt_len;
     __u8 *send_data = pkt_data;
+    struct pkt_desc pd;
 
     /* Validate packet length */
     if (size < sizeof(struct pkt_meta) + pkt_len) {
-        atomic_fetch_add(&stats->packets_dropped, 1);
-        return;
+        stats->packets_dropped++;
+        return 0;
     }
 
-    /* Skip our own tunnel output when -i and -o are the same (avoid re-encapsulation loop) */
-    if (wctx->config.tunnel_ctx && tunnel_is_own_packet(wctx->config.tunnel_ctx, pkt_data, pkt_len))
-        return;
-
     /* Drop mode (no tunnel and no tx_ring) */
-    if (!wctx->config.tunnel_ctx && wctx->tx_ring.fd < 0) {
-        atomic_fetch_add(&stats->packets_dropped, 1);
-        return;
+    if (!wctx->config.tunnel_ctx && w->tx.fd < 0) {
+        stats->packets_dropped++;
+        return 0;
     }
 
-    /* Filter: if config set, evaluate and count rule hit */
-    if (g_filter_config) {
+    /* Parse once; filter, truncation and loop detection share the descriptor */
+    if (meta->vlan_present)
+        pkt_parse_vlan(pkt_data, pkt_len, meta->vlan_tci, &pd);
+    else
+        pkt_parse(pkt_data, pkt_len, &pd);
+
+    /* Skip our own tunnel output when -i and -o are the same (avoid re-encapsulation loop) */
+    if (wctx->config.tunnel_ctx && tunnel_is_own_packet(wctx->config.tunnel_ctx, pkt_data, &pd))
+        return 0;
+
+    /* Filter: if config set (and not already applied in the kernel), evaluate and count rule hit */
+    if (w->filter && !wctx->filter_in_kernel) {
         int matched;
-        enum filter_action fa = filter_packet(g_filter_config, pkt_data, pkt_len, &matched);
-        unsigned int slot = (matched >= 0) ? (unsigned int)matched : g_filter_config->num_rules;
-        atomic_fetch_add(&filter_rule_hits[slot], 1);
+        enum filter_action fa = filter_classify(w->filter->fc, &pd, &matched);
+        unsigned int slot = (matched >= 0) ? (unsigned int)matched : w->filter->cfg->num_rules;
+        counter_add(&filter_hits_row(w->filter, (unsigned int)w->id)[slot], 1);
         if (fa == FILTER_ACTION_DROP) {
-            atomic_fetch_add(&stats->packets_dropped, 1);
-            return;
+            stats->packets_dropped++;
+            return 0;
         }
     }
 
     /*
-     * Truncation must run on a writable buffer. Perf buffer memory is read-only,
-     * so when truncation is enabled copy into g_truncate_buf and truncate there.
+     * Truncation: normally already done by the BPF program (snap_len, with the
+     * IPv4 fixup), so the sample is sent as-is. Otherwise it must run on a
+     * writable buffer since ring buffer memory is read-only to the consumer:
+     * copy only the bytes that survive truncation into this worker's
+     * truncate_buf and fix up the headers there.
      */
-    if (wctx->config.truncate_enabled && pkt_len <= WORKER_TRUNCATE_BUF_SIZE) {
-        memcpy(g_truncate_buf, pkt_data, pkt_len);
-        send_len = truncate_apply(g_truncate_buf, pkt_len, true, wctx->config.truncate_length);
-        send_data = g_truncate_buf;
-    } else if (!wctx->config.truncate_enabled) {
-        send_len = pkt_len;
-        send_data = pkt_data;
-    } else {
-        /* truncate enabled but packet larger than buffer: send without truncating */
-        send_len = pkt_len;
-        send_data = pkt_data;
+    if (wctx->config.truncate_enabled && !wctx->truncate_in_kernel &&
+        pkt_len > wctx->config.truncate_length &&
+        wctx->config.truncate_length <= WORKER_TRUNCATE_BUF_SIZE) {
+        memcpy(w->truncate_buf, pkt_data, wctx->config.truncate_length);
+        send_len = truncate_apply(w->truncate_buf, pkt_len, true, wctx->config.truncate_length, &pd);
+        send_data = w->truncate_buf;
     }
-    if (send_len < pkt_len) {
-        atomic_fetch_add(&stats->packets_truncated, 1);
-        atomic_fetch_add(&stats->bytes_truncated, (uint64_t)(pkt_len - send_len));
+    if (wctx->config.truncate_enabled && send_len < meta->len) {
+        stats->packets_truncated++;
+        stats->bytes_truncated += (uint64_t)(meta->len - send_len);
     }
 
     if (wctx->config.tunnel_ctx) {
-        tunnel_debug_own_mismatch(wctx->config.tunnel_ctx, send_data, send_len);
-        if (tunnel_send(wctx->config.tunnel_ctx, send_data, send_len) == 0) {
-            atomic_fetch_add(&stats->packets_sent, 1);
-            atomic_fetch_add(&stats->bytes_sent, send_len);
-            wctx->tx_pending++;
-            if (wctx->tx_pending >= 32) {
-                tunnel_flush(wctx->config.tunnel_ctx);
-                wctx->tx_pending = 0;
-            }
+        tunnel_debug_own_mismatch(wctx->config.tunnel_ctx, send_data, &pd);
+        if (tunnel_send(w->tunnel_tx, send_data, send_len, meta->hash) == 0) {
+            stats->packets_sent++;
+            stats->bytes_sent += send_len;
+            w->tx_pending++;
         } else {
-            atomic_fetch_add(&stats->packets_dropped, 1);
-        }
-    } else if (tx_ring_write(&wctx->tx_ring, send_data, send_len) == 0) {
-        atomic_fetch_add(&stats->packets_sent, 1);
-        atomic_fetch_add(&stats->bytes_sent, send_len);
-        wctx->tx_pending++;
-        if (wctx->tx_pending >= 32) {
-            tx_ring_flush(&wctx->tx_ring);
-            wctx->tx_pending = 0;
+            stats->packets_dropped++;
         }
     } else {
-        atomic_fetch_add(&stats->packets_dropped, 1);
+        int sent = tx_ring_write(&w->tx, send_data, send_len, &pd);
+        if (sent >= 0) {
+            stats->packets_sent++;
+            stats->bytes_sent += (uint32_t)sent;
+            if ((uint32_t)sent < send_len)
+                stats->packets_clamped++;
+            w->tx_pending++;
+        } else {
+            stats->packets_dropped++;
+        }
     }
-}
 
-/*
- * Perf buffer lost samples callback
- */
-static void handle_lost(void *ctx, int cpu, __u64 lost_cnt)
-{
-    (void)ctx;
-    struct worker_ctx *wctx = g_worker_ctx;
-    
-    if (wctx && wctx->config.verbose) {
-        fprintf(stderr, "Lost %llu samples on CPU %d\n",
-                (unsigned long long)lost_cnt, cpu);
-    }
-    
-    /* Count lost packets in stats */
-    if (wctx && wctx->stats) {
-        atomic_fetch_add(&wctx->stats[0].packets_dropped, lost_cnt);
-    }
+    if (w->tx_pending >= WORKER_TX_BATCH)
+        worker_flush(w);
+
+    return 0;
 }
 
 /*
@@ -190,7 +198,7 @@ static int pin_to_cpu(int cpu_id)
 
 /*
  * Worker thread main function
- * Single thread polls the perf buffer (handles all CPUs)
+ * Each worker polls its own ring buffer shard and flushes TX after every batch
  */
 static void *worker_thread(void *arg)
 {
@@ -198,6 +206,7 @@ static void *worker_thread(void *arg)
     struct worker_ctx *ctx = targ->ctx;
     int worker_id = targ->worker_id;
     int cpu_id = targ->cpu_id;
+    struct ebpf_worker *w = &ctx->workers[worker_id];
     int err;
 
     /* Pin to CPU */
@@ -210,22 +219,32 @@ static void *worker_thread(void *arg)
     /* Free thread argument */
     free(targ);
 
-    /* Only worker 0 polls the perf buffer */
-    if (worker_id == 0) {
-        while (ctx->running) {
-            err = perf_buffer__poll(ctx->pb, PERF_POLL_TIMEOUT_MS);
-            if (err < 0 && err != -EINTR) {
-                if (ctx->config.verbose) {
-                    fprintf(stderr, "Worker %d poll error: %s\n",
-                            worker_id, strerror(-err));
-                }
+    /*
+     * Wait for data outside the filter read section, then consume what is
+     * there under one filter (ring_buffer__poll() would block inside it)
+     */
+    while (ctx->running) {
+        struct epoll_event ev;
+
+        err = epoll_wait(ring_buffer__epoll_fd(w->rb), &ev, 1, RINGBUF_POLL_TIMEOUT_MS);
+        if (err < 0 && errno != EINTR) {
+            if (ctx->config.verbose) {
+                fprintf(stderr, "Worker %d poll error: %s\n",
+                        worker_id, strerror(errno));
             }
         }
-    } else {
-        /* Other workers just wait (shouldn't happen with num_workers=1) */
-        while (ctx->running) {
-            usleep(100000);
+        if (err <= 0)
+            continue;
+
+        w->filter = filter_enter((unsigned int)worker_id);
+        err = ring_buffer__consume(w->rb);
+        filter_exit((unsigned int)worker_id);
+        w->filter = NULL;
+        worker_stats_publish(&ctx->stats[worker_id], &w->batch);
+        if (err < 0 && ctx->config.verbose) {
+            fprintf(stderr, "Worker %d consume error: %s\n", worker_id, strerror(-err));
         }
+        worker_flush(w);
     }
 
     if (ctx->config.verbose) {
@@ -234,12 +253,88 @@ static void *worker_thread(void *arg)
     return NULL;
 }
 
+/*
+ * Cleanup a single worker's resources
+ */
+static void cleanup_worker(struct ebpf_worker *w)
+{
+    if (w->tx.fd >= 0) {
+        tx_ring_flush(&w->tx);
+    }
+    tx_ring_teardown(&w->tx);
+    tunnel_sender_destroy(w->tunnel_tx);
+    w->tunnel_tx = NULL;
+
+    if (w->rb) {
+        ring_buffer__free(w->rb);
+        w->rb = NULL;
+    }
+    if (w->rb_map_fd >= 0) {
+        close(w->rb_map_fd);
+        w->rb_map_fd = -1;
+    }
+}
+
+/*
+ * Shard size for an equal share of total bytes over shards: the largest power
+ * of two that fits the share, but at least RINGBUF_MIN_SHARD_SIZE
+ */
+static uint32_t ringbuf_shard_size(uint32_t total, int shards)
+{
+    uint32_t share = (total ? total : RINGBUF_DEFAULT_SIZE) / (uint32_t)shards;
+    uint32_t size = RINGBUF_MIN_SHARD_SIZE;
+
+    while (size <= share / 2)
+        size <<= 1;
+    return size;
+}
+
+/*
+ * Create ring buffer shard for one worker, insert it into the outer events
+ * map at the worker's index and attach a libbpf consumer to it
+ */
+static int setup_worker_ringbuf(struct ebpf_worker *w, int events_fd)
+{
+    __u32 key = (__u32)w->id;
+    char name[16];
+    int err;
+
+    snprintf(name, sizeof(name), "vasn_rb%d", w->id);
+    w->rb_map_fd = bpf_map_create(BPF_MAP_TYPE_RINGBUF, name, 0, 0,
+                                  w->ctx->shard_size, NULL);
+    if (w->rb_map_fd < 0) {
+        err = -errno;
+        fprintf(stderr, "Failed to create ring buffer shard %d: %s\n",
+                w->id, strerror(-err));
+        w->rb_map_fd = -1;
+        return err;
+    }
+
+    if (bpf_map_update_elem(events_fd, &key, &w->rb_map_fd, BPF_ANY) != 0) {
+        err = -errno;
+        fprintf(stderr, "Failed to insert ring buffer shard %d: %s\n",
+                w->id, strerror(-err));
+        return err;
+    }
+
+    w->rb = ring_buffer__new(w->rb_map_fd, handle_sample, w, NULL);
+    if (!w->rb) {
+        err = -errno;
+        fprintf(stderr, "Failed to create ring buffer consumer %d: %s\n",
+                w->id, strerror(-err));
+        return err;
+    }
+    return 0;
+}
+
 int workers_init(struct worker_ctx *ctx, struct bpf_object *bpf_obj,
                  const struct worker_config *config)
 {
-    int err;
-    int map_fd;
+    int i, err;
+    int events_fd, config_fd;
     struct bpf_map *map;
+    struct tc_clone_cfg cfg = {0};
+    __u32 key = 0;
 
     if (!ctx || !bpf_obj || !config) {
         return -EINVAL;
@@ -248,85 +343,140 @@ int workers_init(struct worker_ctx *ctx, struct bpf_object *bpf_obj,
     memset(ctx, 0, sizeof(*ctx));
     ctx->config = *config;
     ctx->bpf_obj = bpf_obj;
-    ctx->tx_ring.fd = -1;
+    ctx->counters_fd = -1;
+    ctx->filter_in_kernel = config->filter_in_kernel;
 
-    /* Store global context for perf buffer callbacks */
-    g_worker_ctx = ctx;
+    /* Default to number of CPUs; one ring buffer shard per worker */
+    if (ctx->config.num_workers <= 0) {
+        int num_cpus = get_nprocs();
+        ctx->config.num_workers = num_cpus > 0 ? num_cpus : 1;
+    }
+    if (ctx->config.num_workers > RINGBUF_MAX_SHARDS) {
+        printf("Limiting eBPF workers to %d (ring buffer shard limit)\n",
+               RINGBUF_MAX_SHARDS);
+        ctx->config.num_workers = RINGBUF_MAX_SHARDS;
+    }
+    ctx->shard_size = ringbuf_shard_size(ctx->config.ringbuf_size, ctx->config.num_workers);
+    printf("Using %d worker thread(s), one %u KB ring buffer shard each\n",
+           ctx->config.num_workers, ctx->shard_size / 1024);
 
-    /* Use 1 worker - perf_buffer__poll handles all CPUs */
-    ctx->config.num_workers = 1;
-    printf("Using 1 worker thread (perf buffer handles all CPUs)\n");
+    /* One filter hit row per worker */
+    err = filter_set_readers((unsigned int)ctx->config.num_workers);
+    if (err) {
+        return err;
+    }
 
-    /* Find events perf buffer map */
-    map = bpf_object__find_map_by_name(bpf_obj, "events");
+    /* Find ring buffer shard array and config map */
+    map = bpf_object__find_map_by_name(bpf_obj, EVENTS_MAP_NAME);
     if (!map) {
-        fprintf(stderr, "Failed to find 'events' map in BPF object\n");
+        fprintf(stderr, "Failed to find '%s' map in BPF object\n", EVENTS_MAP_NAME);
         return -ENOENT;
     }
-    map_fd = bpf_map__fd(map);
-
-    /* Create perf buffer */
-    struct perf_buffer_opts pb_opts = {
-        .sample_cb = handle_sample,
-        .lost_cb = handle_lost,
-        .ctx = ctx,
-    };
-    
-    ctx->pb = perf_buffer__new(map_fd, PERF_BUFFER_PAGES, &pb_opts);
-    if (!ctx->pb) {
-        err = -errno;
-        fprintf(stderr, "Failed to create perf buffer: %s\n", strerror(-err));
-        return err;
+    events_fd = bpf_map__fd(map);
+
+    map = bpf_object__find_map_by_name(bpf_obj, CONFIG_MAP_NAME);
+    if (!map) {
+        fprintf(stderr, "Failed to find '%s' map in BPF object\n", CONFIG_MAP_NAME);
+        return -ENOENT;
     }
+    config_fd = bpf_map__fd(map);
+    ctx->config_fd = config_fd;
 
-    /* Allocate thread handles */
+    /* Counters are optional (stats only) */
+    map = bpf_object__find_map_by_name(bpf_obj, COUNTERS_MAP_NAME);
+    if (map) {
+        ctx->counters_fd = bpf_map__fd(map);
+    }
+
+    /* Allocate per-worker state, thread handles and stats */
+    ctx->workers = counter_calloc(ctx->config.num_workers, sizeof(struct ebpf_worker));
     ctx->threads = calloc(ctx->config.num_workers, sizeof(pthread_t));
-    if (!ctx->threads) {
-        perf_buffer__free(ctx->pb);
-        ctx->pb = NULL;
-        return -ENOMEM;
+    ctx->stats = counter_calloc(ctx->config.num_workers, sizeof(struct worker_stats));
+    if (!ctx->workers || !ctx->threads || !ctx->stats) {
+        err = -ENOMEM;
+        goto err_cleanup;
     }
 
-    /* Allocate per-worker stats */
-    ctx->stats = calloc(ctx->config.num_workers, sizeof(struct worker_stats));
-    if (!ctx->stats) {
-        free(ctx->threads);
-        ctx->threads = NULL;
-        perf_buffer__free(ctx->pb);
-        ctx->pb = NULL;
-        return -ENOMEM;
+    for (i = 0; i < ctx->config.num_workers; i++) {
+        ctx->workers[i].ctx = ctx;
+        ctx->workers[i].id = i;
+        ctx->workers[i].rb_map_fd = -1;
+        ctx->workers[i].tx.fd = -1;
     }
 
-    /* Setup shared TX ring if output interface specified */
-    if (config->output_ifindex > 0 && config->output_ifname[0] != '\0') {
-        int ifindex = if_nametoindex(config->output_ifname);
-        if (ifindex == 0) {
-            fprintf(stderr, "Output interface %s not found\n", config->output_ifname);
-            err = -ENODEV;
-            free(ctx->stats);
-            ctx->stats = NULL;
-            free(ctx->threads);
-            ctx->threads = NULL;
-            perf_buffer__free(ctx->pb);
-            ctx->pb = NULL;
-            return err;
-        }
-        err = tx_ring_setup(&ctx->tx_ring, ifindex, config->verbose, config->debug);
+    for (i = 0; i < ctx->config.num_workers; i++) {
+        err = setup_worker_ringbuf(&ctx->workers[i], events_fd);
         if (err) {
-            free(ctx->stats);
-            ctx->stats = NULL;
-            free(ctx->threads);
-            ctx->threads = NULL;
-            perf_buffer__free(ctx->pb);
-            ctx->pb = NULL;
-            return err;
+            goto err_cleanup;
         }
-        printf("TX ring on %s (ifindex=%d)\n", config->output_ifname, ifindex);
-    } else {
+
+        /* Setup per-worker TX ring if output interface specified */
+        if (config->output_ifindex > 0 && config->output_ifname[0] != '\0') {
+            int ifindex = if_nametoindex(config->output_ifname);
+            if (ifindex == 0) {
+                fprintf(stderr, "Output interface %s not found\n", config->output_ifname);
+                err = -ENODEV;
+                goto err_cleanup;
+            }
+            err = tx_ring_setup(&ctx->workers[i].tx, ifindex, &config->tx_ring,
+                                config->verbose && i == 0, config->debug);
+            if (err) {
+                fprintf(stderr, "Failed to setup TX ring for worker %d\n", i);
+                goto err_cleanup;
+            }
+        }
+
+        /* Each worker encapsulates into its own buffer and socket */
+        if (config->tunnel_ctx) {
+            err = tunnel_sender_create(config->tunnel_ctx, &config->tx_ring,
+                                       &ctx->workers[i].tunnel_tx);
+            if (err) {
+                fprintf(stderr, "Failed to setup tunnel sender for worker %d\n", i);
+                goto err_cleanup;
+            }
+        }
+    }
+
+    /*
+     * Truncate in the kernel when the sample carries everything userspace
+     * still needs: the ACL already ran in the kernel (or there is none)
+     */
+    ctx->truncate_in_kernel = ctx->config.truncate_enabled &&
+                              (ctx->filter_in_kernel || !filter_current());
+    if (ctx->truncate_in_kernel) {
+        printf("Truncating to %u bytes in TC program\n", ctx->config.truncate_length);
+    }
+
+    /* Publish shard count last: BPF program passes packets until this is set */
+    cfg.nr_shards = (__u32)ctx->config.num_workers;
+    cfg.snap_len = ctx->truncate_in_kernel ? ctx->config.truncate_length : 0;
+    if (bpf_map_update_elem(config_fd, &key, &cfg, BPF_ANY) != 0) {
+        err = -errno;
+        fprintf(stderr, "Failed to write BPF config map: %s\n", strerror(-err));
+        goto err_cleanup;
+    }
+
+    if (config->output_ifindex > 0 && config->output_ifname[0] != '\0') {
+        printf("TX ring on %s (one per worker)\n", config->output_ifname);
+    } else if (!config->tunnel_ctx) {
         printf("No output interface specified - running in drop mode\n");
     }
 
     return 0;
+
+err_cleanup:
+    if (ctx->workers) {
+        for (i = 0; i < ctx->config.num_workers; i++) {
+            cleanup_worker(&ctx->workers[i]);
+        }
+    }
+    free(ctx->workers);
+    ctx->workers = NULL;
+    free(ctx->stats);
+    ctx->stats = NULL;
+    free(ctx->threads);
+    ctx->threads = NULL;
+    return err;
 }
 
 int workers_start(struct worker_ctx *ctx)
@@ -392,6 +542,8 @@ void workers_stop(struct worker_ctx *ctx)
 
 void workers_cleanup(struct worker_ctx *ctx)
 {
+    int i;
+
     if (!ctx) {
         return;
     }
@@ -400,15 +552,13 @@ void workers_cleanup(struct worker_ctx *ctx)
         workers_stop(ctx);
     }
 
-    /* Flush any pending TX then teardown shared TX ring */
-    if (ctx->tx_ring.fd >= 0) {
-        tx_ring_flush(&ctx->tx_ring);
-        tx_ring_teardown(&ctx->tx_ring);
-    }
-
-    if (ctx->pb) {
-        perf_buffer__free(ctx->pb);
-        ctx->pb = NULL;
+    /* Flush pending TX, teardown TX rings and ring buffer shards */
+    if (ctx->workers) {
+        for (i = 0; i < ctx->config.num_workers; i++) {
+            cleanup_worker(&ctx->workers[i]);
+        }
+        free(ctx->workers);
+        ctx->workers = NULL;
     }
 
     if (ctx->stats) {
@@ -420,8 +570,54 @@ void workers_cleanup(struct worker_ctx *ctx)
         free(ctx->threads);
         ctx->threads = NULL;
     }
+}
+
+/*
+ * Sum one per-CPU counter from the BPF counters map
+ */
+static uint64_t read_bpf_counter(int map_fd, __u32 idx)
+{
+    int ncpus = libbpf_num_possible_cpus();
+    uint64_t sum = 0;
+    __u64 *vals;
+    int i;
+
+    if (ncpus <= 0) {
+        return 0;
+    }
+    vals = calloc(ncpus, sizeof(*vals));
+    if (!vals) {
+        return 0;
+    }
+    if (bpf_map_lookup_elem(map_fd, &idx, vals) == 0) {
+        for (i = 0; i < ncpus; i++) {
+            sum += vals[i];
+        }
+    }
+    free(vals);
+    return sum;
+}
 
-    g_worker_ctx = NULL;
+int workers_filter_in_userspace(struct worker_ctx *ctx)
+{
+    struct tc_clone_cfg cfg;
+    __u32 key = 0;
+
+    if (!ctx || !ctx->workers) {
+        return -EINVAL;
+    }
+    if (ctx->truncate_in_kernel) {
+        /* Samples still snapped in the kernel are short enough to pass untouched */
+        ctx->truncate_in_kernel = false;
+        if (bpf_map_lookup_elem(ctx->config_fd, &key, &cfg) != 0 ||
+            (cfg.snap_len = 0, bpf_map_update_elem(ctx->config_fd, &key, &cfg, BPF_ANY) != 0)) {
+            ctx->truncate_in_kernel = true;
+            return -errno;
+        }
+        printf("Truncating to %u bytes in workers\n", ctx->config.truncate_length);
+    }
+    ctx->filter_in_kernel = false;
+    return 0;
 }
 
 void workers_get_stats(struct worker_ctx *ctx, struct worker_stats *total)
@@ -435,13 +631,50 @@ void workers_get_stats(struct worker_ctx *ctx, struct worker_stats *total)
     memset(total, 0, sizeof(*total));
 
     for (i = 0; i < ctx->config.num_workers; i++) {
-        total->packets_received += atomic_load(&ctx->stats[i].packets_received);
-        total->packets_sent += atomic_load(&ctx->stats[i].packets_sent);
-        total->packets_dropped += atomic_load(&ctx->stats[i].packets_dropped);
-        total->bytes_received += atomic_load(&ctx->stats[i].bytes_received);
-        total->bytes_sent += atomic_load(&ctx->stats[i].bytes_sent);
-        total->packets_truncated += atomic_load(&ctx->stats[i].packets_truncated);
-        total->bytes_truncated += atomic_load(&ctx->stats[i].bytes_truncated);
+        total->packets_received += counter_read(&ctx->stats[i].packets_received);
+        total->packets_sent += counter_read(&ctx->stats[i].packets_sent);
+        total->packets_dropped += counter_read(&ctx->stats[i].packets_dropped);
+        total->bytes_received += counter_read(&ctx->stats[i].bytes_received);
+        total->bytes_sent += counter_read(&ctx->stats[i].bytes_sent);
+        total->packets_truncated += counter_read(&ctx->stats[i].packets_truncated);
+        total->bytes_truncated += counter_read(&ctx->stats[i].bytes_truncated);
+        total->packets_clamped += counter_read(&ctx->stats[i].packets_clamped);
+        total->packets_cutoff += counter_read(&ctx->stats[i].packets_cutoff);
+        total->bytes_cutoff += counter_read(&ctx->stats[i].bytes_cutoff);
+        total->packets_dup += counter_read(&ctx->stats[i].packets_dup);
+        total->bytes_dup += counter_read(&ctx->stats[i].bytes_dup);
+        total->packets_sampled_out += counter_read(&ctx->stats[i].packets_sampled_out);
+        total->bytes_sampled_out += counter_read(&ctx->stats[i].bytes_sampled_out);
+        if (ctx->workers)
+            total->packets_tx_full += counter_read(&ctx->workers[i].tx.full_drops);
+    }
+
+    /*
+     * Kernel-side counters: samples the BPF program could not hand to a shard
+     * (ring full), packets denied by the in-kernel ACL, packets of flows
+     * past their cutoff, duplicates and packets sampled out. The last four
+     * never reach a worker, so they also count as received.
+     */
+    if (ctx->bpf_obj && ctx->counters_fd >= 0) {
+        uint64_t filter_drop = read_bpf_counter(ctx->counters_fd, TC_CNT_FILTER_DROP);
+        uint64_t cutoff = read_bpf_counter(ctx->counters_fd, TC_CNT_CUTOFF);
+        uint64_t cutoff_bytes = read_bpf_counter(ctx->counters_fd, TC_CNT_CUTOFF_BYTES);
+        uint64_t dup = read_bpf_counter(ctx->counters_fd, TC_CNT_DUP);
+        uint64_t dup_bytes = read_bpf_counter(ctx->counters_fd, TC_CNT_DUP_BYTES);
+        uint64_t sampled = read_bpf_counter(ctx->counters_fd, TC_CNT_SAMPLED_OUT);
+        uint64_t sampled_bytes = read_bpf_counter(ctx->counters_fd, TC_CNT_SAMPLED_OUT_BYTES);
+
+        total->packets_received += filter_drop + cutoff + dup + sampled;
+        total->bytes_received += read_bpf_counter(ctx->counters_fd, TC_CNT_FILTER_DROP_BYTES) +
+                                 cutoff_bytes + dup_bytes + sampled_bytes;
+        total->packets_dropped += filter_drop;
+        total->packets_dropped += read_bpf_counter(ctx->counters_fd, TC_CNT_RINGBUF_DROP);
+        total->packets_cutoff += cutoff;
+        total->bytes_cutoff += cutoff_bytes;
+        total->packets_dup += dup;
+        total->bytes_dup += dup_bytes;
+        total->packets_sampled_out += sampled;
+        total->bytes_sampled_out += sampled_bytes;
     }
 }
 
@@ -454,12 +687,34 @@ void workers_reset_stats(struct worker_ctx *ctx)
     }
 
     for (i = 0; i < ctx->config.num_workers; i++) {
-        atomic_store(&ctx->stats[i].packets_received, 0);
-        atomic_store(&ctx->stats[i].packets_sent, 0);
-        atomic_store(&ctx->stats[i].packets_dropped, 0);
-        atomic_store(&ctx->stats[i].bytes_received, 0);
-        atomic_store(&ctx->stats[i].bytes_sent, 0);
-        atomic_store(&ctx->stats[i].packets_truncated, 0);
-        atomic_store(&ctx->stats[i].bytes_truncated, 0);
+        counter_set(&ctx->stats[i].packets_received, 0);
+        counter_set(&ctx->stats[i].packets_sent, 0);
+        counter_set(&ctx->stats[i].packets_dropped, 0);
+        counter_set(&ctx->stats[i].bytes_received, 0);
+        counter_set(&ctx->stats[i].bytes_sent, 0);
+        counter_set(&ctx->stats[i].packets_truncated, 0);
+        counter_set(&ctx->stats[i].bytes_truncated, 0);
+        counter_set(&ctx->stats[i].packets_clamped, 0);
+        counter_set(&ctx->stats[i].packets_cutoff, 0);
+        counter_set(&ctx->stats[i].bytes_cutoff, 0);
+        counter_set(&ctx->stats[i].packets_dup, 0);
+        counter_set(&ctx->stats[i].bytes_dup, 0);
+        counter_set(&ctx->stats[i].packets_sampled_out, 0);
+        counter_set(&ctx->stats[i].bytes_sampled_out, 0);
+        if (ctx->workers)
+            counter_set(&ctx->workers[i].tx.full_drops, 0);
+    }
+
+    if (ctx->bpf_obj && ctx->counters_fd >= 0) {
+        int ncpus = libbpf_num_possible_cpus();
+        __u64 *zeros = ncpus > 0 ? calloc(ncpus, sizeof(*zeros)) : NULL;
+        __u32 idx;
+
+        if (zeros) {
+            for (idx = 0; idx < TC_CNT_MAX; idx++) {
+                bpf_map_update_elem(ctx->counters_fd, &idx, zeros, BPF_ANY);
+            }
+            free(zeros);
+        }
     }
 }
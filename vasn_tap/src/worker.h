@@ -1,6 +1,7 @@
 /*
  * vasn_tap - Worker Thread Header
  * CPU-pinned pthread workers for packet processing
+ * Each worker consumes its own BPF ring buffer shard (eBPF mode)
  */
 
 #ifndef __WORKER_H__
@@ -12,25 +13,69 @@
 
 /* Forward declarations */
 struct bpf_object;
-struct perf_buffer;
+struct ring_buffer;
 struct tunnel_ctx;
+struct tunnel_sender;
+struct filter_state;
+struct worker_ctx;
 
+#include "counter.h"
 #include "tx_ring.h"
 
-/* Per-worker statistics */
+/*
+ * Per-worker statistics. Written only by the owning worker with counter_add()
+ * and summed by the stats thread with counter_read(); the struct starts on its
+ * own cache line, so workers never write to a line another worker uses.
+ */
 struct worker_stats {
-    _Atomic uint64_t packets_received;
-    _Atomic uint64_t packets_sent;
-    _Atomic uint64_t packets_dropped;
-    _Atomic uint64_t bytes_received;
-    _Atomic uint64_t bytes_sent;
-    _Atomic uint64_t packets_truncated;
-    _Atomic uint64_t bytes_truncated;
-};
+    uint64_t packets_received;
+    uint64_t packets_sent;
+    uint64_t packets_dropped;
+    uint64_t bytes_received;
+    uint64_t bytes_sent;
+    uint64_t packets_truncated;
+    uint64_t bytes_truncated;
+    uint64_t packets_copy_free;  /* Sent without a userspace payload copy (afxdp) */
+    uint64_t packets_clamped;    /* Sent cut to the TX frame / output MTU */
+    uint64_t packets_tx_full;    /* Of packets_dropped: TX ring had no free frame (from tx_ring full_drops) */
+    uint64_t packets_cutoff;     /* Not sent: flow past runtime.flow_cutoff (not in packets_dropped) */
+    uint64_t bytes_cutoff;
+    uint64_t packets_dup;        /* Not sent: duplicate within runtime.dedup.window_us (not in packets_dropped) */
+    uint64_t bytes_dup;
+    uint64_t packets_sampled_out; /* Not sent: left out by runtime.sampling (not in packets_dropped) */
+    uint64_t bytes_sampled_out;
+} __attribute__((aligned(COUNTER_CACHE_LINE)));
+
+/*
+ * Publish deltas a worker accumulated in a local worker_stats over one batch
+ * (RX block, ring buffer consume, XSK batch) into its stats, then clear them.
+ * The stats thread sees counts at most one batch late. Owner thread only.
+ */
+static inline void worker_stats_publish(struct worker_stats *stats, struct worker_stats *delta)
+{
+    if (delta->packets_received == 0 && delta->packets_dropped == 0)
+        return;
+    counter_add(&stats->packets_received, delta->packets_received);
+    counter_add(&stats->packets_sent, delta->packets_sent);
+    counter_add(&stats->packets_dropped, delta->packets_dropped);
+    counter_add(&stats->bytes_received, delta->bytes_received);
+    counter_add(&stats->bytes_sent, delta->bytes_sent);
+    counter_add(&stats->packets_truncated, delta->packets_truncated);
+    counter_add(&stats->bytes_truncated, delta->bytes_truncated);
+    counter_add(&stats->packets_copy_free, delta->packets_copy_free);
+    counter_add(&stats->packets_clamped, delta->packets_clamped);
+    counter_add(&stats->packets_cutoff, delta->packets_cutoff);
+    counter_add(&stats->bytes_cutoff, delta->bytes_cutoff);
+    counter_add(&stats->packets_dup, delta->packets_dup);
+    counter_add(&stats->bytes_dup, delta->bytes_dup);
+    counter_add(&stats->packets_sampled_out, delta->packets_sampled_out);
+    counter_add(&stats->bytes_sampled_out, delta->bytes_sampled_out);
+    *delta = (struct worker_stats){0};
+}
 
 /* Worker configuration */
 struct worker_config {
-    int num_workers;              /* Number of worker threads (1 recommended) */
+    int num_workers;              /* Number of worker threads / ring buffer shards (0 = all CPUs) */
     int output_ifindex;           /* Output interface index (0 = drop mode) */
     char output_ifname[64];       /* Output interface name */
     struct tunnel_ctx *tunnel_ctx; /* If set, use tunnel_send instead of tx_ring */
@@ -38,24 +83,49 @@ struct worker_config {
     bool debug;                   /* TX debug (hex dumps) */
     bool truncate_enabled;        /* Truncate allowed packets before send */
     uint32_t truncate_length;     /* Truncate length when enabled (64..9000) */
+    bool filter_in_kernel;        /* ACL already applied by the TC program: skip filter_packet */
+    struct ring_config tx_ring;   /* TPACKET_V2 TX ring geometry (runtime.tx_ring) */
+    uint32_t ringbuf_size;        /* Ring buffer bytes over all shards (runtime.ringbuf_size; 0 = default) */
+};
+
+/* Size of the per-worker writable buffer used for truncation */
+#define WORKER_TRUNCATE_BUF_SIZE 9216
+
+/* Per-worker state for eBPF mode (one ring buffer shard per worker) */
+struct ebpf_worker {
+    struct worker_ctx   *ctx;            /* Back-pointer for ring buffer callback */
+    int                  id;             /* Worker / shard index */
+    int                  rb_map_fd;      /* BPF_MAP_TYPE_RINGBUF shard fd (-1 if none) */
+    struct ring_buffer  *rb;             /* libbpf consumer for rb_map_fd */
+    struct tx_ring_ctx   tx;             /* Per-worker TPACKET_V2 TX ring (tx.fd == -1 if drop mode) */
+    struct tunnel_sender *tunnel_tx;     /* Per-worker tunnel send state (tunnel mode) */
+    unsigned int         tx_pending;     /* Packets written since last flush */
+    const struct filter_state *filter;   /* Held across one consume batch (filter_enter) */
+    struct worker_stats  batch;          /* Counts of the current consume batch (unpublished) */
+    uint8_t              truncate_buf[WORKER_TRUNCATE_BUF_SIZE]; /* Ring buffer is read-only */
 };
 
 /* Worker context */
 struct worker_ctx {
     struct worker_config config;
     struct bpf_object *bpf_obj;   /* Reference to BPF object */
-    struct perf_buffer *pb;       /* Perf buffer */
-    struct tx_ring_ctx tx_ring;   /* Shared TPACKET_V2 TX ring (tx_ring.fd == -1 if drop mode) */
-    unsigned int tx_pending;      /* Packets written since last flush (for batching) */
+    int counters_fd;              /* BPF per-CPU counters map (ring buffer drops) */
+    int config_fd;                /* BPF config map (shards, snap_len) */
+    uint32_t shard_size;          /* Bytes per ring buffer shard */
+    volatile bool filter_in_kernel;   /* config.filter_in_kernel until workers_filter_in_userspace() */
+    volatile bool truncate_in_kernel; /* BPF program truncates samples (cfg.snap_len) */
+    struct ebpf_worker *workers;  /* Per-worker state array */
     volatile bool running;        /* Running flag */
     pthread_t *threads;           /* Worker thread handles */
-    struct worker_stats *stats;   /* Per-worker stats array */
+    struct worker_stats *stats;   /* Per-worker stats array (cache-line aligned) */
 };
 
 /*
  * Initialize worker context
  * @param ctx: Worker context to initialize
- * @param bpf_obj: Loaded BPF object (for perf buffer map)
+ * Creates one ring buffer shard per worker and publishes the shard count
+ * to the BPF program; must run before the TC programs are attached.
+ * @param bpf_obj: Loaded BPF object (for ring buffer maps)
  * @param config: Worker configuration
  * @return: 0 on success, negative errno on failure
  */
@@ -81,15 +151,26 @@ void workers_stop(struct worker_ctx *ctx);
  */
 void workers_cleanup(struct worker_ctx *ctx);
 
+/*
+ * Take the ACL over from the TC program while the workers run (a reload with
+ * more rules than the in-kernel ACL holds): in-kernel truncation is turned
+ * off first, since the filter needs the full sample, then the workers start
+ * classifying. The caller disables the kernel ACL afterwards.
+ * @param ctx: Initialized worker context
+ * @return: 0 on success, negative errno if the BPF config could not be updated
+ */
+int workers_filter_in_userspace(struct worker_ctx *ctx);
+
 /*
  * Get aggregate statistics from all workers
+ * Ring buffer drops counted in the BPF program are added to packets_dropped.
  * @param ctx: Worker context
  * @param total: Output structure for aggregate stats
  */
 void workers_get_stats(struct worker_ctx *ctx, struct worker_stats *total);
 
 /*
- * Reset all worker statistics
+ * Reset all worker statistics (workers stopped: counters have one writer)
  * @param ctx: Worker context
  */
 void workers_reset_stats(struct worker_ctx *ctx);
@@ -0,0 +1,225 @@
+/*
+ * vasn_tap - Filter micro-benchmark: linear scan (filter_packet) vs compiled
+ * classifier (pkt_parse + filter_classify, as in the workers).
+ *
+ * allow-list: 64 /24 ip_dst + protocol + port_dst entries, all distinct, so most
+ * packets match late or fall through to the default: the linear scan's worst
+ * case and the usual shape of a real allow-list.
+ *
+ * blocklist: 100000 ip_dst prefixes (/16, /24 and /32 nested inside each other)
+ * with a default of allow, as loaded from a threat feed. The linear scan runs
+ * 1/1000 of the packets here; its per-packet figure is still comparable.
+ *
+ * blocklist6: 100000 ip6_dst /48 prefixes, half the packets IPv6 (a third
+ * of those blocked) and half IPv4, which no IPv6 rule may cost anything.
+ *
+ * port-list: 60000 protocol + port_dst rules (TCP and UDP, every value
+ * distinct) with a default of drop: no address to index, so it measures the
+ * exact-field part and its memory.
+ *
+ * Usage: bench_filter [packets]   (default 5000000)
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "../../src/config.h"
+#include "../../src/filter.h"
+
+#define ETH_HLEN     14
+#define NUM_PKTS     1024	/* Distinct packets, cycled */
+#define PKT_LEN      84	/* Ethernet + IPv6 + TCP */
+#define ALLOW_RULES  64
+#define BLOCK_RULES  100000
+#define PORT_RULES   60000
+
+static uint32_t lcg_next(uint32_t *s)
+{
+	*s = *s * 1664525u + 1013904223u;
+	return *s >> 8;
+}
+
+static void build_ip_tcp(uint8_t *buf, uint32_t ip_src, uint32_t ip_dst,
+                         uint8_t protocol, uint16_t port_src, uint16_t port_dst)
+{
+	memset(buf, 0, PKT_LEN);
+	buf[12] = 0x08;
+	buf[13] = 0x00;
+	buf[ETH_HLEN + 0] = 0x45;
+	buf[ETH_HLEN + 9] = protocol;
+	buf[ETH_HLEN + 12] = ip_src >> 24; buf[ETH_HLEN + 13] = ip_src >> 16;
+	buf[ETH_HLEN + 14] = ip_src >> 8;  buf[ETH_HLEN + 15] = ip_src;
+	buf[ETH_HLEN + 16] = ip_dst >> 24; buf[ETH_HLEN + 17] = ip_dst >> 16;
+	buf[ETH_HLEN + 18] = ip_dst >> 8;  buf[ETH_HLEN + 19] = ip_dst;
+	buf[ETH_HLEN + 20] = port_src >> 8; buf[ETH_HLEN + 21] = port_src;
+	buf[ETH_HLEN + 22] = port_dst >> 8; buf[ETH_HLEN + 23] = port_dst;
+}
+
+static void build_ip6_tcp(uint8_t *buf, uint64_t dst_hi, uint16_t port_src, uint16_t port_dst)
+{
+	int i;
+
+	memset(buf, 0, PKT_LEN);
+	buf[12] = 0x86;
+	buf[13] = 0xdd;
+	buf[ETH_HLEN + 0] = 0x60;
+	buf[ETH_HLEN + 6] = 6;
+	buf[ETH_HLEN + 8] = 0x20; buf[ETH_HLEN + 9] = 0x01;	/* Source 2001:db8::1 */
+	buf[ETH_HLEN + 10] = 0x0d; buf[ETH_HLEN + 11] = 0xb8;
+	buf[ETH_HLEN + 23] = 1;
+	for (i = 0; i < 8; i++)
+		buf[ETH_HLEN + 24 + i] = (uint8_t)(dst_hi >> (56 - 8 * i));
+	buf[ETH_HLEN + 39] = 1;
+	buf[ETH_HLEN + 40] = port_src >> 8; buf[ETH_HLEN + 41] = port_src;
+	buf[ETH_HLEN + 42] = port_dst >> 8; buf[ETH_HLEN + 43] = port_dst;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static uint8_t pkts[NUM_PKTS][PKT_LEN];
+
+/* Time both paths over the packet set; 0 if they agree on every packet */
+static int run(const char *name, const struct filter_config *cfg,
+               unsigned long iters_lin, unsigned long iters)
+{
+	struct filter_classifier *fc;
+	unsigned long i, hits_lin = 0, hits_fc = 0;
+	double t0, t_lin, t_fc, t_compile;
+	struct pkt_desc pd;
+	int bad = 0;
+
+	t0 = now_ns();
+	fc = filter_compile(cfg);
+	t_compile = now_ns() - t0;
+	if (!fc) {
+		fprintf(stderr, "filter_compile failed\n");
+		return 1;
+	}
+	for (i = 0; i < NUM_PKTS; i++) {
+		pkt_parse(pkts[i], PKT_LEN, &pd);
+		bad |= filter_packet(cfg, pkts[i], PKT_LEN, NULL) != filter_classify(fc, &pd, NULL);
+	}
+
+	t0 = now_ns();
+	for (i = 0; i < iters_lin; i++)
+		hits_lin += filter_packet(cfg, pkts[i % NUM_PKTS], PKT_LEN, NULL) == FILTER_ACTION_ALLOW;
+	t_lin = now_ns() - t0;
+
+	t0 = now_ns();
+	for (i = 0; i < iters; i++) {
+		pkt_parse(pkts[i % NUM_PKTS], PKT_LEN, &pd);
+		hits_fc += filter_classify(fc, &pd, NULL) == FILTER_ACTION_ALLOW;
+	}
+	t_fc = now_ns() - t0;
+
+	printf("%s: %u rules, compiled in %.1f ms, %zu KiB\n", name, cfg->num_rules,
+	       t_compile / 1e6, filter_classifier_mem(fc) / 1024);
+	printf("  linear:   %9.1f ns/pkt (%lu of %lu allowed)\n", t_lin / (double)iters_lin, hits_lin, iters_lin);
+	printf("  compiled: %9.1f ns/pkt (%lu of %lu allowed)\n", t_fc / (double)iters, hits_fc, iters);
+	filter_classifier_free(fc);
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	static struct filter_rule rules[BLOCK_RULES];
+	struct filter_config cfg = { .rules = rules };
+	unsigned long iters = argc > 1 ? strtoul(argv[1], NULL, 10) : 5000000ul;
+	unsigned long i;
+	uint32_t seed = 1;
+	unsigned int r;
+	int bad;
+
+	cfg.default_action = FILTER_ACTION_DROP;
+	cfg.num_rules = ALLOW_RULES;
+	for (r = 0; r < cfg.num_rules; r++) {
+		struct filter_match *m = &cfg.rules[r].match;
+		cfg.rules[r].action = FILTER_ACTION_ALLOW;
+		m->has_ip_dst = true;
+		m->ip_dst = 0x0a000000u | (r << 8);	/* 10.0.<r>.0/24 */
+		m->ip_dst_mask = 0xFFFFFF00u;
+		m->has_protocol = true;
+		m->protocol = 6;
+		m->has_port_dst = true;
+		m->port_dst = (uint16_t)(8000 + r);
+	}
+	for (i = 0; i < NUM_PKTS; i++) {
+		r = lcg_next(&seed) % (cfg.num_rules * 2);	/* About half miss every rule */
+		build_ip_tcp(pkts[i], 0xC0A80001u + (uint32_t)i, 0x0a000000u | ((r % 256) << 8) | 7,
+		             6, (uint16_t)(1024 + i), (uint16_t)(8000 + r));
+	}
+
+	bad = run("allow-list", &cfg, iters, iters);
+
+	/* Blocklist: prefixes inside 10.0.0.0/10, where most packets hit one */
+	memset(rules, 0, sizeof(rules));
+	cfg.default_action = FILTER_ACTION_ALLOW;
+	cfg.num_rules = BLOCK_RULES;
+	for (r = 0; r < cfg.num_rules; r++) {
+		static const uint32_t masks[] = { 0xFFFF0000u, 0xFFFFFF00u, 0xFFFFFFFFu, 0xFFFFFFFFu };
+		struct filter_match *m = &rules[r].match;
+		uint32_t mask = masks[r < 16 ? 0 : 1 + lcg_next(&seed) % 3];
+
+		rules[r].action = FILTER_ACTION_DROP;
+		m->has_ip_dst = true;
+		m->ip_dst_mask = mask;
+		m->ip_dst = (0x0a000000u | (lcg_next(&seed) & 0x3fffffu)) & mask;
+	}
+	for (i = 0; i < NUM_PKTS; i++)
+		build_ip_tcp(pkts[i], 0xC0A80001u + (uint32_t)i, 0x0a000000u | (lcg_next(&seed) & 0x3fffffu),
+		             6, (uint16_t)(1024 + i), 443);
+	bad |= run("blocklist", &cfg, iters / 1000 + 1, iters);
+
+	/* IPv6 blocklist: /48s under 2001:db8::/32, where a third of the IPv6 packets hit one */
+	memset(rules, 0, sizeof(rules));
+	cfg.default_action = FILTER_ACTION_ALLOW;
+	cfg.num_rules = BLOCK_RULES;
+	for (r = 0; r < cfg.num_rules; r++) {
+		struct filter_match *m = &rules[r].match;
+
+		rules[r].action = FILTER_ACTION_DROP;
+		m->has_ip6_dst = true;
+		m->ip6_dst_mask[0] = 0xFFFFFFFFFFFF0000ull;
+		m->ip6_dst[0] = 0x20010db800000000ull | (uint64_t)(lcg_next(&seed) & 0x3ffff) << 16;
+	}
+	for (i = 0; i < NUM_PKTS; i++) {
+		if (i & 1)
+			build_ip_tcp(pkts[i], 0xC0A80001u + (uint32_t)i, 0x0a000000u | (lcg_next(&seed) & 0x3fffffu),
+			             6, (uint16_t)(1024 + i), 443);
+		else
+			build_ip6_tcp(pkts[i], 0x20010db800000000ull | (uint64_t)(lcg_next(&seed) & 0x3ffff) << 16 | 7,
+			              (uint16_t)(1024 + i), 443);
+	}
+	bad |= run("blocklist6", &cfg, iters / 1000 + 1, iters);
+
+	/* Port list: every TCP port, then UDP ports, one rule each */
+	memset(rules, 0, sizeof(rules));
+	cfg.default_action = FILTER_ACTION_DROP;
+	cfg.num_rules = PORT_RULES;
+	for (r = 0; r < cfg.num_rules; r++) {
+		struct filter_match *m = &rules[r].match;
+
+		rules[r].action = FILTER_ACTION_ALLOW;
+		m->has_protocol = true;
+		m->protocol = r < 40000 ? 6 : 17;
+		m->has_port_dst = true;
+		m->port_dst = (uint16_t)(r < 40000 ? r : r - 40000);
+	}
+	for (i = 0; i < NUM_PKTS; i++) {
+		uint32_t v = lcg_next(&seed);
+
+		build_ip_tcp(pkts[i], 0xC0A80001u + (uint32_t)i, 0x0a000001u,
+		             v & 1 ? 6 : 17, (uint16_t)(1024 + i), (uint16_t)(v >> 1));
+	}
+	bad |= run("port-list", &cfg, iters / 1000 + 1, iters);
+	return bad;
+}
@@ -3,11 +3,11 @@
 # vasn_tap integration test runner - Suite: basic | filter | tunnel | all
 # Usage: sudo ./tests/integration/run_integ.sh [basic|filter|tunnel|truncate|all]
 #
-# basic: 8 tests (basic_forward, drop_mode, graceful_shutdown x2 modes, multiworker, fanout)
+# basic: 9 tests (basic_forward, drop_mode, graceful_shutdown x2 modes, basic_forward afxdp, multiworker, fanout)
 # filter: 10 tests (drop_all x2, allow_all, allow_icmp_rule, drop_icmp_rule, ip_cidr x2 modes each)
 # tunnel: 2 tests (tunnel_gre, tunnel_vxlan)
 # truncate: 3 tests (truncate afpacket, ebpf, no_truncate)
-# all: 23 tests (basic 8 + filter 10 + tunnel 2 + truncate 3)
+# all: 24 tests (basic 9 + filter 10 + tunnel 2 + truncate 3)
 #
 # Reports: tests/integration/reports/test_report_*.html
 #
@@ -90,9 +90,13 @@ if [ "$SUITE" = "basic" ] || [ "$SUITE" = "all" ]; then
             run_one "test_filter_ip_cidr.sh" "$mode"
         fi
     done
-    echo "========== AF_PACKET-only tests =========="
+    echo "========== Mode: afxdp (XDP generic on veth) =========="
     echo ""
-    echo ">>> Running: test_multiworker (afpacket only)"
+    echo ">>> Running: test_basic_forward (afxdp)"
+    run_one "test_basic_forward.sh" "afxdp"
+    echo "========== Multi-worker tests =========="
+    echo ""
+    echo ">>> Running: test_multiworker (afpacket + ebpf)"
     run_one "test_multiworker.sh"
     echo ">>> Running: test_fanout_distribution (afpacket only)"
     run_one "test_fanout_distribution.sh"
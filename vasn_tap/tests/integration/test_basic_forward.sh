@@ -99,6 +99,10 @@ filter:
   default_action: allow
   rules: []
 EOF
+# AF_XDP on veth: generic (skb) XDP is always available
+if [ "$MODE" = "afxdp" ]; then
+    sed -i 's/^filter:$/  afxdp:\n    xdp_mode: generic\nfilter:/' "$CONFIG_FILE"
+fi
 
 # Start vasn_tap
 STATS_FILE=$(mktemp /tmp/vasn_tap_stats_XXXXXX.txt)
@@ -176,8 +180,10 @@ fi
 # Build mode-specific note
 if [ "$MODE" = "afpacket" ]; then
     NOTE_TEXT="AF_PACKET RX counts all raw frames on the input interface (both directions: echo requests + echo replies + ARP). Sent $NUM_PINGS pings, but AF_PACKET sees ~${NUM_PINGS}x2 ICMP frames plus ARP overhead."
+elif [ "$MODE" = "afxdp" ]; then
+    NOTE_TEXT="AF_XDP mode redirects ingress frames on veth_src_host into XSK sockets (generic XDP), so the host stack never sees them: pings get no reply and ARP requests repeat. RX counts the echo requests and ARP frames that reached the sockets."
 else
-    NOTE_TEXT="eBPF mode uses TC hook + perf buffer. RX count reflects packets delivered by the perf buffer to userspace. Count depends on TC hook direction and kernel behavior."
+    NOTE_TEXT="eBPF mode uses TC hook + BPF ring buffers. RX count reflects packets delivered by the ring buffer shards to userspace. Count depends on TC hook direction and kernel behavior."
 fi
 
 # Write JSON result
@@ -103,7 +103,7 @@ fi
 if [ "$MODE" = "afpacket" ]; then
     NOTE_TEXT="No output interface configured -- all captured frames are counted as dropped. AF_PACKET RX includes both directions (requests + replies) plus ARP overhead."
 else
-    NOTE_TEXT="No output interface configured -- all captured frames are counted as dropped. eBPF perf buffer delivers packets matching the TC hook."
+    NOTE_TEXT="No output interface configured -- all captured frames are counted as dropped. eBPF ring buffers deliver packets matching the TC hook."
 fi
 
 # Write JSON result
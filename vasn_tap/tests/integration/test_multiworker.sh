@@ -1,7 +1,8 @@
 #!/bin/bash
 #
 # vasn_tap integration test - Multi-worker verification
-# Tests that AF_PACKET mode works correctly with different worker counts
+# Tests that AF_PACKET and eBPF modes work correctly with different worker counts
+# (eBPF: one ring buffer shard per worker)
 #
 
 set -e
@@ -20,8 +21,9 @@ echo "=== Test: multiworker ==="
 PASS=0
 FAIL=0
 
+for mode in afpacket ebpf; do
 for workers in 1 2 4; do
-    echo "--- Testing with $workers worker(s) ---"
+    echo "--- Testing $mode with $workers worker(s) ---"
     SUB_START=$(date +%s)
     SUB_RESULT="FAIL"
     SUB_ERROR=""
@@ -29,6 +31,12 @@ for workers in 1 2 4; do
     TX_COUNT=0
     CAPTURED=0
 
+    if [ "$mode" = "afpacket" ]; then
+        RESULT_NAME="multiworker_w${workers}"
+    else
+        RESULT_NAME="multiworker_${mode}_w${workers}"
+    fi
+
     STATS_FILE=$(mktemp /tmp/vasn_tap_stats_XXXXXX.txt)
     CAPTURE_FILE=$(mktemp /tmp/vasn_tap_multiworker_XXXXXX.pcap)
     CONFIG_FILE=$(mktemp /tmp/vasn_tap_multiworker_XXXXXX.yaml)
@@ -36,7 +44,7 @@ for workers in 1 2 4; do
 runtime:
   input_iface: veth_src_host
   output_iface: veth_dst_host
-  mode: afpacket
+  mode: $mode
   workers: $workers
   stats: true
 filter:
@@ -56,17 +64,17 @@ EOF
 
     if ! kill -0 $VASN_PID 2>/dev/null; then
         kill $TCPDUMP_PID 2>/dev/null || true
-        SUB_ERROR="vasn_tap failed to start with $workers workers"
+        SUB_ERROR="vasn_tap failed to start in $mode mode with $workers workers"
         echo "  FAIL: $SUB_ERROR"
         cat "$STATS_FILE"
         rm -f "$STATS_FILE" "$CAPTURE_FILE" "$CONFIG_FILE"
         FAIL=$((FAIL + 1))
         SUB_DURATION=$(($(date +%s) - SUB_START))
         JSON=$(build_result_json \
-            "test_name"         "Multi-Worker ($workers workers)" \
-            "description"       "AF_PACKET mode with $workers worker thread(s): send $NUM_PINGS ICMP pings and verify RX/TX and packets at ns_dst" \
+            "test_name"         "Multi-Worker ($mode, $workers workers)" \
+            "description"       "$mode mode with $workers worker thread(s): send $NUM_PINGS ICMP pings and verify RX/TX and packets at ns_dst" \
             "result"            "$SUB_RESULT" \
-            "mode"              "afpacket" \
+            "mode"              "$mode" \
             "workers"           "$workers" \
             "input_iface"       "veth_src_host" \
             "output_iface"      "veth_dst_host" \
@@ -80,7 +88,7 @@ EOF
             "captured_at_dst"   "0" \
             "duration_sec"      "$SUB_DURATION" \
             "error_msg"         "$SUB_ERROR")
-        write_result "$JSON" "multiworker_w${workers}"
+        write_result "$JSON" "$RESULT_NAME"
         continue
     fi
 
@@ -101,7 +109,7 @@ EOF
     DROP_COUNT=$(grep -oP 'Dropped: \K[0-9]+' "$STATS_FILE" | tail -1)
     CAPTURED=$(tcpdump -r "$CAPTURE_FILE" 2>/dev/null | wc -l)
 
-    echo "  Workers=$workers: RX=${RX_COUNT:-0}, TX=${TX_COUNT:-0}, captured_at_dst=$CAPTURED"
+    echo "  Mode=$mode Workers=$workers: RX=${RX_COUNT:-0}, TX=${TX_COUNT:-0}, captured_at_dst=$CAPTURED"
 
     rm -f "$STATS_FILE" "$CAPTURE_FILE" "$CONFIG_FILE"
 
@@ -119,10 +127,10 @@ EOF
 
     # Write JSON result for this sub-test
     JSON=$(build_result_json \
-        "test_name"         "Multi-Worker ($workers workers)" \
-        "description"       "AF_PACKET mode with $workers worker thread(s): send $NUM_PINGS ICMP pings and verify RX/TX and packets at ns_dst" \
+        "test_name"         "Multi-Worker ($mode, $workers workers)" \
+        "description"       "$mode mode with $workers worker thread(s): send $NUM_PINGS ICMP pings and verify RX/TX and packets at ns_dst" \
         "result"            "$SUB_RESULT" \
-        "mode"              "afpacket" \
+        "mode"              "$mode" \
         "workers"           "$workers" \
         "input_iface"       "veth_src_host" \
         "output_iface"      "veth_dst_host" \
@@ -137,10 +145,11 @@ EOF
         "duration_sec"      "$SUB_DURATION" \
         "error_msg"         "$SUB_ERROR" \
         "note"              "RX counts raw frames on input (requests+replies+ARP). Pass requires packets captured in ns_dst (tcpdump on veth_dst_ns).")
-    write_result "$JSON" "multiworker_w${workers}"
+    write_result "$JSON" "$RESULT_NAME"
 
     sleep 0.5
 done
+done
 
 echo ""
 echo "=== Multiworker test: $PASS passed, $FAIL failed ==="
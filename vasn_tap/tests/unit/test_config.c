@@ -56,6 +56,8 @@ static void test_runtime_mode_values(void **state)
     assert_int_equal(RUNTIME_MODE_UNSET, 0);
     assert_int_equal(RUNTIME_MODE_EBPF, 1);
     assert_int_equal(RUNTIME_MODE_AFPACKET, 2);
+    assert_int_equal(RUNTIME_MODE_AFXDP, 3);
+    assert_int_equal(RUNTIME_MODE_EBPF_REDIRECT, 4);
 }
 
 /* ---- main ---- */
@@ -111,6 +111,111 @@ static void test_config_load_valid_with_rules(void **state)
 	config_free(cfg);
 }
 
+/* Rule storage grows with the file: well past the old fixed table of 64 */
+static void test_config_load_many_rules(void **state)
+{
+	(void)state;
+	const unsigned int n = 5000;
+	char path[] = "/tmp/vasn_tap_test_XXXXXX";
+	unsigned int i;
+	int fd = mkstemp(path);
+	assert_true(fd >= 0);
+	FILE *f = fdopen(fd, "w");
+	assert_non_null(f);
+	fprintf(f, "runtime:\n  input_iface: eth0\n  mode: afpacket\n"
+	           "filter:\n  default_action: allow\n  rules:\n");
+	for (i = 0; i < n; i++)
+		fprintf(f, "    - action: drop\n      match:\n        ip_dst: 10.%u.%u.0/24\n",
+		        i >> 8, i & 0xff);
+	fclose(f);
+
+	struct tap_config *cfg = config_load(path);
+	unlink(path);
+	assert_non_null(cfg);
+	assert_int_equal(cfg->filter.num_rules, n);
+	assert_int_equal(cfg->filter.rules[n - 1].action, FILTER_ACTION_DROP);
+	assert_true(cfg->filter.rules[n - 1].match.has_ip_dst);
+	assert_int_equal(cfg->filter.rules[n - 1].match.ip_dst, 0x0a138700u);	/* 10.19.135.0 */
+	assert_int_equal(cfg->filter.rules[n - 1].match.ip_dst_mask, 0xFFFFFF00u);
+	config_free(cfg);
+}
+
+/* ip_src/ip_dst take IPv6 prefixes too; vlan / inner_vlan match stacked tags */
+static void test_config_load_ipv6_and_vlan_rules(void **state)
+{
+	(void)state;
+	const char *yaml =
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"filter:\n"
+		"  default_action: drop\n"
+		"  rules:\n"
+		"    - action: allow\n"
+		"      match:\n"
+		"        ip_dst: 2001:db8:0:1::/96\n"
+		"        protocol: icmpv6\n"
+		"    - action: allow\n"
+		"      match:\n"
+		"        ip_src: fe80::1\n"
+		"        vlan: 300\n"
+		"        inner_vlan: 100\n";
+	char path[] = "/tmp/vasn_tap_test_XXXXXX";
+	int fd = mkstemp(path);
+	assert_true(fd >= 0);
+	FILE *f = fdopen(fd, "w");
+	assert_non_null(f);
+	assert_true(fwrite(yaml, 1, strlen(yaml), f) == (size_t)strlen(yaml));
+	fclose(f);
+
+	struct tap_config *cfg = config_load(path);
+	unlink(path);
+	assert_non_null(cfg);
+	assert_int_equal(cfg->filter.num_rules, 2);
+	const struct filter_match *m0 = &cfg->filter.rules[0].match;
+	const struct filter_match *m1 = &cfg->filter.rules[1].match;
+	assert_true(m0->has_ip6_dst);
+	assert_false(m0->has_ip_dst);
+	assert_true(m0->ip6_dst[0] == 0x20010db800000001ULL && m0->ip6_dst[1] == 0);
+	assert_true(m0->ip6_dst_mask[0] == ~0ULL && m0->ip6_dst_mask[1] == 0xFFFFFFFF00000000ULL);
+	assert_int_equal(m0->protocol, 58);
+	assert_true(m1->has_ip6_src);
+	assert_true(m1->ip6_src[0] == 0xfe80000000000000ULL && m1->ip6_src[1] == 1);
+	assert_true(m1->ip6_src_mask[0] == ~0ULL && m1->ip6_src_mask[1] == ~0ULL);
+	assert_true(m1->has_vlan);
+	assert_int_equal(m1->vlan, 300);
+	assert_true(m1->has_inner_vlan);
+	assert_int_equal(m1->inner_vlan, 100);
+	config_free(cfg);
+}
+
+static void test_config_load_invalid_vlan(void **state)
+{
+	(void)state;
+	const char *yaml =
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"filter:\n"
+		"  default_action: drop\n"
+		"  rules:\n"
+		"    - action: allow\n"
+		"      match:\n"
+		"        vlan: 4096\n";
+	char path[] = "/tmp/vasn_tap_test_XXXXXX";
+	int fd = mkstemp(path);
+	assert_true(fd >= 0);
+	FILE *f = fdopen(fd, "w");
+	assert_non_null(f);
+	assert_true(fwrite(yaml, 1, strlen(yaml), f) == (size_t)strlen(yaml));
+	fclose(f);
+
+	struct tap_config *cfg = config_load(path);
+	unlink(path);
+	assert_null(cfg);
+	assert_non_null(strstr(config_get_error(), "vlan"));
+}
+
 static void test_config_load_invalid_yaml(void **state)
 {
 	(void)state;
@@ -225,9 +330,141 @@ static void test_config_load_tunnel_vxlan(void **state)
 	assert_string_equal(cfg->tunnel.remote_ip, "192.168.201.2");
 	assert_int_equal(cfg->tunnel.vni, 1000);
 	assert_int_equal(cfg->tunnel.dstport, 4789);
+	assert_int_equal(cfg->tunnel.srcport_min, 49152);
+	assert_int_equal(cfg->tunnel.srcport_max, 65535);
+	config_free(cfg);
+}
+
+static void test_config_load_tunnel_srcport_range(void **state)
+{
+	(void)state;
+	const char *yaml =
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  output_iface: eth1\n"
+		"  mode: afpacket\n"
+		"filter:\n"
+		"  default_action: drop\n"
+		"  rules: []\n"
+		"tunnel:\n"
+		"  type: vxlan\n"
+		"  remote_ip: 192.168.201.2\n"
+		"  vni: 1000\n"
+		"  srcport_min: 32768\n"
+		"  srcport_max: 33023\n";
+	char path[] = "/tmp/vasn_tap_test_XXXXXX";
+	int fd = mkstemp(path);
+	assert_true(fd >= 0);
+	FILE *f = fdopen(fd, "w");
+	assert_non_null(f);
+	assert_true(fwrite(yaml, 1, strlen(yaml), f) == (size_t)strlen(yaml));
+	fclose(f);
+
+	struct tap_config *cfg = config_load(path);
+	unlink(path);
+	assert_non_null(cfg);
+	assert_int_equal(cfg->tunnel.srcport_min, 32768);
+	assert_int_equal(cfg->tunnel.srcport_max, 33023);
+	config_free(cfg);
+}
+
+static void test_config_load_tunnel_srcport_range_inverted(void **state)
+{
+	(void)state;
+	const char *yaml =
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  output_iface: eth1\n"
+		"  mode: afpacket\n"
+		"filter:\n"
+		"  default_action: drop\n"
+		"  rules: []\n"
+		"tunnel:\n"
+		"  type: vxlan\n"
+		"  remote_ip: 192.168.201.2\n"
+		"  vni: 1000\n"
+		"  srcport_min: 60000\n"
+		"  srcport_max: 50000\n";
+	char path[] = "/tmp/vasn_tap_test_XXXXXX";
+	int fd = mkstemp(path);
+	assert_true(fd >= 0);
+	FILE *f = fdopen(fd, "w");
+	assert_non_null(f);
+	assert_true(fwrite(yaml, 1, strlen(yaml), f) == (size_t)strlen(yaml));
+	fclose(f);
+
+	struct tap_config *cfg = config_load(path);
+	unlink(path);
+	assert_null(cfg);
+	assert_non_null(strstr(config_get_error(), "srcport_min"));
+}
+
+static void test_config_load_tunnel_remotes(void **state)
+{
+	(void)state;
+	const char *yaml =
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  output_iface: eth1\n"
+		"  mode: afpacket\n"
+		"filter:\n"
+		"  default_action: drop\n"
+		"  rules: []\n"
+		"tunnel:\n"
+		"  type: vxlan\n"
+		"  remotes:\n"
+		"    - 192.168.201.2\n"
+		"    - 192.168.201.3\n"
+		"    - 192.168.201.4\n"
+		"  vni: 1000\n";
+	char path[] = "/tmp/vasn_tap_test_XXXXXX";
+	int fd = mkstemp(path);
+	assert_true(fd >= 0);
+	FILE *f = fdopen(fd, "w");
+	assert_non_null(f);
+	assert_true(fwrite(yaml, 1, strlen(yaml), f) == (size_t)strlen(yaml));
+	fclose(f);
+
+	struct tap_config *cfg = config_load(path);
+	unlink(path);
+	assert_non_null(cfg);
+	assert_int_equal(cfg->tunnel.num_remotes, 3);
+	assert_string_equal(cfg->tunnel.remotes[0], "192.168.201.2");
+	assert_string_equal(cfg->tunnel.remotes[2], "192.168.201.4");
+	assert_string_equal(cfg->tunnel.remote_ip, "192.168.201.2");
+	assert_int_equal(cfg->tunnel.vni, 1000);
 	config_free(cfg);
 }
 
+static void test_config_load_tunnel_remotes_with_remote_ip(void **state)
+{
+	(void)state;
+	const char *yaml =
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  output_iface: eth1\n"
+		"  mode: afpacket\n"
+		"filter:\n"
+		"  default_action: drop\n"
+		"  rules: []\n"
+		"tunnel:\n"
+		"  type: gre\n"
+		"  remote_ip: 192.168.201.2\n"
+		"  remotes: [192.168.201.3]\n";
+	char path[] = "/tmp/vasn_tap_test_XXXXXX";
+	int fd = mkstemp(path);
+	assert_true(fd >= 0);
+	FILE *f = fdopen(fd, "w");
+	assert_non_null(f);
+	assert_true(fwrite(yaml, 1, strlen(yaml), f) == (size_t)strlen(yaml));
+	fclose(f);
+
+	struct tap_config *cfg = config_load(path);
+	unlink(path);
+	assert_null(cfg);
+	assert_non_null(strstr(config_get_error(), "mutually exclusive"));
+}
+
 static void test_config_load_missing_runtime_input(void **state)
 {
 	(void)state;
@@ -385,6 +622,526 @@ static void test_config_load_runtime_truncate_length_out_of_range(void **state)
 	assert_non_null(strstr(config_get_error(), "truncate.length must be in range 64-9000"));
 }
 
+static void test_config_load_runtime_afxdp(void **state)
+{
+	(void)state;
+	const char *yaml =
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  output_iface: eth1\n"
+		"  mode: afxdp\n"
+		"  afxdp:\n"
+		"    zero_copy: true\n"
+		"    xdp_mode: native\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n";
+	char path[] = "/tmp/vasn_tap_test_XXXXXX";
+	int fd = mkstemp(path);
+	assert_true(fd >= 0);
+	FILE *f = fdopen(fd, "w");
+	assert_non_null(f);
+	assert_true(fwrite(yaml, 1, strlen(yaml), f) == (size_t)strlen(yaml));
+	fclose(f);
+
+	struct tap_config *cfg = config_load(path);
+	unlink(path);
+	assert_non_null(cfg);
+	assert_int_equal(cfg->runtime.mode, RUNTIME_MODE_AFXDP);
+	assert_true(cfg->runtime.afxdp.zero_copy);
+	assert_int_equal(cfg->runtime.afxdp.xdp_mode, AFXDP_XDP_MODE_NATIVE);
+	config_free(cfg);
+}
+
+static void test_config_load_runtime_afxdp_invalid_xdp_mode(void **state)
+{
+	(void)state;
+	const char *yaml =
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afxdp\n"
+		"  afxdp:\n"
+		"    xdp_mode: offload\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n";
+	char path[] = "/tmp/vasn_tap_test_XXXXXX";
+	int fd = mkstemp(path);
+	assert_true(fd >= 0);
+	FILE *f = fdopen(fd, "w");
+	assert_non_null(f);
+	assert_true(fwrite(yaml, 1, strlen(yaml), f) == (size_t)strlen(yaml));
+	fclose(f);
+
+	struct tap_config *cfg = config_load(path);
+	unlink(path);
+	assert_null(cfg);
+	assert_non_null(strstr(config_get_error(), "afxdp.xdp_mode"));
+}
+
+static struct tap_config *load_yaml(const char *yaml)
+{
+	char path[] = "/tmp/vasn_tap_test_XXXXXX";
+	int fd = mkstemp(path);
+	assert_true(fd >= 0);
+	FILE *f = fdopen(fd, "w");
+	assert_non_null(f);
+	assert_true(fwrite(yaml, 1, strlen(yaml), f) == (size_t)strlen(yaml));
+	fclose(f);
+
+	struct tap_config *cfg = config_load(path);
+	unlink(path);
+	return cfg;
+}
+
+static void test_config_load_ring_defaults(void **state)
+{
+	(void)state;
+	struct tap_config *cfg = load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n");
+	assert_non_null(cfg);
+	assert_int_equal(cfg->runtime.rx_ring.block_size, RX_RING_DEFAULT_BLOCK_SIZE);
+	assert_int_equal(cfg->runtime.rx_ring.block_nr, RX_RING_DEFAULT_BLOCK_NR);
+	assert_int_equal(cfg->runtime.rx_ring.frame_size, RX_RING_DEFAULT_FRAME_SIZE);
+	assert_int_equal(cfg->runtime.rx_ring.retire_timeout_ms, RX_RING_DEFAULT_TIMEOUT_MS);
+	assert_false(cfg->runtime.rx_ring.hugepages);
+	assert_int_equal(cfg->runtime.tx_ring.block_size, TX_RING_DEFAULT_BLOCK_SIZE);
+	assert_int_equal(cfg->runtime.tx_ring.block_nr, TX_RING_DEFAULT_BLOCK_NR);
+	assert_int_equal(cfg->runtime.tx_ring.frame_size, TX_RING_DEFAULT_FRAME_SIZE);
+	assert_false(cfg->runtime.tx_ring.gso);
+	assert_int_equal(cfg->runtime.tx_ring.full_policy, TX_FULL_DROP);
+	assert_int_equal(cfg->runtime.tx_ring.block_timeout_us, TX_RING_DEFAULT_BLOCK_TIMEOUT_US);
+	config_free(cfg);
+}
+
+static void test_config_load_ring_custom(void **state)
+{
+	(void)state;
+	struct tap_config *cfg = load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"  rx_ring:\n"
+		"    block_size: 1048576\n"
+		"    block_nr: 32\n"
+		"    frame_size: 4096\n"
+		"    retire_timeout_ms: 10\n"
+		"    hugepages: true\n"
+		"  tx_ring:\n"
+		"    block_size: 524288\n"
+		"    block_nr: 8\n"
+		"    frame_size: 10240\n"
+		"    gso: true\n"
+		"    full_policy: block\n"
+		"    block_timeout_us: 500\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n");
+	assert_non_null(cfg);
+	assert_int_equal(cfg->runtime.rx_ring.block_size, 1048576);
+	assert_int_equal(cfg->runtime.rx_ring.block_nr, 32);
+	assert_int_equal(cfg->runtime.rx_ring.frame_size, 4096);
+	assert_int_equal(cfg->runtime.rx_ring.retire_timeout_ms, 10);
+	assert_true(cfg->runtime.rx_ring.hugepages);
+	assert_int_equal(cfg->runtime.tx_ring.block_size, 524288);
+	assert_int_equal(cfg->runtime.tx_ring.block_nr, 8);
+	assert_int_equal(cfg->runtime.tx_ring.frame_size, 10240);
+	assert_true(cfg->runtime.tx_ring.gso);
+	assert_int_equal(cfg->runtime.tx_ring.full_policy, TX_FULL_BLOCK);
+	assert_int_equal(cfg->runtime.tx_ring.block_timeout_us, 500);
+	config_free(cfg);
+}
+
+static void test_config_load_ring_invalid(void **state)
+{
+	(void)state;
+	/* Block size not a multiple of the page size */
+	assert_null(load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"  rx_ring:\n"
+		"    block_size: 100000\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n"));
+	assert_non_null(strstr(config_get_error(), "rx_ring.block_size"));
+
+	/* Frame larger than its block */
+	assert_null(load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"  rx_ring:\n"
+		"    block_size: 4096\n"
+		"    frame_size: 8192\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n"));
+	assert_non_null(strstr(config_get_error(), "rx_ring.frame_size"));
+
+	/* TX frame too small for a full-size Ethernet frame */
+	assert_null(load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"  tx_ring:\n"
+		"    frame_size: 1024\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n"));
+	assert_non_null(strstr(config_get_error(), "tx_ring.frame_size"));
+
+	/* Unaligned frame size */
+	assert_null(load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"  tx_ring:\n"
+		"    frame_size: 2050\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n"));
+
+	assert_null(load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"  rx_ring:\n"
+		"    block_nr: 0\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n"));
+	assert_non_null(strstr(config_get_error(), "rx_ring.block_nr"));
+
+	assert_null(load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"  tx_ring:\n"
+		"    full_policy: spin\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n"));
+	assert_non_null(strstr(config_get_error(), "tx_ring.full_policy"));
+
+	/* A blocked worker is not reading RX: the deadline is capped */
+	assert_null(load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"  tx_ring:\n"
+		"    full_policy: block\n"
+		"    block_timeout_us: 1000000\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n"));
+	assert_non_null(strstr(config_get_error(), "tx_ring.block_timeout_us"));
+}
+
+static void test_config_load_ebpf_redirect(void **state)
+{
+	(void)state;
+	struct tap_config *cfg = load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  output_iface: eth1\n"
+		"  mode: ebpf-redirect\n"
+		"  truncate:\n"
+		"    enabled: true\n"
+		"    length: 128\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n");
+	assert_non_null(cfg);
+	assert_int_equal(cfg->runtime.mode, RUNTIME_MODE_EBPF_REDIRECT);
+	assert_true(cfg->runtime.truncate.enabled);
+	config_free(cfg);
+
+	/* Nowhere to mirror to */
+	assert_null(load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: ebpf-redirect\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n"));
+	assert_non_null(strstr(config_get_error(), "output_iface"));
+
+	/* Clones sent back out of the input would be mirrored again */
+	assert_null(load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  output_iface: eth0\n"
+		"  mode: ebpf-redirect\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n"));
+	assert_non_null(strstr(config_get_error(), "must differ"));
+
+	/* Encapsulated in the kernel: the tunnel may leave through the input */
+	cfg = load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  output_iface: eth0\n"
+		"  mode: ebpf-redirect\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n"
+		"tunnel:\n"
+		"  type: vxlan\n"
+		"  remote_ip: 10.0.0.1\n");
+	assert_non_null(cfg);
+	assert_true(cfg->tunnel.enabled);
+	config_free(cfg);
+}
+
+static void test_config_load_flow_cutoff(void **state)
+{
+	(void)state;
+	struct tap_config *cfg = load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n");
+	assert_non_null(cfg);
+	assert_false(cfg->runtime.flow_cutoff.enabled);
+	config_free(cfg);
+
+	cfg = load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"  flow_cutoff:\n"
+		"    bytes: 65536\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n");
+	assert_non_null(cfg);
+	assert_true(cfg->runtime.flow_cutoff.enabled);
+	assert_int_equal(cfg->runtime.flow_cutoff.bytes, 65536);
+	assert_int_equal(cfg->runtime.flow_cutoff.packets, 0);
+	assert_int_equal(cfg->runtime.flow_cutoff.idle_timeout_ms, FLOW_CUTOFF_DEFAULT_IDLE_MS);
+	config_free(cfg);
+
+	cfg = load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: ebpf\n"
+		"  flow_cutoff:\n"
+		"    packets: 100\n"
+		"    idle_timeout_ms: 5000\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n");
+	assert_non_null(cfg);
+	assert_int_equal(cfg->runtime.flow_cutoff.packets, 100);
+	assert_int_equal(cfg->runtime.flow_cutoff.idle_timeout_ms, 5000);
+	config_free(cfg);
+
+	/* A section without a limit would cut nothing */
+	assert_null(load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"  flow_cutoff:\n"
+		"    idle_timeout_ms: 1000\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n"));
+	assert_non_null(strstr(config_get_error(), "flow_cutoff"));
+
+	assert_null(load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"  flow_cutoff:\n"
+		"    bytes: -1\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n"));
+	assert_non_null(strstr(config_get_error(), "flow_cutoff.bytes"));
+}
+
+static void test_config_load_dedup(void **state)
+{
+	(void)state;
+	struct tap_config *cfg = load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: ebpf\n"
+		"  dedup:\n"
+		"    enabled: true\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n");
+	assert_non_null(cfg);
+	assert_true(cfg->runtime.dedup.enabled);
+	assert_int_equal(cfg->runtime.dedup.window_us, DEDUP_DEFAULT_WINDOW_US);
+	config_free(cfg);
+
+	cfg = load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"  dedup:\n"
+		"    enabled: true\n"
+		"    window_us: 250\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n");
+	assert_non_null(cfg);
+	assert_int_equal(cfg->runtime.dedup.window_us, 250);
+	config_free(cfg);
+
+	assert_null(load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"  dedup:\n"
+		"    enabled: true\n"
+		"    window_us: 2000000\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n"));
+	assert_non_null(strstr(config_get_error(), "dedup.window_us"));
+}
+
+static void test_config_load_ringbuf_size(void **state)
+{
+	(void)state;
+	struct tap_config *cfg = load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: ebpf\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n");
+	assert_non_null(cfg);
+	assert_int_equal(cfg->runtime.ringbuf_size, RINGBUF_DEFAULT_SIZE);
+	config_free(cfg);
+
+	cfg = load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: ebpf\n"
+		"  ringbuf_size: 4194304\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n");
+	assert_non_null(cfg);
+	assert_int_equal(cfg->runtime.ringbuf_size, 4194304);
+	config_free(cfg);
+
+	assert_null(load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: ebpf\n"
+		"  ringbuf_size: 65536\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n"));
+	assert_non_null(strstr(config_get_error(), "ringbuf_size"));
+}
+
+static void test_config_load_sampling(void **state)
+{
+	(void)state;
+	struct tap_config *cfg = load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n");
+	assert_non_null(cfg);
+	assert_int_equal(cfg->runtime.sampling.mode, SAMPLING_NONE);
+	config_free(cfg);
+
+	cfg = load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: ebpf\n"
+		"  sampling:\n"
+		"    mode: packet\n"
+		"    rate: 100\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n");
+	assert_non_null(cfg);
+	assert_int_equal(cfg->runtime.sampling.mode, SAMPLING_PACKET);
+	assert_int_equal(cfg->runtime.sampling.rate, 100);
+	config_free(cfg);
+
+	cfg = load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afxdp\n"
+		"  sampling:\n"
+		"    mode: flow\n"
+		"    flow_percent: 10\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n");
+	assert_non_null(cfg);
+	assert_int_equal(cfg->runtime.sampling.mode, SAMPLING_FLOW);
+	assert_int_equal(cfg->runtime.sampling.flow_percent, 10);
+	config_free(cfg);
+
+	/* A block without a mode, or without that mode's parameter, is rejected */
+	assert_null(load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"  sampling:\n"
+		"    rate: 10\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n"));
+	assert_non_null(strstr(config_get_error(), "sampling.mode"));
+
+	assert_null(load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"  sampling:\n"
+		"    mode: flow\n"
+		"    flow_percent: 101\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n"));
+	assert_non_null(strstr(config_get_error(), "sampling.flow_percent"));
+
+	assert_null(load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"  sampling:\n"
+		"    mode: packet\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n"));
+	assert_non_null(strstr(config_get_error(), "sampling.rate"));
+
+	assert_null(load_yaml(
+		"runtime:\n"
+		"  input_iface: eth0\n"
+		"  mode: afpacket\n"
+		"  sampling:\n"
+		"    mode: random\n"
+		"filter:\n"
+		"  default_action: allow\n"
+		"  rules: []\n"));
+	assert_non_null(strstr(config_get_error(), "sampling.mode"));
+}
+
 int main(void)
 {
 	const struct CMUnitTest tests[] = {
@@ -393,17 +1150,34 @@ int main(void)
 		cmocka_unit_test(test_config_load_missing_file),
 		cmocka_unit_test(test_config_load_valid_minimal),
 		cmocka_unit_test(test_config_load_valid_with_rules),
+		cmocka_unit_test(test_config_load_many_rules),
+		cmocka_unit_test(test_config_load_ipv6_and_vlan_rules),
+		cmocka_unit_test(test_config_load_invalid_vlan),
 		cmocka_unit_test(test_config_load_invalid_yaml),
 		cmocka_unit_test(test_config_load_invalid_default_action),
 		cmocka_unit_test(test_config_free_null),
 		cmocka_unit_test(test_config_load_tunnel_gre),
 		cmocka_unit_test(test_config_load_tunnel_vxlan),
+		cmocka_unit_test(test_config_load_tunnel_srcport_range),
+		cmocka_unit_test(test_config_load_tunnel_srcport_range_inverted),
+		cmocka_unit_test(test_config_load_tunnel_remotes),
+		cmocka_unit_test(test_config_load_tunnel_remotes_with_remote_ip),
 		cmocka_unit_test(test_config_load_missing_runtime_input),
 		cmocka_unit_test(test_config_load_missing_runtime_mode),
 		cmocka_unit_test(test_config_load_tunnel_requires_runtime_output),
 		cmocka_unit_test(test_config_load_runtime_truncate_valid),
 		cmocka_unit_test(test_config_load_runtime_truncate_enabled_missing_length),
 		cmocka_unit_test(test_config_load_runtime_truncate_length_out_of_range),
+		cmocka_unit_test(test_config_load_runtime_afxdp),
+		cmocka_unit_test(test_config_load_runtime_afxdp_invalid_xdp_mode),
+		cmocka_unit_test(test_config_load_ring_defaults),
+		cmocka_unit_test(test_config_load_ring_custom),
+		cmocka_unit_test(test_config_load_ring_invalid),
+		cmocka_unit_test(test_config_load_ebpf_redirect),
+		cmocka_unit_test(test_config_load_flow_cutoff),
+		cmocka_unit_test(test_config_load_dedup),
+		cmocka_unit_test(test_config_load_ringbuf_size),
+		cmocka_unit_test(test_config_load_sampling),
 	};
 
 	return cmocka_run_group_tests(tests, NULL, NULL);
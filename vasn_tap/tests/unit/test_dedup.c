@@ -0,0 +1,176 @@
+/*
+ * vasn_tap - Unit tests for duplicate suppression (dedup)
+ */
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+#include "../../src/dedup.h"
+
+#define US 1000ull
+
+/*
+ * Ethernet (+ optional 802.1Q tag) + IPv4 + UDP 10.0.0.1:1000 -> 10.0.0.2:53
+ * with a 32-byte payload of fill; returns the frame length
+ */
+static uint32_t build_udp4(uint8_t *buf, int vlan, uint8_t ttl, uint16_t ip_id, uint8_t fill)
+{
+	uint32_t off = 12;
+
+	memset(buf, 0, 128);
+	buf[0] = 0x02; buf[6] = 0x02; buf[11] = ttl;	/* MAC differs per hop */
+	if (vlan) {
+		buf[off] = 0x81; buf[off + 1] = 0x00;
+		buf[off + 3] = (uint8_t)vlan;
+		off += 4;
+	}
+	buf[off] = 0x08; buf[off + 1] = 0x00;
+	off += 2;
+	buf[off] = 0x45;
+	buf[off + 2] = 0; buf[off + 3] = 20 + 8 + 32;
+	buf[off + 4] = ip_id >> 8; buf[off + 5] = ip_id & 0xff;
+	buf[off + 8] = ttl;
+	buf[off + 9] = 17;
+	buf[off + 10] = ttl;	/* Header checksum follows the TTL */
+	buf[off + 12] = 10; buf[off + 15] = 1;
+	buf[off + 16] = 10; buf[off + 19] = 2;
+	off += 20;
+	buf[off] = 1000 >> 8; buf[off + 1] = 1000 & 0xff;
+	buf[off + 3] = 53;
+	buf[off + 5] = 8 + 32;
+	off += 8;
+	memset(buf + off, fill, 32);
+	return off + 32;
+}
+
+static struct dedup_table *table(uint32_t window_us)
+{
+	struct dedup_config cfg = { .enabled = true, .window_us = window_us };
+	struct dedup_table *dt = dedup_table_create(&cfg);
+
+	assert_non_null(dt);
+	return dt;
+}
+
+static bool seen(struct dedup_table *dt, const uint8_t *buf, uint32_t len, uint64_t now)
+{
+	struct pkt_desc pd;
+
+	pkt_parse(buf, len, &pd);
+	return dedup_seen(dt, buf, &pd, now);
+}
+
+/* A routed (TTL, MACs) or re-tagged copy within the window is a duplicate */
+static void test_dedup_routed_copy(void **state)
+{
+	(void)state;
+	struct dedup_table *dt = table(1000);
+	uint8_t a[128], b[128], c[128];
+	uint32_t la = build_udp4(a, 0, 64, 0x1234, 0xaa);
+	uint32_t lb = build_udp4(b, 0, 63, 0x1234, 0xaa);
+	uint32_t lc = build_udp4(c, 100, 63, 0x1234, 0xaa);
+
+	assert_false(seen(dt, a, la, 10 * US));
+	assert_true(seen(dt, b, lb, 10 * US + 50));
+	assert_true(seen(dt, c, lc, 11 * US));	/* Third copy, other VLAN */
+	dedup_table_destroy(dt);
+}
+
+/* Same flow, different IP ID or payload: distinct packets */
+static void test_dedup_distinct_packets(void **state)
+{
+	(void)state;
+	struct dedup_table *dt = table(1000);
+	uint8_t buf[128];
+	uint32_t len;
+
+	len = build_udp4(buf, 0, 64, 1, 0xaa);
+	assert_false(seen(dt, buf, len, 10 * US));
+	len = build_udp4(buf, 0, 64, 2, 0xaa);
+	assert_false(seen(dt, buf, len, 10 * US));
+	len = build_udp4(buf, 0, 64, 2, 0xbb);
+	assert_false(seen(dt, buf, len, 10 * US));
+	dedup_table_destroy(dt);
+}
+
+/* A copy arriving after the window is forwarded again */
+static void test_dedup_window(void **state)
+{
+	(void)state;
+	struct dedup_table *dt = table(100);
+	uint8_t buf[128];
+	uint32_t len = build_udp4(buf, 0, 64, 7, 0xaa);
+
+	assert_false(seen(dt, buf, len, 10 * US));
+	assert_true(seen(dt, buf, len, 10 * US + 100 * US));
+	assert_false(seen(dt, buf, len, 10 * US + 101 * US));
+	assert_true(seen(dt, buf, len, 10 * US + 102 * US));
+	dedup_table_destroy(dt);
+}
+
+/* Frames without IP are never suppressed; IPv6 is */
+static void test_dedup_non_ip_and_ipv6(void **state)
+{
+	(void)state;
+	struct dedup_table *dt = table(1000);
+	uint8_t arp[64], ip6[128];
+	struct pkt_desc pd;
+	uint32_t len = 14 + 40 + 8 + 16;
+
+	memset(arp, 0, sizeof(arp));
+	arp[12] = 0x08; arp[13] = 0x06;
+	assert_false(seen(dt, arp, sizeof(arp), 1 * US));
+	assert_false(seen(dt, arp, sizeof(arp), 1 * US));
+
+	memset(ip6, 0, sizeof(ip6));
+	ip6[12] = 0x86; ip6[13] = 0xdd;
+	ip6[14] = 0x60;
+	ip6[19] = 8 + 16;	/* Payload length */
+	ip6[20] = 17;
+	ip6[21] = 64;
+	ip6[22] = 0x20; ip6[23] = 0x01; ip6[37] = 1;
+	ip6[38] = 0x20; ip6[39] = 0x01; ip6[53] = 2;
+	ip6[55] = 1; ip6[57] = 53;
+	pkt_parse(ip6, len, &pd);
+	assert_true(pd.flags & PKT_F_IPV6);
+	assert_int_not_equal(dedup_signature(ip6, &pd), 0);
+
+	assert_false(seen(dt, ip6, len, 2 * US));
+	ip6[21] = 63;	/* Hop limit */
+	assert_true(seen(dt, ip6, len, 2 * US));
+	dedup_table_destroy(dt);
+}
+
+/* Ethernet padding of a short frame is not hashed */
+static void test_dedup_ignores_padding(void **state)
+{
+	(void)state;
+	uint8_t buf[128];
+	uint32_t len = build_udp4(buf, 0, 64, 9, 0xaa);
+	struct pkt_desc pd;
+	uint64_t sig;
+
+	pkt_parse(buf, len, &pd);
+	sig = dedup_signature(buf, &pd);
+	buf[len] = 0xee;
+	pkt_parse(buf, len + 1, &pd);
+	assert_int_equal(dedup_signature(buf, &pd), sig);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_dedup_routed_copy),
+		cmocka_unit_test(test_dedup_distinct_packets),
+		cmocka_unit_test(test_dedup_window),
+		cmocka_unit_test(test_dedup_non_ip_and_ipv6),
+		cmocka_unit_test(test_dedup_ignores_padding),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -9,6 +9,10 @@
 #include <setjmp.h>
 #include <cmocka.h>
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 
 #include "../../src/config.h"
 #include "../../src/filter.h"
@@ -43,6 +47,44 @@ static void build_ip_tcp(uint8_t *buf, uint32_t ip_src, uint32_t ip_dst,
 	*out_len = ETH_HLEN + 20 + 4;
 }
 
+/* Ethernet + IPv6 (2001:db8::<src_lo> -> 2001:db8::<dst_lo>) + TCP ports */
+static void build_ip6_tcp(uint8_t *buf, uint64_t src_lo, uint64_t dst_lo,
+                          uint16_t port_src, uint16_t port_dst, size_t *out_len)
+{
+	uint8_t *p = buf;
+	int i;
+
+	memset(p, 0, ETH_HLEN + 40 + 4);
+	p[12] = 0x86;
+	p[13] = 0xdd;
+	p += ETH_HLEN;
+	p[0] = 0x60;
+	p[6] = 6;
+	p[8] = 0x20; p[9] = 0x01; p[10] = 0x0d; p[11] = 0xb8;
+	p[24] = 0x20; p[25] = 0x01; p[26] = 0x0d; p[27] = 0xb8;
+	for (i = 0; i < 8; i++) {
+		p[16 + i] = (uint8_t)(src_lo >> (56 - 8 * i));
+		p[32 + i] = (uint8_t)(dst_lo >> (56 - 8 * i));
+	}
+	p += 40;
+	p[0] = (port_src >> 8) & 0xff;
+	p[1] = port_src & 0xff;
+	p[2] = (port_dst >> 8) & 0xff;
+	p[3] = port_dst & 0xff;
+	*out_len = ETH_HLEN + 40 + 4;
+}
+
+/* Insert a VLAN tag (tpid, vid) after the MAC addresses */
+static void push_vlan(uint8_t *buf, size_t *len, uint16_t tpid, uint16_t vid)
+{
+	memmove(buf + 16, buf + 12, *len - 12);
+	buf[12] = tpid >> 8;
+	buf[13] = tpid & 0xff;
+	buf[14] = (vid >> 8) & 0x0f;
+	buf[15] = vid & 0xff;
+	*len += 4;
+}
+
 static void test_filter_null_config_allows(void **state)
 {
 	(void)state;
@@ -77,7 +119,8 @@ static void test_filter_default_allow(void **state)
 static void test_filter_first_match_allow(void **state)
 {
 	(void)state;
-	struct filter_config cfg = { .default_action = FILTER_ACTION_DROP, .num_rules = 1 };
+	struct filter_rule rules[1] = { 0 };
+	struct filter_config cfg = { .default_action = FILTER_ACTION_DROP, .rules = rules, .num_rules = 1 };
 	cfg.rules[0].action = FILTER_ACTION_ALLOW;
 	cfg.rules[0].match.has_protocol = true;
 	cfg.rules[0].match.protocol = 6;
@@ -90,7 +133,8 @@ static void test_filter_first_match_allow(void **state)
 static void test_filter_match_port_dst(void **state)
 {
 	(void)state;
-	struct filter_config cfg = { .default_action = FILTER_ACTION_DROP, .num_rules = 1 };
+	struct filter_rule rules[1] = { 0 };
+	struct filter_config cfg = { .default_action = FILTER_ACTION_DROP, .rules = rules, .num_rules = 1 };
 	cfg.rules[0].action = FILTER_ACTION_ALLOW;
 	cfg.rules[0].match.has_port_dst = true;
 	cfg.rules[0].match.port_dst = 443;
@@ -113,7 +157,8 @@ static void test_filter_short_packet_allows(void **state)
 static void test_filter_match_ip_src_cidr(void **state)
 {
 	(void)state;
-	struct filter_config cfg = { .default_action = FILTER_ACTION_DROP, .num_rules = 1 };
+	struct filter_rule rules[1] = { 0 };
+	struct filter_config cfg = { .default_action = FILTER_ACTION_DROP, .rules = rules, .num_rules = 1 };
 	cfg.rules[0].action = FILTER_ACTION_ALLOW;
 	cfg.rules[0].match.has_ip_src = true;
 	cfg.rules[0].match.ip_src = 0xC0A8C800u;   /* 192.168.200.0 network order */
@@ -125,6 +170,543 @@ static void test_filter_match_ip_src_cidr(void **state)
 	assert_int_equal(filter_packet(&cfg, buf, (uint32_t)len, NULL), FILTER_ACTION_ALLOW);
 }
 
+/* filter_classify() on a raw frame, as the workers do: parse, then classify */
+static enum filter_action classify(const struct filter_classifier *fc, const uint8_t *buf,
+                                   uint32_t len, int *idx)
+{
+	struct pkt_desc pd;
+
+	pkt_parse(buf, len, &pd);
+	return filter_classify(fc, &pd, idx);
+}
+
+/* Overlapping prefixes: the earlier, shorter prefix still wins (first match) */
+static void test_filter_compiled_first_match(void **state)
+{
+	(void)state;
+	struct filter_rule rules[2] = { 0 };
+	struct filter_config cfg = { .default_action = FILTER_ACTION_ALLOW, .rules = rules, .num_rules = 2 };
+	struct filter_classifier *fc;
+	uint8_t buf[64];
+	size_t len;
+	int idx;
+
+	cfg.rules[0].action = FILTER_ACTION_DROP;
+	cfg.rules[0].match.has_ip_dst = true;
+	cfg.rules[0].match.ip_dst = 0x0a000000u;	/* 10.0.0.0/8 */
+	cfg.rules[0].match.ip_dst_mask = 0xFF000000u;
+	cfg.rules[1].action = FILTER_ACTION_ALLOW;
+	cfg.rules[1].match.has_ip_dst = true;
+	cfg.rules[1].match.ip_dst = 0x0a010000u;	/* 10.1.0.0/16 */
+	cfg.rules[1].match.ip_dst_mask = 0xFFFF0000u;
+	cfg.rules[1].match.has_port_dst = true;
+	cfg.rules[1].match.port_dst = 443;
+	fc = filter_compile(&cfg);
+	assert_non_null(fc);
+
+	build_ip_tcp(buf, 0xC0A80001, 0x0a010203, 12345, 443, &len);
+	assert_int_equal(classify(fc, buf, (uint32_t)len, &idx), FILTER_ACTION_DROP);
+	assert_int_equal(idx, 0);
+	build_ip_tcp(buf, 0xC0A80001, 0x0b010203, 12345, 443, &len);
+	assert_int_equal(classify(fc, buf, (uint32_t)len, &idx), FILTER_ACTION_ALLOW);
+	assert_int_equal(idx, -1);
+	filter_classifier_free(fc);
+}
+
+/* IPv6 prefix, next header and stacked VLAN IDs, the same rules on both paths */
+static void test_filter_match_ipv6_and_vlan(void **state)
+{
+	(void)state;
+	struct filter_rule rules[3] = { 0 };
+	struct filter_config cfg = { .default_action = FILTER_ACTION_DROP, .rules = rules, .num_rules = 3 };
+	struct filter_classifier *fc;
+	struct pkt_desc pd;
+	uint8_t buf[128];
+	size_t len;
+	int idx;
+
+	/* 0: allow 2001:db8::/64 -> port 443 */
+	rules[0].action = FILTER_ACTION_ALLOW;
+	rules[0].match.has_ip6_dst = true;
+	rules[0].match.ip6_dst[0] = 0x20010db800000000ULL;
+	rules[0].match.ip6_dst_mask[0] = ~0ULL;
+	rules[0].match.has_port_dst = true;
+	rules[0].match.port_dst = 443;
+	/* 1: allow TCP in outer VLAN 300, inner VLAN 100 */
+	rules[1].action = FILTER_ACTION_ALLOW;
+	rules[1].match.has_vlan = true;
+	rules[1].match.vlan = 300;
+	rules[1].match.has_inner_vlan = true;
+	rules[1].match.inner_vlan = 100;
+	rules[1].match.has_protocol = true;
+	rules[1].match.protocol = 6;
+	/* 2: an IPv4 prefix never matches IPv6 */
+	rules[2].action = FILTER_ACTION_ALLOW;
+	rules[2].match.has_ip_src = true;
+	fc = filter_compile(&cfg);
+	assert_non_null(fc);
+
+	build_ip6_tcp(buf, 1, 2, 40000, 443, &len);
+	assert_int_equal(filter_packet(&cfg, buf, (uint32_t)len, &idx), FILTER_ACTION_ALLOW);
+	assert_int_equal(idx, 0);
+	assert_int_equal(classify(fc, buf, (uint32_t)len, &idx), FILTER_ACTION_ALLOW);
+	assert_int_equal(idx, 0);
+
+	build_ip6_tcp(buf, 1, 2, 40000, 80, &len);
+	assert_int_equal(filter_packet(&cfg, buf, (uint32_t)len, &idx), FILTER_ACTION_DROP);
+	assert_int_equal(classify(fc, buf, (uint32_t)len, &idx), FILTER_ACTION_DROP);
+
+	/* QinQ IPv6: rule 1 (ports are no longer 443 for rule 0) */
+	push_vlan(buf, &len, 0x8100, 100);
+	push_vlan(buf, &len, 0x88a8, 300);
+	assert_int_equal(filter_packet(&cfg, buf, (uint32_t)len, &idx), FILTER_ACTION_ALLOW);
+	assert_int_equal(idx, 1);
+	assert_int_equal(classify(fc, buf, (uint32_t)len, &idx), FILTER_ACTION_ALLOW);
+	assert_int_equal(idx, 1);
+
+	/* Only one tag: inner_vlan cannot match */
+	build_ip6_tcp(buf, 1, 2, 40000, 80, &len);
+	push_vlan(buf, &len, 0x8100, 300);
+	assert_int_equal(filter_packet(&cfg, buf, (uint32_t)len, &idx), FILTER_ACTION_DROP);
+	assert_int_equal(classify(fc, buf, (uint32_t)len, &idx), FILTER_ACTION_DROP);
+
+	/* Outer tag 300 stripped on receive, inner tag 100 in the frame: still rule 1 */
+	build_ip6_tcp(buf, 1, 2, 40000, 80, &len);
+	push_vlan(buf, &len, 0x8100, 100);
+	pkt_parse_vlan(buf, (uint32_t)len, 300, &pd);
+	assert_int_equal(filter_classify(fc, &pd, &idx), FILTER_ACTION_ALLOW);
+	assert_int_equal(idx, 1);
+	/* The same frame without the metadata has 100 as its outer tag */
+	pkt_parse(buf, (uint32_t)len, &pd);
+	assert_int_equal(filter_classify(fc, &pd, &idx), FILTER_ACTION_DROP);
+	filter_classifier_free(fc);
+}
+
+static uint32_t lcg_next(uint32_t *s)
+{
+	*s = *s * 1664525u + 1013904223u;
+	return *s >> 8;
+}
+
+#define RANDOM_MAX_RULES 64
+
+/* Compiled classifier agrees with the linear scan on random rule sets and packets */
+static void test_filter_compiled_matches_linear(void **state)
+{
+	(void)state;
+	static struct filter_rule rules[RANDOM_MAX_RULES];
+	static const uint32_t addrs[] = { 0x0a000001u, 0x0a000102u, 0x0a01ff03u, 0xC0A8C801u, 0xC0A8C8FEu, 0x08080808u };
+	static const uint16_t ports[] = { 22, 53, 80, 443, 8080 };
+	static const uint8_t protos[] = { 1, 6, 17 };
+	static const uint64_t addrs6[] = { 1, 2, 0x100, 0x1000000000000ULL };	/* Low halves under 2001:db8:: */
+	static const uint16_t vids[] = { 10, 20, 30 };
+	struct filter_config cfg;
+	uint32_t seed = 12345;
+	unsigned int round, i, n;
+
+	for (round = 0; round < 50; round++) {
+		struct filter_classifier *fc;
+
+		memset(&cfg, 0, sizeof(cfg));
+		memset(rules, 0, sizeof(rules));
+		cfg.rules = rules;
+		cfg.default_action = (round & 1) ? FILTER_ACTION_ALLOW : FILTER_ACTION_DROP;
+		cfg.num_rules = 1 + lcg_next(&seed) % RANDOM_MAX_RULES;
+		for (i = 0; i < cfg.num_rules; i++) {
+			struct filter_match *m = &cfg.rules[i].match;
+			unsigned int plen;
+
+			cfg.rules[i].action = (lcg_next(&seed) & 1) ? FILTER_ACTION_ALLOW : FILTER_ACTION_DROP;
+			if (lcg_next(&seed) % 8 == 0) {
+				m->has_eth_type = true;
+				m->eth_type = (lcg_next(&seed) & 1) ? 0x0800 : 0x86dd;
+			}
+			if (lcg_next(&seed) % 3 == 0) {
+				m->has_protocol = true;
+				m->protocol = protos[lcg_next(&seed) % 3];
+			}
+			if (lcg_next(&seed) % 3 == 0) {
+				plen = lcg_next(&seed) % 33;
+				m->has_ip_src = true;
+				m->ip_src_mask = plen ? 0xFFFFFFFFu << (32 - plen) : 0;
+				m->ip_src = addrs[lcg_next(&seed) % 6] & m->ip_src_mask;
+				if (lcg_next(&seed) % 32 == 0)
+					m->ip_src = addrs[lcg_next(&seed) % 6];	/* Host bits set: never matches */
+			}
+			if (lcg_next(&seed) % 3 == 0) {
+				plen = lcg_next(&seed) % 33;
+				m->has_ip_dst = true;
+				m->ip_dst_mask = plen ? 0xFFFFFFFFu << (32 - plen) : 0;
+				m->ip_dst = addrs[lcg_next(&seed) % 6] & m->ip_dst_mask;
+				if (lcg_next(&seed) % 16 == 0)
+					m->ip_dst_mask = 0xFF00FF00u;	/* Non-prefix mask */
+			}
+			if (lcg_next(&seed) % 6 == 0) {
+				/* IPv6 source in 2001:db8::/32, prefix 32..128 */
+				plen = 32 + lcg_next(&seed) % 97;
+				m->has_ip6_src = true;
+				m->ip6_src_mask[0] = plen >= 64 ? ~0ULL : ~0ULL << (64 - plen);
+				m->ip6_src_mask[1] = plen <= 64 ? 0 : plen == 128 ? ~0ULL : ~0ULL << (128 - plen);
+				m->ip6_src[0] = 0x20010db800000000ULL & m->ip6_src_mask[0];
+				m->ip6_src[1] = addrs6[lcg_next(&seed) % 4] & m->ip6_src_mask[1];
+			}
+			if (lcg_next(&seed) % 5 == 0) {
+				/* IPv6 destination, same pool; now and then a non-prefix mask or host bits */
+				plen = 32 + lcg_next(&seed) % 97;
+				m->has_ip6_dst = true;
+				m->ip6_dst_mask[0] = plen >= 64 ? ~0ULL : ~0ULL << (64 - plen);
+				m->ip6_dst_mask[1] = plen <= 64 ? 0 : plen == 128 ? ~0ULL : ~0ULL << (128 - plen);
+				m->ip6_dst[0] = 0x20010db800000000ULL & m->ip6_dst_mask[0];
+				m->ip6_dst[1] = addrs6[lcg_next(&seed) % 4] & m->ip6_dst_mask[1];
+				if (lcg_next(&seed) % 16 == 0)
+					m->ip6_dst_mask[1] = 0xFFFF0000FFFF0000ULL;	/* Non-prefix mask */
+				else if (lcg_next(&seed) % 32 == 0)
+					m->ip6_dst[1] = addrs6[lcg_next(&seed) % 4];	/* Host bits may be set */
+			}
+			if (lcg_next(&seed) % 3 == 0) {
+				m->has_port_src = true;
+				m->port_src = ports[lcg_next(&seed) % 5];
+			}
+			if (lcg_next(&seed) % 3 == 0) {
+				m->has_port_dst = true;
+				m->port_dst = ports[lcg_next(&seed) % 5];
+			}
+			if (lcg_next(&seed) % 6 == 0) {
+				m->has_vlan = true;
+				m->vlan = vids[lcg_next(&seed) % 3];
+			}
+			if (lcg_next(&seed) % 8 == 0) {
+				m->has_inner_vlan = true;
+				m->inner_vlan = vids[lcg_next(&seed) % 3];
+			}
+		}
+		fc = filter_compile(&cfg);
+		assert_non_null(fc);
+
+		for (n = 0; n < 500; n++) {
+			uint8_t buf[128];
+			size_t len;
+			int idx_lin = -2, idx_fc = -2;
+			enum filter_action a_lin, a_fc;
+
+			if (lcg_next(&seed) % 3 == 0) {
+				build_ip6_tcp(buf, addrs6[lcg_next(&seed) % 4], addrs6[lcg_next(&seed) % 4],
+				              ports[lcg_next(&seed) % 5], ports[lcg_next(&seed) % 5], &len);
+				buf[ETH_HLEN + 6] = protos[lcg_next(&seed) % 3];
+			} else {
+				build_ip_tcp(buf, addrs[lcg_next(&seed) % 6], addrs[lcg_next(&seed) % 6],
+				             ports[lcg_next(&seed) % 5], ports[lcg_next(&seed) % 5], &len);
+				buf[ETH_HLEN + 9] = protos[lcg_next(&seed) % 3];
+			}
+			if (lcg_next(&seed) % 10 == 0)
+				buf[13] = 0x06;		/* ARP: no IP fields */
+			for (i = lcg_next(&seed) % 3; i > 0; i--)	/* 0, 1 or 2 tags */
+				push_vlan(buf, &len, i == 1 ? 0x88a8 : 0x8100, vids[lcg_next(&seed) % 3]);
+			a_lin = filter_packet(&cfg, buf, (uint32_t)len, &idx_lin);
+			a_fc = classify(fc, buf, (uint32_t)len, &idx_fc);
+			assert_int_equal(a_fc, a_lin);
+			assert_int_equal(idx_fc, idx_lin);
+		}
+		filter_classifier_free(fc);
+	}
+}
+
+/*
+ * A large blocklist: 20000 nested /16, /24 and /32 prefixes on ip_dst and ip_src
+ * (duplicates included), some with a port or protocol, plus port-only rules.
+ * Packets are drawn from the same address pool so most hit deep in a chain.
+ */
+static void test_filter_compiled_large_prefix_set(void **state)
+{
+	(void)state;
+	enum { NUM_RULES = 20000 };
+	static struct filter_rule rules[NUM_RULES];
+	struct filter_config cfg = { .default_action = FILTER_ACTION_ALLOW, .rules = rules, .num_rules = NUM_RULES };
+	struct filter_classifier *fc;
+	uint32_t seed = 777;
+	unsigned int i, n;
+
+	memset(rules, 0, sizeof(rules));
+	for (i = 0; i < NUM_RULES; i++) {
+		struct filter_match *m = &rules[i].match;
+		uint32_t addr = 0x0a000000u | (lcg_next(&seed) & 0x3f3f3fu);	/* 10.[0-63].[0-63].[0-63] */
+		static const uint32_t masks[] = { 0xFFFF0000u, 0xFFFFFF00u, 0xFFFFFFFFu, 0xFFFFFFFFu };
+		uint32_t mask = masks[lcg_next(&seed) % 4];
+
+		rules[i].action = (lcg_next(&seed) & 1) ? FILTER_ACTION_ALLOW : FILTER_ACTION_DROP;
+		switch (lcg_next(&seed) % 8) {
+		case 0:
+			m->has_port_dst = true;
+			m->port_dst = (uint16_t)(lcg_next(&seed) % 64);
+			break;
+		case 1:
+			m->has_ip_src = true;
+			m->ip_src_mask = mask;
+			m->ip_src = addr & mask;
+			break;
+		default:
+			m->has_ip_dst = true;
+			m->ip_dst_mask = mask;
+			m->ip_dst = addr & mask;
+			if (lcg_next(&seed) % 4 == 0) {
+				m->has_port_dst = true;
+				m->port_dst = (uint16_t)(lcg_next(&seed) % 64);
+			}
+			if (lcg_next(&seed) % 4 == 0) {
+				m->has_protocol = true;
+				m->protocol = 17;
+			}
+			break;
+		}
+	}
+	fc = filter_compile(&cfg);
+	assert_non_null(fc);
+
+	for (n = 0; n < 20000; n++) {
+		uint8_t buf[64];
+		size_t len;
+		int idx_lin = -2, idx_fc = -2;
+
+		build_ip_tcp(buf, 0x0a000000u | (lcg_next(&seed) & 0x3f3f3fu),
+		             0x0a000000u | (lcg_next(&seed) & 0x3f3f3fu),
+		             1024, (uint16_t)(lcg_next(&seed) % 128), &len);
+		assert_int_equal(classify(fc, buf, (uint32_t)len, &idx_fc),
+		                 filter_packet(&cfg, buf, (uint32_t)len, &idx_lin));
+		assert_int_equal(idx_fc, idx_lin);
+	}
+	filter_classifier_free(fc);
+}
+
+/* Port-dst rule helper for the reload tests */
+static void set_port_rule(struct filter_rule *r, enum filter_action action, uint16_t port)
+{
+	memset(r, 0, sizeof(*r));
+	r->action = action;
+	r->match.has_port_dst = true;
+	r->match.port_dst = port;
+}
+
+/* Identity = action + match: reordered rules map, changed and duplicate ones do not */
+static void test_filter_rule_map(void **state)
+{
+	(void)state;
+	struct filter_rule a[3], b[4];
+	struct filter_config from = { .default_action = FILTER_ACTION_ALLOW, .rules = a, .num_rules = 3 };
+	struct filter_config to = { .default_action = FILTER_ACTION_DROP, .rules = b, .num_rules = 4 };
+	unsigned int map[5];
+
+	set_port_rule(&a[0], FILTER_ACTION_DROP, 22);
+	set_port_rule(&a[1], FILTER_ACTION_ALLOW, 443);
+	set_port_rule(&a[2], FILTER_ACTION_DROP, 53);
+	set_port_rule(&b[0], FILTER_ACTION_ALLOW, 443);	/* Moved */
+	set_port_rule(&b[1], FILTER_ACTION_ALLOW, 22);	/* Action changed */
+	set_port_rule(&b[2], FILTER_ACTION_DROP, 53);	/* Same */
+	set_port_rule(&b[3], FILTER_ACTION_DROP, 53);	/* Duplicate: old rule already taken */
+
+	assert_int_equal(filter_rule_map(&from, &to, map), 0);
+	assert_int_equal(map[0], 1);
+	assert_int_equal(map[1], FILTER_NO_RULE);
+	assert_int_equal(map[2], 2);
+	assert_int_equal(map[3], FILTER_NO_RULE);
+	assert_int_equal(map[4], 3);	/* Default -> default */
+}
+
+/* filter_reload() keeps the counts of identical rules and of the default */
+static void test_filter_reload_carries_hits(void **state)
+{
+	(void)state;
+	struct filter_rule a[2], b[2];
+	struct filter_config ca = { .default_action = FILTER_ACTION_ALLOW, .rules = a, .num_rules = 2 };
+	struct filter_config cb = { .default_action = FILTER_ACTION_ALLOW, .rules = b, .num_rules = 2 };
+	const struct filter_state *fs;
+
+	set_port_rule(&a[0], FILTER_ACTION_DROP, 22);
+	set_port_rule(&a[1], FILTER_ACTION_DROP, 23);
+	set_port_rule(&b[0], FILTER_ACTION_DROP, 80);
+	set_port_rule(&b[1], FILTER_ACTION_DROP, 22);
+
+	assert_int_equal(filter_set_config(&ca), 0);
+	fs = filter_enter(0);
+	assert_non_null(fs);
+	assert_true(fs->cfg == &ca);
+	counter_set(&filter_hits_row(fs, 0)[0], 5);
+	counter_set(&filter_hits_row(fs, 0)[1], 7);
+	counter_set(&filter_hits_row(fs, 0)[2], 11);
+	filter_exit(0);
+
+	assert_int_equal(filter_reload(&cb), 0);
+	fs = filter_current();
+	assert_true(fs->cfg == &cb);
+	assert_int_equal(filter_hits_get(fs, 0), 0);
+	assert_int_equal(filter_hits_get(fs, 1), 5);	/* port 22 moved from slot 0 */
+	assert_int_equal(filter_hits_get(fs, 2), 11);
+
+	/* filter_set_config() starts from zero */
+	assert_int_equal(filter_set_config(&ca), 0);
+	assert_int_equal(filter_hits_get(filter_current(), 0), 0);
+	assert_int_equal(filter_set_config(NULL), 0);
+	assert_null(filter_current());
+}
+
+/* A prepared reload publishes nothing until committed; aborting leaves the current filter */
+static void test_filter_reload_prepare_commit(void **state)
+{
+	(void)state;
+	struct filter_rule a[1], b[2];
+	struct filter_config ca = { .default_action = FILTER_ACTION_ALLOW, .rules = a, .num_rules = 1 };
+	struct filter_config cb = { .default_action = FILTER_ACTION_ALLOW, .rules = b, .num_rules = 2 };
+	struct filter_state *fs;
+
+	set_port_rule(&a[0], FILTER_ACTION_DROP, 22);
+	set_port_rule(&b[0], FILTER_ACTION_DROP, 80);
+	set_port_rule(&b[1], FILTER_ACTION_DROP, 22);
+
+	assert_int_equal(filter_set_config(&ca), 0);
+	counter_set(&filter_hits_row(filter_current(), 0)[0], 3);
+
+	fs = filter_reload_prepare(&cb);
+	assert_non_null(fs);
+	assert_true(filter_current()->cfg == &ca);
+	filter_reload_abort(fs);
+	assert_true(filter_current()->cfg == &ca);
+	assert_int_equal(filter_hits_get(filter_current(), 0), 3);
+
+	fs = filter_reload_prepare(&cb);
+	assert_non_null(fs);
+	filter_reload_commit(fs);
+	assert_true(filter_current() == fs);
+	assert_null(fs->carry);
+	assert_int_equal(filter_hits_get(fs, 1), 3);	/* Same carry-over as filter_reload() */
+	assert_int_equal(filter_set_config(NULL), 0);
+}
+
+/* Each reader counts into its own cache line; filter_set_readers() keeps the counts */
+static void test_filter_hits_rows(void **state)
+{
+	(void)state;
+	struct filter_rule r[2];
+	struct filter_config cfg = { .default_action = FILTER_ACTION_ALLOW, .rules = r, .num_rules = 2 };
+	const struct filter_state *fs;
+
+	set_port_rule(&r[0], FILTER_ACTION_DROP, 22);
+	set_port_rule(&r[1], FILTER_ACTION_DROP, 23);
+	assert_int_equal(filter_set_readers(0), -EINVAL);
+	assert_int_equal(filter_set_readers(FILTER_MAX_READERS + 1), -EINVAL);
+	assert_int_equal(filter_set_readers(2), 0);
+	assert_int_equal(filter_set_config(&cfg), 0);
+	fs = filter_current();
+	assert_int_equal(fs->readers, 2);
+	assert_true(fs->hit_stride > cfg.num_rules);
+	assert_int_equal((uintptr_t)filter_hits_row(fs, 1) % COUNTER_CACHE_LINE, 0);
+	assert_int_equal((uintptr_t)filter_hits_row(fs, 2) % COUNTER_CACHE_LINE, 0);
+
+	counter_add(&filter_hits_row(fs, 0)[1], 3);
+	counter_add(&filter_hits_row(fs, 1)[1], 4);
+	counter_add(&filter_hits_row(fs, 2)[2], 1);	/* Publisher's row */
+	assert_int_equal(filter_hits_get(fs, 0), 0);
+	assert_int_equal(filter_hits_get(fs, 1), 7);
+	assert_int_equal(filter_hits_get(fs, 2), 1);
+
+	assert_int_equal(filter_set_readers(8), 0);
+	fs = filter_current();
+	assert_int_equal(fs->readers, 8);
+	assert_int_equal(filter_hits_get(fs, 1), 7);
+	assert_int_equal(filter_hits_get(fs, 2), 1);
+
+	assert_int_equal(filter_set_config(NULL), 0);
+	assert_int_equal(filter_set_readers(1), 0);
+}
+
+#define RELOAD_READERS 4
+#define RELOAD_ROUNDS  200
+
+struct reload_reader {
+	unsigned int id;
+	_Atomic bool *stop;
+	_Atomic uint64_t classified;
+};
+
+/* Worker stand-in: batches of 32 classifications under one filter_enter() */
+static void *reload_reader_thread(void *arg)
+{
+	struct reload_reader *r = arg;
+	struct pkt_desc pd;
+	uint8_t buf[64];
+	size_t len;
+	uint16_t port = 0;
+	int i;
+
+	while (!atomic_load(r->stop)) {
+		const struct filter_state *fs = filter_enter(r->id);
+
+		for (i = 0; i < 32 && fs; i++) {
+			int matched;
+
+			build_ip_tcp(buf, 0x0a000001, 0x0a000002, 1024, port++ % 4, &len);
+			pkt_parse(buf, (uint32_t)len, &pd);
+			filter_classify(fs->fc, &pd, &matched);
+			counter_add(&filter_hits_row(fs, r->id)[matched >= 0 ? (unsigned int)matched : fs->cfg->num_rules], 1);
+			atomic_fetch_add_explicit(&r->classified, 1, memory_order_relaxed);
+		}
+		filter_exit(r->id);
+	}
+	return NULL;
+}
+
+/*
+ * Readers classify while the main thread keeps swapping between two orderings
+ * of the same rules: every hit must survive the swaps (carried over, never
+ * counted into a freed state), and no reader may crash on a freed classifier.
+ */
+static void test_filter_reload_concurrent(void **state)
+{
+	(void)state;
+	struct filter_rule a[3], b[3];
+	struct filter_config ca = { .default_action = FILTER_ACTION_ALLOW, .rules = a, .num_rules = 3 };
+	struct filter_config cb = { .default_action = FILTER_ACTION_ALLOW, .rules = b, .num_rules = 3 };
+	struct reload_reader readers[RELOAD_READERS];
+	pthread_t threads[RELOAD_READERS];
+	_Atomic bool stop = false;
+	const struct filter_state *fs;
+	uint64_t total = 0, hits = 0;
+	unsigned int i;
+
+	set_port_rule(&a[0], FILTER_ACTION_DROP, 1);
+	set_port_rule(&a[1], FILTER_ACTION_ALLOW, 2);
+	set_port_rule(&a[2], FILTER_ACTION_DROP, 3);
+	b[0] = a[2];
+	b[1] = a[0];
+	b[2] = a[1];
+
+	assert_int_equal(filter_set_readers(RELOAD_READERS), 0);
+	assert_int_equal(filter_set_config(&ca), 0);
+	for (i = 0; i < RELOAD_READERS; i++) {
+		readers[i].id = i;
+		readers[i].stop = &stop;
+		readers[i].classified = 0;
+		assert_int_equal(pthread_create(&threads[i], NULL, reload_reader_thread, &readers[i]), 0);
+	}
+	/* Swap only once every reader is inside its loop */
+	for (i = 0; i < RELOAD_READERS; i++)
+		while (atomic_load(&readers[i].classified) == 0)
+			sched_yield();
+	for (i = 0; i < RELOAD_ROUNDS; i++)
+		assert_int_equal(filter_reload(i % 2 ? &ca : &cb), 0);
+	atomic_store(&stop, true);
+	for (i = 0; i < RELOAD_READERS; i++) {
+		pthread_join(threads[i], NULL);
+		total += atomic_load(&readers[i].classified);
+	}
+
+	fs = filter_current();
+	for (i = 0; i <= fs->cfg->num_rules; i++)
+		hits += filter_hits_get(fs, i);
+	assert_true(total > 0);
+	assert_int_equal(hits, total);
+	assert_int_equal(filter_set_config(NULL), 0);
+	assert_int_equal(filter_set_readers(1), 0);
+}
+
 int main(void)
 {
 	const struct CMUnitTest tests[] = {
@@ -135,6 +717,15 @@ int main(void)
 		cmocka_unit_test(test_filter_match_port_dst),
 		cmocka_unit_test(test_filter_short_packet_allows),
 		cmocka_unit_test(test_filter_match_ip_src_cidr),
+		cmocka_unit_test(test_filter_compiled_first_match),
+		cmocka_unit_test(test_filter_match_ipv6_and_vlan),
+		cmocka_unit_test(test_filter_compiled_matches_linear),
+		cmocka_unit_test(test_filter_compiled_large_prefix_set),
+		cmocka_unit_test(test_filter_rule_map),
+		cmocka_unit_test(test_filter_reload_carries_hits),
+		cmocka_unit_test(test_filter_reload_prepare_commit),
+		cmocka_unit_test(test_filter_hits_rows),
+		cmocka_unit_test(test_filter_reload_concurrent),
 	};
 	return cmocka_run_group_tests(tests, NULL, NULL);
 }
@@ -0,0 +1,151 @@
+/*
+ * vasn_tap - Unit tests for the per-flow cutoff table (flow_cutoff)
+ */
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+#include "../../src/flow.h"
+
+#define MS 1000000ull
+
+/* IPv4 UDP 10.0.0.1:sport -> 10.0.0.2:53; the hash is chosen by the test */
+static struct pkt_desc udp4(uint16_t sport, uint32_t hash)
+{
+	struct pkt_desc pd;
+
+	memset(&pd, 0, sizeof(pd));
+	pd.flags = PKT_F_IPV4 | PKT_F_PORTS;
+	pd.eth_type = 0x0800;
+	pd.protocol = 17;
+	pd.ip_src = 0x0a000001;
+	pd.ip_dst = 0x0a000002;
+	pd.port_src = sport;
+	pd.port_dst = 53;
+	pd.flow_hash = hash;
+	return pd;
+}
+
+static struct flow_table *table(uint32_t bytes, uint32_t packets, uint32_t idle_ms)
+{
+	struct flow_cutoff_config cfg = {
+		.enabled = true,
+		.bytes = bytes,
+		.packets = packets,
+		.idle_timeout_ms = idle_ms,
+	};
+	struct flow_table *ft = flow_table_create(&cfg);
+
+	assert_non_null(ft);
+	return ft;
+}
+
+/* Packets pass until the flow has sent the byte limit; the one crossing it passes too */
+static void test_flow_cutoff_bytes(void **state)
+{
+	(void)state;
+	struct flow_table *ft = table(3000, 0, 0);
+	struct pkt_desc pd = udp4(1000, 0x1234);
+
+	assert_false(flow_cutoff(ft, &pd, 1500, 1 * MS));
+	assert_false(flow_cutoff(ft, &pd, 1000, 2 * MS));
+	assert_false(flow_cutoff(ft, &pd, 1000, 3 * MS));   /* 2500 before: crosses 3000 */
+	assert_true(flow_cutoff(ft, &pd, 64, 4 * MS));
+	assert_true(flow_cutoff(ft, &pd, 1500, 5 * MS));
+	flow_table_destroy(ft);
+}
+
+static void test_flow_cutoff_packets(void **state)
+{
+	(void)state;
+	struct flow_table *ft = table(0, 3, 0);
+	struct pkt_desc pd = udp4(1000, 0x1234);
+	int i;
+
+	for (i = 0; i < 3; i++)
+		assert_false(flow_cutoff(ft, &pd, 9000, (uint64_t)(i + 1) * MS));
+	assert_true(flow_cutoff(ft, &pd, 64, 10 * MS));
+	flow_table_destroy(ft);
+}
+
+/* Flows are counted apart; frames without IP are never cut */
+static void test_flow_cutoff_per_flow(void **state)
+{
+	(void)state;
+	struct flow_table *ft = table(0, 1, 0);
+	struct pkt_desc a = udp4(1000, 0x1111);
+	struct pkt_desc b = udp4(1001, 0x2222);
+	struct pkt_desc arp;
+
+	memset(&arp, 0, sizeof(arp));
+	arp.eth_type = 0x0806;
+	arp.flow_hash = 0x1111;
+
+	assert_false(flow_cutoff(ft, &a, 100, 1 * MS));
+	assert_false(flow_cutoff(ft, &b, 100, 1 * MS));
+	assert_true(flow_cutoff(ft, &a, 100, 2 * MS));
+	assert_true(flow_cutoff(ft, &b, 100, 2 * MS));
+	assert_false(flow_cutoff(ft, &arp, 60, 3 * MS));
+	assert_false(flow_cutoff(ft, &arp, 60, 4 * MS));
+	flow_table_destroy(ft);
+}
+
+/* An idle flow starts over; a flow kept busy stays cut */
+static void test_flow_cutoff_idle_timeout(void **state)
+{
+	(void)state;
+	struct flow_table *ft = table(0, 1, 100);
+	struct pkt_desc pd = udp4(1000, 0x1234);
+
+	assert_false(flow_cutoff(ft, &pd, 100, 1 * MS));
+	assert_true(flow_cutoff(ft, &pd, 100, 60 * MS));
+	assert_true(flow_cutoff(ft, &pd, 100, 120 * MS));   /* 60 ms since the last packet */
+	assert_false(flow_cutoff(ft, &pd, 100, 400 * MS));
+	assert_true(flow_cutoff(ft, &pd, 100, 401 * MS));
+	flow_table_destroy(ft);
+}
+
+/* A full probe window gives up its least recently seen flow */
+static void test_flow_cutoff_eviction(void **state)
+{
+	(void)state;
+	struct flow_table *ft = table(0, 1, 0);
+	struct pkt_desc pd;
+	uint16_t i;
+
+	/* Same hash: all land in one probe window */
+	for (i = 0; i < FLOW_PROBE_MAX; i++) {
+		pd = udp4(2000 + i, 0x42);
+		assert_false(flow_cutoff(ft, &pd, 100, (uint64_t)(i + 1) * MS));
+	}
+	/* Keep flow 0 recent; flow 1 becomes the oldest */
+	pd = udp4(2000, 0x42);
+	assert_true(flow_cutoff(ft, &pd, 100, 50 * MS));
+
+	pd = udp4(3000, 0x42);
+	assert_false(flow_cutoff(ft, &pd, 100, 60 * MS));
+
+	pd = udp4(2001, 0x42);
+	assert_false(flow_cutoff(ft, &pd, 100, 70 * MS));   /* Evicted: counted afresh */
+	pd = udp4(2000, 0x42);
+	assert_true(flow_cutoff(ft, &pd, 100, 80 * MS));
+	flow_table_destroy(ft);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_flow_cutoff_bytes),
+		cmocka_unit_test(test_flow_cutoff_packets),
+		cmocka_unit_test(test_flow_cutoff_per_flow),
+		cmocka_unit_test(test_flow_cutoff_idle_timeout),
+		cmocka_unit_test(test_flow_cutoff_eviction),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
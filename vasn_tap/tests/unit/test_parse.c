@@ -0,0 +1,349 @@
+/*
+ * vasn_tap - Unit tests for the single-pass packet parser (pkt_parse)
+ */
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+#include "../../src/parse.h"
+
+/* Ethernet (+ optional tag with tpid) + IPv4 (ihl 5) + 4 bytes of L4 ports */
+static uint32_t build_frame(uint8_t *buf, uint16_t tpid, uint8_t protocol,
+                            uint32_t ip_src, uint32_t ip_dst, uint16_t sport, uint16_t dport)
+{
+	uint32_t off = 12;
+
+	memset(buf, 0, 128);
+	buf[0] = 0x02; buf[6] = 0x02; buf[11] = 0x01;
+	if (tpid) {
+		buf[off] = tpid >> 8; buf[off + 1] = tpid & 0xff;
+		buf[off + 3] = 100;	/* VID */
+		off += 4;
+	}
+	buf[off] = 0x08; buf[off + 1] = 0x00;
+	off += 2;
+	buf[off] = 0x45;
+	buf[off + 9] = protocol;
+	buf[off + 12] = ip_src >> 24; buf[off + 13] = ip_src >> 16;
+	buf[off + 14] = ip_src >> 8;  buf[off + 15] = ip_src;
+	buf[off + 16] = ip_dst >> 24; buf[off + 17] = ip_dst >> 16;
+	buf[off + 18] = ip_dst >> 8;  buf[off + 19] = ip_dst;
+	off += 20;
+	buf[off] = sport >> 8; buf[off + 1] = sport & 0xff;
+	buf[off + 2] = dport >> 8; buf[off + 3] = dport & 0xff;
+	return off + 8;
+}
+
+/* Ethernet + IPv6 (2001:db8::1 -> 2001:db8::2) + ext (pre-chained by the caller) + L4 ports */
+static uint32_t build_frame6(uint8_t *buf, uint8_t nh, const uint8_t *ext, uint32_t ext_len,
+                             uint16_t sport, uint16_t dport)
+{
+	static const uint8_t src[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 1 };
+	static const uint8_t dst[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 2 };
+	uint32_t off = 14;
+
+	memset(buf, 0, 128);
+	buf[12] = 0x86; buf[13] = 0xdd;
+	buf[off] = 0x60;
+	buf[off + 6] = nh;
+	memcpy(buf + off + 8, src, 16);
+	memcpy(buf + off + 24, dst, 16);
+	off += 40;
+	memcpy(buf + off, ext, ext_len);
+	off += ext_len;
+	buf[off] = sport >> 8; buf[off + 1] = sport & 0xff;
+	buf[off + 2] = dport >> 8; buf[off + 3] = dport & 0xff;
+	return off + 8;
+}
+
+static void test_parse_ipv4_tcp(void **state)
+{
+	(void)state;
+	uint8_t buf[128];
+	struct pkt_desc pd;
+	uint32_t len = build_frame(buf, 0, 6, 0x0a000001u, 0xC0A80102u, 12345, 443);
+
+	pkt_parse(buf, len, &pd);
+	assert_int_equal(pd.len, len);
+	assert_int_equal(pd.flags, PKT_F_IPV4 | PKT_F_PORTS);
+	assert_int_equal(pd.eth_type, 0x0800);
+	assert_int_equal(pd.l3_off, 14);
+	assert_int_equal(pd.l4_off, 34);
+	assert_int_equal(pd.protocol, 6);
+	assert_int_equal(pd.ip_src, 0x0a000001u);
+	assert_int_equal(pd.ip_dst, 0xC0A80102u);
+	assert_int_equal(pd.port_src, 12345);
+	assert_int_equal(pd.port_dst, 443);
+}
+
+/* One 802.1Q or 802.1ad tag: IPv4 at 18, ethertype is the inner one */
+static void test_parse_single_tag(void **state)
+{
+	(void)state;
+	static const uint16_t tpids[] = { 0x8100, 0x88A8 };
+	uint8_t buf[128];
+	struct pkt_desc pd;
+	unsigned int i;
+
+	for (i = 0; i < 2; i++) {
+		uint32_t len = build_frame(buf, tpids[i], 17, 0x0a000001u, 0x0a000002u, 53, 53);
+		pkt_parse(buf, len, &pd);
+		assert_int_equal(pd.flags, PKT_F_IPV4 | PKT_F_PORTS);
+		assert_int_equal(pd.eth_type, 0x0800);
+		assert_int_equal(pd.l3_off, 18);
+		assert_int_equal(pd.l4_off, 38);
+		assert_int_equal(pd.port_dst, 53);
+	}
+}
+
+static void test_parse_short_and_non_ip(void **state)
+{
+	(void)state;
+	uint8_t buf[128];
+	struct pkt_desc pd;
+
+	memset(buf, 0, sizeof(buf));
+	pkt_parse(buf, 10, &pd);
+	assert_int_equal(pd.len, 10);
+	assert_int_equal(pd.flags, 0);
+	assert_int_equal(pd.l3_off, 0);
+
+	buf[12] = 0x08; buf[13] = 0x06;	/* ARP */
+	pkt_parse(buf, 60, &pd);
+	assert_int_equal(pd.flags, 0);
+	assert_int_equal(pd.eth_type, 0x0806);
+	assert_int_equal(pd.l4_off, 0);
+
+	/* IPv4 ethertype but too short for the header */
+	build_frame(buf, 0, 6, 1, 2, 3, 4);
+	pkt_parse(buf, 30, &pd);
+	assert_int_equal(pd.flags, 0);
+	assert_int_equal(pd.eth_type, 0x0800);
+}
+
+/* Ports are read for SCTP (flow hash) but only TCP/UDP set PKT_F_PORTS (ACL) */
+static void test_parse_sctp_ports_not_flagged(void **state)
+{
+	(void)state;
+	uint8_t buf[128];
+	struct pkt_desc pd;
+	uint32_t len = build_frame(buf, 0, 132, 1, 2, 2905, 2905);
+
+	pkt_parse(buf, len, &pd);
+	assert_int_equal(pd.flags, PKT_F_IPV4);
+	assert_int_equal(pd.port_dst, 2905);
+}
+
+/* Fragments hash on addresses and protocol only, so all fragments of a datagram agree */
+static void test_parse_fragment_flow_hash(void **state)
+{
+	(void)state;
+	uint8_t a[128], b[128];
+	struct pkt_desc pa, pb;
+	uint32_t len = build_frame(a, 0, 17, 0x0a000001u, 0x0a000002u, 1000, 2000);
+
+	build_frame(b, 0, 17, 0x0a000001u, 0x0a000002u, 3000, 4000);
+	pkt_parse(a, len, &pa);
+	pkt_parse(b, len, &pb);
+	assert_int_not_equal(pa.flow_hash, pb.flow_hash);
+
+	a[14 + 6] = 0x20;	/* MF */
+	b[14 + 7] = 0x10;	/* Offset 16 bytes */
+	pkt_parse(a, len, &pa);
+	pkt_parse(b, len, &pb);
+	assert_true(pa.flags & PKT_F_FRAGMENT);
+	assert_true(pb.flags & PKT_F_FRAGMENT);
+	assert_int_equal(pa.flow_hash, pb.flow_hash);
+}
+
+/* Unknown ethertype with an IPv4 header at 18: used by the ACL, flagged as a guess */
+static void test_parse_guessed_ipv4(void **state)
+{
+	(void)state;
+	uint8_t buf[128];
+	struct pkt_desc pd;
+	uint32_t len = build_frame(buf, 0x1234, 6, 0x0a000001u, 0x0a000002u, 1, 2);
+
+	buf[16] = 0x12;	/* Inner ethertype not IPv4 either */
+	pkt_parse(buf, len, &pd);
+	assert_int_equal(pd.flags, PKT_F_IPV4 | PKT_F_PORTS | PKT_F_L3_GUESSED);
+	assert_int_equal(pd.eth_type, 0x0800);
+	assert_int_equal(pd.l3_off, 18);
+	assert_int_equal(pd.ip_dst, 0x0a000002u);
+}
+
+/* 802.1ad + 802.1Q (and a third tag): outer and inner VIDs, ethertype after the last tag */
+static void test_parse_stacked_vlans(void **state)
+{
+	(void)state;
+	uint8_t buf[160], frame[128];
+	struct pkt_desc pd;
+	uint32_t len = build_frame(frame, 0x8100, 17, 0x0a000001u, 0x0a000002u, 53, 53);
+
+	/* Prepend an S-tag (VID 300) in front of the C-tag (VID 100) */
+	memcpy(buf, frame, 12);
+	buf[12] = 0x88; buf[13] = 0xa8; buf[14] = 0x21; buf[15] = 0x2c;	/* PCP 1, VID 300 */
+	memcpy(buf + 16, frame + 12, len - 12);
+	pkt_parse(buf, len + 4, &pd);
+	assert_int_equal(pd.flags, PKT_F_IPV4 | PKT_F_PORTS);
+	assert_int_equal(pd.eth_type, 0x0800);
+	assert_int_equal(pd.vlan_count, 2);
+	assert_int_equal(pd.vlan_outer, 300);
+	assert_int_equal(pd.vlan_inner, 100);
+	assert_int_equal(pd.l3_off, 22);
+	assert_int_equal(pd.port_dst, 53);
+
+	/* Old-style 0x9100 outer tag: three tags, inner is still the second */
+	memmove(buf + 16, buf + 12, len - 8);
+	buf[12] = 0x91; buf[13] = 0x00; buf[14] = 0x00; buf[15] = 0x07;
+	pkt_parse(buf, len + 8, &pd);
+	assert_int_equal(pd.flags, PKT_F_IPV4 | PKT_F_PORTS);
+	assert_int_equal(pd.vlan_count, 3);
+	assert_int_equal(pd.vlan_outer, 7);
+	assert_int_equal(pd.vlan_inner, 300);
+	assert_int_equal(pd.l3_off, 26);
+}
+
+/* Outer tag stripped into metadata (tp_vlan_tci / skb->vlan_tci): it stays the outer one */
+static void test_parse_stripped_outer_tag(void **state)
+{
+	(void)state;
+	uint8_t frame[128];
+	struct pkt_desc pd;
+	uint32_t len;
+
+	/* S-tag 300 stripped, C-tag 100 still in the frame */
+	len = build_frame(frame, 0x8100, 6, 0x0a000001u, 0x0a000002u, 40000, 443);
+	pkt_parse_vlan(frame, len, 0x212c, &pd);	/* PCP 1, VID 300 */
+	assert_int_equal(pd.flags, PKT_F_IPV4 | PKT_F_PORTS);
+	assert_int_equal(pd.eth_type, 0x0800);
+	assert_int_equal(pd.vlan_count, 2);
+	assert_int_equal(pd.vlan_outer, 300);
+	assert_int_equal(pd.vlan_inner, 100);
+	assert_int_equal(pd.l3_off, 18);
+	assert_int_equal(pd.port_dst, 443);
+
+	/* Single tag, stripped: untagged in the frame, VID 0 still counts as a tag */
+	len = build_frame(frame, 0, 6, 0x0a000001u, 0x0a000002u, 40000, 443);
+	pkt_parse_vlan(frame, len, 0, &pd);
+	assert_int_equal(pd.flags, PKT_F_IPV4 | PKT_F_PORTS);
+	assert_int_equal(pd.vlan_count, 1);
+	assert_int_equal(pd.vlan_outer, 0);
+	assert_int_equal(pd.l3_off, 14);
+
+	/* The next plain parse of the same descriptor forgets the tag */
+	pkt_parse(frame, len, &pd);
+	assert_int_equal(pd.vlan_count, 0);
+}
+
+/* MPLS: labels skipped to bottom-of-stack, IPv4 or IPv6 by the version nibble */
+static void test_parse_mpls(void **state)
+{
+	(void)state;
+	static const uint8_t labels[8] = { 0x03, 0xe8, 0x00, 0x40, 0x03, 0xe9, 0x01, 0x40 };
+	uint8_t buf[160], frame[128];
+	struct pkt_desc pd;
+	uint32_t len = build_frame(frame, 0, 6, 0x0a000001u, 0x0a000002u, 1234, 80);
+
+	memcpy(buf, frame, 12);
+	buf[12] = 0x88; buf[13] = 0x47;
+	memcpy(buf + 14, labels, sizeof(labels));
+	memcpy(buf + 22, frame + 14, len - 14);
+	pkt_parse(buf, len + 8, &pd);
+	assert_int_equal(pd.flags, PKT_F_IPV4 | PKT_F_PORTS);
+	assert_int_equal(pd.eth_type, 0x8847);
+	assert_int_equal(pd.l3_off, 22);
+	assert_int_equal(pd.ip_dst, 0x0a000002u);
+	assert_int_equal(pd.port_dst, 80);
+
+	len = build_frame6(frame, 6, NULL, 0, 1234, 443);
+	memcpy(buf + 22, frame + 14, len - 14);
+	pkt_parse(buf, len + 8, &pd);
+	assert_int_equal(pd.flags, PKT_F_IPV6 | PKT_F_PORTS);
+	assert_int_equal(pd.l3_off, 22);
+	assert_int_equal(pd.port_dst, 443);
+
+	/* No bottom-of-stack within the frame: no L3 */
+	buf[20] = 0x00;
+	pkt_parse(buf, 22, &pd);
+	assert_int_equal(pd.flags, 0);
+}
+
+/* IPv6: addresses in host-order halves, extension headers skipped to TCP */
+static void test_parse_ipv6_ext_headers(void **state)
+{
+	(void)state;
+	/* Hop-by-hop (8 bytes) -> routing (16 bytes) -> TCP */
+	static const uint8_t ext[24] = { 43, 0, [8] = 6, [9] = 1 };
+	uint8_t buf[128];
+	struct pkt_desc pd;
+	uint32_t len = build_frame6(buf, 6, NULL, 0, 40000, 443);
+
+	pkt_parse(buf, len, &pd);
+	assert_int_equal(pd.flags, PKT_F_IPV6 | PKT_F_PORTS);
+	assert_int_equal(pd.eth_type, 0x86dd);
+	assert_int_equal(pd.l3_off, 14);
+	assert_int_equal(pd.l4_off, 54);
+	assert_int_equal(pd.protocol, 6);
+	assert_true(pd.ip6_src[0] == 0x20010db800000000ULL && pd.ip6_src[1] == 1);
+	assert_true(pd.ip6_dst[0] == 0x20010db800000000ULL && pd.ip6_dst[1] == 2);
+	assert_int_equal(pd.port_src, 40000);
+
+	len = build_frame6(buf, 0, ext, sizeof(ext), 40000, 443);
+	pkt_parse(buf, len, &pd);
+	assert_int_equal(pd.flags, PKT_F_IPV6 | PKT_F_PORTS);
+	assert_int_equal(pd.l4_off, 54 + 24);
+	assert_int_equal(pd.protocol, 6);
+	assert_int_equal(pd.port_dst, 443);
+
+	/* Extension header running past the frame: IPv6, but no upper-layer protocol */
+	pkt_parse(buf, 54 + 12, &pd);
+	assert_int_equal(pd.flags, PKT_F_IPV6);
+	assert_int_equal(pd.protocol, 0);
+	assert_int_equal(pd.l4_off, 0);
+}
+
+/* IPv6 fragments: ports only in the first, same flow hash for all */
+static void test_parse_ipv6_fragment(void **state)
+{
+	(void)state;
+	static const uint8_t first[8] = { 17, 0, 0x00, 0x01 };	/* Offset 0, M */
+	static const uint8_t later[8] = { 17, 0, 0x05, 0x90 };	/* Offset 178 (1424 bytes) */
+	uint8_t a[128], b[128];
+	struct pkt_desc pa, pb;
+	uint32_t len = build_frame6(a, 44, first, sizeof(first), 5000, 53);
+
+	build_frame6(b, 44, later, sizeof(later), 5000, 53);
+	pkt_parse(a, len, &pa);
+	pkt_parse(b, len, &pb);
+	assert_int_equal(pa.flags, PKT_F_IPV6 | PKT_F_PORTS | PKT_F_FRAGMENT);
+	assert_int_equal(pa.protocol, 17);
+	assert_int_equal(pa.port_dst, 53);
+	assert_int_equal(pb.flags, PKT_F_IPV6 | PKT_F_FRAGMENT);
+	assert_int_equal(pb.protocol, 17);
+	assert_int_equal(pb.l4_off, 62);
+	assert_int_equal(pa.flow_hash, pb.flow_hash);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_parse_ipv4_tcp),
+		cmocka_unit_test(test_parse_single_tag),
+		cmocka_unit_test(test_parse_short_and_non_ip),
+		cmocka_unit_test(test_parse_sctp_ports_not_flagged),
+		cmocka_unit_test(test_parse_fragment_flow_hash),
+		cmocka_unit_test(test_parse_guessed_ipv4),
+		cmocka_unit_test(test_parse_stacked_vlans),
+		cmocka_unit_test(test_parse_stripped_outer_tag),
+		cmocka_unit_test(test_parse_mpls),
+		cmocka_unit_test(test_parse_ipv6_ext_headers),
+		cmocka_unit_test(test_parse_ipv6_fragment),
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,147 @@
+/*
+ * vasn_tap - Unit tests for deterministic sampling (sampling)
+ */
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+#include "../../src/sample.h"
+
+/* IPv4 TCP src:sport -> dst:dport */
+static struct pkt_desc tcp4(uint32_t src, uint16_t sport, uint32_t dst, uint16_t dport)
+{
+	struct pkt_desc pd;
+
+	memset(&pd, 0, sizeof(pd));
+	pd.flags = PKT_F_IPV4 | PKT_F_PORTS;
+	pd.eth_type = 0x0800;
+	pd.protocol = 6;
+	pd.ip_src = src;
+	pd.ip_dst = dst;
+	pd.port_src = sport;
+	pd.port_dst = dport;
+	return pd;
+}
+
+static struct sampler sampler(enum sampling_mode mode, uint32_t rate, uint32_t percent)
+{
+	struct sampling_config cfg = { .mode = mode, .rate = rate, .flow_percent = percent };
+	struct sampler s;
+
+	sampler_init(&s, &cfg);
+	return s;
+}
+
+/* Packet mode keeps the 1st, (rate+1)th, ... packet */
+static void test_sample_packet_one_in_n(void **state)
+{
+	(void)state;
+	struct sampler s = sampler(SAMPLING_PACKET, 4, 0);
+	struct pkt_desc pd = tcp4(0x0a000001, 1000, 0x0a000002, 80);
+	int i, kept = 0;
+
+	for (i = 0; i < 12; i++) {
+		bool skip = sampler_skip(&s, &pd);
+
+		assert_int_equal(skip, i % 4 != 0);
+		kept += !skip;
+	}
+	assert_int_equal(kept, 3);
+}
+
+/* No sampling and a rate of 1 forward every packet */
+static void test_sample_keep_all(void **state)
+{
+	(void)state;
+	struct sampler none = sampler(SAMPLING_NONE, 0, 0);
+	struct sampler one = sampler(SAMPLING_PACKET, 1, 0);
+	struct sampler all = sampler(SAMPLING_FLOW, 0, 100);
+	struct pkt_desc pd;
+	uint32_t i;
+
+	for (i = 0; i < 1000; i++) {
+		pd = tcp4(0x0a000000 + i, (uint16_t)(1024 + i), 0xc0a80001, 443);
+		assert_false(sampler_skip(&none, &pd));
+		assert_false(sampler_skip(&one, &pd));
+		assert_false(sampler_skip(&all, &pd));
+	}
+}
+
+/* Both directions of a conversation hash the same; the ports still count */
+static void test_sample_flow_hash_symmetric(void **state)
+{
+	(void)state;
+	struct pkt_desc fwd = tcp4(0x0a000001, 40000, 0x0a000002, 80);
+	struct pkt_desc rev = tcp4(0x0a000002, 80, 0x0a000001, 40000);
+	struct pkt_desc other = tcp4(0x0a000001, 40001, 0x0a000002, 80);
+	struct pkt_desc v6a, v6b;
+
+	assert_int_equal(sample_flow_hash(&fwd), sample_flow_hash(&rev));
+	assert_int_not_equal(sample_flow_hash(&fwd), sample_flow_hash(&other));
+
+	/* Same address on both sides: the ports decide the order */
+	fwd = tcp4(0x7f000001, 5000, 0x7f000001, 6000);
+	rev = tcp4(0x7f000001, 6000, 0x7f000001, 5000);
+	assert_int_equal(sample_flow_hash(&fwd), sample_flow_hash(&rev));
+
+	memset(&v6a, 0, sizeof(v6a));
+	v6a.flags = PKT_F_IPV6 | PKT_F_PORTS;
+	v6a.protocol = 17;
+	v6a.ip6_src[0] = 0x20010db800000000ull; v6a.ip6_src[1] = 1;
+	v6a.ip6_dst[0] = 0x20010db800000000ull; v6a.ip6_dst[1] = 2;
+	v6a.port_src = 5353; v6a.port_dst = 53;
+	v6b = v6a;
+	memcpy(v6b.ip6_src, v6a.ip6_dst, sizeof(v6b.ip6_src));
+	memcpy(v6b.ip6_dst, v6a.ip6_src, sizeof(v6b.ip6_dst));
+	v6b.port_src = 53; v6b.port_dst = 5353;
+	assert_int_equal(sample_flow_hash(&v6a), sample_flow_hash(&v6b));
+}
+
+/* Flow mode keeps a flow whole: every packet, both directions, or none */
+static void test_sample_flow_whole(void **state)
+{
+	(void)state;
+	struct sampler s = sampler(SAMPLING_FLOW, 0, 25);
+	struct pkt_desc fwd, rev, frag;
+	uint32_t i, kept = 0;
+	int j;
+
+	for (i = 0; i < 4000; i++) {
+		bool skip;
+
+		fwd = tcp4(0x0a000000 + i, (uint16_t)(1024 + i), 0xc0a80001, 443);
+		rev = tcp4(0xc0a80001, 443, 0x0a000000 + i, (uint16_t)(1024 + i));
+		skip = sampler_skip(&s, &fwd);
+		for (j = 0; j < 3; j++) {
+			assert_int_equal(sampler_skip(&s, &fwd), skip);
+			assert_int_equal(sampler_skip(&s, &rev), skip);
+		}
+		kept += !skip;
+	}
+	/* 25% of 4000 flows, within a loose bound */
+	assert_true(kept >= 800 && kept <= 1200);
+
+	/* Fragments are keyed without ports, whatever the parser left in them */
+	frag = tcp4(0x0a000001, 1000, 0x0a000002, 80);
+	frag.flags |= PKT_F_FRAGMENT;
+	fwd = tcp4(0x0a000001, 0, 0x0a000002, 0);
+	fwd.flags &= (uint8_t)~PKT_F_PORTS;
+	assert_int_equal(sample_flow_hash(&frag), sample_flow_hash(&fwd));
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_sample_packet_one_in_n),
+		cmocka_unit_test(test_sample_keep_all),
+		cmocka_unit_test(test_sample_flow_hash_symmetric),
+		cmocka_unit_test(test_sample_flow_whole),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -29,11 +29,11 @@ static void test_afpacket_get_stats_single_worker(void **state)
     memset(&ctx, 0, sizeof(ctx));
     memset(&worker, 0, sizeof(worker));
 
-    atomic_store(&worker.stats.packets_received, 100);
-    atomic_store(&worker.stats.packets_sent, 80);
-    atomic_store(&worker.stats.packets_dropped, 20);
-    atomic_store(&worker.stats.bytes_received, 50000);
-    atomic_store(&worker.stats.bytes_sent, 40000);
+    counter_set(&worker.stats.packets_received, 100);
+    counter_set(&worker.stats.packets_sent, 80);
+    counter_set(&worker.stats.packets_dropped, 20);
+    counter_set(&worker.stats.bytes_received, 50000);
+    counter_set(&worker.stats.bytes_sent, 40000);
 
     ctx.workers = &worker;
     ctx.config.num_workers = 1;
@@ -59,11 +59,11 @@ static void test_afpacket_get_stats_multi_worker(void **state)
     memset(workers, 0, sizeof(workers));
 
     for (i = 0; i < 4; i++) {
-        atomic_store(&workers[i].stats.packets_received, (i + 1) * 100);
-        atomic_store(&workers[i].stats.packets_sent, (i + 1) * 80);
-        atomic_store(&workers[i].stats.packets_dropped, (i + 1) * 5);
-        atomic_store(&workers[i].stats.bytes_received, (i + 1) * 10000);
-        atomic_store(&workers[i].stats.bytes_sent, (i + 1) * 8000);
+        counter_set(&workers[i].stats.packets_received, (i + 1) * 100);
+        counter_set(&workers[i].stats.packets_sent, (i + 1) * 80);
+        counter_set(&workers[i].stats.packets_dropped, (i + 1) * 5);
+        counter_set(&workers[i].stats.bytes_received, (i + 1) * 10000);
+        counter_set(&workers[i].stats.bytes_sent, (i + 1) * 8000);
     }
 
     ctx.workers = workers;
@@ -124,18 +124,18 @@ static void test_afpacket_reset_stats(void **state)
     memset(&ctx, 0, sizeof(ctx));
     memset(workers, 0, sizeof(workers));
 
-    atomic_store(&workers[0].stats.packets_received, 500);
-    atomic_store(&workers[0].stats.bytes_sent, 99999);
-    atomic_store(&workers[1].stats.packets_dropped, 42);
+    counter_set(&workers[0].stats.packets_received, 500);
+    counter_set(&workers[0].stats.bytes_sent, 99999);
+    counter_set(&workers[1].stats.packets_dropped, 42);
 
     ctx.workers = workers;
     ctx.config.num_workers = 2;
 
     afpacket_reset_stats(&ctx);
 
-    assert_int_equal(atomic_load(&workers[0].stats.packets_received), 0);
-    assert_int_equal(atomic_load(&workers[0].stats.bytes_sent), 0);
-    assert_int_equal(atomic_load(&workers[1].stats.packets_dropped), 0);
+    assert_int_equal(counter_read(&workers[0].stats.packets_received), 0);
+    assert_int_equal(counter_read(&workers[0].stats.bytes_sent), 0);
+    assert_int_equal(counter_read(&workers[1].stats.packets_dropped), 0);
 }
 
 static void test_afpacket_reset_stats_null(void **state)
@@ -157,12 +157,12 @@ static void test_workers_get_stats_multi(void **state)
     memset(&ctx, 0, sizeof(ctx));
     memset(stats_arr, 0, sizeof(stats_arr));
 
-    atomic_store(&stats_arr[0].packets_received, 10);
-    atomic_store(&stats_arr[1].packets_received, 20);
-    atomic_store(&stats_arr[2].packets_received, 30);
-    atomic_store(&stats_arr[0].bytes_received, 1000);
-    atomic_store(&stats_arr[1].bytes_received, 2000);
-    atomic_store(&stats_arr[2].bytes_received, 3000);
+    counter_set(&stats_arr[0].packets_received, 10);
+    counter_set(&stats_arr[1].packets_received, 20);
+    counter_set(&stats_arr[2].packets_received, 30);
+    counter_set(&stats_arr[0].bytes_received, 1000);
+    counter_set(&stats_arr[1].bytes_received, 2000);
+    counter_set(&stats_arr[2].bytes_received, 3000);
 
     ctx.stats = stats_arr;
     ctx.config.num_workers = 3;
@@ -190,16 +190,79 @@ static void test_workers_reset_stats(void **state)
     memset(&ctx, 0, sizeof(ctx));
     memset(stats_arr, 0, sizeof(stats_arr));
 
-    atomic_store(&stats_arr[0].packets_received, 999);
-    atomic_store(&stats_arr[1].packets_sent, 888);
+    counter_set(&stats_arr[0].packets_received, 999);
+    counter_set(&stats_arr[1].packets_sent, 888);
 
     ctx.stats = stats_arr;
     ctx.config.num_workers = 2;
 
     workers_reset_stats(&ctx);
 
-    assert_int_equal(atomic_load(&stats_arr[0].packets_received), 0);
-    assert_int_equal(atomic_load(&stats_arr[1].packets_sent), 0);
+    assert_int_equal(counter_read(&stats_arr[0].packets_received), 0);
+    assert_int_equal(counter_read(&stats_arr[1].packets_sent), 0);
+}
+
+/* ---- layout ---- */
+
+/* Each worker's counters sit on cache lines no other worker writes */
+static void test_worker_stats_cache_aligned(void **state)
+{
+    (void)state;
+    struct afpacket_worker *workers = counter_calloc(3, sizeof(struct afpacket_worker));
+    int i;
+
+    assert_non_null(workers);
+    assert_int_equal(_Alignof(struct worker_stats), COUNTER_CACHE_LINE);
+    assert_int_equal(sizeof(struct worker_stats) % COUNTER_CACHE_LINE, 0);
+    for (i = 0; i < 3; i++) {
+        assert_int_equal((uintptr_t)&workers[i].stats % COUNTER_CACHE_LINE, 0);
+        assert_int_equal(workers[i].stats.packets_received, 0);
+    }
+    free(workers);
+}
+
+/* Batch deltas are added once and cleared for the next batch */
+static void test_worker_stats_publish(void **state)
+{
+    (void)state;
+    struct worker_stats stats = {0};
+    struct worker_stats batch = {0};
+
+    counter_set(&stats.packets_received, 10);
+    batch.packets_received = 3;
+    batch.bytes_received = 300;
+    batch.packets_sent = 2;
+    batch.packets_dropped = 1;
+    batch.packets_truncated = 1;
+    batch.bytes_truncated = 50;
+    batch.packets_clamped = 1;
+    batch.packets_cutoff = 4;
+    batch.bytes_cutoff = 6000;
+    batch.packets_dup = 5;
+    batch.bytes_dup = 700;
+    batch.packets_sampled_out = 6;
+    batch.bytes_sampled_out = 800;
+
+    worker_stats_publish(&stats, &batch);
+    assert_int_equal(counter_read(&stats.packets_received), 13);
+    assert_int_equal(counter_read(&stats.bytes_received), 300);
+    assert_int_equal(counter_read(&stats.packets_sent), 2);
+    assert_int_equal(counter_read(&stats.packets_dropped), 1);
+    assert_int_equal(counter_read(&stats.packets_truncated), 1);
+    assert_int_equal(counter_read(&stats.bytes_truncated), 50);
+    assert_int_equal(counter_read(&stats.packets_clamped), 1);
+    assert_int_equal(counter_read(&stats.packets_cutoff), 4);
+    assert_int_equal(counter_read(&stats.bytes_cutoff), 6000);
+    assert_int_equal(counter_read(&stats.packets_dup), 5);
+    assert_int_equal(counter_read(&stats.bytes_dup), 700);
+    assert_int_equal(counter_read(&stats.packets_sampled_out), 6);
+    assert_int_equal(counter_read(&stats.bytes_sampled_out), 800);
+    assert_int_equal(batch.packets_received, 0);
+    assert_int_equal(batch.bytes_truncated, 0);
+
+    /* Empty batch: no change */
+    worker_stats_publish(&stats, &batch);
+    assert_int_equal(counter_read(&stats.packets_received), 13);
 }
 
 /* ---- main ---- */
@@ -219,6 +282,9 @@ int main(void)
         cmocka_unit_test(test_workers_get_stats_multi),
         cmocka_unit_test(test_workers_get_stats_null),
         cmocka_unit_test(test_workers_reset_stats),
+        /* layout */
+        cmocka_unit_test(test_worker_stats_cache_aligned),
+        cmocka_unit_test(test_worker_stats_publish),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -75,7 +75,7 @@ static void test_truncate_disabled_no_change(void **state)
     (void)state;
     uint8_t pkt[256];
     memset(pkt, 0x11, sizeof(pkt));
-    assert_int_equal(truncate_apply(pkt, sizeof(pkt), false, 128), 256);
+    assert_int_equal(truncate_apply(pkt, sizeof(pkt), false, 128, NULL), 256);
 }
 
 static void test_truncate_eth_ipv4_updates_total_len_and_checksum(void **state)
@@ -85,7 +85,7 @@ static void test_truncate_eth_ipv4_updates_total_len_and_checksum(void **state)
     uint16_t hdr_sum;
 
     build_eth_ipv4(pkt, sizeof(pkt));
-    assert_int_equal(truncate_apply(pkt, sizeof(pkt), true, 128), 128);
+    assert_int_equal(truncate_apply(pkt, sizeof(pkt), true, 128, NULL), 128);
     assert_int_equal(((unsigned)pkt[16] << 8) | pkt[17], 114); /* 128 - ETH(14) */
 
     hdr_sum = csum16_test(pkt + 14, 20);
@@ -96,34 +96,70 @@ static void test_truncate_eth_vlan_ipv4_updates_total_len_and_checksum(void **st
 {
     (void)state;
     uint8_t pkt[260];
+    struct pkt_desc pd;
     uint16_t hdr_sum;
 
     build_eth_vlan_ipv4(pkt, sizeof(pkt));
-    assert_int_equal(truncate_apply(pkt, sizeof(pkt), true, 128), 128);
+    pkt_parse(pkt, sizeof(pkt), &pd);
+    assert_int_equal(truncate_apply(pkt, sizeof(pkt), true, 128, &pd), 128);
     assert_int_equal(((unsigned)pkt[20] << 8) | pkt[21], 110); /* 128 - ETH(14) - VLAN(4) */
 
     hdr_sum = csum16_test(pkt + 18, 20);
     assert_int_equal(hdr_sum, 0);
 }
 
+/* 802.1ad + 802.1Q: the IPv4 header behind both tags is fixed up too */
+static void test_truncate_qinq_ipv4_updates_total_len_and_checksum(void **state)
+{
+    (void)state;
+    uint8_t vlan[260], pkt[264];
+    uint16_t hdr_sum;
+
+    build_eth_vlan_ipv4(vlan, sizeof(vlan));
+    memcpy(pkt, vlan, 12);
+    pkt[12] = 0x88; pkt[13] = 0xA8; /* 802.1ad */
+    pkt[14] = 0x00; pkt[15] = 0x02; /* TCI */
+    memcpy(pkt + 16, vlan + 12, sizeof(vlan) - 12);
+    assert_int_equal(truncate_apply(pkt, sizeof(pkt), true, 128, NULL), 128);
+    assert_int_equal(((unsigned)pkt[24] << 8) | pkt[25], 106); /* 128 - ETH(14) - 2 x VLAN(4) */
+
+    hdr_sum = csum16_test(pkt + 22, 20);
+    assert_int_equal(hdr_sum, 0);
+}
+
 static void test_truncate_non_ipv4_only_len_changes(void **state)
 {
     (void)state;
     uint8_t pkt[200];
     memset(pkt, 0x5A, sizeof(pkt));
     pkt[12] = 0x86; pkt[13] = 0xDD; /* IPv6 ethertype */
-    assert_int_equal(truncate_apply(pkt, sizeof(pkt), true, 128), 128);
+    assert_int_equal(truncate_apply(pkt, sizeof(pkt), true, 128, NULL), 128);
     assert_int_equal(pkt[12], 0x86);
     assert_int_equal(pkt[13], 0xDD);
 }
 
+/* IPv4 only guessed at offset 18 (unknown ethertype): header left untouched */
+static void test_truncate_guessed_ipv4_not_rewritten(void **state)
+{
+    (void)state;
+    uint8_t pkt[200], orig[200];
+
+    build_eth_vlan_ipv4(pkt, sizeof(pkt));
+    pkt[12] = 0x12; pkt[13] = 0x34;
+    memcpy(orig, pkt, sizeof(pkt));
+    assert_int_equal(truncate_apply(pkt, sizeof(pkt), true, 128, NULL), 128);
+    assert_memory_equal(pkt, orig, 128);
+}
+
 int main(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_truncate_disabled_no_change),
         cmocka_unit_test(test_truncate_eth_ipv4_updates_total_len_and_checksum),
         cmocka_unit_test(test_truncate_eth_vlan_ipv4_updates_total_len_and_checksum),
+        cmocka_unit_test(test_truncate_qinq_ipv4_updates_total_len_and_checksum),
         cmocka_unit_test(test_truncate_non_ipv4_only_len_changes),
+        cmocka_unit_test(test_truncate_guessed_ipv4_not_rewritten),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);